@@ -0,0 +1,51 @@
+#ifndef TOYOTA_BENCH
+#define TOYOTA_BENCH
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int bench_func_t(int argc, char **argv);
+
+typedef struct {
+    const char *name;
+    const char *description;
+    bench_func_t *run;
+} bench_t;
+
+/**
+ * @brief Monotonic time in nanoseconds
+ */
+int64_t
+bench_now_ns(void);
+
+/**
+ * @brief Print one result line as CSV: bench,metric,value,unit
+ *
+ * With a baseline loaded (--baseline) the line is followed by the baseline
+ * value, relative change in percents and verdict, see bench_main.c.
+ */
+void
+bench_report(const char *bench, const char *metric, double value, const char *unit);
+
+/**
+ * @brief Throughput in MB/s of processing given number of bytes in given time
+ */
+double
+bench_mb_per_s(uint64_t bytes, int64_t elapsed_ns);
+
+int bench_fw_verify(int argc, char **argv);
+int bench_fw_checkpoint(int argc, char **argv);
+int bench_fw_delta(int argc, char **argv);
+int bench_fw_compress(int argc, char **argv);
+int bench_ingest(int argc, char **argv);
+int bench_history(int argc, char **argv);
+int bench_senml(int argc, char **argv);
+int bench_instances(int argc, char **argv);
+int bench_actuator(int argc, char **argv);
+int bench_sampler(int argc, char **argv);
+int bench_config(int argc, char **argv);
+int bench_metrics(int argc, char **argv);
+int bench_lwm2m(int argc, char **argv);
+int bench_fw_download(int argc, char **argv);
+
+#endif // TOYOTA_BENCH
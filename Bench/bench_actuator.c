@@ -0,0 +1,98 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "toyota_actuator.h"
+
+#define BENCH_NAME              "actuator"
+#define DEFAULT_DELAY_US        300     // typical sysfs PWM write on an embedded board
+#define DEFAULT_INTERVAL_MS     ACTUATOR_DEFAULT_INTERVAL
+#define BURST_UNITS             4
+#define BURST_DURATION_MS       1000
+#define BURST_PERIOD_US         100     // brightness write every 100 us, e.g. a dimming ramp
+
+//------------------------------------------------------------------------------
+
+static void
+sleep_us(unsigned us) {
+    struct timespec delay = {
+        .tv_sec = 0,
+        .tv_nsec = (long) us * 1000
+    };
+    nanosleep(&delay, NULL);
+}
+
+//------------------------------------------------------------------------------
+
+// usage: actuator [apply_delay_us] [interval_ms]
+int
+bench_actuator(int argc, char **argv) {
+    unsigned delay_us = DEFAULT_DELAY_US;
+    int interval_ms = DEFAULT_INTERVAL_MS;
+    if (argc > 1) {
+        delay_us = (unsigned) strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        interval_ms = atoi(argv[2]);
+    }
+
+    actuator_backend_t *backend = actuator_backend_sim_create(delay_us);
+    actuator_t *actuator = backend ? actuator_create(backend, interval_ms) : NULL;
+    if (!actuator) {
+        fprintf(stderr, "could not create actuator\n");
+        return -1;
+    }
+
+    // caller side stands for the network loop, it must never wait for hardware
+    histogram_t request_ns;
+    histogram_init(&request_ns);
+    int64_t start = bench_now_ns();
+    int64_t brightness = 0;
+    while (bench_now_ns() - start < (int64_t) BURST_DURATION_MS * 1000000) {
+        brightness = (brightness + 1) % 101;
+        for (anjay_iid_t unit = 0; unit < BURST_UNITS; ++unit) {
+            int64_t request_start = bench_now_ns();
+            (void) actuator_request(actuator, unit, true, brightness);
+            histogram_record(&request_ns, (uint64_t) (bench_now_ns() - request_start));
+        }
+        sleep_us(BURST_PERIOD_US);
+    }
+    actuator_flush(actuator);
+
+    actuator_stats_t stats;
+    actuator_get_stats(actuator, &stats);
+    int result = 0;
+    for (anjay_iid_t unit = 0; unit < BURST_UNITS; ++unit) {
+        bool state;
+        int64_t applied;
+        (void) actuator_backend_sim_get(backend, unit, &state, &applied);
+        if (!state || applied != brightness) {
+            fprintf(stderr, "unit %u ended at %lld instead of %lld\n",
+                    (unsigned) unit, (long long) applied, (long long) brightness);
+            result = -1;
+        }
+    }
+
+    bench_report(BENCH_NAME, "requests", (double) stats.requested, "writes");
+    bench_report(BENCH_NAME, "applies", (double) stats.applied, "writes");
+    bench_report(BENCH_NAME, "coalesced",
+                 100.0 * (double) stats.coalesced / (double) stats.requested, "%");
+    bench_report(BENCH_NAME, "request_p99",
+                 (double) histogram_percentile(&request_ns, 99.0), "ns");
+    bench_report(BENCH_NAME, "request_max", (double) request_ns.max, "ns");
+    // what the loop would block for per write without the worker
+    bench_report(BENCH_NAME, "apply_p50",
+                 (double) histogram_percentile(&stats.apply_ns, 50.0) / 1e3, "us");
+    bench_report(BENCH_NAME, "apply_p99",
+                 (double) histogram_percentile(&stats.apply_ns, 99.0) / 1e3, "us");
+    bench_report(BENCH_NAME, "latency_p50",
+                 (double) histogram_percentile(&stats.latency_ns, 50.0) / 1e6, "ms");
+    bench_report(BENCH_NAME, "latency_p99",
+                 (double) histogram_percentile(&stats.latency_ns, 99.0) / 1e6, "ms");
+
+    actuator_destroy(actuator);
+    return result;
+}
@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "file_parser.h"
+
+#define BENCH_NAME              "config"
+#define DEFAULT_ENDPOINTS       100000
+#define ROUNDS                  5       // best of, the file stays in page cache
+
+//------------------------------------------------------------------------------
+
+static int
+write_fleet_file(const char *path, size_t endpoints) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return -1;
+    }
+    fprintf(file, "# generated fleet\n"
+                  "[client]\n"
+                  "endpoint_name = vehicle\n"
+                  "server_uri    = coaps://127.0.0.1:5684\n"
+                  "lifetime      = 86400\n"
+                  "\n"
+                  "[fleet]\n"
+                  "threads = 8\n"
+                  "\n"
+                  "[endpoints]\n");
+    for (size_t i = 0; i < endpoints; ++i) {
+        fprintf(file, "vehicle-%08zu identity-%08zu key-%08zu-0123456789abcdef\n",
+                i, i, i);
+    }
+    return fclose(file) ? -1 : 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+load_best(const char *path, bool use_mmap, size_t endpoints, int64_t *out_ns) {
+    *out_ns = INT64_MAX;
+    for (int round = 0; round < ROUNDS; ++round) {
+        config_t config = {
+            .lifetime = 86400,
+            .humidity_zones = 1,
+            .headlight_units = 1,
+            .fleet_threads = 1
+        };
+        int64_t start = bench_now_ns();
+        int result = config_load(&config, path, use_mmap);
+        int64_t elapsed = bench_now_ns() - start;
+        size_t loaded = config.endpoint_count;
+        config_release(&config);
+        if (result || loaded != endpoints) {
+            fprintf(stderr, "loaded %zu of %zu endpoints\n", loaded, endpoints);
+            return -1;
+        }
+        if (elapsed < *out_ns) {
+            *out_ns = elapsed;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+// usage: config [endpoints]
+int
+bench_config(int argc, char **argv) {
+    size_t endpoints = DEFAULT_ENDPOINTS;
+    if (argc > 1) {
+        endpoints = (size_t) strtoul(argv[1], NULL, 10);
+    }
+
+    char path[] = "/tmp/toyota_bench_config_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "could not create config file\n");
+        return -1;
+    }
+    close(fd);
+
+    int64_t mmap_ns = 0;
+    int64_t read_ns = 0;
+    int result = -1;
+    if (!write_fleet_file(path, endpoints)
+            && !load_best(path, true, endpoints, &mmap_ns)
+            && !load_best(path, false, endpoints, &read_ns)) {
+        result = 0;
+        double seconds = (double) mmap_ns / 1e9;
+        bench_report(BENCH_NAME, "endpoints", (double) endpoints, "endpoints");
+        bench_report(BENCH_NAME, "mmap_load", (double) mmap_ns / 1e6, "ms");
+        bench_report(BENCH_NAME, "read_load", (double) read_ns / 1e6, "ms");
+        bench_report(BENCH_NAME, "mmap_rate", (double) endpoints / seconds, "endpoints/s");
+        bench_report(BENCH_NAME, "ns_per_endpoint", (double) mmap_ns / (double) endpoints, "ns");
+    }
+    unlink(path);
+    return result;
+}
@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_NAME              "fw_checkpoint"
+#define DEFAULT_IMAGE_SIZE_MB   4
+#define DEFAULT_BLOCK_SIZE      1024
+#define DEFAULT_INTERVAL        (256 * 1024)  // matches client checkpoint interval
+#define BENCH_FILE_PATH         "/tmp/toyota_bench_ckpt-XXXXXX"
+
+//------------------------------------------------------------------------------
+
+// write image block by block, fdatasync every sync_interval bytes
+static int
+run_download(const char *metric,
+             const uint8_t *image,
+             size_t image_size,
+             size_t block_size,
+             size_t sync_interval) {
+    char path[] = BENCH_FILE_PATH;
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "could not create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int result = 0;
+    size_t synced = 0;
+    uint64_t syncs = 0;
+    int64_t start = bench_now_ns();
+    for (size_t offset = 0; !result && offset < image_size; offset += block_size) {
+        size_t length = image_size - offset < block_size ? image_size - offset : block_size;
+        if (pwrite(fd, image + offset, length, (off_t) offset) != (ssize_t) length) {
+            result = -1;
+        } else if (offset + length - synced >= sync_interval) {
+            result = fdatasync(fd);
+            synced = offset + length;
+            ++syncs;
+        }
+    }
+    if (!result) {
+        result = fdatasync(fd);
+        ++syncs;
+    }
+    int64_t elapsed = bench_now_ns() - start;
+
+    if (result) {
+        fprintf(stderr, "%s failed: %s\n", metric, strerror(errno));
+    } else {
+        char name[64];
+        bench_report(BENCH_NAME, metric, bench_mb_per_s(image_size, elapsed), "MB/s");
+        snprintf(name, sizeof(name), "%s_syncs", metric);
+        bench_report(BENCH_NAME, name, (double) syncs, "count");
+    }
+    close(fd);
+    unlink(path);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+// usage: fw_checkpoint [image size in MB] [block size in bytes] [interval in bytes]
+int
+bench_fw_checkpoint(int argc, char **argv) {
+    size_t image_size = (size_t) DEFAULT_IMAGE_SIZE_MB * 1024 * 1024;
+    size_t block_size = DEFAULT_BLOCK_SIZE;
+    size_t interval = DEFAULT_INTERVAL;
+    if (argc > 1) {
+        image_size = (size_t) strtoul(argv[1], NULL, 10) * 1024 * 1024;
+    }
+    if (argc > 2) {
+        block_size = (size_t) strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        interval = (size_t) strtoul(argv[3], NULL, 10);
+    }
+    if (!image_size || !block_size || !interval) {
+        fprintf(stderr, "invalid image size, block size or interval\n");
+        return -1;
+    }
+
+    uint8_t *image = (uint8_t *) malloc(image_size);
+    if (!image) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    memset(image, 0xA5, image_size);
+
+    bench_report(BENCH_NAME, "image_size", (double) image_size, "bytes");
+    bench_report(BENCH_NAME, "checkpoint_interval", (double) interval, "bytes");
+    int result = run_download("sync_per_block", image, image_size, block_size, block_size)
+                 | run_download("group_commit", image, image_size, block_size, interval)
+                 | run_download("sync_at_end", image, image_size, block_size, image_size + 1);
+    free(image);
+    return result;
+}
@@ -0,0 +1,219 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Main_Objects/firmware_compress.h>
+#include <Main_Objects/firmware_package.h>
+#include <toyota_hash.h>
+
+#ifdef TOYOTA_WITH_ZSTD
+#    include <zstd.h>
+#endif
+#ifdef TOYOTA_WITH_LZ4
+#    include <lz4frame.h>
+#endif
+
+#define BENCH_NAME              "fw_compress"
+#define DEFAULT_IMAGE_PATH      "/proc/self/exe"
+#define DOWNLOAD_BLOCK_SIZE     1024
+#define MIN_PROCESSED_BYTES     (64 * 1024 * 1024)  // repeat runs until this much is decoded
+#define ZSTD_LEVEL              19
+
+typedef struct {
+    uint64_t bytes;
+} counting_sink_t;
+
+//------------------------------------------------------------------------------
+
+static int
+counting_sink_write(void *sink_, const void *data, size_t length) {
+    (void) data;
+    ((counting_sink_t *) sink_)->bytes += length;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static uint8_t *
+read_image(const char *path, size_t *out_size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    size_t capacity = 1024 * 1024;
+    size_t size = 0;
+    uint8_t *data = (uint8_t *) malloc(capacity);
+    size_t got;
+    while (data && (got = fread(data + size, 1, capacity - size, file)) > 0) {
+        size += got;
+        if (size == capacity) {
+            uint8_t *data_ = (uint8_t *) realloc(data, capacity * 2);
+            if (!data_) {
+                free(data);
+            }
+            data = data_;
+            capacity *= 2;
+        }
+    }
+    fclose(file);
+    *out_size = size;
+    return data;
+}
+
+//------------------------------------------------------------------------------
+
+static uint8_t *
+compress_image(fw_compression_t compression,
+               const uint8_t *image,
+               size_t image_size,
+               size_t *out_size) {
+    uint8_t *compressed = NULL;
+    size_t size = 0;
+    switch (compression) {
+#ifdef TOYOTA_WITH_ZSTD
+    case FW_COMPRESSION_ZSTD:
+        if ((compressed = (uint8_t *) malloc(ZSTD_compressBound(image_size)))) {
+            size = ZSTD_compress(compressed, ZSTD_compressBound(image_size),
+                                 image, image_size, ZSTD_LEVEL);
+            size = ZSTD_isError(size) ? 0 : size;
+        }
+        break;
+#endif
+#ifdef TOYOTA_WITH_LZ4
+    case FW_COMPRESSION_LZ4:
+        if ((compressed = (uint8_t *) malloc(LZ4F_compressFrameBound(image_size, NULL)))) {
+            size = LZ4F_compressFrame(compressed, LZ4F_compressFrameBound(image_size, NULL),
+                                      image, image_size, NULL);
+            size = LZ4F_isError(size) ? 0 : size;
+        }
+        break;
+#endif
+    default:
+        (void) image;
+        (void) image_size;
+        break;
+    }
+    if (!size) {
+        free(compressed);
+        return NULL;
+    }
+    *out_size = size;
+    return compressed;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+bench_codec(fw_compression_t compression, const uint8_t *image, size_t image_size) {
+    char metric[64];
+    const char *name = fw_compression_name(compression);
+    size_t compressed_size = 0;
+    uint8_t *compressed = compress_image(compression, image, image_size, &compressed_size);
+    if (!compressed) {
+        fprintf(stderr, "%s compression failed\n", name);
+        return -1;
+    }
+    snprintf(metric, sizeof(metric), "%s_package_size", name);
+    bench_report(BENCH_NAME, metric, (double) compressed_size, "bytes");
+    snprintf(metric, sizeof(metric), "%s_ratio", name);
+    bench_report(BENCH_NAME, metric, (double) image_size / (double) compressed_size, "x");
+
+    int iterations = (int) (MIN_PROCESSED_BYTES / image_size) + 1;
+    int result = 0;
+
+    // decoder alone, whole frame passed at once
+    counting_sink_t sink = { 0 };
+    int64_t start = bench_now_ns();
+    for (int i = 0; !result && i < iterations; ++i) {
+        fw_decompress_t decompress;
+        if (!(result = fw_decompress_open(&decompress, compression))) {
+            result = fw_decompress_write(&decompress, compressed, compressed_size,
+                                         counting_sink_write, &sink);
+            fw_decompress_close(&decompress);
+        }
+    }
+    int64_t elapsed = bench_now_ns() - start;
+    if (!result) {
+        snprintf(metric, sizeof(metric), "%s_decompress", name);
+        bench_report(BENCH_NAME, metric, bench_mb_per_s(sink.bytes, elapsed), "MB/s");
+    }
+
+    // full package path as in fw_stream_write: download blocks, SHA-256 digest
+    uint8_t *package_data = (uint8_t *) malloc(FW_PACKAGE_HEADER_SIZE + compressed_size);
+    if (!result && package_data) {
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256_ctx_t sha;
+        sha256_init(&sha);
+        sha256_update(&sha, image, image_size);
+        sha256_final(&sha, digest);
+        fw_package_encode_header(package_data, FW_DIGEST_SHA256, 0, image_size, digest);
+        memcpy(package_data + FW_PACKAGE_HEADER_SIZE, compressed, compressed_size);
+        size_t package_size = FW_PACKAGE_HEADER_SIZE + compressed_size;
+
+        sink.bytes = 0;
+        start = bench_now_ns();
+        for (int i = 0; !result && i < iterations; ++i) {
+            fw_package_t package;
+            fw_package_reset(&package, NULL);
+            for (size_t offset = 0; !result && offset < package_size;
+                 offset += DOWNLOAD_BLOCK_SIZE) {
+                size_t length = package_size - offset < DOWNLOAD_BLOCK_SIZE
+                                        ? package_size - offset
+                                        : DOWNLOAD_BLOCK_SIZE;
+                result = fw_package_write(&package, package_data + offset, length,
+                                          counting_sink_write, &sink);
+            }
+            if (!result) {
+                result = fw_package_finish(&package, counting_sink_write, &sink);
+            }
+            fw_package_release(&package);
+        }
+        elapsed = bench_now_ns() - start;
+        if (!result) {
+            snprintf(metric, sizeof(metric), "%s_package_verified", name);
+            bench_report(BENCH_NAME, metric, bench_mb_per_s(sink.bytes, elapsed), "MB/s");
+        }
+    } else if (!package_data) {
+        result = -1;
+    }
+
+    if (result) {
+        fprintf(stderr, "%s decompression failed: %d\n", name, result);
+    }
+    free(package_data);
+    free(compressed);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+// usage: fw_compress [image path]
+int
+bench_fw_compress(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : DEFAULT_IMAGE_PATH;
+    size_t image_size = 0;
+    uint8_t *image = read_image(path, &image_size);
+    if (!image || !image_size) {
+        free(image);
+        return -1;
+    }
+    bench_report(BENCH_NAME, "image_size", (double) image_size, "bytes");
+
+    int result = 0;
+#ifdef TOYOTA_WITH_ZSTD
+    result |= bench_codec(FW_COMPRESSION_ZSTD, image, image_size);
+#endif
+#ifdef TOYOTA_WITH_LZ4
+    result |= bench_codec(FW_COMPRESSION_LZ4, image, image_size);
+#endif
+#if !defined(TOYOTA_WITH_ZSTD) && !defined(TOYOTA_WITH_LZ4)
+    (void) bench_codec;
+    fprintf(stderr, "built without zstd and LZ4, nothing to measure\n");
+#endif
+    free(image);
+    return result;
+}
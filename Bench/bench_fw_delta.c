@@ -0,0 +1,258 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <Main_Objects/firmware_delta.h>
+#include <Main_Objects/firmware_package.h>
+#include <toyota_hash.h>
+
+#define BENCH_NAME              "fw_delta"
+#define DEFAULT_IMAGE_SIZE_MB   32
+#define DEFAULT_CHANGES         2000        // scattered single byte changes
+#define INSERTED_BYTES          (16 * 1024) // new code in the middle of the image
+#define DOWNLOAD_BLOCK_SIZE     1024
+#define BASE_FILE_PATH          "/tmp/toyota_bench_base-XXXXXX"
+#define PACKAGE_FILE_PATH       "/tmp/toyota_bench_pkg-XXXXXX"
+#define OUTPUT_FILE_PATH        "/tmp/toyota_bench_out-XXXXXX"
+
+typedef struct {
+    int fd;
+    off_t offset;
+} file_sink_t;
+
+//------------------------------------------------------------------------------
+
+static int
+file_sink_write(void *sink_, const void *data, size_t length) {
+    file_sink_t *sink = (file_sink_t *) sink_;
+    const char *bytes = (const char *) data;
+    while (length) {
+        ssize_t written = pwrite(sink->fd, bytes, length, sink->offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        length -= (size_t) written;
+        sink->offset += written;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static long
+current_rss_kb(void) {
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%*s %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+//------------------------------------------------------------------------------
+
+// applies the package like fw_stream_write does, in a fresh process so
+// that peak RSS reflects the client side only
+static int
+apply_package(const char *package_path, const char *base_path, size_t image_size) {
+    char output_path[] = OUTPUT_FILE_PATH;
+    file_sink_t sink = { mkstemp(output_path), 0 };
+    int package_fd = open(package_path, O_RDONLY);
+    if (sink.fd < 0 || package_fd < 0) {
+        fprintf(stderr, "could not open bench files\n");
+        return -1;
+    }
+
+    long baseline_rss = current_rss_kb();
+    fw_package_t package;
+    uint8_t block[DOWNLOAD_BLOCK_SIZE];
+    uint64_t package_size = 0;
+    int result = 0;
+    ssize_t got;
+    int64_t start = bench_now_ns();
+    fw_package_reset(&package, base_path);
+    while (!result && (got = read(package_fd, block, sizeof(block))) > 0) {
+        package_size += (uint64_t) got;
+        result = fw_package_write(&package, block, (size_t) got,
+                                  file_sink_write, &sink);
+    }
+    if (!result) {
+        result = fw_package_finish(&package, file_sink_write, &sink);
+    }
+    fw_package_release(&package);
+    int64_t elapsed = bench_now_ns() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    if (result) {
+        fprintf(stderr, "delta apply failed: %d\n", result);
+    } else {
+        bench_report(BENCH_NAME, "apply_image", bench_mb_per_s(image_size, elapsed), "MB/s");
+        bench_report(BENCH_NAME, "apply_package", bench_mb_per_s(package_size, elapsed), "MB/s");
+        bench_report(BENCH_NAME, "apply_baseline_rss", (double) baseline_rss, "KiB");
+        bench_report(BENCH_NAME, "apply_peak_rss", (double) usage.ru_maxrss, "KiB");
+    }
+    close(package_fd);
+    close(sink.fd);
+    unlink(output_path);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} buffer_t;
+
+static int
+buffer_write(void *buffer_, const void *data, size_t length) {
+    buffer_t *buffer = (buffer_t *) buffer_;
+    if (buffer->size + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->size + length) {
+            capacity *= 2;
+        }
+        uint8_t *data_ = (uint8_t *) realloc(buffer->data, capacity);
+        if (!data_) {
+            return -1;
+        }
+        buffer->data = data_;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+write_temp_file(char *path, const void *data, size_t length) {
+    file_sink_t sink = { mkstemp(path), 0 };
+    if (sink.fd < 0) {
+        return -1;
+    }
+    int result = file_sink_write(&sink, data, length);
+    close(sink.fd);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+// usage: fw_delta [image size in MB] [number of changed bytes]
+int
+bench_fw_delta(int argc, char **argv) {
+    size_t base_size = (size_t) DEFAULT_IMAGE_SIZE_MB * 1024 * 1024;
+    size_t changes = DEFAULT_CHANGES;
+    if (argc > 1) {
+        base_size = (size_t) strtoul(argv[1], NULL, 10) * 1024 * 1024;
+    }
+    if (argc > 2) {
+        changes = (size_t) strtoul(argv[2], NULL, 10);
+    }
+    if (base_size < 2 * INSERTED_BYTES) {
+        fprintf(stderr, "invalid image size\n");
+        return -1;
+    }
+
+    size_t image_size = base_size + INSERTED_BYTES;
+    uint8_t *base = (uint8_t *) malloc(base_size);
+    uint8_t *image = (uint8_t *) malloc(image_size);
+    buffer_t package = { NULL, 0, 0 };
+    if (!base || !image) {
+        fprintf(stderr, "out of memory\n");
+        free(base);
+        free(image);
+        return -1;
+    }
+
+    // new release: same image with scattered patches and a block of new code
+    uint32_t seed = 0x2468ace1u;
+    for (size_t i = 0; i < base_size; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        base[i] = (uint8_t) (seed >> 16);
+    }
+    size_t half = base_size / 2;
+    memcpy(image, base, half);
+    for (size_t i = 0; i < INSERTED_BYTES; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        image[half + i] = (uint8_t) (seed >> 16);
+    }
+    memcpy(image + half + INSERTED_BYTES, base + half, base_size - half);
+    for (size_t i = 0; i < changes; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        image[(seed >> 4) % image_size] ^= 0x5A;
+    }
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_ctx_t sha;
+    sha256_init(&sha);
+    sha256_update(&sha, image, image_size);
+    sha256_final(&sha, digest);
+    uint8_t header[FW_PACKAGE_HEADER_SIZE];
+    fw_package_encode_header(header, FW_DIGEST_SHA256, FW_PACKAGE_FLAG_DELTA,
+                             image_size, digest);
+
+    int64_t start = bench_now_ns();
+    int result = buffer_write(&package, header, sizeof(header));
+    if (!result) {
+        result = fw_delta_encode(base, base_size, image, image_size,
+                                 buffer_write, &package);
+    }
+    int64_t elapsed = bench_now_ns() - start;
+
+    char base_path[] = BASE_FILE_PATH;
+    char package_path[] = PACKAGE_FILE_PATH;
+    if (!result) {
+        bench_report(BENCH_NAME, "image_size", (double) image_size, "bytes");
+        bench_report(BENCH_NAME, "full_package_size",
+                     (double) (image_size + FW_PACKAGE_HEADER_SIZE), "bytes");
+        bench_report(BENCH_NAME, "delta_package_size", (double) package.size, "bytes");
+        bench_report(BENCH_NAME, "transfer_reduction",
+                     (double) (image_size + FW_PACKAGE_HEADER_SIZE) / (double) package.size, "x");
+        bench_report(BENCH_NAME, "encode", bench_mb_per_s(image_size, elapsed), "MB/s");
+        result = write_temp_file(base_path, base, base_size)
+                 | write_temp_file(package_path, package.data, package.size);
+    }
+    // images are dropped before the client side runs
+    free(base);
+    free(image);
+    free(package.data);
+
+    if (!result) {
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            _exit(apply_package(package_path, base_path, image_size) ? 1 : 0);
+        }
+        int status = 0;
+        if (child < 0 || waitpid(child, &status, 0) < 0
+                || !WIFEXITED(status) || WEXITSTATUS(status)) {
+            result = -1;
+        }
+    }
+    unlink(base_path);
+    unlink(package_path);
+    if (result) {
+        fprintf(stderr, "delta benchmark failed\n");
+    }
+    return result;
+}
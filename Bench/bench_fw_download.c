@@ -0,0 +1,168 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "bench_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_NAME              "fw_download"
+#define DEFAULT_IMAGE_SIZE_MB   16
+#define DOWNLOAD_PATH           "fw"
+#define STATE_FILE_PATH         "/tmp/toyota_bench_fw_state-XXXXXX"
+#define CHECKPOINT_SUFFIX       ".ckpt"
+#define FW_STATE_DOWNLOADED     "2"         // /5/0/3 after the image is stored
+#define STATE_POLL_ROUNDS       100
+#define TIMEOUT_MS              60000
+#define REQUEST_TIMEOUT_MS      5000
+
+typedef struct {
+    uint64_t bytes;                         // download size to wait for
+} download_wait_t;
+
+//------------------------------------------------------------------------------
+
+// legacy raw image: not starting with the package, zstd or LZ4 magic
+static void
+fill_image(uint8_t *image, size_t size) {
+    uint32_t state = 0x12345678;
+    for (size_t i = 0; i < size; ++i) {
+        state = state * 1664525u + 1013904223u;
+        image[i] = (uint8_t) (state >> 24);
+    }
+    image[0] = 0;
+}
+
+//------------------------------------------------------------------------------
+
+static bool
+download_served(bench_server_t *server, void *wait_) {
+    const download_wait_t *wait = (const download_wait_t *) wait_;
+    return bench_server_stats(server)->bytes_served >= wait->bytes;
+}
+
+//------------------------------------------------------------------------------
+
+// the last block is written by fw_stream_write() before stream_finish(), so
+// /5/0/3 is polled until the image is stored
+static int
+wait_downloaded(bench_server_t *server) {
+    for (int i = 0; i < STATE_POLL_ROUNDS; ++i) {
+        bench_response_t response;
+        if (bench_server_request(server, COAP_GET, "5/0/3",
+                                 COAP_FORMAT_NONE, NULL, 0, &response,
+                                 REQUEST_TIMEOUT_MS)
+                || response.code != COAP_CONTENT) {
+            return -1;
+        }
+        if (response.payload_length == strlen(FW_STATE_DOWNLOADED)
+                && !memcmp(response.payload, FW_STATE_DOWNLOADED,
+                           response.payload_length)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+run_download(bench_server_t *server, const char *uri, size_t image_size) {
+    bench_response_t response;
+    download_wait_t wait = {
+        .bytes = bench_server_stats(server)->bytes_served + image_size
+    };
+    uint64_t blocks = bench_server_stats(server)->blocks_served;
+
+    int64_t start = bench_now_ns();
+    if (bench_server_request(server, COAP_PUT, "5/0/1", COAP_FORMAT_TEXT,
+                             uri, strlen(uri), &response, REQUEST_TIMEOUT_MS)
+            || response.code != COAP_CHANGED) {
+        fprintf(stderr, "could not write package URI\n");
+        return -1;
+    }
+    if (bench_server_wait(server, download_served, &wait, TIMEOUT_MS)
+            || wait_downloaded(server)) {
+        fprintf(stderr, "firmware download did not finish\n");
+        return -1;
+    }
+    int64_t elapsed = bench_now_ns() - start;
+    blocks = bench_server_stats(server)->blocks_served - blocks;
+
+    bench_report(BENCH_NAME, "image_size", (double) image_size / (1024.0 * 1024.0), "MiB");
+    bench_report(BENCH_NAME, "throughput", bench_mb_per_s(image_size, elapsed), "MB/s");
+    bench_report(BENCH_NAME, "blocks", (double) blocks, "count");
+    bench_report(BENCH_NAME, "per_block", (double) elapsed / (double) blocks / 1e3, "us");
+
+    // empty URI resets the object, which removes the downloaded image
+    if (bench_server_request(server, COAP_PUT, "5/0/1", COAP_FORMAT_TEXT,
+                             "", 0, &response, REQUEST_TIMEOUT_MS)) {
+        fprintf(stderr, "could not reset firmware update\n");
+        return -1;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+// usage: fw_download [image_size_mb]
+int
+bench_fw_download(int argc, char **argv) {
+    size_t image_size_mb = DEFAULT_IMAGE_SIZE_MB;
+    if (argc > 1) {
+        image_size_mb = (size_t) strtoul(argv[1], NULL, 10);
+    }
+    if (!image_size_mb) {
+        fprintf(stderr, "invalid arguments\n");
+        return -1;
+    }
+    size_t image_size = image_size_mb * 1024 * 1024;
+
+    // the persistence file must not exist, an existing one means "updated"
+    char state_path[] = STATE_FILE_PATH;
+    int fd = mkstemp(state_path);
+    if (fd < 0) {
+        fprintf(stderr, "could not create %s\n", state_path);
+        return -1;
+    }
+    close(fd);
+    unlink(state_path);
+
+    uint8_t *image = (uint8_t *) malloc(image_size);
+    event_loop_t *loop = event_loop_create();
+    bench_server_t *server = loop ? bench_server_create(loop) : NULL;
+    if (!image || !server) {
+        fprintf(stderr, "could not create server stand-in\n");
+        bench_server_destroy(server);
+        event_loop_destroy(loop);
+        free(image);
+        return -1;
+    }
+    fill_image(image, image_size);
+    bench_server_set_download(server, DOWNLOAD_PATH, image, image_size);
+
+    char uri[64];
+    snprintf(uri, sizeof(uri), "%s/%s", bench_server_uri(server), DOWNLOAD_PATH);
+
+    bench_client_t client;
+    int result = bench_client_create(&client, server, loop, "toyota-bench",
+                                     HUMIDITY_SENSOR_DEFAULT_INSTANCES, state_path);
+    if (!result) {
+        if (!(result = bench_client_wait_registered(&client, server,
+                                                    REQUEST_TIMEOUT_MS))) {
+            result = run_download(server, uri, image_size);
+        }
+        bench_client_destroy(&client, loop);
+    }
+
+    char checkpoint_path[sizeof(state_path) + sizeof(CHECKPOINT_SUFFIX)];
+    snprintf(checkpoint_path, sizeof(checkpoint_path), "%s%s", state_path,
+             CHECKPOINT_SUFFIX);
+    unlink(checkpoint_path);
+    unlink(state_path);
+    bench_server_destroy(server);
+    event_loop_destroy(loop);
+    free(image);
+    return result;
+}
@@ -0,0 +1,258 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <Main_Objects/firmware_package.h>
+#include <toyota_hash.h>
+
+#define BENCH_NAME                  "fw_verify"
+#define DEFAULT_IMAGE_SIZE_MB       64
+#define DEFAULT_BLOCK_SIZE          1024          // typical CoAP Block2 size
+#define READ_BACK_CHUNK             (64 * 1024)
+#define BENCH_FILE_PATH             "/tmp/toyota_bench_fw-XXXXXX"
+
+typedef struct {
+    int fd;
+    off_t offset;
+} file_sink_t;
+
+//------------------------------------------------------------------------------
+
+static int
+file_sink_write(void *sink_, const void *data, size_t length) {
+    file_sink_t *sink = (file_sink_t *) sink_;
+    const char *bytes = (const char *) data;
+    while (length) {
+        ssize_t written = pwrite(sink->fd, bytes, length, sink->offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        length -= (size_t) written;
+        sink->offset += written;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+bench_in_memory(const uint8_t *image, size_t size) {
+    volatile uint32_t crc_sink = 0;
+    int64_t start;
+
+    if (crc32c_is_hw_accelerated()) {
+        start = bench_now_ns();
+        crc_sink ^= crc32c_update(0, image, size);
+        bench_report(BENCH_NAME, "crc32c_hw", bench_mb_per_s(size, bench_now_ns() - start), "MB/s");
+    }
+
+    start = bench_now_ns();
+    crc_sink ^= crc32c_update_sw(0, image, size);
+    bench_report(BENCH_NAME, "crc32c_sw", bench_mb_per_s(size, bench_now_ns() - start), "MB/s");
+
+    sha256_ctx_t sha;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    start = bench_now_ns();
+    sha256_init(&sha);
+    sha256_update(&sha, image, size);
+    sha256_final(&sha, digest);
+    bench_report(BENCH_NAME, "sha256", bench_mb_per_s(size, bench_now_ns() - start), "MB/s");
+    (void) crc_sink;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+open_bench_file(char *path) {
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "could not create %s: %s\n", path, strerror(errno));
+    }
+    return fd;
+}
+
+//------------------------------------------------------------------------------
+
+// current client flow: digest updated in fw_stream_write as blocks arrive
+static int
+bench_streaming(const char *metric,
+                const uint8_t *package_data,
+                size_t package_size,
+                size_t block_size) {
+    char path[] = BENCH_FILE_PATH;
+    file_sink_t sink = { open_bench_file(path), 0 };
+    if (sink.fd < 0) {
+        return -1;
+    }
+
+    fw_package_t package;
+    int result = 0;
+    int64_t start = bench_now_ns();
+    fw_package_reset(&package, NULL);
+    for (size_t offset = 0; !result && offset < package_size; offset += block_size) {
+        size_t length = package_size - offset < block_size ? package_size - offset : block_size;
+        result = fw_package_write(&package, package_data + offset, length,
+                                  file_sink_write, &sink);
+    }
+    if (!result) {
+        result = fw_package_finish(&package, file_sink_write, &sink);
+    }
+    if (!result && fdatasync(sink.fd)) {
+        result = -1;
+    }
+    int64_t elapsed = bench_now_ns() - start;
+
+    if (result) {
+        fprintf(stderr, "streaming verification failed: %d\n", result);
+    } else {
+        bench_report(BENCH_NAME, metric, bench_mb_per_s(package_size, elapsed), "MB/s");
+    }
+    close(sink.fd);
+    unlink(path);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+// previous flow: store all blocks, then read the image back and hash it
+static int
+bench_read_back(const char *metric,
+                const uint8_t *package_data,
+                size_t package_size,
+                size_t block_size) {
+    char path[] = BENCH_FILE_PATH;
+    file_sink_t sink = { open_bench_file(path), 0 };
+    if (sink.fd < 0) {
+        return -1;
+    }
+
+    int result = 0;
+    int64_t start = bench_now_ns();
+    for (size_t offset = 0; !result && offset < package_size; offset += block_size) {
+        size_t length = package_size - offset < block_size ? package_size - offset : block_size;
+        result = file_sink_write(&sink, package_data + offset, length);
+    }
+    if (!result && fdatasync(sink.fd)) {
+        result = -1;
+    }
+    int64_t write_end = bench_now_ns();
+    // drop the image from page cache, so it is really read back from storage
+    posix_fadvise(sink.fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    uint8_t *chunk = (uint8_t *) malloc(READ_BACK_CHUNK);
+    int fd = open(path, O_RDONLY);
+    sha256_ctx_t sha;
+    sha256_init(&sha);
+    int64_t verify_start = bench_now_ns();
+    ssize_t got = 0;
+    while (!result && chunk && fd >= 0
+            && (got = read(fd, chunk, READ_BACK_CHUNK)) > 0) {
+        sha256_update(&sha, chunk, (size_t) got);
+    }
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_final(&sha, digest);
+    int64_t end = bench_now_ns();
+    if (!chunk || fd < 0 || got < 0) {
+        result = -1;
+    }
+
+    if (result) {
+        fprintf(stderr, "read-back verification failed\n");
+    } else {
+        bench_report(BENCH_NAME, metric, bench_mb_per_s(package_size, end - start), "MB/s");
+        bench_report(BENCH_NAME, "read_back_verify_only_ms",
+                     (double) (end - verify_start) / 1e6, "ms");
+        bench_report(BENCH_NAME, "read_back_write_only_ms",
+                     (double) (write_end - start) / 1e6, "ms");
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(chunk);
+    close(sink.fd);
+    unlink(path);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+static uint8_t *
+build_package(size_t image_size, fw_digest_type_t digest_type, size_t *out_size) {
+    uint8_t *package_data = (uint8_t *) malloc(FW_PACKAGE_HEADER_SIZE + image_size);
+    if (!package_data) {
+        return NULL;
+    }
+    uint8_t *image = package_data + FW_PACKAGE_HEADER_SIZE;
+    uint32_t seed = 0x12345678u;
+    for (size_t i = 0; i < image_size; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        image[i] = (uint8_t) (seed >> 16);
+    }
+
+    uint8_t digest[SHA256_DIGEST_SIZE] = { 0 };
+    if (digest_type == FW_DIGEST_SHA256) {
+        sha256_ctx_t sha;
+        sha256_init(&sha);
+        sha256_update(&sha, image, image_size);
+        sha256_final(&sha, digest);
+    } else if (digest_type == FW_DIGEST_CRC32C) {
+        uint32_t crc = crc32c_update(0, image, image_size);
+        digest[0] = (uint8_t) (crc >> 24);
+        digest[1] = (uint8_t) (crc >> 16);
+        digest[2] = (uint8_t) (crc >> 8);
+        digest[3] = (uint8_t) crc;
+    }
+    fw_package_encode_header(package_data, digest_type, 0, image_size, digest);
+    *out_size = FW_PACKAGE_HEADER_SIZE + image_size;
+    return package_data;
+}
+
+//------------------------------------------------------------------------------
+
+// usage: fw_verify [image size in MB] [block size in bytes]
+int
+bench_fw_verify(int argc, char **argv) {
+    size_t image_size = (size_t) DEFAULT_IMAGE_SIZE_MB * 1024 * 1024;
+    size_t block_size = DEFAULT_BLOCK_SIZE;
+    if (argc > 1) {
+        image_size = (size_t) strtoul(argv[1], NULL, 10) * 1024 * 1024;
+    }
+    if (argc > 2) {
+        block_size = (size_t) strtoul(argv[2], NULL, 10);
+    }
+    if (!image_size || !block_size) {
+        fprintf(stderr, "invalid image or block size\n");
+        return -1;
+    }
+
+    bench_report(BENCH_NAME, "image_size", (double) image_size, "bytes");
+    bench_report(BENCH_NAME, "block_size", (double) block_size, "bytes");
+    bench_report(BENCH_NAME, "crc32c_hw_available", crc32c_is_hw_accelerated(), "bool");
+
+    size_t sha_size = 0;
+    size_t crc_size = 0;
+    uint8_t *sha_package = build_package(image_size, FW_DIGEST_SHA256, &sha_size);
+    uint8_t *crc_package = build_package(image_size, FW_DIGEST_CRC32C, &crc_size);
+    int result = -1;
+    if (sha_package && crc_package) {
+        bench_in_memory(sha_package + FW_PACKAGE_HEADER_SIZE, image_size);
+        result = bench_streaming("streaming_sha256", sha_package, sha_size, block_size)
+                 | bench_streaming("streaming_crc32c", crc_package, crc_size, block_size)
+                 | bench_read_back("read_back_sha256", sha_package, sha_size, block_size);
+    } else {
+        fprintf(stderr, "out of memory\n");
+    }
+    free(sha_package);
+    free(crc_package);
+    return result;
+}
@@ -0,0 +1,76 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "toyota_history.h"
+
+#define BENCH_NAME              "history"
+#define DEFAULT_SAMPLES         10000000
+#define SAMPLE_PERIOD_MS        1
+
+//------------------------------------------------------------------------------
+
+// usage: history [samples] [capacity]
+int
+bench_history(int argc, char **argv) {
+    size_t samples = DEFAULT_SAMPLES;
+    size_t capacity = HISTORY_DEFAULT_CAPACITY;
+    if (argc > 1) {
+        samples = (size_t) strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        capacity = (size_t) strtoul(argv[2], NULL, 10);
+    }
+    if (!samples || !capacity) {
+        fprintf(stderr, "invalid arguments\n");
+        return -1;
+    }
+
+    sample_history_t history;
+    if (sample_history_init(&history, capacity)) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    // values sweep the humidity range, so min/max keep being updated
+    int64_t start = bench_now_ns();
+    for (size_t i = 0; i < samples; ++i) {
+        sample_history_push(&history, (int64_t) i * SAMPLE_PERIOD_MS,
+                            (float) (i % 4001) / 100.0f);
+    }
+    int64_t push_ns = bench_now_ns() - start;
+
+    // one full read of stored samples, as done for a server read
+    double sum = 0.0;
+    start = bench_now_ns();
+    for (size_t i = 0; i < history.count; ++i) {
+        sum += sample_history_value(&history, i)
+               + (double) sample_history_time_ms(&history, i);
+    }
+    int64_t read_ns = bench_now_ns() - start;
+
+    int result = 0;
+    if (history.count != (samples < capacity ? samples : capacity) || sum <= 0.0
+            || history.aggregate_count != samples) {
+        fprintf(stderr, "history is inconsistent\n");
+        result = -1;
+    } else {
+        bench_report(BENCH_NAME, "ingest", (double) samples / ((double) push_ns / 1e9),
+                     "samples/s");
+        bench_report(BENCH_NAME, "push_latency", (double) push_ns / (double) samples, "ns");
+        bench_report(BENCH_NAME, "read_latency",
+                     (double) read_ns / (double) history.count, "ns/sample");
+        bench_report(BENCH_NAME, "sample_memory",
+                     (double) (sizeof(*history.times_ms) + sizeof(*history.values)),
+                     "bytes");
+        bench_report(BENCH_NAME, "total_memory",
+                     (double) (sizeof(history) + capacity * (sizeof(*history.times_ms)
+                                                             + sizeof(*history.values))),
+                     "bytes");
+        bench_report(BENCH_NAME, "mean", sample_history_mean(&history), "value");
+    }
+    sample_history_release(&history);
+    return result;
+}
@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "toyota_event_loop.h"
+#include "toyota_ingest.h"
+
+#define BENCH_NAME              "ingest"
+#define DEFAULT_PRODUCERS       4
+#define DEFAULT_SAMPLES         1000000   // per producer
+#define LOOP_WAIT_MS            100
+
+typedef struct {
+    ingest_queue_t *queue;
+    size_t samples;
+    uint64_t full;          // pushes rejected because the queue was full
+    int64_t push_ns;        // time spent in successful pushes
+} producer_t;
+
+//------------------------------------------------------------------------------
+
+static void
+count_sample(void *sum_, const ingest_sample_t *sample) {
+    *(double *) sum_ += sample->data.humidity.value;
+}
+
+//------------------------------------------------------------------------------
+
+static void *
+producer_thread(void *producer_) {
+    producer_t *producer = (producer_t *) producer_;
+    ingest_sample_t sample = {
+        .kind = INGEST_SAMPLE_HUMIDITY,
+        .data.humidity = { .value = 1.0f, .state = true }
+    };
+    for (size_t i = 0; i < producer->samples; ++i) {
+        int64_t start = bench_now_ns();
+        // the loop is busy, a real sensor would drop the sample; retry to
+        // keep the total fixed
+        while (ingest_queue_push(producer->queue, &sample)) {
+            ++producer->full;
+            sched_yield();
+            start = bench_now_ns();
+        }
+        producer->push_ns += bench_now_ns() - start;
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+// usage: ingest [producer threads] [samples per producer]
+int
+bench_ingest(int argc, char **argv) {
+    size_t producers = DEFAULT_PRODUCERS;
+    size_t samples = DEFAULT_SAMPLES;
+    if (argc > 1) {
+        producers = (size_t) strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        samples = (size_t) strtoul(argv[2], NULL, 10);
+    }
+    if (!producers || !samples) {
+        fprintf(stderr, "invalid arguments\n");
+        return -1;
+    }
+
+    event_loop_t *loop = event_loop_create();
+    double sum = 0.0;
+    ingest_queue_t *queue =
+            loop ? ingest_queue_create(loop, INGEST_DEFAULT_CAPACITY, count_sample, &sum)
+                 : NULL;
+    producer_t *threads = (producer_t *) calloc(producers, sizeof(producer_t));
+    pthread_t *ids = (pthread_t *) calloc(producers, sizeof(pthread_t));
+    int result = -1;
+    if (!queue || !threads || !ids) {
+        fprintf(stderr, "could not set up the queue\n");
+        goto finish;
+    }
+
+    int64_t start = bench_now_ns();
+    size_t started = 0;
+    for (; started < producers; ++started) {
+        threads[started].queue = queue;
+        threads[started].samples = samples;
+        if (pthread_create(&ids[started], NULL, producer_thread, &threads[started])) {
+            fprintf(stderr, "could not start producer\n");
+            break;
+        }
+    }
+
+    uint64_t total = (uint64_t) started * samples;
+    ingest_stats_t stats;
+    do {
+        (void) event_loop_run_once(loop, LOOP_WAIT_MS);
+        ingest_queue_get_stats(queue, &stats);
+    } while (stats.drained < total);
+    int64_t elapsed = bench_now_ns() - start;
+
+    uint64_t full = 0;
+    int64_t push_ns = 0;
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(ids[i], NULL);
+        full += threads[i].full;
+        push_ns += threads[i].push_ns;
+    }
+    if (started < producers || (uint64_t) sum != total) {
+        goto finish;
+    }
+
+    bench_report(BENCH_NAME, "producers", (double) producers, "count");
+    bench_report(BENCH_NAME, "throughput", (double) total / ((double) elapsed / 1e9),
+                 "samples/s");
+    bench_report(BENCH_NAME, "push_latency", (double) push_ns / (double) total, "ns");
+    bench_report(BENCH_NAME, "queue_full", (double) full, "count");
+    bench_report(BENCH_NAME, "wakeups", (double) stats.wakeups, "count");
+    bench_report(BENCH_NAME, "samples_per_wakeup",
+                 stats.wakeups ? (double) total / (double) stats.wakeups : 0.0,
+                 "samples");
+    bench_report(BENCH_NAME, "max_batch", (double) stats.max_batch, "samples");
+    result = 0;
+
+finish:
+    free(ids);
+    free(threads);
+    ingest_queue_destroy(queue);
+    event_loop_destroy(loop);
+    return result;
+}
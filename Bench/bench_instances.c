@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <anjay/anjay.h>
+
+#include "Main_Objects/humidity.h"
+#include "Main_Objects/headlights_control.h"
+
+#define BENCH_NAME              "instances"
+#define DEFAULT_MAX_INSTANCES   1024
+#define SCAN_ROUNDS             1000
+#define PUSH_ROUNDS             20
+
+//------------------------------------------------------------------------------
+
+static int
+compare_ns(const void *a_, const void *b_) {
+    int64_t a = *(const int64_t *) a_;
+    int64_t b = *(const int64_t *) b_;
+    return (a > b) - (a < b);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+report_metric(size_t instances, const char *name, double value, const char *unit) {
+    char metric[64];
+    snprintf(metric, sizeof(metric), "n_%zu_%s", instances, name);
+    bench_report(BENCH_NAME, metric, value, unit);
+}
+
+//------------------------------------------------------------------------------
+
+static int
+run_instances(anjay_t *anjay, size_t instances) {
+    int64_t start = bench_now_ns();
+    humidity_object_t *humidity = humidity_sensor_init_object(anjay, NULL, instances);
+    headlights_object_t *headlights =
+            headlights_control_init_object(anjay, NULL, instances);
+    int64_t setup_ns = bench_now_ns() - start;
+    size_t pushes = instances * PUSH_ROUNDS;
+    int64_t *latencies = (int64_t *) malloc(pushes * sizeof(int64_t));
+    int result = -1;
+    if (!humidity || !headlights || !latencies) {
+        fprintf(stderr, "could not create %zu instances\n", instances);
+        goto finish;
+    }
+    report_metric(instances, "setup", (double) setup_ns / 1e3, "us");
+
+    // every push changes the value, so each one notifies right away
+    for (size_t i = 0; i < pushes; ++i) {
+        anjay_iid_t iid = (anjay_iid_t) (i % instances);
+        float value = (float) ((i / instances) % 2 ? 10 : 30);
+        int64_t push_start = bench_now_ns();
+        (void) humidity_sensor_set_data(anjay, humidity, iid, value, true);
+        latencies[i] = bench_now_ns() - push_start;
+    }
+    qsort(latencies, pushes, sizeof(int64_t), compare_ns);
+    report_metric(instances, "notify_p50", (double) latencies[pushes / 2], "ns");
+    report_metric(instances, "notify_p99", (double) latencies[pushes * 99 / 100], "ns");
+
+    // read of the whole object visits instances in IID order
+    double sum = 0.0;
+    start = bench_now_ns();
+    for (size_t round = 0; round < SCAN_ROUNDS; ++round) {
+        for (size_t iid = 0; iid < instances; ++iid) {
+            float value;
+            bool state;
+            bool control_state;
+            int64_t brightness;
+            (void) humidity_sensor_get_data(humidity, (anjay_iid_t) iid, &value, &state);
+            (void) headlights_control_get_data(headlights, (anjay_iid_t) iid,
+                                               &control_state, &brightness);
+            sum += value + (double) brightness;
+        }
+    }
+    int64_t elapsed = bench_now_ns() - start;
+    report_metric(instances, "read_all",
+                  (double) elapsed / SCAN_ROUNDS / 1e3, "us");
+    report_metric(instances, "read_per_instance",
+                  (double) elapsed / (double) (SCAN_ROUNDS * instances), "ns");
+    if (sum <= 0.0) {
+        fprintf(stderr, "unexpected values\n");
+        goto finish;
+    }
+    result = 0;
+
+finish:
+    free(latencies);
+    headlights_control_object_release(anjay, headlights);
+    humidity_sensor_object_release(anjay, humidity);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+// usage: instances [max_instances]
+int
+bench_instances(int argc, char **argv) {
+    size_t max_instances = DEFAULT_MAX_INSTANCES;
+    if (argc > 1) {
+        max_instances = (size_t) strtoul(argv[1], NULL, 10);
+    }
+    if (!max_instances || max_instances > HUMIDITY_SENSOR_MAX_INSTANCES) {
+        fprintf(stderr, "instances must be 1..%d\n", HUMIDITY_SENSOR_MAX_INSTANCES);
+        return -1;
+    }
+
+    const anjay_configuration_t config = {
+        .endpoint_name   = "toyota-bench",
+        .in_buffer_size  = 4000,
+        .out_buffer_size = 4000
+    };
+    anjay_t *anjay = anjay_new(&config);
+    if (!anjay) {
+        fprintf(stderr, "could not create anjay instance\n");
+        return -1;
+    }
+
+    int result = 0;
+    for (size_t instances = 1; !result && instances <= max_instances; instances *= 4) {
+        result = run_instances(anjay, instances);
+    }
+    anjay_delete(anjay);
+    return result;
+}
@@ -0,0 +1,206 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "bench_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_NAME              "lwm2m"
+#define DEFAULT_INSTANCES       64
+#define DEFAULT_OPERATIONS      5000
+#define REGISTER_ROUNDS         20
+#define FANOUT_ROUNDS           50
+#define TIMEOUT_MS              5000
+
+typedef struct {
+    const char *name;                       // metric prefix
+    uint8_t    code;
+    const char *path_format;                // printf format taking the IID
+    const char *payload;                    // NULL for reads
+    uint8_t    expected_code;
+} operation_t;
+
+static const operation_t OPERATIONS[] = {
+    { "read_33204", COAP_GET, "33204/%u/5500", NULL, COAP_CONTENT },
+    { "read_33205", COAP_GET, "33205/%u/5504", NULL, COAP_CONTENT },
+    { "write_33204", COAP_PUT, "33204/%u/5500", "20.5", COAP_CHANGED },
+    { "write_33205", COAP_PUT, "33205/%u/5504", "75", COAP_CHANGED }
+};
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+
+typedef struct {
+    uint64_t notifications;                 // notifications to wait for
+} fanout_wait_t;
+
+//------------------------------------------------------------------------------
+
+static int
+compare_ns(const void *a_, const void *b_) {
+    int64_t a = *(const int64_t *) a_;
+    int64_t b = *(const int64_t *) b_;
+    return (a > b) - (a < b);
+}
+
+//------------------------------------------------------------------------------
+
+// time from creation of a client to the response to its Register
+static int
+bench_register(bench_server_t *server, event_loop_t *loop) {
+    int64_t latencies[REGISTER_ROUNDS];
+    for (int round = 0; round < REGISTER_ROUNDS; ++round) {
+        char endpoint_name[32];
+        bench_client_t client;
+        snprintf(endpoint_name, sizeof(endpoint_name), "toyota-bench-%d", round);
+        int64_t start = bench_now_ns();
+        if (bench_client_create(&client, server, loop, endpoint_name,
+                                HUMIDITY_SENSOR_DEFAULT_INSTANCES, NULL)) {
+            return -1;
+        }
+        int result = bench_client_wait_registered(&client, server, TIMEOUT_MS);
+        latencies[round] = bench_now_ns() - start;
+        bench_client_destroy(&client, loop);
+        if (result) {
+            fprintf(stderr, "client did not register\n");
+            return -1;
+        }
+    }
+    qsort(latencies, REGISTER_ROUNDS, sizeof(int64_t), compare_ns);
+    bench_report(BENCH_NAME, "register_p50", (double) latencies[REGISTER_ROUNDS / 2] / 1e6, "ms");
+    bench_report(BENCH_NAME, "register_max", (double) latencies[REGISTER_ROUNDS - 1] / 1e6, "ms");
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+// request/response round trips, one in flight at a time
+static int
+bench_operation(bench_server_t *server, const operation_t *operation,
+                size_t instances, size_t operations) {
+    bench_response_t response;
+    size_t payload_length = operation->payload ? strlen(operation->payload) : 0;
+    int64_t start = bench_now_ns();
+    for (size_t i = 0; i < operations; ++i) {
+        char path[32];
+        snprintf(path, sizeof(path), operation->path_format,
+                 (unsigned) (i % instances));
+        if (bench_server_request(server, operation->code, path,
+                                 operation->payload ? COAP_FORMAT_TEXT
+                                                    : COAP_FORMAT_NONE,
+                                 operation->payload, payload_length, &response,
+                                 TIMEOUT_MS)
+                || response.code != operation->expected_code) {
+            fprintf(stderr, "%s of %s failed\n", operation->name, path);
+            return -1;
+        }
+    }
+    int64_t elapsed = bench_now_ns() - start;
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "%s_rate", operation->name);
+    bench_report(BENCH_NAME, metric, (double) operations / ((double) elapsed / 1e9), "ops/s");
+    snprintf(metric, sizeof(metric), "%s_rtt", operation->name);
+    bench_report(BENCH_NAME, metric, (double) elapsed / (double) operations / 1e3, "us");
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static bool
+notifications_received(bench_server_t *server, void *wait_) {
+    const fanout_wait_t *wait = (const fanout_wait_t *) wait_;
+    return bench_server_stats(server)->notifications >= wait->notifications;
+}
+
+//------------------------------------------------------------------------------
+
+// every instance is observed, one push round changes all of them; latency
+// is the time from the first push to the last notification at the server
+static int
+bench_fanout(bench_server_t *server, bench_client_t *client, size_t instances) {
+    for (size_t iid = 0; iid < instances; ++iid) {
+        char path[32];
+        snprintf(path, sizeof(path), "33204/%u/5500", (unsigned) iid);
+        if (bench_server_observe(server, path, TIMEOUT_MS)) {
+            fprintf(stderr, "could not observe %s\n", path);
+            return -1;
+        }
+    }
+
+    int64_t latencies[FANOUT_ROUNDS];
+    for (int round = 0; round < FANOUT_ROUNDS; ++round) {
+        fanout_wait_t wait = {
+            .notifications = bench_server_stats(server)->notifications + instances
+        };
+        float value = round % 2 ? 10.0f : 30.0f;
+        int64_t start = bench_now_ns();
+        for (size_t iid = 0; iid < instances; ++iid) {
+            (void) humidity_sensor_set_data(client->anjay, client->humidity,
+                                            (anjay_iid_t) iid, value, true);
+        }
+        if (bench_server_wait(server, notifications_received, &wait, TIMEOUT_MS)) {
+            fprintf(stderr, "notifications missing after round %d\n", round);
+            return -1;
+        }
+        latencies[round] = bench_server_stats(server)->last_notification_ns - start;
+    }
+    qsort(latencies, FANOUT_ROUNDS, sizeof(int64_t), compare_ns);
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "fanout_%zu_p50", instances);
+    bench_report(BENCH_NAME, metric, (double) latencies[FANOUT_ROUNDS / 2] / 1e3, "us");
+    snprintf(metric, sizeof(metric), "fanout_%zu_p99", instances);
+    bench_report(BENCH_NAME, metric,
+                 (double) latencies[FANOUT_ROUNDS * 99 / 100] / 1e3, "us");
+    snprintf(metric, sizeof(metric), "fanout_%zu_per_notification", instances);
+    bench_report(BENCH_NAME, metric,
+                 (double) latencies[FANOUT_ROUNDS / 2] / (double) instances / 1e3, "us");
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+// usage: lwm2m [instances] [operations]
+int
+bench_lwm2m(int argc, char **argv) {
+    size_t instances = DEFAULT_INSTANCES;
+    size_t operations = DEFAULT_OPERATIONS;
+    if (argc > 1) {
+        instances = (size_t) strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        operations = (size_t) strtoul(argv[2], NULL, 10);
+    }
+    if (!instances || instances > HUMIDITY_SENSOR_MAX_INSTANCES || !operations) {
+        fprintf(stderr, "instances must be 1..%d\n", HUMIDITY_SENSOR_MAX_INSTANCES);
+        return -1;
+    }
+
+    event_loop_t *loop = event_loop_create();
+    bench_server_t *server = loop ? bench_server_create(loop) : NULL;
+    if (!server) {
+        fprintf(stderr, "could not create server stand-in\n");
+        event_loop_destroy(loop);
+        return -1;
+    }
+
+    bench_client_t client;
+    int result = bench_register(server, loop);
+    if (!result
+            && !(result = bench_client_create(&client, server, loop, "toyota-bench",
+                                              instances, NULL))) {
+        result = bench_client_wait_registered(&client, server, TIMEOUT_MS);
+        for (size_t i = 0; !result && i < ARRAY_SIZE(OPERATIONS); ++i) {
+            result = bench_operation(server, &OPERATIONS[i], instances, operations);
+        }
+        if (!result) {
+            result = bench_fanout(server, &client, instances);
+        }
+        bench_client_destroy(&client, loop);
+    }
+
+    bench_server_destroy(server);
+    event_loop_destroy(loop);
+    return result;
+}
@@ -0,0 +1,238 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+#define DEFAULT_TOLERANCE   10.0    // percents of change tolerated by --baseline
+#define MAX_LINE            256
+
+typedef struct {
+    char   name[128];               // "bench,metric"
+    double value;
+} baseline_entry_t;
+
+typedef struct {
+    baseline_entry_t *entries;
+    size_t           count;
+    double           tolerance;
+    int              regressions;
+} baseline_t;
+
+static baseline_t baseline = { .tolerance = DEFAULT_TOLERANCE };
+
+static const bench_t BENCHES[] = {
+    { "fw_verify", "firmware digest throughput, streaming vs read-back", bench_fw_verify },
+    { "fw_checkpoint", "firmware download with fsync per block vs group commit", bench_fw_checkpoint },
+    { "fw_delta", "delta package size, apply throughput and peak RSS", bench_fw_delta },
+    { "fw_compress", "compressed package ratio and decompression throughput", bench_fw_compress },
+    { "ingest", "sensor sample queue throughput and batching per wakeup", bench_ingest },
+    { "history", "sensor history ingest rate and memory per sample", bench_history },
+    { "senml", "SenML-CBOR batch size per value for different payload limits", bench_senml },
+    { "instances", "notify latency and read-all scan for many object instances", bench_instances },
+    { "actuator", "headlights apply latency and coalescing of write bursts", bench_actuator },
+    { "sampler", "sensor reads and reaction time of adaptive sampling", bench_sampler },
+    { "config", "config file load rate for large fleet endpoint lists", bench_config },
+    { "metrics", "cost of latency and counter instrumentation per operation", bench_metrics },
+    { "lwm2m", "registration, object read/write rate and notify fan-out via local server", bench_lwm2m },
+    { "fw_download", "firmware Block2 download throughput via local server", bench_fw_download }
+};
+
+//------------------------------------------------------------------------------
+
+int64_t
+bench_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+
+static const baseline_entry_t *
+find_baseline(const char *bench, const char *metric) {
+    char name[sizeof(((baseline_entry_t *) NULL)->name)];
+    snprintf(name, sizeof(name), "%s,%s", bench, metric);
+    for (size_t i = 0; i < baseline.count; ++i) {
+        if (!strcmp(baseline.entries[i].name, name)) {
+            return &baseline.entries[i];
+        }
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+// +1 when higher values are better, -1 when lower are, 0 when neither
+static int
+unit_direction(const char *unit) {
+    size_t length = strlen(unit);
+    if (length > 2 && !strcmp(unit + length - 2, "/s")) {
+        return 1;
+    }
+    static const char *const LOWER_IS_BETTER[] = {
+        "ns", "us", "ms", "ns/op", "bytes", "KiB"
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(LOWER_IS_BETTER); ++i) {
+        if (!strcmp(unit, LOWER_IS_BETTER[i])) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+bench_report(const char *bench, const char *metric, double value, const char *unit) {
+    if (!baseline.entries) {
+        printf("%s,%s,%.3f,%s\n", bench, metric, value, unit);
+        fflush(stdout);
+        return;
+    }
+
+    const baseline_entry_t *entry = find_baseline(bench, metric);
+    if (!entry) {
+        printf("%s,%s,%.3f,%s,,,new\n", bench, metric, value, unit);
+        fflush(stdout);
+        return;
+    }
+    double change = entry->value ? (value - entry->value) / entry->value * 100.0 : 0.0;
+    const char *verdict = "ok";
+    int direction = unit_direction(unit);
+    if (direction && change * direction < -baseline.tolerance) {
+        verdict = "regressed";
+        ++baseline.regressions;
+    } else if (direction && change * direction > baseline.tolerance) {
+        verdict = "improved";
+    }
+    printf("%s,%s,%.3f,%s,%.3f,%.1f,%s\n", bench, metric, value, unit,
+           entry->value, change, verdict);
+    fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+
+double
+bench_mb_per_s(uint64_t bytes, int64_t elapsed_ns) {
+    if (elapsed_ns <= 0) {
+        return 0.0;
+    }
+    return (double) bytes / (1024.0 * 1024.0) / ((double) elapsed_ns / 1e9);
+}
+
+//------------------------------------------------------------------------------
+
+// results of a previous run, lines "bench,metric,value,unit[,...]"
+static int
+load_baseline(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "could not open baseline %s\n", path);
+        return -1;
+    }
+    char line[MAX_LINE];
+    size_t capacity = 0;
+    while (fgets(line, sizeof(line), file)) {
+        char *bench = strtok(line, ",");
+        char *metric = strtok(NULL, ",");
+        char *value = strtok(NULL, ",");
+        char *end = NULL;
+        double parsed = value ? strtod(value, &end) : 0.0;
+        if (!metric || end == value) {
+            continue;   // header or malformed line
+        }
+        if (baseline.count == capacity) {
+            size_t new_capacity = capacity ? 2 * capacity : 64;
+            baseline_entry_t *entries = (baseline_entry_t *) realloc(
+                    baseline.entries, new_capacity * sizeof(baseline_entry_t));
+            if (!entries) {
+                fclose(file);
+                return -1;
+            }
+            baseline.entries = entries;
+            capacity = new_capacity;
+        }
+        baseline_entry_t *entry = &baseline.entries[baseline.count++];
+        snprintf(entry->name, sizeof(entry->name), "%s,%s", bench, metric);
+        entry->value = parsed;
+    }
+    fclose(file);
+    if (!baseline.entries) {
+        fprintf(stderr, "baseline %s has no results\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+print_usage(const char *program) {
+    printf("Usage: %s [--baseline FILE [--tolerance PERCENT]] [BENCH [ARGS...]]\n\n"
+           "Available benchmarks:\n", program);
+    for (size_t i = 0; i < ARRAY_SIZE(BENCHES); ++i) {
+        printf("  %-14s %s\n", BENCHES[i].name, BENCHES[i].description);
+    }
+    printf("\nWithout BENCH all benchmarks run with default arguments.\n"
+           "With --baseline every result is compared with the same metric of a\n"
+           "previous run; exit status is 2 when any of them got worse by more\n"
+           "than the tolerance (%.0f%% by default).\n", DEFAULT_TOLERANCE);
+}
+
+//------------------------------------------------------------------------------
+
+static int
+run_benches(int argc, char **argv) {
+    if (argc < 1) {
+        int result = 0;
+        for (size_t i = 0; i < ARRAY_SIZE(BENCHES); ++i) {
+            char *bench_argv[] = { (char *) BENCHES[i].name, NULL };
+            result |= BENCHES[i].run(1, bench_argv);
+        }
+        return result ? 1 : 0;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(BENCHES); ++i) {
+        if (!strcmp(argv[0], BENCHES[i].name)) {
+            return BENCHES[i].run(argc, argv) ? 1 : 0;
+        }
+    }
+    fprintf(stderr, "unknown benchmark: %s\n", argv[0]);
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+int
+main(int argc, char **argv) {
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+        if (!strcmp(argv[arg], "-h") || !strcmp(argv[arg], "--help")) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (!strcmp(argv[arg], "--baseline") && arg + 1 < argc) {
+            if (load_baseline(argv[++arg])) {
+                return 1;
+            }
+        } else if (!strcmp(argv[arg], "--tolerance") && arg + 1 < argc) {
+            baseline.tolerance = strtod(argv[++arg], NULL);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    printf(baseline.entries ? "bench,metric,value,unit,baseline,change_pct,verdict\n"
+                            : "bench,metric,value,unit\n");
+    int result = run_benches(argc - arg, argv + arg);
+    free(baseline.entries);
+    if (result < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    return result ? result : baseline.regressions ? 2 : 0;
+}
@@ -0,0 +1,90 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "toyota_metrics.h"
+
+#define BENCH_NAME              "metrics"
+#define DEFAULT_OPERATIONS      10000000
+#define REPORT_ROUNDS           100
+#define SIMULATED_WORK          64      // iterations of the measured loop body
+
+static volatile uint64_t sink;
+
+//------------------------------------------------------------------------------
+
+static void
+simulated_work(void) {
+    uint64_t value = 0;
+    for (int i = 0; i < SIMULATED_WORK; ++i) {
+        value = value * 31 + (uint64_t) i;
+    }
+    sink = value;
+}
+
+//------------------------------------------------------------------------------
+
+// cost of one operation measured the way the event loop measures anjay_serve()
+static int64_t
+run_operations(metrics_t *metrics, size_t operations) {
+    int64_t start = bench_now_ns();
+    for (size_t i = 0; i < operations; ++i) {
+        int64_t start_ns = metrics_start(metrics);
+        simulated_work();
+        metrics_stop(metrics, METRIC_SERVE, start_ns);
+        metrics_count(metrics, METRIC_WAKEUPS, 1);
+    }
+    // once per loop iteration in the event loop, not per operation
+    metrics_publish(metrics);
+    return bench_now_ns() - start;
+}
+
+//------------------------------------------------------------------------------
+
+// usage: metrics [operations]
+int
+bench_metrics(int argc, char **argv) {
+    size_t operations = DEFAULT_OPERATIONS;
+    if (argc > 1) {
+        operations = (size_t) strtoul(argv[1], NULL, 10);
+    }
+    if (!operations) {
+        fprintf(stderr, "invalid arguments\n");
+        return -1;
+    }
+
+    metrics_t *metrics = metrics_create("bench");
+    int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (!metrics || fd < 0) {
+        fprintf(stderr, "could not create metrics\n");
+        metrics_destroy(metrics);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    int64_t bare_ns = run_operations(NULL, operations);
+    int64_t measured_ns = run_operations(metrics, operations);
+
+    int64_t start = bench_now_ns();
+    for (int i = 0; i < REPORT_ROUNDS; ++i) {
+        (void) metrics_write_report(fd);
+    }
+    int64_t report_ns = (bench_now_ns() - start) / REPORT_ROUNDS;
+
+    bench_report(BENCH_NAME, "operations", (double) operations, "operations");
+    bench_report(BENCH_NAME, "bare", (double) bare_ns / (double) operations, "ns/op");
+    bench_report(BENCH_NAME, "measured", (double) measured_ns / (double) operations, "ns/op");
+    bench_report(BENCH_NAME, "overhead",
+                 (double) (measured_ns - bare_ns) / (double) operations, "ns/op");
+    bench_report(BENCH_NAME, "report", (double) report_ns / 1000.0, "us");
+
+    close(fd);
+    metrics_destroy(metrics);
+    return 0;
+}
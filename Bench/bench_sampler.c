@@ -0,0 +1,144 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "toyota_event_loop.h"
+#include "toyota_histogram.h"
+#include "toyota_sampler.h"
+
+#define BENCH_NAME              "sampler"
+#define DEFAULT_CHANNELS        4
+#define DEFAULT_DURATION_MS     9000
+#define MIN_INTERVAL_MS         10
+#define MAX_INTERVAL_MS         1000
+#define THRESHOLD               0.1f
+#define STABLE_MS               2000    // humidity mostly sits still...
+#define MOVING_MS               1000    // ...and sometimes swings by +-5%
+#define AMPLITUDE               5.0f
+#define BASE                    50.0f
+#define LOOP_WAIT_MS            100
+#define TWO_PI                  6.28318530717958647692
+
+typedef struct {
+    int64_t cycle;          // moving phase the last detection belongs to, -1 - none
+    float last_value;
+} channel_state_t;
+
+typedef struct {
+    const sensor_driver_t *driver;
+    int64_t started_ms;
+    channel_state_t channels[SAMPLER_MAX_CHANNELS];
+    histogram_t reaction_ms;    // threshold crossing to the first sample seeing it
+    double max_error;           // largest gap between the last sample and the real value
+} bench_state_t;
+
+//------------------------------------------------------------------------------
+
+static void
+take_sample(void *state_, size_t channel, float value) {
+    bench_state_t *state = (bench_state_t *) state_;
+    channel_state_t *channel_state = &state->channels[channel];
+    int64_t elapsed_ms = bench_now_ns() / 1000000 - state->started_ms;
+
+    // what the server would have seen just before this sample
+    double error = fabs(sensor_driver_synthetic_value(state->driver, channel, elapsed_ms)
+                        - channel_state->last_value);
+    if (error > state->max_error) {
+        state->max_error = error;
+    }
+    channel_state->last_value = value;
+
+    int64_t shifted_ms = elapsed_ms + (int64_t) channel * MOVING_MS / 4;
+    int64_t cycle = shifted_ms / (STABLE_MS + MOVING_MS);
+    int64_t in_moving_ms = shifted_ms % (STABLE_MS + MOVING_MS) - STABLE_MS;
+    if (in_moving_ms >= 0 && cycle != channel_state->cycle
+            && fabsf(value - BASE) >= THRESHOLD) {
+        channel_state->cycle = cycle;
+        double crossing_ms = asin(THRESHOLD / AMPLITUDE) / TWO_PI * MOVING_MS;
+        double reaction_ms = (double) in_moving_ms - crossing_ms;
+        histogram_record(&state->reaction_ms, reaction_ms > 0.0 ? (uint64_t) reaction_ms : 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// usage: sampler [channels] [duration_ms]
+int
+bench_sampler(int argc, char **argv) {
+    size_t channels = DEFAULT_CHANNELS;
+    int64_t duration_ms = DEFAULT_DURATION_MS;
+    if (argc > 1) {
+        channels = (size_t) strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        duration_ms = strtoll(argv[2], NULL, 10);
+    }
+    if (!channels || channels > SAMPLER_MAX_CHANNELS || duration_ms <= 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return -1;
+    }
+
+    bench_state_t *state = (bench_state_t *) calloc(1, sizeof(bench_state_t));
+    event_loop_t *loop = event_loop_create();
+    sensor_driver_t *driver = sensor_driver_synthetic_create(&(sensor_synthetic_config_t) {
+        .base = BASE,
+        .amplitude = AMPLITUDE,
+        .stable_ms = STABLE_MS,
+        .moving_ms = MOVING_MS
+    });
+    if (!state || !loop || !driver) {
+        fprintf(stderr, "could not create sampler\n");
+        sensor_driver_destroy(driver);
+        event_loop_destroy(loop);
+        free(state);
+        return -1;
+    }
+    state->driver = driver;
+    state->started_ms = bench_now_ns() / 1000000;
+    histogram_init(&state->reaction_ms);
+    for (size_t i = 0; i < channels; ++i) {
+        state->channels[i].cycle = -1;
+        state->channels[i].last_value = BASE;
+    }
+
+    sampler_limits_t limits = {
+        .min_interval_ms = MIN_INTERVAL_MS,
+        .max_interval_ms = MAX_INTERVAL_MS,
+        .threshold = THRESHOLD
+    };
+    sampler_handlers_t handlers = {
+        .apply = take_sample
+    };
+    sampler_t *sampler = sampler_create(loop, driver, channels, &limits, &handlers, state);
+    if (!sampler) {
+        fprintf(stderr, "could not create sampler\n");
+        event_loop_destroy(loop);
+        free(state);
+        return -1;
+    }
+    while (bench_now_ns() / 1000000 - state->started_ms < duration_ms) {
+        (void) event_loop_run_once(loop, LOOP_WAIT_MS);
+    }
+
+    sampler_stats_t stats;
+    sampler_get_stats(sampler, &stats);
+    // a fixed-rate sampler needs the min interval all the time to react as fast
+    double fixed_reads = (double) channels * (double) duration_ms / MIN_INTERVAL_MS;
+    bench_report(BENCH_NAME, "reads", (double) stats.reads, "reads");
+    bench_report(BENCH_NAME, "fixed_rate_reads", fixed_reads, "reads");
+    bench_report(BENCH_NAME, "wakeups_saved",
+                 100.0 * (1.0 - (double) stats.reads / fixed_reads), "%");
+    bench_report(BENCH_NAME, "moving_reads", (double) stats.moving, "reads");
+    bench_report(BENCH_NAME, "reaction_p50",
+                 (double) histogram_percentile(&state->reaction_ms, 50.0), "ms");
+    bench_report(BENCH_NAME, "reaction_max", (double) state->reaction_ms.max, "ms");
+    bench_report(BENCH_NAME, "max_error", state->max_error, "%RH");
+
+    sampler_destroy(sampler);
+    event_loop_destroy(loop);
+    free(state);
+    return 0;
+}
@@ -0,0 +1,144 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "bench_server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Main_Objects/humidity.h"
+#include "Main_Objects/sensor_batch.h"
+
+#define BENCH_NAME              "senml"
+#define DEFAULT_VALUES          100000
+#define SINGLE_VALUE_BYTES      (SENML_RECORD_MAX_SIZE + 3) // smallest limit, one value per payload
+#define BATCH_PATH              "33206/0/5510"
+#define TIMEOUT_MS              5000
+
+static const size_t BATCH_LIMITS[] = { SINGLE_VALUE_BYTES, 256, 512, SENSOR_BATCH_CAPACITY };
+
+//------------------------------------------------------------------------------
+
+static bool
+batches_delivered(bench_server_t *server, void *batch_) {
+    (void) server;
+    const report_stats_t *stats = sensor_batch_stats((sensor_batch_object_t *) batch_);
+    return stats->delivered == stats->batches;
+}
+
+//------------------------------------------------------------------------------
+
+// humidity value and state in turns, as reported by toyota_client.c
+static int
+add_value(sensor_batch_object_t *batch, size_t i) {
+    if (i % 2) {
+        return sensor_batch_add_bool(batch, HUMIDITY_SENSOR_OBJECT_ID, 0,
+                                     HUMIDITY_SENSOR_STATE, true);
+    }
+    return sensor_batch_add_float(batch, HUMIDITY_SENSOR_OBJECT_ID, 0,
+                                  HUMIDITY_SENSOR_VALUE,
+                                  (float) (i / 2 % 4001) / 100.0f);
+}
+
+//------------------------------------------------------------------------------
+
+// Batches are observed by the server stand-in. A value is refused while the
+// queue of unread batches is full, the loop then runs until notifications
+// drain it and the value is added again; only the adds are timed. Every
+// published batch must reach the server.
+static int
+run_batches(bench_server_t *server, sensor_batch_object_t *batch,
+            size_t max_bytes, size_t values) {
+    const report_stats_t *stats = sensor_batch_stats(batch);
+    const report_stats_t before = *stats;
+    uint64_t notifications = bench_server_stats(server)->notifications;
+    // window is left to the timer, only the size triggers while adding
+    sensor_batch_set_limits(batch, max_bytes, SENSOR_BATCH_DEFAULT_WINDOW);
+
+    int result = 0;
+    int64_t elapsed = 0;
+    for (size_t i = 0; !result && i < values; ++i) {
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            int64_t start = bench_now_ns();
+            result = add_value(batch, i);
+            elapsed += bench_now_ns() - start;
+            if (!result
+                    || bench_server_wait(server, batches_delivered, batch, TIMEOUT_MS)) {
+                break;
+            }
+        }
+    }
+    if (!result) {
+        result = sensor_batch_flush(batch) < 0
+                 || bench_server_wait(server, batches_delivered, batch, TIMEOUT_MS);
+    }
+
+    uint64_t published = stats->batches - before.batches;
+    uint64_t queued = stats->values - before.values;
+    uint64_t delivered = stats->delivered - before.delivered;
+    notifications = bench_server_stats(server)->notifications - notifications;
+    if (result || queued != values || delivered != published || !notifications) {
+        fprintf(stderr, "limit %zu: %llu of %llu batches delivered\n", max_bytes,
+                (unsigned long long) delivered, (unsigned long long) published);
+        return -1;
+    }
+
+    char metric[64];
+    snprintf(metric, sizeof(metric), "limit_%zu_bytes_per_value", max_bytes);
+    bench_report(BENCH_NAME, metric,
+                 (double) (stats->payload_bytes - before.payload_bytes) / (double) queued,
+                 "bytes");
+    snprintf(metric, sizeof(metric), "limit_%zu_values_per_notify", max_bytes);
+    bench_report(BENCH_NAME, metric, (double) queued / (double) notifications, "values");
+    snprintf(metric, sizeof(metric), "limit_%zu_batches_per_notify", max_bytes);
+    bench_report(BENCH_NAME, metric, (double) delivered / (double) notifications, "batches");
+    snprintf(metric, sizeof(metric), "limit_%zu_encode_latency", max_bytes);
+    bench_report(BENCH_NAME, metric, (double) elapsed / (double) queued, "ns");
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+// usage: senml [values]
+int
+bench_senml(int argc, char **argv) {
+    size_t values = DEFAULT_VALUES;
+    if (argc > 1) {
+        values = (size_t) strtoul(argv[1], NULL, 10);
+    }
+
+    event_loop_t *loop = event_loop_create();
+    bench_server_t *server = loop ? bench_server_create(loop) : NULL;
+    if (!server) {
+        fprintf(stderr, "could not create server stand-in\n");
+        event_loop_destroy(loop);
+        return -1;
+    }
+
+    bench_client_t client;
+    int result = bench_client_create(&client, server, loop, "toyota-bench",
+                                     HUMIDITY_SENSOR_DEFAULT_INSTANCES, NULL);
+    if (!result) {
+        sensor_batch_object_t *batch = NULL;
+        if ((result = bench_client_wait_registered(&client, server, TIMEOUT_MS))
+                || !(batch = sensor_batch_init_object(client.anjay, loop))) {
+            fprintf(stderr, "could not set up client\n");
+            result = -1;
+        } else {
+            sensor_batch_set_message_size(batch, BENCH_CLIENT_BUFFER_SIZE);
+            if ((result = bench_server_observe(server, BATCH_PATH, TIMEOUT_MS))) {
+                fprintf(stderr, "could not observe %s\n", BATCH_PATH);
+            }
+        }
+        for (size_t i = 0; !result && i < sizeof(BATCH_LIMITS) / sizeof(BATCH_LIMITS[0]); ++i) {
+            result = run_batches(server, batch, BATCH_LIMITS[i], values);
+        }
+        if (batch) {
+            sensor_batch_object_release(client.anjay, batch);
+        }
+        bench_client_destroy(&client, loop);
+    }
+
+    bench_server_destroy(server);
+    event_loop_destroy(loop);
+    return result;
+}
@@ -0,0 +1,521 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench_server.h"
+#include "bench.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <anjay/attr_storage.h>
+#include <anjay/security.h>
+#include <anjay/server.h>
+
+#define SERVER_MAX_MESSAGE          2048
+#define SERVER_MAX_PATH             128
+#define SERVER_TOKEN_SIZE           4
+#define SERVER_OBSERVE_FLAG         0x80000000u // token of an observation
+#define SERVER_REGISTRATION_PATH    "rd/1"
+#define SERVER_WAIT_SLICE_MS        50
+
+#define CLIENT_SSID                 1
+#define CLIENT_LIFETIME             86400
+
+struct bench_server {
+    event_loop_t          *loop;
+    int                   fd;
+    event_loop_fd_watch_t *watch;
+    char                  uri[32];
+    struct sockaddr_in    peer;             // client that registered last
+    bool                  has_peer;
+    uint16_t              next_msg_id;
+    uint32_t              next_token;
+    uint32_t              observations;
+    uint32_t              pending_token;    // token of the request in flight, 0 - none
+    uint16_t              pending_msg_id;
+    bool                  response_ready;
+    bench_response_t      *response;
+    const char            *download_path;
+    const uint8_t         *download;
+    size_t                download_size;
+    bench_server_stats_t  stats;
+};
+
+//------------------------------------------------------------------------------
+
+static void
+send_to(bench_server_t *server, const coap_builder_t *builder,
+        const struct sockaddr_in *address) {
+    if (builder->overflow) {
+        fprintf(stderr, "bench server: message too large\n");
+        return;
+    }
+    (void) sendto(server->fd, builder->data, builder->length, 0,
+                  (const struct sockaddr *) address, sizeof(*address));
+}
+
+//------------------------------------------------------------------------------
+
+static void
+send_empty_ack(bench_server_t *server, const coap_msg_t *msg,
+               const struct sockaddr_in *from) {
+    uint8_t buffer[COAP_HEADER_SIZE];
+    coap_builder_t builder;
+    coap_builder_init(&builder, buffer, sizeof(buffer), COAP_TYPE_ACK, 0, msg->msg_id,
+                 NULL, 0);
+    send_to(server, &builder, from);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+serve_block(bench_server_t *server, const coap_msg_t *request,
+            const struct sockaddr_in *from) {
+    uint8_t buffer[SERVER_MAX_MESSAGE];
+    coap_builder_t builder;
+    uint32_t num = 0;
+    uint32_t szx = COAP_BLOCK_SZX_MAX;
+    const coap_option_t *block2 = coap_find_option(request, COAP_OPTION_BLOCK2);
+    if (block2) {
+        uint32_t value = coap_option_uint(block2);
+        num = value >> 4;
+        if ((value & 0x7) < szx) {
+            szx = value & 0x7;
+        }
+    }
+    size_t block_size = (size_t) 1 << (szx + 4);
+    size_t offset = (size_t) num * block_size;
+    if (szx == 7 || offset > server->download_size
+            || (offset == server->download_size && offset)) {
+        coap_builder_response(&builder, buffer, sizeof(buffer), request,
+                          COAP_BAD_OPTION, server->next_msg_id++);
+        send_to(server, &builder, from);
+        return;
+    }
+    size_t length = server->download_size - offset;
+    bool more = length > block_size;
+    if (more) {
+        length = block_size;
+    }
+
+    coap_builder_response(&builder, buffer, sizeof(buffer), request,
+                          COAP_CONTENT, server->next_msg_id++);
+    coap_builder_option_uint(&builder, COAP_OPTION_CONTENT_FORMAT,
+                        COAP_FORMAT_OPAQUE);
+    coap_builder_option_uint(&builder, COAP_OPTION_BLOCK2,
+                        num << 4 | (uint32_t) more << 3 | szx);
+    coap_builder_option_uint(&builder, COAP_OPTION_SIZE2, (uint32_t) server->download_size);
+    coap_builder_payload(&builder, server->download + offset, length);
+    send_to(server, &builder, from);
+    ++server->stats.blocks_served;
+    server->stats.bytes_served += length;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+handle_request(bench_server_t *server, const coap_msg_t *request,
+               const struct sockaddr_in *from) {
+    uint8_t buffer[SERVER_MAX_MESSAGE];
+    coap_builder_t builder;
+    char path[SERVER_MAX_PATH];
+    coap_option_path(request, COAP_OPTION_URI_PATH, path, sizeof(path));
+
+    if (request->code == COAP_GET && server->download_path
+            && !strcmp(path, server->download_path)) {
+        serve_block(server, request, from);
+        return;
+    }
+
+    uint8_t code = COAP_NOT_FOUND;
+    bool registered = false;
+    if (request->code == COAP_POST && !strcmp(path, "rd")) {
+        // every Register gets the same location, the stand-in keeps one
+        // registration and talks to the client that registered last
+        server->peer = *from;
+        server->has_peer = true;
+        ++server->stats.registrations;
+        code = COAP_CREATED;
+        registered = true;
+    } else if (request->code == COAP_POST
+               && !strcmp(path, SERVER_REGISTRATION_PATH)) {
+        ++server->stats.updates;
+        code = COAP_CHANGED;
+    } else if (request->code == COAP_DELETE
+               && !strcmp(path, SERVER_REGISTRATION_PATH)) {
+        code = COAP_DELETED;
+    }
+
+    coap_builder_response(&builder, buffer, sizeof(buffer), request, code,
+                          server->next_msg_id++);
+    if (registered) {
+        coap_builder_path(&builder, COAP_OPTION_LOCATION_PATH, SERVER_REGISTRATION_PATH);
+    }
+    send_to(server, &builder, from);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+handle_response(bench_server_t *server, const coap_msg_t *msg,
+                const struct sockaddr_in *from) {
+    if (msg->type == COAP_TYPE_CON) {
+        send_empty_ack(server, msg, from);
+    }
+    if (server->pending_token && msg->token == server->pending_token
+            && !server->response_ready) {
+        server->response->code = msg->code;
+        server->response->payload_length =
+                msg->payload_length < BENCH_SERVER_MAX_PAYLOAD
+                        ? msg->payload_length : BENCH_SERVER_MAX_PAYLOAD;
+        if (msg->payload_length) {
+            memcpy(server->response->payload, msg->payload,
+                   server->response->payload_length);
+        }
+        server->response_ready = true;
+        return;
+    }
+    if (msg->token & SERVER_OBSERVE_FLAG) {
+        ++server->stats.notifications;
+        server->stats.last_notification_ns = bench_now_ns();
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+handle_datagram(bench_server_t *server, const uint8_t *data, size_t length,
+                const struct sockaddr_in *from) {
+    coap_msg_t msg;
+    if (coap_parse(&msg, data, length)) {
+        return;
+    }
+    if (msg.code == COAP_EMPTY) {
+        // empty ACK of a separate response or RST of a request in flight
+        if (msg.type == COAP_TYPE_RST && server->pending_token
+                && msg.msg_id == server->pending_msg_id && !server->response_ready) {
+            server->response->code = 0;
+            server->response->payload_length = 0;
+            server->response_ready = true;
+        }
+        return;
+    }
+    if (COAP_IS_REQUEST(msg.code)) {
+        handle_request(server, &msg, from);
+    } else {
+        handle_response(server, &msg, from);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+socket_readable(void *server_) {
+    bench_server_t *server = (bench_server_t *) server_;
+    uint8_t buffer[SERVER_MAX_MESSAGE];
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t from_length = sizeof(from);
+        ssize_t received = recvfrom(server->fd, buffer, sizeof(buffer), 0,
+                                    (struct sockaddr *) &from, &from_length);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        handle_datagram(server, buffer, (size_t) received, &from);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bench_server_t *
+bench_server_create(event_loop_t *loop) {
+    bench_server_t *server = (bench_server_t *) calloc(1, sizeof(bench_server_t));
+    if (!server) {
+        return NULL;
+    }
+    server->loop = loop;
+    server->next_msg_id = (uint16_t) bench_now_ns();
+    server->next_token = 1;
+
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    socklen_t length = sizeof(address);
+    server->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->fd < 0
+            || bind(server->fd, (const struct sockaddr *) &address, sizeof(address))
+            || getsockname(server->fd, (struct sockaddr *) &address, &length)
+            || !(server->watch = event_loop_watch_fd(loop, server->fd,
+                                                     socket_readable, server))) {
+        fprintf(stderr, "bench server: could not open socket: %s\n", strerror(errno));
+        bench_server_destroy(server);
+        return NULL;
+    }
+    snprintf(server->uri, sizeof(server->uri), "coap://127.0.0.1:%u",
+             (unsigned) ntohs(address.sin_port));
+    return server;
+}
+
+//------------------------------------------------------------------------------
+
+void
+bench_server_destroy(bench_server_t *server) {
+    if (!server) {
+        return;
+    }
+    if (server->watch) {
+        event_loop_unwatch_fd(server->loop, server->watch);
+    }
+    if (server->fd >= 0) {
+        close(server->fd);
+    }
+    free(server);
+}
+
+//------------------------------------------------------------------------------
+
+const char *
+bench_server_uri(const bench_server_t *server) {
+    return server->uri;
+}
+
+//------------------------------------------------------------------------------
+
+void
+bench_server_set_download(bench_server_t *server,
+                          const char     *path,
+                          const void     *data,
+                          size_t         size) {
+    server->download_path = path;
+    server->download = (const uint8_t *) data;
+    server->download_size = size;
+}
+
+//------------------------------------------------------------------------------
+
+const bench_server_stats_t *
+bench_server_stats(const bench_server_t *server) {
+    return &server->stats;
+}
+
+//------------------------------------------------------------------------------
+
+int
+bench_server_wait(bench_server_t    *server,
+                  bench_condition_t *condition,
+                  void              *arg,
+                  int               timeout_ms) {
+    int64_t deadline = bench_now_ns() + (int64_t) timeout_ms * 1000000;
+    while (!condition(server, arg)) {
+        int64_t remaining_ms = (deadline - bench_now_ns()) / 1000000;
+        if (remaining_ms <= 0) {
+            return -1;
+        }
+        (void) event_loop_run_once(server->loop,
+                                   remaining_ms < SERVER_WAIT_SLICE_MS
+                                           ? (int) remaining_ms
+                                           : SERVER_WAIT_SLICE_MS);
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static bool
+response_ready(bench_server_t *server, void *arg) {
+    (void) arg;
+    return server->response_ready;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+send_request(bench_server_t   *server,
+             uint32_t         token,
+             uint8_t          code,
+             const char       *path,
+             bool             observe,
+             int              content_format,
+             const void       *payload,
+             size_t           payload_length,
+             bench_response_t *out_response,
+             int              timeout_ms) {
+    if (!server->has_peer) {
+        return -1;
+    }
+    uint8_t raw_token[SERVER_TOKEN_SIZE] = {
+        (uint8_t) (token >> 24), (uint8_t) (token >> 16),
+        (uint8_t) (token >> 8), (uint8_t) token
+    };
+    uint8_t buffer[SERVER_MAX_MESSAGE];
+    coap_builder_t builder;
+    server->pending_msg_id = server->next_msg_id++;
+    coap_builder_init(&builder, buffer, sizeof(buffer), COAP_TYPE_CON, code,
+                 server->pending_msg_id, raw_token, sizeof(raw_token));
+    if (observe) {
+        coap_builder_option_uint(&builder, COAP_OPTION_OBSERVE, 0);
+    }
+    coap_builder_path(&builder, COAP_OPTION_URI_PATH, path);
+    if (content_format != COAP_FORMAT_NONE) {
+        coap_builder_option_uint(&builder, COAP_OPTION_CONTENT_FORMAT,
+                            (uint32_t) content_format);
+    }
+    coap_builder_payload(&builder, payload, payload_length);
+    if (builder.overflow) {
+        return -1;
+    }
+
+    server->pending_token = token;
+    server->response_ready = false;
+    server->response = out_response;
+    (void) sendto(server->fd, builder.data, builder.length, 0,
+                  (const struct sockaddr *) &server->peer, sizeof(server->peer));
+    int result = bench_server_wait(server, response_ready, NULL, timeout_ms);
+    server->pending_token = 0;
+    server->response = NULL;
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+int
+bench_server_request(bench_server_t   *server,
+                     uint8_t          code,
+                     const char       *path,
+                     int              content_format,
+                     const void       *payload,
+                     size_t           payload_length,
+                     bench_response_t *out_response,
+                     int              timeout_ms) {
+    uint32_t token = server->next_token++ & ~SERVER_OBSERVE_FLAG;
+    return send_request(server, token ? token : server->next_token++, code, path,
+                        false, content_format, payload, payload_length,
+                        out_response, timeout_ms);
+}
+
+//------------------------------------------------------------------------------
+
+int
+bench_server_observe(bench_server_t *server, const char *path, int timeout_ms) {
+    bench_response_t response;
+    uint32_t token = SERVER_OBSERVE_FLAG | server->observations++;
+    if (send_request(server, token, COAP_GET, path, true,
+                     COAP_FORMAT_NONE, NULL, 0, &response, timeout_ms)
+            || response.code != COAP_CONTENT) {
+        return -1;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+int
+bench_client_create(bench_client_t *client,
+                    bench_server_t *server,
+                    event_loop_t   *loop,
+                    const char     *endpoint_name,
+                    size_t         instances,
+                    const char     *fw_state_path) {
+    static const char *const FW_UPDATE_ARGS[] = { "toyota_bench", NULL };
+    memset(client, 0, sizeof(*client));
+    client->firmware_update.firmware_update_fd = -1;
+
+    const anjay_configuration_t config = {
+        .endpoint_name   = endpoint_name,
+        .in_buffer_size  = BENCH_CLIENT_BUFFER_SIZE,
+        .out_buffer_size = BENCH_CLIENT_BUFFER_SIZE
+    };
+    const anjay_security_instance_t security_instance = {
+        .ssid          = CLIENT_SSID,
+        .server_uri    = bench_server_uri(server),
+        .security_mode = ANJAY_UDP_SECURITY_NOSEC
+    };
+    const anjay_server_instance_t server_instance = {
+        .ssid               = CLIENT_SSID,
+        .lifetime           = CLIENT_LIFETIME,
+        .default_min_period = -1,
+        .default_max_period = -1,
+        .disable_timeout    = -1,
+        .binding            = "U"
+    };
+    anjay_iid_t security_iid = ANJAY_IID_INVALID;
+    anjay_iid_t server_iid = ANJAY_IID_INVALID;
+
+    if (!(client->anjay = anjay_new(&config))
+            || anjay_attr_storage_install(client->anjay)
+            || anjay_security_object_install(client->anjay)
+            || anjay_server_object_install(client->anjay)
+            || anjay_security_object_add_instance(client->anjay, &security_instance,
+                                                  &security_iid)
+            || anjay_server_object_add_instance(client->anjay, &server_instance,
+                                                &server_iid)
+            || !(client->endpoint = event_loop_attach(loop, client->anjay))
+            || !(client->humidity =
+                         humidity_sensor_init_object(client->anjay, loop, instances))
+            || !(client->headlights =
+                         headlights_control_init_object(client->anjay, loop, instances))) {
+        fprintf(stderr, "could not create client %s\n", endpoint_name);
+        bench_client_destroy(client, loop);
+        return -1;
+    }
+    // every push is a separate measurement, nothing is batched
+    humidity_sensor_set_notify_window(client->humidity, 0);
+    humidity_sensor_set_deadband(client->humidity, 0.0f);
+    headlights_control_set_notify_window(client->headlights, 0);
+
+    if (fw_state_path) {
+        if (firmware_update_install(client->anjay, &client->firmware_update,
+                                    fw_state_path, NULL, NULL, FW_UPDATE_ARGS)) {
+            fprintf(stderr, "could not install firmware update object\n");
+            bench_client_destroy(client, loop);
+            return -1;
+        }
+        client->has_firmware_update = true;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static bool
+client_registered(bench_server_t *server, void *client_) {
+    (void) server;
+    const bench_client_t *client = (const bench_client_t *) client_;
+    // the first packet served by a fresh client is the response to Register
+    return event_loop_endpoint_served(client->endpoint) > 0;
+}
+
+//------------------------------------------------------------------------------
+
+int
+bench_client_wait_registered(bench_client_t *client,
+                             bench_server_t *server,
+                             int            timeout_ms) {
+    return bench_server_wait(server, client_registered, client, timeout_ms);
+}
+
+//------------------------------------------------------------------------------
+
+void
+bench_client_destroy(bench_client_t *client, event_loop_t *loop) {
+    if (client->anjay) {
+        headlights_control_object_release(client->anjay, client->headlights);
+        humidity_sensor_object_release(client->anjay, client->humidity);
+        if (client->has_firmware_update) {
+            firmware_update_destroy(&client->firmware_update);
+        }
+        if (client->endpoint) {
+            event_loop_detach(loop, client->endpoint);
+        }
+        anjay_delete(client->anjay);
+    }
+    memset(client, 0, sizeof(*client));
+}
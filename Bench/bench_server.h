@@ -0,0 +1,150 @@
+#ifndef TOYOTA_BENCH_SERVER
+#define TOYOTA_BENCH_SERVER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <anjay/anjay.h>
+
+#include "coap.h"
+#include "toyota_event_loop.h"
+#include "Main_Objects/firmware_update.h"
+#include "Main_Objects/headlights_control.h"
+#include "Main_Objects/humidity.h"
+
+#define BENCH_SERVER_MAX_PAYLOAD    1024    // payload bytes kept from a response
+#define BENCH_CLIENT_BUFFER_SIZE    4000    // CoAP buffers of bench clients
+
+typedef struct bench_server bench_server_t;
+
+typedef struct {
+    uint8_t code;
+    uint8_t payload[BENCH_SERVER_MAX_PAYLOAD];
+    size_t  payload_length;                 // truncated to BENCH_SERVER_MAX_PAYLOAD
+} bench_response_t;
+
+typedef struct {
+    uint64_t registrations;                 // Register requests answered
+    uint64_t updates;                       // Update requests answered
+    uint64_t notifications;                 // notifications of observed paths
+    uint64_t blocks_served;                 // Block2 responses of the download
+    uint64_t bytes_served;                  // download payload bytes sent
+    int64_t  last_notification_ns;          // arrival of the latest notification
+} bench_server_stats_t;
+
+// returns true once the awaited condition holds
+typedef bool bench_condition_t(bench_server_t *server, void *arg);
+
+/**
+ * @brief In-process LwM2M server stand-in
+ *
+ * Plain CoAP over UDP on 127.0.0.1, served from the given event loop, so
+ * the benches stay single-threaded: the clients and the server stand-in
+ * run on the same loop and every exchange is driven by
+ * event_loop_run_once(). It answers Register, Update and De-register,
+ * serves one blob with Block2 for firmware downloads, and sends Read,
+ * Write and Observe requests to the client that registered last.
+ *
+ * @param loop  Event loop the server socket is watched by
+ *
+ * @return pointer to the new server, NULL in case of error.
+ */
+bench_server_t *
+bench_server_create(event_loop_t *loop);
+
+void
+bench_server_destroy(bench_server_t *server);
+
+// "coap://127.0.0.1:<port>", valid as long as the server
+const char *
+bench_server_uri(const bench_server_t *server);
+
+// blob served with Block2 at coap://127.0.0.1:<port>/<path>, not copied
+void
+bench_server_set_download(bench_server_t *server,
+                          const char     *path,
+                          const void     *data,
+                          size_t         size);
+
+const bench_server_stats_t *
+bench_server_stats(const bench_server_t *server);
+
+/**
+ * @brief Run the event loop until the condition holds
+ *
+ * @return 0 when the condition holds, -1 on timeout.
+ */
+int
+bench_server_wait(bench_server_t    *server,
+                  bench_condition_t *condition,
+                  void              *arg,
+                  int               timeout_ms);
+
+/**
+ * @brief Send a confirmable request to the registered client and wait for
+ *        its response
+ *
+ * @param code            COAP_GET, COAP_PUT, ...
+ * @param path            Path without leading slash, e.g. "33204/0/5500"
+ * @param content_format  COAP_FORMAT_* of the payload
+ *
+ * @return 0 when a response arrived, -1 on timeout or send error.
+ */
+int
+bench_server_request(bench_server_t   *server,
+                     uint8_t          code,
+                     const char       *path,
+                     int              content_format,
+                     const void       *payload,
+                     size_t           payload_length,
+                     bench_response_t *out_response,
+                     int              timeout_ms);
+
+/**
+ * @brief Observe path of the registered client
+ *
+ * Notifications are counted in bench_server_stats().
+ *
+ * @return 0 when the observation is established, -1 otherwise.
+ */
+int
+bench_server_observe(bench_server_t *server, const char *path, int timeout_ms);
+
+// client connected to the stand-in, objects installed as by toyota_client.c
+typedef struct {
+    anjay_t                 *anjay;
+    event_loop_endpoint_t   *endpoint;
+    humidity_object_t       *humidity;
+    headlights_object_t     *headlights;
+    firmware_update_logic_t firmware_update;
+    bool                    has_firmware_update;
+} bench_client_t;
+
+/**
+ * @brief Create client registering to the stand-in with NoSec security
+ *
+ * @param instances         Instances of humidity and headlights objects
+ * @param fw_state_path     Firmware update persistence file, NULL to skip
+ *                          the firmware update object
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int
+bench_client_create(bench_client_t *client,
+                    bench_server_t *server,
+                    event_loop_t   *loop,
+                    const char     *endpoint_name,
+                    size_t         instances,
+                    const char     *fw_state_path);
+
+// wait until the Register exchange of the client has completed
+int
+bench_client_wait_registered(bench_client_t *client,
+                             bench_server_t *server,
+                             int            timeout_ms);
+
+void
+bench_client_destroy(bench_client_t *client, event_loop_t *loop);
+
+#endif // TOYOTA_BENCH_SERVER
@@ -1 +1,553 @@
+#define _POSIX_C_SOURCE 200809L
 #include "file_parser.h"
+#include "../SDK/include/toyota_client.h"
+
+#include <avsystem/commons/defs.h>
+#include <avsystem/commons/log.h>
+#include <avsystem/commons/memory.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define config_log(level, ...) avs_log(toyota_config, level, __VA_ARGS__)
+
+#define ENDPOINTS_INITIAL_CAPACITY 1024
+#define WATCH_BUFFER_SIZE          4096
+
+typedef enum {
+    SECTION_NONE,
+    SECTION_CLIENT,
+    SECTION_FLEET,
+    SECTION_ENDPOINTS,
+    SECTION_METRICS
+} config_section_t;
+
+typedef enum {
+    VALUE_STRING,
+    VALUE_INT,
+    VALUE_SIZE,
+    VALUE_BOOL
+} config_value_type_t;
+
+typedef struct {
+    config_section_t section;
+    const char *key;
+    config_value_type_t type;
+    size_t offset;          // of the field in config_t
+} config_key_t;
+
+static const config_key_t CONFIG_KEYS[] = {
+    { SECTION_CLIENT,  "endpoint_name",          VALUE_STRING, offsetof(config_t, endpoint_name) },
+    { SECTION_CLIENT,  "server_uri",             VALUE_STRING, offsetof(config_t, server_uri) },
+    { SECTION_CLIENT,  "binding",                VALUE_STRING, offsetof(config_t, binding_mode) },
+    { SECTION_CLIENT,  "lifetime",               VALUE_INT,    offsetof(config_t, lifetime) },
+    { SECTION_CLIENT,  "bootstrap",              VALUE_BOOL,   offsetof(config_t, bootstrap_state) },
+    { SECTION_CLIENT,  "psk_identity",           VALUE_STRING, offsetof(config_t, psk_identity) },
+    { SECTION_CLIENT,  "psk_key",                VALUE_STRING, offsetof(config_t, psk_key) },
+    { SECTION_CLIENT,  "fw_updated_marker_path", VALUE_STRING, offsetof(config_t, fw_updated_marker_path) },
+    { SECTION_CLIENT,  "humidity_sensor",        VALUE_STRING, offsetof(config_t, humidity_sensor) },
+    { SECTION_CLIENT,  "humidity_zones",         VALUE_SIZE,   offsetof(config_t, humidity_zones) },
+    { SECTION_CLIENT,  "headlight_units",        VALUE_SIZE,   offsetof(config_t, headlight_units) },
+    { SECTION_CLIENT,  "in_buffer_size",         VALUE_SIZE,   offsetof(config_t, in_buffer_size) },
+    { SECTION_CLIENT,  "out_buffer_size",        VALUE_SIZE,   offsetof(config_t, out_buffer_size) },
+    { SECTION_FLEET,   "size",                   VALUE_SIZE,   offsetof(config_t, fleet_size) },
+    { SECTION_FLEET,   "threads",                VALUE_SIZE,   offsetof(config_t, fleet_threads) },
+    { SECTION_FLEET,   "push_interval_ms",       VALUE_INT,    offsetof(config_t, push_interval_ms) },
+    { SECTION_METRICS, "dump",                   VALUE_STRING, offsetof(config_t, metrics_dump) },
+    { SECTION_METRICS, "socket",                 VALUE_STRING, offsetof(config_t, metrics_socket) },
+    { SECTION_METRICS, "interval_ms",            VALUE_INT,    offsetof(config_t, metrics_interval_ms) }
+};
+
+typedef struct {
+    const char *path;
+    size_t line;
+    config_section_t section;
+    size_t endpoint_capacity;
+} parser_t;
+
+//------------------------------------------------------------------------------
+
+static inline bool
+is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+//------------------------------------------------------------------------------
+
+// terminates the token in place, returns NULL for an empty one
+static char *
+trim(char *begin, char *end) {
+    while (begin < end && is_blank(*begin)) {
+        ++begin;
+    }
+    while (end > begin && is_blank(end[-1])) {
+        --end;
+    }
+    *end = '\0';
+    return begin < end ? begin : NULL;
+}
+
+//------------------------------------------------------------------------------
+
+// next whitespace-separated token of an endpoint line, terminated in place
+static char *
+next_token(char **cursor) {
+    char *begin = *cursor;
+    while (*begin && is_blank(*begin)) {
+        ++begin;
+    }
+    if (!*begin) {
+        *cursor = begin;
+        return NULL;
+    }
+    char *end = begin;
+    while (*end && !is_blank(*end)) {
+        ++end;
+    }
+    *cursor = *end ? end + 1 : end;
+    *end = '\0';
+    return begin;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+parse_endpoint(parser_t *parser, config_t *config, char *line) {
+    char *name = next_token(&line);
+    char *identity = next_token(&line);
+    char *key = next_token(&line);
+    if (!name || (identity && !key) || next_token(&line)) {
+        config_log(ERROR, "%s:%zu: expected: name [identity key]",
+                   parser->path, parser->line);
+        return -1;
+    }
+    if (strlen(name) >= FLEET_MAX_ENDPOINT_NAME) {
+        config_log(ERROR, "%s:%zu: endpoint name longer than %d characters",
+                   parser->path, parser->line, FLEET_MAX_ENDPOINT_NAME - 1);
+        return -1;
+    }
+
+    if (config->endpoint_count == parser->endpoint_capacity) {
+        size_t capacity = parser->endpoint_capacity
+                                  ? 2 * parser->endpoint_capacity
+                                  : ENDPOINTS_INITIAL_CAPACITY;
+        fleet_endpoint_t *endpoints = (fleet_endpoint_t *) avs_realloc(
+                config->endpoints, capacity * sizeof(fleet_endpoint_t));
+        if (!endpoints) {
+            config_log(ERROR, "Out of memory");
+            return -1;
+        }
+        config->endpoints = endpoints;
+        parser->endpoint_capacity = capacity;
+    }
+    config->endpoints[config->endpoint_count++] = (fleet_endpoint_t) {
+        .name = name,
+        .psk_identity = identity,
+        .psk_key = key
+    };
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+parse_value(parser_t *parser, config_t *config, const config_key_t *key, char *value) {
+    void *field = (char *) config + key->offset;
+    char *end = NULL;
+    errno = 0;
+    switch (key->type) {
+    case VALUE_STRING:
+        // optional quotes allow leading and trailing spaces
+        if (value[0] == '"') {
+            size_t length = strlen(value);
+            if (length < 2 || value[length - 1] != '"') {
+                break;
+            }
+            value[length - 1] = '\0';
+            ++value;
+        }
+        *(const char **) field = value;
+        return 0;
+    case VALUE_INT: {
+        long number = strtol(value, &end, 10);
+        if (errno || *end || number < 0 || number > INT_MAX) {
+            break;
+        }
+        *(int *) field = (int) number;
+        return 0;
+    }
+    case VALUE_SIZE: {
+        if (value[0] == '-') {
+            break;
+        }
+        unsigned long long number = strtoull(value, &end, 10);
+        if (errno || *end || number > SIZE_MAX) {
+            break;
+        }
+        *(size_t *) field = (size_t) number;
+        return 0;
+    }
+    case VALUE_BOOL:
+        if (!strcmp(value, "true") || !strcmp(value, "yes")
+                || !strcmp(value, "on") || !strcmp(value, "1")) {
+            *(bool *) field = true;
+            return 0;
+        }
+        if (!strcmp(value, "false") || !strcmp(value, "no")
+                || !strcmp(value, "off") || !strcmp(value, "0")) {
+            *(bool *) field = false;
+            return 0;
+        }
+        break;
+    }
+    config_log(ERROR, "%s:%zu: invalid value of %s: %s",
+               parser->path, parser->line, key->key, value);
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+parse_section(parser_t *parser, char *line) {
+    size_t length = strlen(line);
+    if (line[length - 1] != ']') {
+        config_log(ERROR, "%s:%zu: unterminated section", parser->path, parser->line);
+        return -1;
+    }
+    line[length - 1] = '\0';
+    char *name = trim(line + 1, line + length - 1);
+    if (name && !strcmp(name, "client")) {
+        parser->section = SECTION_CLIENT;
+    } else if (name && !strcmp(name, "fleet")) {
+        parser->section = SECTION_FLEET;
+    } else if (name && !strcmp(name, "endpoints")) {
+        parser->section = SECTION_ENDPOINTS;
+    } else if (name && !strcmp(name, "metrics")) {
+        parser->section = SECTION_METRICS;
+    } else {
+        config_log(ERROR, "%s:%zu: unknown section [%s]",
+                   parser->path, parser->line, name ? name : "");
+        return -1;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+parse_line(parser_t *parser, config_t *config, char *begin, char *end) {
+    char *line = trim(begin, end);
+    if (!line || line[0] == '#' || line[0] == ';') {
+        return 0;
+    }
+    if (line[0] == '[') {
+        return parse_section(parser, line);
+    }
+    if (parser->section == SECTION_ENDPOINTS) {
+        return parse_endpoint(parser, config, line);
+    }
+
+    char *equals = strchr(line, '=');
+    if (!equals) {
+        config_log(ERROR, "%s:%zu: expected key = value", parser->path, parser->line);
+        return -1;
+    }
+    char *key = trim(line, equals);
+    char *value = trim(equals + 1, equals + 1 + strlen(equals + 1));
+    if (!key || !value) {
+        config_log(ERROR, "%s:%zu: empty key or value", parser->path, parser->line);
+        return -1;
+    }
+    for (size_t i = 0; i < AVS_ARRAY_SIZE(CONFIG_KEYS); ++i) {
+        if (CONFIG_KEYS[i].section == parser->section
+                && !strcmp(CONFIG_KEYS[i].key, key)) {
+            return parse_value(parser, config, &CONFIG_KEYS[i], value);
+        }
+    }
+    config_log(ERROR, "%s:%zu: unknown key %s", parser->path, parser->line, key);
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+static uint64_t
+hash_name(const char *name) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *name; ++name) {
+        hash ^= (uint8_t) *name;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+//------------------------------------------------------------------------------
+
+// open addressing over endpoint indices, one pass over the list
+static int
+check_duplicate_endpoints(const char *path, const config_t *config) {
+    size_t slots = 1;
+    while (slots < 2 * config->endpoint_count) {
+        slots <<= 1;
+    }
+    size_t *table = (size_t *) avs_calloc(slots, sizeof(size_t));
+    if (!table) {
+        config_log(ERROR, "Out of memory");
+        return -1;
+    }
+    int result = 0;
+    for (size_t i = 0; i < config->endpoint_count && !result; ++i) {
+        const char *name = config->endpoints[i].name;
+        size_t slot = (size_t) hash_name(name) & (slots - 1);
+        // entries are index + 1, 0 marks a free slot
+        while (table[slot]) {
+            if (!strcmp(config->endpoints[table[slot] - 1].name, name)) {
+                config_log(ERROR, "%s: duplicate endpoint %s", path, name);
+                result = -1;
+                break;
+            }
+            slot = (slot + 1) & (slots - 1);
+        }
+        table[slot] = i + 1;
+    }
+    avs_free(table);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+validate(const char *path, config_t *config) {
+    const char *uri_error = config->server_uri ? remote_client_uri_error(config->server_uri)
+                                               : NULL;
+    if (uri_error) {
+        config_log(ERROR, "%s: %s", path, uri_error);
+        return -1;
+    }
+    if (config->lifetime < CONFIG_MIN_LIFETIME) {
+        config_log(ERROR, "%s: lifetime is shorter than %d s", path, CONFIG_MIN_LIFETIME);
+        return -1;
+    }
+    if (!config->psk_identity != !config->psk_key) {
+        config_log(ERROR, "%s: psk_identity and psk_key go together", path);
+        return -1;
+    }
+    if (!config->humidity_zones || config->humidity_zones > CONFIG_MAX_INSTANCES
+            || !config->headlight_units || config->headlight_units > CONFIG_MAX_INSTANCES) {
+        config_log(ERROR, "%s: humidity_zones and headlight_units must be in 1..%d",
+                   path, CONFIG_MAX_INSTANCES);
+        return -1;
+    }
+    if (!config->fleet_threads) {
+        config_log(ERROR, "%s: number of fleet threads must be positive", path);
+        return -1;
+    }
+    if (config->endpoints) {
+        if (!config->fleet_size) {
+            config->fleet_size = config->endpoint_count;
+        } else if (config->fleet_size > config->endpoint_count) {
+            config_log(ERROR, "%s: fleet size %zu, but only %zu endpoints listed",
+                       path, config->fleet_size, config->endpoint_count);
+            return -1;
+        }
+        return check_duplicate_endpoints(path, config);
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+// data gets one writable byte past the end, so the last line can be
+// terminated in place as well
+static int
+load_file(const char *path, bool use_mmap, config_t *config) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        config_log(ERROR, "Could not open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode)) {
+        config_log(ERROR, "%s is not a regular file", path);
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t) info.st_size;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    // the rest of the last page of a mapping is zeroed and private, it is
+    // the extra byte unless the file ends on a page boundary
+    if (use_mmap && size && page_size > 0 && size % (size_t) page_size) {
+        void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            (void) posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+            close(fd);
+            config->data = (char *) data;
+            config->data_size = size;
+            config->data_mapped = true;
+            return 0;
+        }
+    }
+
+    char *data = (char *) avs_malloc(size + 1);
+    size_t done = 0;
+    while (data && done < size) {
+        ssize_t result = read(fd, data + done, size - done);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            config_log(ERROR, "Could not read %s", path);
+            avs_free(data);
+            close(fd);
+            return -1;
+        }
+        done += (size_t) result;
+    }
+    close(fd);
+    if (!data) {
+        config_log(ERROR, "Out of memory");
+        return -1;
+    }
+    data[size] = '\0';
+    config->data = data;
+    config->data_size = size;
+    config->data_mapped = false;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+int
+config_load(config_t *config, const char *path, bool use_mmap) {
+    assert(config);
+    assert(path);
+    assert(!config->data && !config->endpoints);
+
+    config_t next = *config;
+    if (load_file(path, use_mmap, &next)) {
+        return -1;
+    }
+
+    parser_t parser = {
+        .path = path,
+        .section = SECTION_NONE
+    };
+    char *cursor = next.data;
+    char *end = next.data + next.data_size;
+    while (cursor < end) {
+        char *eol = (char *) memchr(cursor, '\n', (size_t) (end - cursor));
+        if (!eol) {
+            eol = end;
+        }
+        ++parser.line;
+        if (parse_line(&parser, &next, cursor, eol)) {
+            config_release(&next);
+            return -1;
+        }
+        cursor = eol + 1;
+    }
+    if (validate(path, &next)) {
+        config_release(&next);
+        return -1;
+    }
+
+    config_log(INFO, "Loaded %s: %zu endpoints listed", path, next.endpoint_count);
+    *config = next;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+config_release(config_t *config) {
+    if (!config) {
+        return;
+    }
+    if (config->data_mapped) {
+        munmap(config->data, config->data_size);
+    } else {
+        avs_free(config->data);
+    }
+    avs_free(config->endpoints);
+    config->data = NULL;
+    config->data_size = 0;
+    config->data_mapped = false;
+    config->endpoints = NULL;
+    config->endpoint_count = 0;
+}
+
+//------------------------------------------------------------------------------
+
+static const char *
+file_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+//------------------------------------------------------------------------------
+
+int
+config_watch_open(const char *path) {
+    assert(path);
+
+    // editors replace files by renaming a new one over them, which a watch
+    // of the file itself would not see - watch the directory instead
+    const char *name = file_name(path);
+    size_t dir_length = (size_t) (name - path);
+    char *dir = (char *) avs_malloc(dir_length + 2);
+    if (!dir) {
+        config_log(ERROR, "Out of memory");
+        return -1;
+    }
+    if (dir_length) {
+        memcpy(dir, path, dir_length);
+        dir[dir_length] = '\0';
+    } else {
+        strcpy(dir, ".");
+    }
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        config_log(WARNING, "Could not watch %s: %s", dir, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        fd = -1;
+    }
+    avs_free(dir);
+    return fd;
+}
+
+//------------------------------------------------------------------------------
+
+bool
+config_watch_changed(int fd, const char *path) {
+    assert(path);
+
+    const char *name = file_name(path);
+    bool changed = false;
+    char buffer[WATCH_BUFFER_SIZE]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    // drain all pending events, several writes end up in one reload
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char *cursor = buffer; cursor < buffer + length;) {
+            const struct inotify_event *event = (const struct inotify_event *) cursor;
+            if (event->len && !strcmp(event->name, name)) {
+                changed = true;
+            }
+            cursor += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
@@ -1,21 +1,116 @@
 #ifndef FILE_PARSER_H
 #define FILE_PARSER_H
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-#endif // FILE_PARSER_H
\ No newline at end of file
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "../SDK/include/toyota_fleet.h"
+
+#define CONFIG_MIN_LIFETIME     60      // shortest accepted registration lifetime, in seconds
+#define CONFIG_MAX_INSTANCES    4096    // most humidity zones or headlight units
+
+/*
+ * Client configuration, one INI-like file:
+ *
+ *   # comment
+ *   [client]
+ *   endpoint_name = RPI_3B+
+ *   # coap:// or coaps://, CoAP over TCP is rejected
+ *   server_uri    = coaps://127.0.0.1:5684
+ *   lifetime      = 86400
+ *   psk_identity  = vehicle-1
+ *   psk_key       = secret
+ *
+ *   [fleet]
+ *   threads       = 8
+ *
+ *   [metrics]
+ *   socket        = /run/toyota/metrics.sock
+ *
+ *   [endpoints]
+ *   # name identity key, one endpoint per line
+ *   vehicle-000001 identity-000001 key-000001
+ *
+ * Strings point into the loaded file and stay valid until config_release().
+ */
+typedef struct {
+    // [client]
+    const char  *endpoint_name;
+    const char  *server_uri;
+    const char  *binding_mode;          // key: binding, NULL - by transport
+    int         lifetime;
+    bool        bootstrap_state;        // key: bootstrap
+    const char  *psk_identity;          // NULL - built-in default
+    const char  *psk_key;               // NULL - built-in default
+    const char  *fw_updated_marker_path;
+    const char  *humidity_sensor;       // NULL - simulated humidity
+    size_t      humidity_zones;
+    size_t      headlight_units;
+    size_t      in_buffer_size;         // 0 - default of the transport
+    size_t      out_buffer_size;        // 0 - default of the transport
+
+    // [fleet]
+    size_t      fleet_size;             // key: size, 0 - single client
+    size_t      fleet_threads;          // key: threads
+    int         push_interval_ms;
+
+    // [metrics]
+    const char  *metrics_dump;          // key: dump, NULL - no dump file
+    const char  *metrics_socket;        // key: socket, NULL - no Unix socket
+    int         metrics_interval_ms;    // key: interval_ms, period of dump writes
+
+    // [endpoints]
+    fleet_endpoint_t *endpoints;        // NULL - fleet names generated from endpoint_name
+    size_t      endpoint_count;
+
+    char        *data;                  // loaded file, tokens are terminated in place
+    size_t      data_size;
+    bool        data_mapped;            // data is a private mapping of the file
+} config_t;
+
+/**
+ * @brief Load configuration file
+ *
+ * Keys present in the file override values already set in config, so the
+ * caller fills in defaults first. The file is parsed in one pass: regular
+ * files are mapped copy-on-write and tokens are terminated in place, so
+ * endpoint lists cost one array entry per endpoint and no string copies.
+ * Errors are logged with the line number.
+ *
+ * @param config   Configuration to update, released with config_release()
+ * @param path     Path of the file
+ * @param use_mmap False to read the file into memory instead of mapping it
+ *
+ * @return 0 on success, -1 in case of error (config is left unchanged).
+ */
+int
+config_load(config_t *config, const char *path, bool use_mmap);
+/**
+ * @brief Release file and endpoint list of a loaded configuration
+ */
+void
+config_release(config_t *config);
+/**
+ * @brief Watch configuration file for changes
+ *
+ * The directory of the file is watched, so files replaced by a rename are
+ * noticed as well as files written in place.
+ *
+ * @param path Path of the file
+ *
+ * @return non-blocking descriptor to poll and close(), -1 in case of error.
+ */
+int
+config_watch_open(const char *path);
+/**
+ * @brief Consume pending events of a watch
+ *
+ * @param fd   Descriptor returned by config_watch_open()
+ * @param path Path the watch was opened with
+ *
+ * @return true if the file was written or replaced since the last call.
+ */
+bool
+config_watch_changed(int fd, const char *path);
+
+#endif // FILE_PARSER_H
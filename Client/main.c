@@ -1,6 +1,7 @@
 #include "main.h"
 
 volatile sig_atomic_t in_while = true;
+volatile sig_atomic_t reload_requested = false;
 
 void kill_exec_signal_handlers(int signal) {
 
@@ -8,6 +9,9 @@ void kill_exec_signal_handlers(int signal) {
         avs_log(main, INFO, ANSI_COLOR_YELLOW "|| ====== || EXITING FROM THE PROCESS OF REMOTE CONTROLLER || ====== ||" ANSI_COLOR_RESET);
         in_while = false;
     }
+    else if (signal == SIGHUP) {
+        reload_requested = true;
+    }
     else if (signal == SIGKILL) {
         avs_log(main, INFO, ANSI_COLOR_RED "|| ====== || KILL THE PROCESS OF REMOTE CONTROLLER || ====== ||" ANSI_COLOR_RESET);
         exit(0);
@@ -19,12 +23,20 @@ void print_help_info(void) {
     // array of pointers to strings of availible options
     char *availible_options[] = {
         "==========================================================================================================\n"
+        "=   Long option: '--config'        | short option: '-c'   = INI config file, later options override it;  =\n"
         "=   Long option: '--endpoint-name' | short option: '-e'   = endpoint_name;                               =\n"
         "=   Long option: '--server-uri'    | short option: '-u'   = server_uri;                                  =\n"
         "=   Long option: '--lifetime'      | short option: '-l'   = time of registration update;                 =\n"
         "=   Long option: '--bootstrap'     | short option: '-b'   = bootstrap ON/OFF;                            =\n"
+        "=   Long option: '--fleet-size'    | short option: '-n'   = number of simulated vehicles (fleet mode);   =\n"
+        "=   Long option: '--fleet-threads' | short option: '-t'   = number of fleet worker threads;              =\n"
+        "=   Long option: '--humidity-sensor' | short option: '-s' = sysfs file of humidity, %zu - zone;          =\n"
+        "=   Long option: '--metrics-dump'  | short option: '-d'   = file rewritten with metrics periodically;    =\n"
+        "=   Long option: '--metrics-socket'| short option: '-m'   = Unix socket answering with metrics;          =\n"
+        "=   Long option: '--fw-updated-marker-path' | short option: '-W' = firmware update marker file;          =\n"
+        "=                                     attributes set by servers are kept in <marker file>.attrs;         =\n"
         "==========================================================================================================\n"
-        "=   Supported security modes       : ANJAY_UDP_SECURITY_PSK                                              =\n"
+        "=   Supported security modes       : NoSec - coap://; PSK - coaps://                                     =\n"
     };
     
     // size of array of availible options
@@ -36,31 +48,47 @@ void print_help_info(void) {
 return;
 }
 
-int main(int argc, char* argv[]) {
+// defaults, overridden by --config and by options given after it
+static void init_config(config_t *config) {
 
-    signal(SIGINT, kill_exec_signal_handlers);
-    signal(SIGUSR1, kill_exec_signal_handlers);
+    *config = (config_t) {
+        .endpoint_name          = "RPI_3B+",
+        .server_uri             = "coaps://127.0.0.1:5684",
+        .lifetime               = DEFAULT_ANJAY_LIFETIME,
+        .fw_updated_marker_path = "/tmp/coros_fw-updated",
+        .humidity_zones         = HUMIDITY_SENSOR_DEFAULT_INSTANCES,
+        .headlight_units        = HEADLIGHTS_CONTROL_DEFAULT_INSTANCES,
+        .fleet_threads          = DEFAULT_FLEET_THREADS,
+        .push_interval_ms       = DEFAULT_FLEET_PUSH_INTERVAL,
+        .metrics_interval_ms    = METRICS_DEFAULT_INTERVAL,
+    };
+}
+
+static int parse_options(int argc, char* argv[], config_t *config, const char **config_path) {
+
+    init_config(config);
 
-    char  *server_uri       = "coaps://127.0.0.1:5684";
-    char  *endpoint_name    = "RPI_3B+";
-    char  *fw_marker_path   = "/tmp/coros_fw-updated";
-    bool  bootstrap_state   = false;
-    int   time_to_wait      = DEFAULT_TIME_TO_WAIT;
-    int   lifetime          = DEFAULT_ANJAY_LIFETIME;
-   
     static struct option long_options[] = {
+        { "config",                        required_argument, 0, 'c' },
         { "endpoint-name",                 required_argument, 0, 'e' },
         { "server-uri",                    required_argument, 0, 'u' },
         { "lifetime",                      required_argument, 0, 'l' },
         { "bootstrap",                     no_argument,       0, 'b' },
         { "fw-updated-marker-path",        required_argument, 0, 'W' },
+        { "fleet-size",                    required_argument, 0, 'n' },
+        { "fleet-threads",                 required_argument, 0, 't' },
+        { "humidity-sensor",               required_argument, 0, 's' },
+        { "metrics-dump",                  required_argument, 0, 'd' },
+        { "metrics-socket",                required_argument, 0, 'm' },
         { "help",                          no_argument,       0, 'h' },
         { 0, 0, 0, 0 }
     };
 
+    // getopt starts over, reloads go through the same steps as startup
+    optind = 0;
     while(true) {
     int option_index = 0;
-    int  getopt_var = getopt_long(argc, argv, "e:u:l:bw:h", long_options,
+    int  getopt_var = getopt_long(argc, argv, "c:e:u:l:bw:n:t:s:d:m:h", long_options,
                                   &option_index);
 
         if (getopt_var == -1) {
@@ -69,71 +97,352 @@ int main(int argc, char* argv[]) {
 
         switch (getopt_var) {
 
+            case 'c': {
+                if (config_path) {
+                    *config_path = optarg;
+                }
+                if (config->data) {
+                    avs_log(toyota_client, ERROR, ANSI_COLOR_RED "Only one config file is supported" ANSI_COLOR_RESET);
+                    config_release(config);
+                    return -1;
+                }
+                if (config_load(config, optarg, true)) {
+                    avs_log(toyota_client, ERROR, ANSI_COLOR_RED "Invalid config file %s" ANSI_COLOR_RESET, optarg);
+                    return -1;
+                }
+                break;
+            }
+
             case 'e': {
-                endpoint_name = optarg;
+                config->endpoint_name = optarg;
                 break;
             }
 
             case 'u': {
-                if(!strncmp(optarg, "coaps", 5)){
-                    server_uri = optarg;
+                const char *uri_error = remote_client_uri_error(optarg);
+                if(!uri_error){
+                    config->server_uri = optarg;
                     break;
                 } else {
-                    avs_log(toyota_client, ERROR, ANSI_COLOR_RED "Unknown protocol - coaps expected" ANSI_COLOR_RESET);
+                    avs_log(toyota_client, ERROR, ANSI_COLOR_RED "%s: %s" ANSI_COLOR_RESET, optarg, uri_error);
+                    config_release(config);
                     return -1;
                 }
             }
 
             case 'l': {
-                lifetime = atoi(optarg);
-                if(lifetime < 60){
+                config->lifetime = atoi(optarg);
+                if(config->lifetime < CONFIG_MIN_LIFETIME){
                     avs_log(toyota_client, ERROR, ANSI_COLOR_RED "Lifetime is too short, please check!" ANSI_COLOR_RESET);
+                    config_release(config);
                     return -1;
                 }
-                avs_log(toyota_client, ERROR, "|| ===========|| Instance lifetime is: %i %s ||===========||", lifetime, "sec.");
+                avs_log(toyota_client, ERROR, "|| ===========|| Instance lifetime is: %i %s ||===========||", config->lifetime, "sec.");
                 break;
             }
 
             case 'b': {
-                bootstrap_state = true;
+                config->bootstrap_state = true;
                 avs_log(toyota_client, INFO, ANSI_COLOR_GREEN "|======| BOOTSTRAP CONNECTION ON |======|" ANSI_COLOR_RESET);
                 break;
             }
             
             case 'w': {
-                fw_marker_path = optarg;
-                avs_log(toyota_client, INFO, ANSI_COLOR_GREEN "Firmware update marker file: %s" ANSI_COLOR_RESET, fw_marker_path);
+                config->fw_updated_marker_path = optarg;
+                avs_log(toyota_client, INFO, ANSI_COLOR_GREEN "Firmware update marker file: %s" ANSI_COLOR_RESET, config->fw_updated_marker_path);
+                break;
+            }
+
+            case 'n': {
+                int fleet_size = atoi(optarg);
+                if (fleet_size < 1
+                        || (config->endpoints && (size_t) fleet_size > config->endpoint_count)) {
+                    avs_log(toyota_client, ERROR, ANSI_COLOR_RED "Fleet size must be positive and fit the endpoint list!" ANSI_COLOR_RESET);
+                    config_release(config);
+                    return -1;
+                }
+                config->fleet_size = (size_t) fleet_size;
+                break;
+            }
+
+            case 't': {
+                int fleet_threads = atoi(optarg);
+                if (fleet_threads < 1) {
+                    avs_log(toyota_client, ERROR, ANSI_COLOR_RED "Number of fleet threads must be positive!" ANSI_COLOR_RESET);
+                    config_release(config);
+                    return -1;
+                }
+                config->fleet_threads = (size_t) fleet_threads;
+                break;
+            }
+
+            case 's': {
+                config->humidity_sensor = optarg;
+                break;
+            }
+
+            case 'd': {
+                config->metrics_dump = optarg;
+                break;
+            }
+
+            case 'm': {
+                config->metrics_socket = optarg;
                 break;
             }
 
             case 'h': {
                 print_help_info();
+                config_release(config);
                 return -1;
             }
         }
     }
-    
-    // default log level - DEBUG
-    avs_log_set_default_level(AVS_LOG_DEBUG);
-    
-    client_t *obj_client = remote_client_create(1, endpoint_name,
-                                                server_uri, "U",
-                                                lifetime,
-                                                bootstrap_state,
-                                                fw_marker_path,
-                                                (const char *const *) argv);
+
+    return 0;
+}
+
+// true once per SIGHUP or change of the config file
+static bool reload_pending(int watch_fd, const char *config_path) {
+
+    bool changed = watch_fd >= 0 && config_watch_changed(watch_fd, config_path);
+    if (reload_requested || changed) {
+        reload_requested = false;
+        return true;
+    }
+    return false;
+}
+
+static void fill_fleet_config(const config_t *client_config, fleet_config_t *config) {
+
+    *config = (fleet_config_t) {
+        .endpoint_count   = client_config->fleet_size,
+        .thread_count     = client_config->fleet_threads,
+        .endpoint_prefix  = client_config->endpoint_name,
+        .server_uri       = client_config->server_uri,
+        .binding_mode     = client_config->binding_mode,
+        .lifetime         = client_config->lifetime,
+        .bootstrap_state  = client_config->bootstrap_state,
+        .push_interval_ms = client_config->push_interval_ms,
+        .psk_identity     = client_config->psk_identity,
+        .psk_key          = client_config->psk_key,
+        .in_buffer_size   = client_config->in_buffer_size,
+        .out_buffer_size  = client_config->out_buffer_size,
+        .endpoints        = client_config->endpoints,
+    };
+}
+
+static int run_fleet(config_t *client_config, int argc, char* argv[],
+                     int watch_fd, const char *config_path) {
+
+    // per-endpoint logs would flood the output, keep only fleet statistics
+    avs_log_set_default_level(AVS_LOG_WARNING);
+    avs_log_set_level(toyota_fleet, AVS_LOG_INFO);
+
+    fleet_config_t config;
+    fill_fleet_config(client_config, &config);
+
+    fleet_t *fleet = fleet_create(&config);
+    if (!fleet) {
+        avs_log(toyota_client, ERROR, ANSI_COLOR_RED "failed to create fleet." ANSI_COLOR_RESET);
+        return -1;
+    }
+
+    while (in_while) {
+        // SIGHUP cuts the sleep short
+        sleep(FLEET_STATS_INTERVAL);
+        fleet_report_stats(fleet);
+
+        config_t next;
+        if (!reload_pending(watch_fd, config_path)
+                || parse_options(argc, argv, &next, NULL)) {
+            continue;
+        }
+        if (!next.fleet_size) {
+            avs_log(toyota_client, WARNING, "Fleet mode cannot be turned off by reload");
+            next.fleet_size = client_config->fleet_size;
+        }
+        fill_fleet_config(&next, &config);
+        if (fleet_reload(fleet, &config) && config.endpoints
+                && config.endpoint_count < client_config->fleet_size) {
+            // rejected before any worker saw it, keep the running one
+            config_release(&next);
+            continue;
+        }
+        config_release(client_config);
+        *client_config = next;
+    }
+    fleet_destroy(fleet);
+
+    return 0;
+}
+
+static void fill_client_config(const config_t *config, char* argv[],
+                               client_config_t *client_config) {
+
+    *client_config = (client_config_t) {
+        .ssid                   = 1,
+        .endpoint_name          = config->endpoint_name,
+        .server_uri             = config->server_uri,
+        .binding_mode           = config->binding_mode,
+        .lifetime               = config->lifetime,
+        .bootstrap_state        = config->bootstrap_state,
+        .psk_identity           = config->psk_identity,
+        .psk_key                = config->psk_key,
+        .fw_updated_marker_path = config->fw_updated_marker_path,
+        .fw_update_args         = (const char *const *) argv,
+        .in_buffer_size         = config->in_buffer_size,
+        .out_buffer_size        = config->out_buffer_size,
+    };
+}
+
+static int start_humidity_sampling(client_t *obj_client, const config_t *config) {
+
+    // without hardware humidity is simulated, so the sampler still runs
+    sensor_driver_t *humidity_driver = NULL;
+    if (config->humidity_sensor) {
+        humidity_driver = sensor_driver_file_create(config->humidity_sensor,
+                                                    HUMIDITY_SENSOR_SCALE, 0.0f);
+    } else {
+        humidity_driver = sensor_driver_synthetic_create(&(sensor_synthetic_config_t) {
+            .base      = DEFAULT_HUMIDITY_VALUE,
+            .amplitude = 5.0f,
+            .noise     = 0.02f,
+            .stable_ms = 60000,
+            .moving_ms = 20000,
+            .seed      = (unsigned) getpid()
+        });
+    }
+    if (!humidity_driver
+            || toyota_client_set_humidity_driver(obj_client, humidity_driver, NULL)) {
+        avs_log(toyota_client, ERROR, ANSI_COLOR_RED "failed to start humidity sampling." ANSI_COLOR_RESET);
+        return -1;
+    }
+    return 0;
+}
+
+static client_t *create_client(const config_t *config, char* argv[]) {
+
+    client_config_t client_config;
+    fill_client_config(config, argv, &client_config);
+    client_t *obj_client = remote_client_create_with_config(NULL, &client_config);
     if (!obj_client) {
         avs_log(toyota_client, ERROR, ANSI_COLOR_RED "failed to create client." ANSI_COLOR_RESET);
-        return -1;
+        return NULL;
+    }
+    if (toyota_client_set_instance_count(obj_client, config->humidity_zones,
+                                         config->headlight_units)) {
+        avs_log(toyota_client, ERROR, ANSI_COLOR_RED "failed to create object instances." ANSI_COLOR_RESET);
+        client_destroy(obj_client);
+        return NULL;
+    }
+    if (start_humidity_sampling(obj_client, config)) {
+        client_destroy(obj_client);
+        return NULL;
     }
 
     toyota_client_push_headlights_control(obj_client, true, 75);
-    toyota_client_push_humidity(obj_client, 77.19, false);
+    return obj_client;
+}
+
+// applies next to the running client, returns the client to run from now on
+static client_t *reload_client(client_t *obj_client, const config_t *config,
+                               const config_t *next, char* argv[]) {
+
+    client_config_t client_config;
+    fill_client_config(next, argv, &client_config);
+    int result = remote_client_reconfigure(obj_client, &client_config);
+    if (result == CLIENT_RECONFIGURE_RECREATE) {
+        // new identity, the old client stays up until the new one exists
+        client_t *new_client = create_client(next, argv);
+        if (!new_client) {
+            return obj_client;
+        }
+        avs_log(toyota_client, INFO, "Client recreated as %s", next->endpoint_name);
+        client_destroy(obj_client);
+        return new_client;
+    }
+    if (result < 0) {
+        avs_log(toyota_client, ERROR, ANSI_COLOR_RED "failed to apply server settings." ANSI_COLOR_RESET);
+    }
+
+    if (toyota_client_set_instance_count(obj_client, next->humidity_zones,
+                                         next->headlight_units)) {
+        avs_log(toyota_client, ERROR, ANSI_COLOR_RED "failed to change object instances." ANSI_COLOR_RESET);
+    }
+    bool sensor_changed = !config->humidity_sensor != !next->humidity_sensor
+            || (config->humidity_sensor
+                && strcmp(config->humidity_sensor, next->humidity_sensor));
+    if (sensor_changed) {
+        (void) start_humidity_sampling(obj_client, next);
+    }
+    return obj_client;
+}
+
+static int run_client(config_t *config, int argc, char* argv[], int time_to_wait,
+                      int watch_fd, const char *config_path) {
+
+    // default log level - DEBUG
+    avs_log_set_default_level(AVS_LOG_DEBUG);
+
+    client_t *obj_client = create_client(config, argv);
+    if (!obj_client) {
+        return -1;
+    }
 
     while (in_while) {
            remote_client_poll_sockets(obj_client, MIN(time_to_wait/1000, MAX_WAIT_TIME));
+
+           config_t next;
+           if (!reload_pending(watch_fd, config_path)
+                   || parse_options(argc, argv, &next, NULL)) {
+               continue;
+           }
+           if (next.fleet_size) {
+               avs_log(toyota_client, WARNING, "Fleet mode cannot be turned on by reload");
+           }
+           obj_client = reload_client(obj_client, config, &next, argv);
+           // the client keeps copies of everything it needs
+           config_release(config);
+           *config = next;
     }
     client_destroy(obj_client);
 
     return 0;
 }
+
+int main(int argc, char* argv[]) {
+
+    signal(SIGINT, kill_exec_signal_handlers);
+    signal(SIGUSR1, kill_exec_signal_handlers);
+    signal(SIGHUP, kill_exec_signal_handlers);
+
+    config_t config;
+    const char *config_path = NULL;
+    if (parse_options(argc, argv, &config, &config_path)) {
+        return -1;
+    }
+    int time_to_wait = DEFAULT_TIME_TO_WAIT;
+
+    // exporter keeps its paths, reloads do not move it
+    metrics_exporter_t *exporter = NULL;
+    if ((config.metrics_dump || config.metrics_socket)
+            && !(exporter = metrics_exporter_start(config.metrics_dump,
+                                                   config.metrics_socket,
+                                                   config.metrics_interval_ms))) {
+        avs_log(toyota_client, ERROR, ANSI_COLOR_RED "failed to start metrics export." ANSI_COLOR_RESET);
+        config_release(&config);
+        return -1;
+    }
+
+    int watch_fd = config_path ? config_watch_open(config_path) : -1;
+    int result = config.fleet_size > 0
+            ? run_fleet(&config, argc, argv, watch_fd, config_path)
+            : run_client(&config, argc, argv, time_to_wait, watch_fd, config_path);
+    if (watch_fd >= 0) {
+        close(watch_fd);
+    }
+    metrics_exporter_stop(exporter);
+    config_release(&config);
+    return result;
+}
@@ -17,6 +17,8 @@
 
 #include "../SDK/include/toyota_client.h"
 #include "../SDK/include/toyota_utils.h"
+#include "../SDK/include/toyota_fleet.h"
+#include "../SDK/include/toyota_metrics.h"
 #include "../SDK/include/Main_Objects/humidity.h"
 #include "../SDK/include/Main_Objects/headlights_control.h"
 #include "file_parser.h"
@@ -25,6 +27,11 @@ char **saved_argv;
 #define DEFAULT_ANJAY_LIFETIME 86400   // default time of registration update
 #define DEFAULT_TIME_TO_WAIT   5000000 // default time to wait in microseconds
 #define MAX_WAIT_TIME          1000    // max wait time for anjay scheduler
+#define DEFAULT_FLEET_THREADS  4       // default number of fleet worker threads
+#define DEFAULT_FLEET_PUSH_INTERVAL 10000 // period of simulated pushes in fleet mode, in milliseconds
+#define FLEET_STATS_INTERVAL   5       // period of fleet statistics report, in seconds
+#define DEFAULT_HUMIDITY_VALUE 77.19   // base of simulated humidity without --humidity-sensor
+#define HUMIDITY_SENSOR_SCALE  0.001   // IIO humidity attributes are in milli-percents
 #define MIN(a,b) (((a)<(b))?(a):(b))
 
 #endif // MAIN_H
@@ -0,0 +1,200 @@
+# Generate resource table of an LwM2M object from its XML definition.
+#
+#   cmake -DXML=xmls/33204.xml -DOUTPUT_DIR=generated -P object_schema.cmake
+#
+# Writes object_<oid>_schema.h and object_<oid>_schema.c, see SDK/include/toyota_object.h.
+# Writable single-instance Float/Integer/Boolean resources get a slot in the
+# object_<oid>_values_t struct, RangeEnumeration "min..max" is used for validation.
+
+cmake_minimum_required(VERSION 3.5)
+
+if(NOT XML OR NOT OUTPUT_DIR)
+    message(FATAL_ERROR "usage: cmake -DXML=<object.xml> -DOUTPUT_DIR=<dir> -P object_schema.cmake")
+endif()
+
+file(READ "${XML}" content)
+# list separator must not appear in descriptions
+string(REPLACE ";" "," content "${content}")
+
+string(REGEX MATCH "<ObjectID>([0-9]+)</ObjectID>" unused "${content}")
+set(oid "${CMAKE_MATCH_1}")
+string(REGEX MATCH "<Name>([^<]*)</Name>" unused "${content}")
+set(object_name "${CMAKE_MATCH_1}")
+if(NOT oid)
+    message(FATAL_ERROR "${XML}: ObjectID not found")
+endif()
+
+string(REGEX MATCHALL "<Item ID=\"[0-9]+\">([^<]|<[A-Za-z0-9]+>[^<]*</[A-Za-z0-9]+>|<[A-Za-z0-9]+/>)*</Item>"
+       items "${content}")
+
+function(item_field item tag out)
+    if("${item}" MATCHES "<${tag}>([^<]*)</${tag}>")
+        string(STRIP "${CMAKE_MATCH_1}" value)
+        set(${out} "${value}" PARENT_SCOPE)
+    else()
+        set(${out} "" PARENT_SCOPE)
+    endif()
+endfunction()
+
+set(values_fields "")
+set(resources "")
+set(rids "")
+set(resource_count 0)
+set(first_rid "")
+set(last_rid "")
+set(index_of_rid "")
+
+foreach(item IN LISTS items)
+    string(REGEX MATCH "<Item ID=\"([0-9]+)\">" unused "${item}")
+    set(rid "${CMAKE_MATCH_1}")
+    item_field("${item}" Name name)
+    item_field("${item}" Operations operations)
+    item_field("${item}" MultipleInstances instances)
+    item_field("${item}" Type type)
+    item_field("${item}" RangeEnumeration range)
+
+    if(NOT "${last_rid}" STREQUAL "" AND NOT rid GREATER last_rid)
+        message(FATAL_ERROR "${XML}: resources must be sorted by ID (${rid} after ${last_rid})")
+    endif()
+    if("${first_rid}" STREQUAL "")
+        set(first_rid ${rid})
+    endif()
+    set(last_rid ${rid})
+
+    set(ops "0")
+    if(operations MATCHES "R")
+        set(ops "${ops} | OBJECT_OP_READ")
+    endif()
+    if(operations MATCHES "W")
+        set(ops "${ops} | OBJECT_OP_WRITE")
+    endif()
+    if(operations MATCHES "E")
+        set(ops "${ops} | OBJECT_OP_EXECUTE")
+    endif()
+    string(REGEX REPLACE "^0 \\| " "" ops "${ops}")
+
+    string(TOUPPER "${type}" type_upper)
+    if(type_upper STREQUAL "")
+        set(type_upper "NONE")
+    elseif(NOT type_upper MATCHES "^(FLOAT|INTEGER|BOOLEAN|STRING|OPAQUE|TIME)$")
+        message(FATAL_ERROR "${XML}: resource ${rid} has unsupported type ${type}")
+    endif()
+
+    set(multiple "false")
+    if(instances STREQUAL "Multiple")
+        set(multiple "true")
+    endif()
+
+    set(has_range "false")
+    set(min "0")
+    set(max "0")
+    if(range MATCHES "^(-?[0-9.]+) *\\.\\. *(-?[0-9.]+)$")
+        set(has_range "true")
+        set(min "${CMAKE_MATCH_1}")
+        set(max "${CMAKE_MATCH_2}")
+    elseif(range MATCHES "^([0-9.]+) *- *([0-9.]+)$")
+        set(has_range "true")
+        set(min "${CMAKE_MATCH_1}")
+        set(max "${CMAKE_MATCH_2}")
+    endif()
+
+    # C identifier from resource name, e.g. "Sensor Value" -> sensor_value
+    string(TOLOWER "${name}" field)
+    string(REGEX REPLACE "[^a-z0-9]+" "_" field "${field}")
+    string(REGEX REPLACE "^_+|_+$" "" field "${field}")
+
+    set(offset "OBJECT_SCHEMA_NOT_STORED")
+    if(operations MATCHES "W" AND NOT multiple AND type_upper MATCHES "^(FLOAT|INTEGER|BOOLEAN)$")
+        if(type_upper STREQUAL "FLOAT")
+            set(c_type "float")
+        elseif(type_upper STREQUAL "INTEGER")
+            set(c_type "int64_t")
+        else()
+            set(c_type "bool")
+        endif()
+        string(APPEND values_fields "    ${c_type} ${field}; // ${rid} ${name}\n")
+        set(offset "offsetof(object_${oid}_values_t, ${field})")
+    endif()
+
+    string(APPEND resources "    { ${rid}, OBJECT_RES_${type_upper}, ${ops}, ${multiple}, ${has_range}, ${offset}, ${min}, ${max} },\n")
+    list(APPEND rids ${rid})
+    set(index_${rid} ${resource_count})
+    math(EXPR resource_count "${resource_count} + 1")
+endforeach()
+
+if(resource_count EQUAL 0)
+    message(FATAL_ERROR "${XML}: no resources found")
+endif()
+if(resource_count GREATER 255)
+    message(FATAL_ERROR "${XML}: too many resources")
+endif()
+math(EXPR index_size "${last_rid} - ${first_rid} + 1")
+if(index_size GREATER 4096)
+    message(FATAL_ERROR "${XML}: resource IDs ${first_rid}..${last_rid} are too sparse for an index table")
+endif()
+
+# rid - first_rid -> position in resources table + 1, zero for unknown rids
+set(index "")
+foreach(rid IN LISTS rids)
+    math(EXPR slot "${rid} - ${first_rid}")
+    math(EXPR entry "${index_${rid}} + 1")
+    string(APPEND index "    [${slot}] = ${entry},\n")
+endforeach()
+
+string(REPLACE ";" ", " rid_list "${rids}")
+get_filename_component(xml_name "${XML}" NAME)
+
+set(header "// Generated from ${xml_name} by object_schema.cmake, do not edit.
+#ifndef OBJECT_${oid}_SCHEMA_H
+#define OBJECT_${oid}_SCHEMA_H
+
+#include \"toyota_object.h\"
+
+#define OBJECT_${oid}_SUPPORTED_RIDS ANJAY_DM_SUPPORTED_RIDS(${rid_list})
+
+")
+if(values_fields)
+    string(APPEND header "// resources of ${object_name} stored by the object engine
+typedef struct {
+${values_fields}} object_${oid}_values_t;
+
+")
+endif()
+string(APPEND header "extern const object_schema_t OBJECT_${oid}_SCHEMA;
+
+#endif // OBJECT_${oid}_SCHEMA_H
+")
+
+set(source "// Generated from ${xml_name} by object_schema.cmake, do not edit.
+#include \"object_${oid}_schema.h\"
+
+static const object_resource_t RESOURCES[] = {
+${resources}};
+
+static const uint8_t INDEX[${index_size}] = {
+${index}};
+
+const object_schema_t OBJECT_${oid}_SCHEMA = {
+    .oid            = ${oid},
+    .first_rid      = ${first_rid},
+    .index          = INDEX,
+    .index_size     = sizeof(INDEX) / sizeof(INDEX[0]),
+    .resources      = RESOURCES,
+    .resource_count = sizeof(RESOURCES) / sizeof(RESOURCES[0])
+};
+")
+
+# keep timestamps of unchanged files, so dependent sources are not rebuilt
+function(write_if_changed path text)
+    if(EXISTS "${path}")
+        file(READ "${path}" old_text)
+        if(old_text STREQUAL text)
+            return()
+        endif()
+    endif()
+    file(WRITE "${path}" "${text}")
+endfunction()
+
+file(MAKE_DIRECTORY "${OUTPUT_DIR}")
+write_if_changed("${OUTPUT_DIR}/object_${oid}_schema.h" "${header}")
+write_if_changed("${OUTPUT_DIR}/object_${oid}_schema.c" "${source}")
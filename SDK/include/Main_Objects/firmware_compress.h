@@ -0,0 +1,53 @@
+#ifndef FIRMWARE_COMPRESS_H
+#define FIRMWARE_COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Package payload may be a zstd or LZ4 frame, recognized by frame magic.
+// Decoders are available when the SDK is built with TOYOTA_WITH_ZSTD or
+// TOYOTA_WITH_LZ4.
+#define FW_COMPRESS_MAGIC_SIZE      4
+#define FW_COMPRESS_WINDOW_LOG_MAX  23           // zstd frames needing more than 8 MiB window are refused
+#define FW_COMPRESS_OUTPUT_SIZE     (64 * 1024)  // decompressed chunk passed to the sink
+
+typedef enum {
+    FW_COMPRESSION_NONE = 0,
+    FW_COMPRESSION_ZSTD = 1,
+    FW_COMPRESSION_LZ4  = 2
+} fw_compression_t;
+
+// receives decompressed bytes in order, returns 0 on success
+typedef int fw_decompress_sink_t(void *arg, const void *data, size_t length);
+
+typedef struct {
+    fw_compression_t type;
+    void    *context;         // ZSTD_DStream or LZ4F_dctx
+    uint8_t *output;          // FW_COMPRESS_OUTPUT_SIZE bytes
+    bool     frame_done;      // decoder reached end of frame
+    uint64_t compressed;      // bytes fed to the decoder
+    uint64_t decompressed;    // bytes passed to the sink
+    int64_t  busy_ns;         // time spent in the decoder
+} fw_decompress_t;
+
+// recognize compressed frame by its first FW_COMPRESS_MAGIC_SIZE bytes
+fw_compression_t fw_compression_detect(const uint8_t *magic);
+
+const char *fw_compression_name(fw_compression_t type);
+
+// returns anjay firmware update error when the format is not compiled in
+int fw_decompress_open(fw_decompress_t *decompress, fw_compression_t type);
+
+void fw_decompress_close(fw_decompress_t *decompress);
+
+int fw_decompress_write(fw_decompress_t *decompress,
+                        const void *data,
+                        size_t length,
+                        fw_decompress_sink_t *sink,
+                        void *sink_arg);
+
+// fails when the frame is incomplete, logs compression ratio and speed
+int fw_decompress_finish(fw_decompress_t *decompress);
+
+#endif // FIRMWARE_COMPRESS_H
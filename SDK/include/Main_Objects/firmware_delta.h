@@ -0,0 +1,67 @@
+#ifndef FIRMWARE_DELTA_H
+#define FIRMWARE_DELTA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Delta payload (all integers big-endian):
+//   preamble: magic "TYDL", base image size (u64), CRC32C of base image (u32)
+//   records:  COPY   op, base offset (u64), length (u32)
+//             ADD    op, base offset (u64), length (u32), length bytes added
+//                    to base bytes modulo 256
+//             INSERT op, length (u32), length literal bytes
+// Records are applied in order and produce the new image sequentially, so
+// neither image has to be held in memory.
+#define FW_DELTA_MAGIC              "TYDL"
+#define FW_DELTA_MAGIC_SIZE         4
+#define FW_DELTA_PREAMBLE_SIZE      16
+#define FW_DELTA_RECORD_HEADER_MAX  13
+#define FW_DELTA_BUFFER_SIZE        (64 * 1024)  // base read window
+
+typedef enum {
+    FW_DELTA_COPY   = 1,
+    FW_DELTA_ADD    = 2,
+    FW_DELTA_INSERT = 3
+} fw_delta_op_t;
+
+// receives reconstructed image bytes in order, returns 0 on success
+typedef int fw_delta_sink_t(void *arg, const void *data, size_t length);
+
+typedef struct {
+    int      base_fd;          // base image, read with pread
+    bool     base_open;
+    uint8_t *buffer;           // FW_DELTA_BUFFER_SIZE window of base data
+    uint8_t  pending[FW_DELTA_PREAMBLE_SIZE]; // preamble or record header being received
+    size_t   pending_size;
+    bool     preamble_done;
+    uint8_t  op;               // record being applied, 0 between records
+    uint64_t base_offset;      // base position of the current record
+    uint32_t remaining;        // bytes of current record still to produce
+    uint64_t base_size;
+} fw_delta_t;
+
+// open base image and allocate the read window
+int fw_delta_open(fw_delta_t *delta, const char *base_path);
+
+void fw_delta_close(fw_delta_t *delta);
+
+// apply delta bytes as they arrive, returns anjay firmware update error on failure
+int fw_delta_write(fw_delta_t *delta,
+                   const void *data,
+                   size_t length,
+                   fw_delta_sink_t *sink,
+                   void *sink_arg);
+
+// fails when the delta ends inside a record
+int fw_delta_finish(const fw_delta_t *delta);
+
+// encode delta of image against base, used by packaging tools
+int fw_delta_encode(const uint8_t *base,
+                    size_t base_size,
+                    const uint8_t *image,
+                    size_t image_size,
+                    fw_delta_sink_t *sink,
+                    void *sink_arg);
+
+#endif // FIRMWARE_DELTA_H
@@ -0,0 +1,96 @@
+#ifndef FIRMWARE_PACKAGE_H
+#define FIRMWARE_PACKAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <avsystem/commons/persistence.h>
+
+#include "../toyota_hash.h"
+#include "firmware_compress.h"
+#include "firmware_delta.h"
+
+// Package layout (all integers big-endian):
+//   0  magic "TYFW"
+//   4  format version
+//   5  digest type (fw_digest_type_t)
+//   6  flags (FW_PACKAGE_FLAG_*)
+//   8  image size
+//   16 digest of the image (CRC32C uses the first 4 bytes)
+//   48 payload: image, or delta against the running image (firmware_delta.h),
+//      optionally compressed as one zstd or LZ4 frame (firmware_compress.h)
+// Data not starting with the magic is accepted as a raw legacy image.
+// Size and digest always describe the resulting image.
+#define FW_PACKAGE_MAGIC        "TYFW"
+#define FW_PACKAGE_MAGIC_SIZE   4
+#define FW_PACKAGE_VERSION      1
+#define FW_PACKAGE_HEADER_SIZE  48
+
+#define FW_PACKAGE_FLAG_DELTA   0x0001  // payload is a delta against the running image
+
+typedef enum {
+    FW_DIGEST_NONE   = 0,
+    FW_DIGEST_CRC32C = 1,
+    FW_DIGEST_SHA256 = 2
+} fw_digest_type_t;
+
+// receives image bytes in order, returns 0 on success
+typedef int fw_package_sink_t(void *arg, const void *data, size_t length);
+
+typedef struct {
+    uint8_t          header[FW_PACKAGE_HEADER_SIZE]; // header bytes received so far
+    size_t           header_received;
+    bool             header_done;      // header parsed or package is a legacy image
+    bool             legacy;           // raw image without header, not verified
+    fw_digest_type_t digest_type;
+    uint16_t         flags;
+    uint8_t          expected_digest[SHA256_DIGEST_SIZE];
+    uint64_t         image_size;       // image size declared in header
+    uint64_t         payload_received; // package bytes after the header
+    uint8_t          payload_magic[FW_COMPRESS_MAGIC_SIZE]; // start of payload, selects decoder
+    size_t           magic_received;
+    bool             payload_detected; // payload format is known
+    uint64_t         image_received;   // image bytes passed to the sink
+    uint32_t         crc;              // running CRC32C of the image, kept for every package
+    sha256_ctx_t     sha;              // running SHA-256 of the image
+    const char      *delta_base;       // image delta payloads are applied to
+    fw_delta_t       delta;            // open while a delta payload is applied
+    fw_decompress_t  decompress;       // open while a compressed payload is decoded
+} fw_package_t;
+
+// delta_base may be NULL when delta packages are not accepted
+void fw_package_reset(fw_package_t *package, const char *delta_base);
+
+// release delta resources, the package has to be reset before next use
+void fw_package_release(fw_package_t *package);
+
+// delta and compressed packages cannot be resumed, decoder state is not persisted
+bool fw_package_resumable(const fw_package_t *package);
+
+// parse package bytes as they arrive, hash the image and pass it to the sink
+int fw_package_write(fw_package_t *package,
+                     const void *data,
+                     size_t length,
+                     fw_package_sink_t *sink,
+                     void *sink_arg);
+
+// returns 0 when the image matches its digest, anjay firmware update error otherwise
+int fw_package_finish(fw_package_t *package,
+                      fw_package_sink_t *sink,
+                      void *sink_arg);
+
+// number of package bytes consumed so far, download resume offset
+uint64_t fw_package_offset(const fw_package_t *package);
+
+// store or restore parser state, so a download can be resumed after restart
+int fw_package_persistence(avs_persistence_context_t *ctx, fw_package_t *package);
+
+// build package header, used by packaging tools
+void fw_package_encode_header(uint8_t out[FW_PACKAGE_HEADER_SIZE],
+                              fw_digest_type_t digest_type,
+                              uint16_t flags,
+                              uint64_t image_size,
+                              const uint8_t *digest);
+
+#endif // FIRMWARE_PACKAGE_H
@@ -1,20 +1,38 @@
 #ifndef FIRMWARE_UPDATE_H
 #define FIRMWARE_UPDATE_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 
 #include <anjay/fw_update.h>
 #include <anjay/download.h>
 
+#include "firmware_package.h"
+
+// called before the process is replaced by the upgraded image
+typedef void firmware_update_restart_handler_t(void *arg);
+
 typedef struct {
     char *administratively_set_target_path;
     char *next_target_path;
     char *package_uri;
     char *persistence_file;
-    FILE *firmware_update_stream;
+    int firmware_update_fd;       // target file descriptor, -1 when no download in progress
+    size_t write_offset;          // number of image bytes written to the target
+    size_t preallocated_size;     // target space reserved ahead of write_offset
+    bool preallocation_supported; // filesystem supports fallocate()
+    fw_package_t package;         // package parser, verifies the image while it streams
+    char *delta_base_path;        // base of delta packages, NULL for the running binary
+    char *checkpoint_file;        // download checkpoint, next to the persistence file
+    size_t checkpoint_interval;   // image bytes between durable checkpoints, 0 disables resume
+    size_t checkpoint_offset;     // image bytes covered by the last checkpoint
     char **startup_args;
+    firmware_update_restart_handler_t *restart_handler; // NULL - none
+    void *restart_handler_arg;
     avs_net_security_info_t security_info;
+    avs_coap_tx_params_t tx_params;
+    anjay_fw_update_handlers_t handlers;
 } firmware_update_logic_t;
 
 int firmware_update_install(anjay_t *anjay,
@@ -26,8 +44,23 @@ int firmware_update_install(anjay_t *anjay,
 
 void firmware_update_destroy(firmware_update_logic_t *fw_update);
 
+// image bytes written between checkpoints; one fdatasync is issued per
+// checkpoint, 0 disables checkpoints and interrupted downloads restart
+void firmware_update_set_checkpoint_interval(firmware_update_logic_t *fw_update,
+                                             size_t interval);
+
+// image delta packages are applied to, the running binary by default
+void firmware_update_set_delta_base(firmware_update_logic_t *fw_update,
+                                    const char *file_path);
+
 void firmware_update_set_package_path(firmware_update_logic_t *fw_update,
                                       const char *file_path);
 
+// lets the client persist its state right before execv() of the new image,
+// the handler runs inside the perform_upgrade handler of anjay
+void firmware_update_set_restart_handler(firmware_update_logic_t *fw_update,
+                                         firmware_update_restart_handler_t *handler,
+                                         void *arg);
+
 
 #endif // FIRMWARE_UPDATE_H
@@ -14,6 +14,8 @@
 #include <stdio.h>
 
 #include "../toyota_utils.h"
+#include "../toyota_notify.h"
+#include "../toyota_actuator.h"
 
 #define HEADLIGHTS_CONTROL_OBJECT_ID  33205 // heghlights control object id
 
@@ -21,15 +23,54 @@
 #define HEADLIGHTS_CONTROL_BRIGHTNESS 5504  // heghlights control bright level
 #define HEADLIGHTS_CONTROL_TIME_STAMP 5505  // time of last change of control state
 
-void
-headlights_control_init_object(anjay_t * anjay);
+#define HEADLIGHTS_CONTROL_DEFAULT_INSTANCES 1    // headlight units of a client
+#define HEADLIGHTS_CONTROL_MAX_INSTANCES     4096 // instance IDs are 0..count-1
 
-void
+typedef struct headlights_object headlights_object_t;
+
+// one instance per headlight unit, instance IDs are 0..instance_count-1
+headlights_object_t *
+headlights_control_init_object(anjay_t * anjay,
+                               event_loop_t *event_loop,
+                               size_t instance_count);
+
+// values of remaining instances are kept, new ones start with defaults
+int
+headlights_control_set_instance_count(headlights_object_t *object, size_t count);
+
+size_t
+headlights_control_instance_count(const headlights_object_t *object);
+
+// returns number of resources reported as changed, -1 for unknown instance
+int
 headlights_control_set_data(anjay_t * anjay,
+                            headlights_object_t *object,
+                            anjay_iid_t iid,
                             bool control_state,
                             int64_t brightness);
 
+// returns 0 on success, -1 for unknown instance
+int
+headlights_control_get_data(const headlights_object_t *object,
+                            anjay_iid_t iid,
+                            bool *out_control_state,
+                            int64_t *out_brightness);
+
+// 0 - notify on every push, otherwise changes are batched within the window
+void
+headlights_control_set_notify_window(headlights_object_t *object, int window_ms);
+
+// values written by the server are applied through the actuator, instance N
+// drives unit N; NULL detaches it, the actuator must outlive the object
+void
+headlights_control_set_actuator(headlights_object_t *object, actuator_t *actuator);
+
+// summed counters of all instances
+void
+headlights_control_notify_stats(const headlights_object_t *object,
+                                notify_stats_t *out_stats);
+
 void
-headlights_control_object_release(anjay_t *anjay);
+headlights_control_object_release(anjay_t *anjay, headlights_object_t *object);
 
 #endif // HEADLIGHTS_CONTROL_H
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <avsystem/commons/log.h>
 #include <avsystem/commons/time.h>
 #include <avsystem/commons/memory.h>
+#include <avsystem/commons/persistence.h>
 #include <avsystem/commons/vector.h>
 
 #include <time.h>
@@ -13,24 +14,95 @@
 #include <stdio.h>
 
 #include "../toyota_utils.h"
+#include "../toyota_notify.h"
+#include "../toyota_history.h"
 
-#define HUMIDITY_SENSOR_OBJECT_ID  33204  // humidity sensor object id
+#define HUMIDITY_SENSOR_OBJECT_ID     33204  // humidity sensor object id
 
-#define HUMIDITY_SENSOR_VALUE      5500   // last or current measured value fron the sensor
-#define HUMIDITY_SENSOR_STATE      5501   // remote control state of the sensor (ON/OFF)
-#define HUMIDITY_SENSOR_TIME_STAMP 5502   // time of last change of humidity sensor value
+#define HUMIDITY_SENSOR_VALUE         5500   // last or current measured value fron the sensor
+#define HUMIDITY_SENSOR_STATE         5501   // remote control state of the sensor (ON/OFF)
+#define HUMIDITY_SENSOR_TIME_STAMP    5502   // time of last change of humidity sensor value
+#define HUMIDITY_SENSOR_MEAN_VALUE    5506   // mean of values measured since the last reset
+#define HUMIDITY_SENSOR_HISTORY       5507   // stored samples, instance id is sample sequence mod 65535
+#define HUMIDITY_SENSOR_HISTORY_TIME  5508   // time of stored samples, ms since epoch
+#define HUMIDITY_SENSOR_HISTORY_CLEAR 5509   // drop stored samples after upload
+#define HUMIDITY_SENSOR_MIN_VALUE     5601   // min value measured since the last reset
+#define HUMIDITY_SENSOR_MAX_VALUE     5602   // max value measured since the last reset
+#define HUMIDITY_SENSOR_RESET_MIN_MAX 5605   // reset min, max and mean values
 
+#define HUMIDITY_SENSOR_DEFAULT_INSTANCES 1    // humidity zones of a client
+#define HUMIDITY_SENSOR_MAX_INSTANCES     4096 // instance IDs are 0..count-1
 
-void 
-humidity_sensor_init_object(anjay_t *anjay);
+typedef struct humidity_object humidity_object_t;
 
-void
+// one instance per humidity zone, instance IDs are 0..instance_count-1
+humidity_object_t *
+humidity_sensor_init_object(anjay_t *anjay,
+                            event_loop_t *event_loop,
+                            size_t instance_count);
+
+// values of remaining instances are kept, new ones start with defaults
+int
+humidity_sensor_set_instance_count(humidity_object_t *object, size_t count);
+
+size_t
+humidity_sensor_instance_count(const humidity_object_t *object);
+
+// returns number of resources reported as changed, -1 for unknown instance
+int
 humidity_sensor_set_data(anjay_t *anjay,
+                         humidity_object_t *object,
+                         anjay_iid_t iid,
                          float humidity_value,
                          bool sensor_state);
 
+// returns 0 on success, -1 for unknown instance
+int
+humidity_sensor_get_data(const humidity_object_t *object,
+                         anjay_iid_t iid,
+                         float *out_value,
+                         bool *out_state);
+
+// effective pmin, pmax and step of the value resource: periods of the
+// resource fall back to those of the instance, the object and server_defaults
+// (default pmin and pmax of the Server object); the smallest of each over all
+// servers; unset ones are ANJAY_ATTRIB_*_NONE; -1 for unknown instance
+int
+humidity_sensor_value_attrs(const humidity_object_t *object,
+                            anjay_iid_t iid,
+                            const anjay_dm_attributes_t *server_defaults,
+                            anjay_dm_resource_attributes_t *out_attrs);
+
+// attributes written by servers, stored in an attribute state file by the client;
+// restore replaces all of them and changes nothing on error
+int
+humidity_sensor_persist_attrs(const humidity_object_t *object,
+                              avs_persistence_context_t *ctx);
+
+int
+humidity_sensor_restore_attrs(humidity_object_t *object,
+                              avs_persistence_context_t *ctx);
+
+// changes of value smaller than deadband are stored but not notified
+void
+humidity_sensor_set_deadband(humidity_object_t *object, float deadband);
+
+// 0 - notify on every push, otherwise changes are batched within the window
+void
+humidity_sensor_set_notify_window(humidity_object_t *object, int window_ms);
+
+// samples pushed between server reads are kept, oldest are overwritten,
+// NULL for unknown instance
+const sample_history_t *
+humidity_sensor_history(const humidity_object_t *object, anjay_iid_t iid);
+
+// summed counters of all instances
+void
+humidity_sensor_notify_stats(const humidity_object_t *object,
+                             notify_stats_t *out_stats);
+
 void
-humidity_sensor_object_release(anjay_t *anjay);
+humidity_sensor_object_release(anjay_t *anjay, humidity_object_t *object);
 
 
 
@@ -0,0 +1,81 @@
+#ifndef SENSOR_BATCH_H
+#define SENSOR_BATCH_H
+
+#include <anjay/anjay.h>
+#include <avsystem/commons/log.h>
+#include <avsystem/commons/memory.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../toyota_utils.h"
+#include "../toyota_event_loop.h"
+#include "../toyota_senml.h"
+
+#define SENSOR_BATCH_OBJECT_ID        33206  // sensor batch object id
+
+#define SENSOR_BATCH_PAYLOAD          5510   // published batches not read yet, SenML-CBOR
+#define SENSOR_BATCH_SEQUENCE         5511   // number of published batches
+#define SENSOR_BATCH_VALUES           5512   // number of values in the last batch
+#define SENSOR_BATCH_FLUSH            5513   // publish queued values right away
+
+#define SENSOR_BATCH_CAPACITY         1024   // hard limit of payload size
+#define SENSOR_BATCH_DEFAULT_BYTES    512    // payload size that triggers publishing
+#define SENSOR_BATCH_DEFAULT_WINDOW   1000   // max age of a queued value, in milliseconds
+#define SENSOR_BATCH_QUEUE_LENGTH     8      // published batches kept until the server reads them
+
+typedef struct sensor_batch_object sensor_batch_object_t;
+
+// without event loop the window is not enforced, only size and explicit flush
+sensor_batch_object_t *
+sensor_batch_init_object(anjay_t *anjay, event_loop_t *event_loop);
+
+// queue value of resource /oid/iid/rid, returns 0 on success, -1 also when
+// the batch is full and cannot be published, see sensor_batch_flush()
+int
+sensor_batch_add_float(sensor_batch_object_t *object,
+                       anjay_oid_t oid,
+                       anjay_iid_t iid,
+                       anjay_rid_t rid,
+                       double value);
+
+int
+sensor_batch_add_int(sensor_batch_object_t *object,
+                     anjay_oid_t oid,
+                     anjay_iid_t iid,
+                     anjay_rid_t rid,
+                     int64_t value);
+
+int
+sensor_batch_add_bool(sensor_batch_object_t *object,
+                      anjay_oid_t oid,
+                      anjay_iid_t iid,
+                      anjay_rid_t rid,
+                      bool value);
+
+// publish queued values and notify observers of the payload resource,
+// returns number of published values, -1 when SENSOR_BATCH_QUEUE_LENGTH
+// batches still wait for the server; values are kept for the next flush
+int
+sensor_batch_flush(sensor_batch_object_t *object);
+
+// payload is published when it reaches max_bytes or its oldest value
+// is window_ms old, 0 - publish on every value
+void
+sensor_batch_set_limits(sensor_batch_object_t *object,
+                        size_t max_bytes,
+                        int window_ms);
+
+// one notification carries all batches waiting for the server, so they are
+// kept within the out_buffer_size of anjay; the oldest batch is always kept
+void
+sensor_batch_set_message_size(sensor_batch_object_t *object,
+                              size_t out_buffer_size);
+
+const report_stats_t *
+sensor_batch_stats(const sensor_batch_object_t *object);
+
+void
+sensor_batch_object_release(anjay_t *anjay, sensor_batch_object_t *object);
+
+#endif // SENSOR_BATCH_H
@@ -0,0 +1,127 @@
+#ifndef TOYOTA_ACTUATOR
+#define TOYOTA_ACTUATOR
+
+#include <anjay/anjay.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "toyota_histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ACTUATOR_MAX_UNITS          64  // headlight units driven by one actuator
+#define ACTUATOR_DEFAULT_INTERVAL   20  // min time between two applies of a unit, in milliseconds
+
+typedef struct actuator_backend actuator_backend_t;
+
+// Hardware access of an actuator, called from its worker thread only.
+typedef struct {
+    const char *name;
+    // drive relay and PWM of the unit, brightness in percents;
+    // returns 0 on success, -1 in case of error
+    int (*apply)(actuator_backend_t *backend,
+                 anjay_iid_t unit,
+                 bool state,
+                 int64_t brightness);
+    void (*destroy)(actuator_backend_t *backend);
+} actuator_backend_vtable_t;
+
+struct actuator_backend {
+    const actuator_backend_vtable_t *vtable;
+};
+
+typedef struct {
+    const char  *pwm_chip;      // e.g. /sys/class/pwm/pwmchip0, unit N uses channel N
+    const char  *gpio_root;     // e.g. /sys/class/gpio, NULL - no relay, PWM only
+    int         relay_gpio_base; // GPIO of relay of unit 0, unit N uses base + N
+} actuator_sysfs_config_t;
+
+/**
+ * @brief Create backend driving sysfs PWM channels and relay GPIOs
+ *
+ * Channels and GPIOs must be exported and configured as outputs. Files are
+ * opened when a unit is applied for the first time and kept open.
+ *
+ * @return new backend, NULL in case of error.
+ */
+actuator_backend_t *
+actuator_backend_sysfs_create(const actuator_sysfs_config_t *config);
+/**
+ * @brief Create backend keeping applied values in memory
+ *
+ * @param apply_delay_us Time every apply takes, emulates slow hardware
+ *
+ * @return new backend, NULL in case of error.
+ */
+actuator_backend_t *
+actuator_backend_sim_create(unsigned apply_delay_us);
+/**
+ * @brief Values applied last by a simulated backend
+ *
+ * @return number of applies of the unit.
+ */
+uint64_t
+actuator_backend_sim_get(actuator_backend_t *backend,
+                         anjay_iid_t unit,
+                         bool *out_state,
+                         int64_t *out_brightness);
+
+typedef struct {
+    uint64_t requested;     // values passed to actuator_request()
+    uint64_t coalesced;     // requests replaced by a newer value before apply
+    uint64_t applied;       // successful backend applies
+    uint64_t failed;        // failed backend applies
+    histogram_t apply_ns;   // time of backend apply calls
+    histogram_t latency_ns; // time from request of a value to its apply
+} actuator_stats_t;
+
+typedef struct actuator actuator_t;
+
+/**
+ * @brief Start worker thread applying values through the backend
+ *
+ * @param backend     Backend, owned by the actuator from now on
+ * @param interval_ms Min time between two applies of a unit, bursts within
+ *                    it are coalesced to the latest value
+ *
+ * @return new actuator, NULL in case of error (backend is destroyed).
+ */
+actuator_t *
+actuator_create(actuator_backend_t *backend, int interval_ms);
+/**
+ * @brief Request new value of a unit
+ *
+ * Never waits for hardware, the value replaces one not applied yet.
+ *
+ * @return 0 on success, -1 for unit out of range.
+ */
+int
+actuator_request(actuator_t *actuator,
+                 anjay_iid_t unit,
+                 bool state,
+                 int64_t brightness);
+/**
+ * @brief Wait until all requested values are applied
+ */
+void
+actuator_flush(actuator_t *actuator);
+/**
+ * @brief Copy counters and histograms
+ */
+void
+actuator_get_stats(actuator_t *actuator, actuator_stats_t *out_stats);
+/**
+ * @brief Stop worker, apply pending values and destroy the backend
+ */
+void
+actuator_destroy(actuator_t *actuator);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_ACTUATOR
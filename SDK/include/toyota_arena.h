@@ -0,0 +1,76 @@
+#ifndef TOYOTA_ARENA
+#define TOYOTA_ARENA
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ARENA_CHUNK_SIZE    (64 * 1024) // system allocation unit of an arena
+
+// Pool of one client's memory. Blocks up to 4 KiB are carved from 64 KiB
+// chunks into power-of-two size classes and recycled through per-class free
+// lists, larger ones come from the system heap but are still accounted.
+//
+// Built with WITH_CLIENT_ARENA, avs_malloc() and the rest of the avs
+// allocation routines take blocks from the arena entered by the calling
+// thread, or from the system heap when none is entered. Every block records
+// its owner, so it may be freed from any thread and in any arena context.
+// Without WITH_CLIENT_ARENA arenas are never used by the avs routines.
+typedef struct arena arena_t;
+
+typedef struct {
+    size_t in_use;      // bytes of live blocks, rounded up to their size class
+    size_t peak;        // highest in_use seen
+    size_t reserved;    // bytes taken from the system: chunks and large blocks
+    size_t blocks;      // live blocks
+} arena_stats_t;
+
+/**
+ * @brief True if avs allocation routines are routed through arenas
+ */
+bool
+arena_enabled(void);
+/**
+ * @brief Create an empty arena, chunks are reserved on first allocation
+ *
+ * @return new arena, NULL in case of error.
+ */
+arena_t *
+arena_create(void);
+/**
+ * @brief Destroy arena
+ *
+ * Chunks are returned to the system at once if no block is live, otherwise
+ * with the last block freed, e.g. state allocated lazily by libraries.
+ * Allocations made in a destroyed arena come from the system heap.
+ */
+void
+arena_destroy(arena_t *arena);
+/**
+ * @brief Route allocations of the calling thread to arena
+ *
+ * @param arena Arena to enter, NULL for the system heap
+ *
+ * @return arena entered before, to be passed to arena_leave().
+ */
+arena_t *
+arena_enter(arena_t *arena);
+/**
+ * @brief Return to the arena entered before arena_enter()
+ */
+void
+arena_leave(arena_t *previous);
+/**
+ * @brief Copy footprint counters
+ */
+void
+arena_get_stats(arena_t *arena, arena_stats_t *out_stats);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_ARENA
@@ -2,6 +2,12 @@
 #define TOYOTA_CLIENT
 
 #include "toyota_utils.h"
+#include "toyota_event_loop.h"
+#include "toyota_ingest.h"
+#include "toyota_notify.h"
+#include "toyota_senml.h"
+#include "toyota_actuator.h"
+#include "toyota_sampler.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -12,6 +18,50 @@ extern "C" {
 
 typedef struct client client_t;
 
+// transport selected by the scheme of the server URI
+typedef enum {
+    CLIENT_TRANSPORT_UDP,                     // coap://, NoSec
+    CLIENT_TRANSPORT_DTLS                     // coaps://, DTLS with PSK
+} client_transport_t;
+
+typedef struct {
+    uint16_t          ssid;                   // short server ID
+    const char        *endpoint_name;         // client name (Device ID)
+    const char        *server_uri;            // server URI
+    const char        *binding_mode;          // binding mode, NULL - "U"
+    int               lifetime;               // client lifetime
+    bool              bootstrap_state;        // client bootstrap on/off
+    const char        *psk_identity;          // PSK identity, NULL - built-in default
+    const char        *psk_key;               // PSK key, NULL - built-in default
+    const char        *fw_updated_marker_path; // firmware update persistence file,
+                                              // NULL to skip the firmware update object
+    const char *const *fw_update_args;        // command-line arguments to use for
+                                              // process restart after firmware installation
+    size_t            in_buffer_size;         // CoAP input buffer, 0 - transport default
+    size_t            out_buffer_size;        // CoAP output buffer, 0 - transport default
+} client_config_t;
+
+/**
+ * @brief Get transport of server URI
+ *
+ * @param server_uri        coap:// or coaps:// URI
+ * @param out_transport     Transport of the URI
+ *
+ * @return 0 on success, -1 for an unsupported scheme.
+ */
+int
+remote_client_transport(const char *server_uri, client_transport_t *out_transport);
+/**
+ * @brief Explain why server URI is not supported
+ *
+ * coap+tcp:// and coaps+tcp:// are told apart from unknown schemes, anjay 1.x
+ * has no CoAP over TCP.
+ *
+ * @return NULL for a supported URI, error message otherwise.
+ */
+const char *
+remote_client_uri_error(const char *server_uri);
+
 /**
  * @brief Create new client
  *
@@ -23,7 +73,8 @@ typedef struct client client_t;
  * @param binding_mode           Bindig mode
  * @param lifetime               Client lifetime
  * @param bootstrap_state        Client bootstrap on/off
- * @param fw_updated_marker_path Client firmware update persistence file
+ * @param fw_updated_marker_path Client firmware update persistence file,
+ *                               NULL to skip the firmware update object
  * @param fw_update_args         Command-line arguments to use for process
  *                               restart after firmware installation
  *
@@ -38,6 +89,71 @@ remote_client_create(uint16_t          ssid,
                      bool              bootstrap_state,
                      const char        *fw_updated_marker_path,
                      const char *const *fw_update_args);
+/**
+ * @brief Create new client served by a shared event loop
+ *
+ * Same as remote_client_create(), but sockets of the client are handled by
+ * the given event loop, so many clients can be multiplexed over one epoll
+ * instance. The loop must outlive the client.
+ *
+ * @param event_loop             Shared event loop, NULL to create a private one
+ *
+ * @return pointer to the new client instance, NULL in case of error.
+ */
+client_t *
+remote_client_create_in_loop(event_loop_t      *event_loop,
+                             uint16_t          ssid,
+                             const char        *endpoint_name,
+                             const char        *server_uri,
+                             const char        *binding_mode,
+                             int               lifetime,
+                             bool              bootstrap_state,
+                             const char        *fw_updated_marker_path,
+                             const char *const *fw_update_args);
+/**
+ * @brief Create new client from configuration
+ *
+ * Same as remote_client_create_in_loop(), and PSK credentials and CoAP
+ * buffer sizes can be set per client. Strings of config are copied by
+ * anjay, they do not have to outlive the client. The scheme of the server
+ * URI selects the transport: NoSec for coap://, PSK for coaps://; CoAP over
+ * TCP schemes are rejected.
+ *
+ * @param event_loop             Shared event loop, NULL to create a private one
+ * @param config                 Client configuration
+ *
+ * @return pointer to the new client instance, NULL in case of error.
+ */
+client_t *
+remote_client_create_with_config(event_loop_t          *event_loop,
+                                 const client_config_t *config);
+typedef enum {
+    CLIENT_RECONFIGURE_UNCHANGED,   // nothing to do, sessions untouched
+    CLIENT_RECONFIGURE_UPDATED,     // security and/or server instance updated in place
+    CLIENT_RECONFIGURE_RECREATE     // endpoint name, SSID, firmware marker or
+                                    // buffer sizes changed
+} client_reconfigure_result_t;
+
+/**
+ * @brief Apply new configuration to a running client
+ *
+ * The configuration is compared with the one the client runs with and
+ * only the affected Security or Server instance is replaced, under the
+ * same IID. Lifetime and binding changes are sent as Registration Update
+ * on the current session, URI and credential changes reconnect this client
+ * only. Unchanged clients are not touched at all. Buffers of anjay are
+ * sized at creation, so a change of buffer sizes, given or implied by a
+ * new transport, needs a new client.
+ *
+ * @param self              Pointer to client object
+ * @param config            New configuration, strings are copied
+ *
+ * @return client_reconfigure_result_t value, CLIENT_RECONFIGURE_RECREATE
+ *         when the change needs a new client, -1 in case of error (the
+ *         old configuration stays).
+ */
+int
+remote_client_reconfigure(client_t *self, const client_config_t *config);
 /**
  * @brief Destroy client instance
  *
@@ -50,13 +166,42 @@ client_destroy(client_t *self);
 /**
  * @brief client_poll_sockets
  *
- * Run main client loop once to process pending events.
+ * Run main client loop once to process pending events. For clients created
+ * in a shared loop this runs the whole loop.
  *
  * @param self              Pointer to client object
  * @param max_wait_time_ms  Max time to wait for IO events, in milliseconds
  */
 void 
 remote_client_poll_sockets(client_t *self, int max_wait_time_ms);
+/**
+ * @brief remote_client_has_traffic
+ *
+ * Check whether anjay of the client has served any packet from the server.
+ * This is not a successful registration: an error response to Register
+ * counts as well, anjay 1.x does not expose the registration state.
+ *
+ * @param self              Pointer to client object
+ */
+bool
+remote_client_has_traffic(const client_t *self);
+/**
+ * @brief toyota_client_set_instance_count
+ *
+ * Set number of humidity zones and headlight units. Instances have IDs
+ * 0..count-1, values of remaining instances are kept and new instances
+ * start with default values. Clients start with one instance of each.
+ *
+ * @param self              Pointer to client object
+ * @param humidity_zones    Number of humidity object instances, at least 1
+ * @param headlight_units   Number of headlights object instances, at least 1
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int
+toyota_client_set_instance_count(client_t *self,
+                                 size_t   humidity_zones,
+                                 size_t   headlight_units);
 /**
  * @brief toyota_client_push_humidity
  *
@@ -65,11 +210,27 @@ remote_client_poll_sockets(client_t *self, int max_wait_time_ms);
  * @param self              Pointer to client object
  * @param sensor_value      Current measured value of humidity
  * @param sensor_state      True - when sensor is ON, false - when sensor is OFF
+ *
+ * @return number of resources reported as changed.
  */
-void
+int
 toyota_client_push_humidity(client_t *self,
                             float sensor_value,
                             bool sensor_state);
+/**
+ * @brief toyota_client_push_humidity_instance
+ *
+ * Same as toyota_client_push_humidity() for the given humidity zone.
+ *
+ * @param iid               Instance ID of the zone
+ *
+ * @return number of resources reported as changed, -1 for unknown instance.
+ */
+int
+toyota_client_push_humidity_instance(client_t    *self,
+                                     anjay_iid_t iid,
+                                     float       sensor_value,
+                                     bool        sensor_state);
 /**
  * @brief toyota_client_push_headlights_control
  *
@@ -78,11 +239,287 @@ toyota_client_push_humidity(client_t *self,
  * @param self              Pointer to client object
  * @param control_state     True - when relay is ON, false - when relay is OFF
  * @param brightness        Brightness level of headlights (set by PWM)
+ *
+ * @return number of resources reported as changed.
  */
-void
+int
 toyota_client_push_headlights_control(client_t *self,
                                       bool     control_state,
                                       int64_t  brightness);
+/**
+ * @brief toyota_client_push_headlights_control_instance
+ *
+ * Same as toyota_client_push_headlights_control() for the given unit.
+ *
+ * @param iid               Instance ID of the headlight unit
+ *
+ * @return number of resources reported as changed, -1 for unknown instance.
+ */
+int
+toyota_client_push_headlights_control_instance(client_t    *self,
+                                               anjay_iid_t iid,
+                                               bool        control_state,
+                                               int64_t     brightness);
+/**
+ * @brief toyota_client_enqueue_humidity
+ *
+ * Queue new value of humidity object. Unlike toyota_client_push_humidity()
+ * it may be called from any thread and never blocks; queued values are
+ * applied by remote_client_poll_sockets().
+ *
+ * @param self              Pointer to client object
+ * @param sensor_value      Current measured value of humidity
+ * @param sensor_state      True - when sensor is ON, false - when sensor is OFF
+ *
+ * @return 0 on success, -1 when the queue is full and the value was dropped.
+ */
+int
+toyota_client_enqueue_humidity(client_t *self,
+                               float sensor_value,
+                               bool sensor_state);
+/**
+ * @brief toyota_client_enqueue_humidity_instance
+ *
+ * Same as toyota_client_enqueue_humidity() for the given humidity zone,
+ * values for unknown instances are dropped when applied.
+ */
+int
+toyota_client_enqueue_humidity_instance(client_t    *self,
+                                        anjay_iid_t iid,
+                                        float       sensor_value,
+                                        bool        sensor_state);
+/**
+ * @brief toyota_client_enqueue_headlights_control
+ *
+ * Queue new value of headlights_control object, thread-safe counterpart
+ * of toyota_client_push_headlights_control().
+ *
+ * @param self              Pointer to client object
+ * @param control_state     True - when relay is ON, false - when relay is OFF
+ * @param brightness        Brightness level of headlights (set by PWM)
+ *
+ * @return 0 on success, -1 when the queue is full and the value was dropped.
+ */
+int
+toyota_client_enqueue_headlights_control(client_t *self,
+                                         bool     control_state,
+                                         int64_t  brightness);
+/**
+ * @brief toyota_client_enqueue_headlights_control_instance
+ *
+ * Same as toyota_client_enqueue_headlights_control() for the given unit.
+ */
+int
+toyota_client_enqueue_headlights_control_instance(client_t    *self,
+                                                  anjay_iid_t iid,
+                                                  bool        control_state,
+                                                  int64_t     brightness);
+/**
+ * @brief toyota_client_get_ingest_stats
+ *
+ * Get counters of queued, dropped and applied samples.
+ *
+ * @param self              Pointer to client object
+ * @param out_stats         Filled with counters of the sample queue
+ */
+void
+toyota_client_get_ingest_stats(const client_t *self, ingest_stats_t *out_stats);
+/**
+ * @brief toyota_client_report_humidity
+ *
+ * Same as toyota_client_push_humidity(), and the values are also queued
+ * in the SenML-CBOR batch of object 33206. Batch is published as one
+ * notification when it grows to the size limit or its oldest value gets
+ * older than the window, see toyota_client_set_report_limits(). Servers
+ * consuming batches observe /33206/0/5510 instead of the object resources.
+ *
+ * @param self              Pointer to client object
+ * @param sensor_value      Current measured value of humidity
+ * @param sensor_state      True - when sensor is ON, false - when sensor is OFF
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int
+toyota_client_report_humidity(client_t *self,
+                              float sensor_value,
+                              bool sensor_state);
+/**
+ * @brief toyota_client_report_humidity_instance
+ *
+ * Same as toyota_client_report_humidity() for the given humidity zone.
+ */
+int
+toyota_client_report_humidity_instance(client_t    *self,
+                                       anjay_iid_t iid,
+                                       float       sensor_value,
+                                       bool        sensor_state);
+/**
+ * @brief toyota_client_report_headlights_control
+ *
+ * Same as toyota_client_push_headlights_control(), values are also queued
+ * in the batch, see toyota_client_report_humidity().
+ *
+ * @param self              Pointer to client object
+ * @param control_state     True - when relay is ON, false - when relay is OFF
+ * @param brightness        Brightness level of headlights (set by PWM)
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int
+toyota_client_report_headlights_control(client_t *self,
+                                        bool     control_state,
+                                        int64_t  brightness);
+/**
+ * @brief toyota_client_report_headlights_control_instance
+ *
+ * Same as toyota_client_report_headlights_control() for the given unit.
+ */
+int
+toyota_client_report_headlights_control_instance(client_t    *self,
+                                                 anjay_iid_t iid,
+                                                 bool        control_state,
+                                                 int64_t     brightness);
+/**
+ * @brief toyota_client_flush_reports
+ *
+ * Publish queued values right away.
+ *
+ * @param self              Pointer to client object
+ *
+ * @return number of published values.
+ */
+int
+toyota_client_flush_reports(client_t *self);
+/**
+ * @brief toyota_client_set_report_limits
+ *
+ * Queued values are flushed before the new limits apply.
+ *
+ * @param self              Pointer to client object
+ * @param max_bytes         Payload size that triggers publishing, up to 1024
+ * @param window_ms         Max age of a queued value, 0 - publish every value
+ */
+void
+toyota_client_set_report_limits(client_t *self, size_t max_bytes, int window_ms);
+/**
+ * @brief toyota_client_get_report_stats
+ *
+ * Bytes per value are payload_bytes / values.
+ *
+ * @param self              Pointer to client object
+ * @param out_stats         Filled with counters of reported values
+ */
+void
+toyota_client_get_report_stats(const client_t *self, report_stats_t *out_stats);
+/**
+ * @brief toyota_client_set_headlights_backend
+ *
+ * Drive headlights hardware with values written by the server. Values are
+ * applied by a worker thread, so slow hardware never stalls
+ * remote_client_poll_sockets(); instance N of the headlights object drives
+ * unit N of the backend. Current values are applied right away.
+ *
+ * @param self              Pointer to client object
+ * @param backend           Backend owned by the client from now on, e.g.
+ *                          actuator_backend_sysfs_create(), NULL to detach
+ * @param interval_ms       Min time between two applies of a unit, writes
+ *                          within it are coalesced to the latest value
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int
+toyota_client_set_headlights_backend(client_t           *self,
+                                     actuator_backend_t *backend,
+                                     int                interval_ms);
+/**
+ * @brief toyota_client_get_actuator_stats
+ *
+ * Get counters and apply latency histograms of the headlights actuator.
+ *
+ * @param self              Pointer to client object
+ * @param out_stats         Filled with actuator statistics
+ *
+ * @return 0 on success, -1 when no backend is set.
+ */
+int
+toyota_client_get_actuator_stats(const client_t *self, actuator_stats_t *out_stats);
+/**
+ * @brief toyota_client_set_humidity_driver
+ *
+ * Read humidity values from sensors instead of pushes. Channel N of the
+ * driver feeds humidity zone N. Sampling runs on timers of the client event
+ * loop and adapts to the rate of change of every zone: fast while the value
+ * moves, backing off to max_interval_ms while it is stable. The limits are
+ * narrowed per zone by pmin, pmax and step attributes of resource 5500 set
+ * by the server.
+ *
+ * @param self              Pointer to client object
+ * @param driver            Driver owned by the client from now on, e.g.
+ *                          sensor_driver_file_create(), NULL to stop sampling
+ * @param limits            Sampling limits, NULL for defaults
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int
+toyota_client_set_humidity_driver(client_t               *self,
+                                  sensor_driver_t        *driver,
+                                  const sampler_limits_t *limits);
+/**
+ * @brief toyota_client_get_sampler_stats
+ *
+ * Get read counters of the humidity sampler.
+ *
+ * @param self              Pointer to client object
+ * @param out_stats         Filled with sampler counters
+ *
+ * @return 0 on success, -1 when no driver is set.
+ */
+int
+toyota_client_get_sampler_stats(const client_t *self, sampler_stats_t *out_stats);
+/**
+ * @brief toyota_client_set_notify_window
+ *
+ * Set batching window of notifications for custom objects. Changes pushed
+ * within the window are reported with a single notification per resource.
+ *
+ * @param self              Pointer to client object
+ * @param window_ms         Window in milliseconds, 0 - notify on every push
+ */
+void
+toyota_client_set_notify_window(client_t *self, int window_ms);
+/**
+ * @brief toyota_client_set_humidity_deadband
+ *
+ * Changes of humidity value smaller than deadband are not notified.
+ *
+ * @param self              Pointer to client object
+ * @param deadband          Deadband in percents, 0 - notify every change
+ */
+void
+toyota_client_set_humidity_deadband(client_t *self, float deadband);
+/**
+ * @brief toyota_client_get_notify_stats
+ *
+ * Get counters of requested, issued and avoided notifications.
+ *
+ * @param self              Pointer to client object
+ * @param out_stats         Filled with summed counters of custom objects
+ */
+void
+toyota_client_get_notify_stats(const client_t *self, notify_stats_t *out_stats);
+/**
+ * @brief toyota_client_get_memory_stats
+ *
+ * Get memory footprint of the client: anjay, objects and their state are
+ * allocated from one arena when the SDK is built with WITH_CLIENT_ARENA.
+ *
+ * @param self              Pointer to client object
+ * @param out_stats         Filled with counters of the client arena
+ *
+ * @return 0 on success, -1 when the client has no arena.
+ */
+int
+toyota_client_get_memory_stats(const client_t *self, arena_stats_t *out_stats);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,181 @@
+#ifndef TOYOTA_EVENT_LOOP
+#define TOYOTA_EVENT_LOOP
+
+#include <anjay/anjay.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "toyota_arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct event_loop event_loop_t;
+typedef struct event_loop_endpoint event_loop_endpoint_t;
+typedef struct event_loop_timer event_loop_timer_t;
+typedef struct event_loop_fd_watch event_loop_fd_watch_t;
+
+typedef void event_loop_timer_handler_t(void *arg);
+typedef void event_loop_fd_handler_t(void *arg);
+
+/**
+ * @brief Create new event loop
+ *
+ * Event loop owns a long-lived epoll instance. Sockets of every attached
+ * anjay instance are registered in it once and kept in sync when connections
+ * change, so each wakeup only touches the sockets that are ready.
+ *
+ * @return pointer to the new event loop, NULL in case of error.
+ */
+event_loop_t *
+event_loop_create(void);
+/**
+ * @brief Destroy event loop
+ *
+ * All endpoints must be detached before the loop is destroyed.
+ *
+ * @param loop Pointer to event loop object
+ */
+void
+event_loop_destroy(event_loop_t *loop);
+/**
+ * @brief Attach anjay instance to the event loop
+ *
+ * @param loop   Pointer to event loop object
+ * @param anjay  Anjay instance which sockets will be served by the loop
+ *
+ * @return handle of the attached endpoint, NULL in case of error.
+ */
+event_loop_endpoint_t *
+event_loop_attach(event_loop_t *loop, anjay_t *anjay);
+/**
+ * @brief Detach anjay instance from the event loop
+ *
+ * Removes all sockets of the endpoint from the epoll set.
+ *
+ * @param loop      Pointer to event loop object
+ * @param endpoint  Handle returned by event_loop_attach()
+ */
+void
+event_loop_detach(event_loop_t *loop, event_loop_endpoint_t *endpoint);
+/**
+ * @brief Number of packets served for the endpoint
+ *
+ * @param endpoint  Handle returned by event_loop_attach()
+ *
+ * @return number of successful anjay_serve() calls for the endpoint.
+ */
+uint64_t
+event_loop_endpoint_served(const event_loop_endpoint_t *endpoint);
+/**
+ * @brief Set arena entered while anjay of the endpoint is served
+ *
+ * Allocations of anjay_serve() and anjay_sched_run() of the endpoint are
+ * taken from the arena, see toyota_arena.h.
+ *
+ * @param endpoint  Handle returned by event_loop_attach()
+ * @param arena     Arena of the endpoint, NULL - system heap
+ */
+void
+event_loop_endpoint_set_arena(event_loop_endpoint_t *endpoint, arena_t *arena);
+/**
+ * @brief Watch descriptor for readability
+ *
+ * Lets other event sources, e.g. an eventfd signalled by producer threads,
+ * wake the loop. The handler is called from event_loop_run_once() while
+ * the descriptor is readable, it has to consume the event.
+ *
+ * @param loop     Pointer to event loop object
+ * @param fd       Descriptor to watch, owned by the caller
+ * @param handler  Function called when the descriptor is readable
+ * @param arg      Argument passed to the handler
+ *
+ * @return handle of the watch, NULL in case of error.
+ */
+event_loop_fd_watch_t *
+event_loop_watch_fd(event_loop_t *loop,
+                    int fd,
+                    event_loop_fd_handler_t *handler,
+                    void *arg);
+/**
+ * @brief Stop watching descriptor
+ *
+ * Must be called before the descriptor is closed.
+ *
+ * @param loop   Pointer to event loop object
+ * @param watch  Handle returned by event_loop_watch_fd()
+ */
+void
+event_loop_unwatch_fd(event_loop_t *loop, event_loop_fd_watch_t *watch);
+/**
+ * @brief Create timer
+ *
+ * Timers are kept in a min-heap of the loop and fired from
+ * event_loop_run_once(), before the anjay schedulers are run.
+ *
+ * @param loop     Pointer to event loop object
+ * @param handler  Function called when the timer expires
+ * @param arg      Argument passed to the handler
+ *
+ * @return pointer to the new (not armed) timer, NULL in case of error.
+ */
+event_loop_timer_t *
+event_loop_timer_create(event_loop_t *loop,
+                        event_loop_timer_handler_t *handler,
+                        void *arg);
+/**
+ * @brief Arm timer
+ *
+ * Timer fires once after the given delay. Arming an armed timer
+ * moves its deadline.
+ *
+ * @param timer     Pointer to timer object
+ * @param delay_ms  Delay in milliseconds
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int
+event_loop_timer_arm(event_loop_timer_t *timer, int delay_ms);
+/**
+ * @brief Check whether timer is armed
+ *
+ * @param timer Pointer to timer object
+ */
+bool
+event_loop_timer_is_armed(const event_loop_timer_t *timer);
+/**
+ * @brief Cancel timer
+ *
+ * @param timer Pointer to timer object
+ */
+void
+event_loop_timer_cancel(event_loop_timer_t *timer);
+/**
+ * @brief Destroy timer
+ *
+ * @param timer Pointer to timer object
+ */
+void
+event_loop_timer_destroy(event_loop_timer_t *timer);
+/**
+ * @brief Run event loop once
+ *
+ * Wait for IO events, the nearest scheduler job or timer, dispatch ready
+ * sockets to anjay_serve(), fire expired timers and run the schedulers of
+ * all attached endpoints.
+ *
+ * @param loop              Pointer to event loop object
+ * @param max_wait_time_ms  Max time to wait for IO events, in milliseconds
+ *
+ * @return number of sockets that were ready.
+ */
+int
+event_loop_run_once(event_loop_t *loop, int max_wait_time_ms);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_EVENT_LOOP
@@ -0,0 +1,97 @@
+#ifndef TOYOTA_FLEET
+#define TOYOTA_FLEET
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLEET_MAX_ENDPOINT_NAME   64   // max size of endpoint name, with terminating NUL
+
+typedef struct fleet fleet_t;
+
+// credentials of one endpoint of a listed fleet
+typedef struct {
+    const char  *name;            // endpoint name
+    const char  *psk_identity;    // PSK identity, NULL - fleet default
+    const char  *psk_key;         // PSK key, NULL - fleet default
+} fleet_endpoint_t;
+
+typedef struct {
+    size_t      endpoint_count;   // number of simulated vehicles
+    size_t      thread_count;     // number of worker threads sharing the endpoints
+    const char  *endpoint_prefix; // endpoint name prefix, index of vehicle is appended
+    const char  *server_uri;      // server URI used by every endpoint
+    const char  *binding_mode;    // binding mode used by every endpoint, NULL - by transport
+    int         lifetime;         // registration lifetime of every endpoint
+    bool        bootstrap_state;  // endpoints connect to bootstrap server
+    int         push_interval_ms; // period of simulated sensor pushes, 0 - disabled
+    const char  *psk_identity;    // PSK identity of every endpoint, NULL - built-in default
+    const char  *psk_key;         // PSK key of every endpoint, NULL - built-in default
+    size_t      in_buffer_size;   // CoAP input buffer of every endpoint, 0 - transport default
+    size_t      out_buffer_size;  // CoAP output buffer of every endpoint, 0 - transport default
+    const fleet_endpoint_t *endpoints; // endpoint_count listed endpoints,
+                                  // NULL - names generated from endpoint_prefix
+} fleet_config_t;
+
+/**
+ * @brief Create fleet of simulated vehicles
+ *
+ * Start worker threads, each of them hosting its share of independent
+ * endpoints (own anjay instance and own object state) multiplexed over
+ * one event loop per thread. Strings in config must outlive the fleet.
+ *
+ * @param config Fleet configuration
+ *
+ * @return pointer to the new fleet, NULL in case of error.
+ */
+fleet_t *
+fleet_create(const fleet_config_t *config);
+/**
+ * @brief Apply new configuration to a running fleet
+ *
+ * Every worker compares the settings of its endpoints with the running
+ * ones between two event loop iterations. Only endpoints whose server or
+ * credentials changed get their Security or Server instance replaced,
+ * the others keep their DTLS sessions; endpoints whose name changed are
+ * recreated. Fleet size and number of threads are fixed at creation.
+ * Returns once every worker has applied the configuration, strings of
+ * the previous one may be released then.
+ *
+ * @param fleet  Pointer to fleet object
+ * @param config New configuration, its endpoint list must have at least
+ *               the running number of endpoints
+ *
+ * @return 0 on success, -1 if some endpoints could not be updated (they
+ *         keep running with previous settings or stay down).
+ */
+int
+fleet_reload(fleet_t *fleet, const fleet_config_t *config);
+/**
+ * @brief Report fleet statistics
+ *
+ * Log endpoints the server has answered, first responses/s and
+ * notifications/s of every worker thread measured since the previous
+ * report, and memory of its endpoints when clients allocate from arenas.
+ *
+ * @param fleet Pointer to fleet object
+ */
+void
+fleet_report_stats(fleet_t *fleet);
+/**
+ * @brief Destroy fleet
+ *
+ * Stop worker threads and destroy all endpoints.
+ *
+ * @param fleet Pointer to fleet object
+ */
+void
+fleet_destroy(fleet_t *fleet);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_FLEET
@@ -0,0 +1,60 @@
+#ifndef TOYOTA_HASH
+#define TOYOTA_HASH
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHA256_DIGEST_SIZE 32  // size of SHA-256 digest in bytes
+#define SHA256_BLOCK_SIZE  64  // size of SHA-256 input block in bytes
+
+typedef struct {
+    uint32_t state[8];                  // intermediate hash value
+    uint64_t length;                    // number of bytes hashed so far
+    uint8_t  buffer[SHA256_BLOCK_SIZE]; // partial input block
+    size_t   buffered;                  // number of bytes in buffer
+} sha256_ctx_t;
+
+/**
+ * @brief Update CRC32C (Castagnoli) checksum
+ *
+ * Uses the SSE4.2 or ARMv8 CRC instructions when the CPU has them,
+ * table-driven software implementation otherwise.
+ *
+ * @param crc    Checksum of the preceding data, 0 for the first chunk
+ * @param data   Data to checksum
+ * @param length Number of bytes
+ *
+ * @return checksum of the preceding data followed by the given chunk.
+ */
+uint32_t
+crc32c_update(uint32_t crc, const void *data, size_t length);
+/**
+ * @brief Software-only CRC32C, same result as crc32c_update()
+ */
+uint32_t
+crc32c_update_sw(uint32_t crc, const void *data, size_t length);
+/**
+ * @brief Check whether crc32c_update() runs on CPU instructions
+ */
+bool
+crc32c_is_hw_accelerated(void);
+
+void
+sha256_init(sha256_ctx_t *ctx);
+
+void
+sha256_update(sha256_ctx_t *ctx, const void *data, size_t length);
+
+void
+sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_HASH
@@ -0,0 +1,61 @@
+#ifndef TOYOTA_HISTOGRAM
+#define TOYOTA_HISTOGRAM
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HISTOGRAM_SUB_BUCKETS   8   // linear buckets per power of two, ~12% resolution
+#define HISTOGRAM_BUCKETS       (64 * HISTOGRAM_SUB_BUCKETS)
+
+// Log-linear histogram of non-negative values (latencies in ns), constant
+// time record and fixed size, so it can live in hot paths and be copied.
+// Not synchronized, every writer keeps its own and readers copy or merge.
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} histogram_t;
+
+/**
+ * @brief Reset histogram to empty
+ */
+void
+histogram_init(histogram_t *histogram);
+/**
+ * @brief Record one value
+ */
+void
+histogram_record(histogram_t *histogram, uint64_t value);
+/**
+ * @brief Add all values recorded in source to target
+ */
+void
+histogram_merge(histogram_t *target, const histogram_t *source);
+/**
+ * @brief Value below which given percent of recorded values fall
+ *
+ * Result is the upper bound of the bucket, clamped to the recorded max.
+ *
+ * @param percentile Percentile in range 0..100
+ *
+ * @return value at the percentile, 0 for empty histogram.
+ */
+uint64_t
+histogram_percentile(const histogram_t *histogram, double percentile);
+/**
+ * @brief Mean of recorded values, 0 for empty histogram
+ */
+double
+histogram_mean(const histogram_t *histogram);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_HISTOGRAM
@@ -0,0 +1,129 @@
+#ifndef TOYOTA_HISTORY
+#define TOYOTA_HISTORY
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HISTORY_DEFAULT_CAPACITY 512 // samples kept per sensor between uploads
+
+// Timestamps and values are kept in separate arrays, so walking the values
+// touches only 4 bytes per sample; memory is allocated once at init.
+typedef struct {
+    int64_t  *times_ms;     // real time of samples, milliseconds since epoch
+    float    *values;
+    size_t   capacity;
+    size_t   count;         // samples currently stored
+    size_t   head;          // slot of the next sample
+    uint64_t sequence;      // number of samples ever pushed
+    uint64_t base;          // sequence numbered 0 by sample_history_number()
+    uint64_t served_end;    // sequence past the samples served by every read since the last clear
+    bool     served;        // a read was served since the last clear
+
+    // aggregates of all samples since the last reset, not only stored ones
+    uint64_t aggregate_count;
+    double   aggregate_sum;
+    float    min;
+    float    max;
+} sample_history_t;
+
+/**
+ * @brief Initialize history
+ *
+ * @param history   History to initialize
+ * @param capacity  Max number of stored samples, oldest ones are overwritten
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int
+sample_history_init(sample_history_t *history, size_t capacity);
+/**
+ * @brief Release memory of history
+ */
+void
+sample_history_release(sample_history_t *history);
+/**
+ * @brief Store sample and update aggregates
+ *
+ * @param history  Pointer to history
+ * @param time_ms  Real time of the sample, milliseconds since epoch
+ * @param value    Sampled value
+ */
+void
+sample_history_push(sample_history_t *history, int64_t time_ms, float value);
+/**
+ * @brief Drop all stored samples
+ *
+ * Aggregates are kept.
+ */
+void
+sample_history_clear(sample_history_t *history);
+/**
+ * @brief Remember that all stored samples were served by a read
+ *
+ * When several reads happen between clears, e.g. of values and of their
+ * timestamps, only samples served by every one of them count as served.
+ */
+void
+sample_history_mark_served(sample_history_t *history);
+/**
+ * @brief Drop stored samples served since the last clear
+ *
+ * Samples pushed after the reads are kept, so none is lost between a read
+ * and its acknowledgement. Numbering starts over at the oldest sample left.
+ * Aggregates are kept.
+ *
+ * @return number of dropped samples.
+ */
+size_t
+sample_history_clear_served(sample_history_t *history);
+/**
+ * @brief Start aggregates over
+ */
+void
+sample_history_reset_aggregates(sample_history_t *history);
+/**
+ * @brief Sequence number of a stored sample
+ *
+ * Samples are indexed from the oldest one. Sequence numbers identify
+ * samples across pushes, so values and timestamps read separately can be
+ * matched.
+ *
+ * @param history  Pointer to history
+ * @param index    Index of the sample, lower than history->count
+ */
+uint64_t
+sample_history_sequence(const sample_history_t *history, size_t index);
+/**
+ * @brief Number of a stored sample counted from the oldest sample left by
+ *        the last clear, see sample_history_sequence()
+ */
+uint64_t
+sample_history_number(const sample_history_t *history, size_t index);
+/**
+ * @brief Value of a stored sample, see sample_history_sequence()
+ */
+float
+sample_history_value(const sample_history_t *history, size_t index);
+/**
+ * @brief Time of a stored sample, see sample_history_sequence()
+ */
+int64_t
+sample_history_time_ms(const sample_history_t *history, size_t index);
+/**
+ * @brief Mean of samples since the last reset of aggregates
+ *
+ * @return mean value, 0 if there was no sample.
+ */
+float
+sample_history_mean(const sample_history_t *history);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_HISTORY
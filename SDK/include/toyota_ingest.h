@@ -0,0 +1,115 @@
+#ifndef TOYOTA_INGEST
+#define TOYOTA_INGEST
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "toyota_event_loop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INGEST_DEFAULT_CAPACITY 4096 // samples buffered between acquisition threads and the loop
+#define INGEST_DRAIN_BATCH      4096 // max samples applied per wakeup, keeps socket IO responsive
+
+typedef enum {
+    INGEST_SAMPLE_HUMIDITY,
+    INGEST_SAMPLE_HEADLIGHTS
+} ingest_sample_kind_t;
+
+typedef struct {
+    ingest_sample_kind_t kind;
+    anjay_iid_t          iid;   // instance the sample belongs to
+    union {
+        struct {
+            float value;
+            bool  state;
+        } humidity;
+        struct {
+            bool    state;
+            int64_t brightness;
+        } headlights;
+    } data;
+} ingest_sample_t;
+
+typedef struct {
+    uint64_t enqueued;   // samples accepted from producers
+    uint64_t dropped;    // samples rejected because the queue was full
+    uint64_t drained;    // samples applied by the loop
+    uint64_t wakeups;    // loop wakeups caused by the queue
+    uint64_t max_batch;  // largest number of samples applied in one wakeup
+} ingest_stats_t;
+
+typedef struct ingest_queue ingest_queue_t;
+
+// called from the loop thread for every drained sample, in push order
+typedef void ingest_consumer_t(void *arg, const ingest_sample_t *sample);
+
+/**
+ * @brief Create sample queue drained by the event loop
+ *
+ * Bounded lock-free ring, any number of threads may push into it. The loop
+ * is woken through an eventfd only when the queue turns non-empty, so
+ * bursts of samples cost a single wakeup.
+ *
+ * @param loop      Event loop draining the queue
+ * @param capacity  Number of slots, rounded up to a power of two
+ * @param consumer  Function applying drained samples
+ * @param arg       Argument passed to the consumer
+ *
+ * @return pointer to the new queue, NULL in case of error.
+ */
+ingest_queue_t *
+ingest_queue_create(event_loop_t *loop,
+                    size_t capacity,
+                    ingest_consumer_t *consumer,
+                    void *arg);
+/**
+ * @brief Destroy sample queue
+ *
+ * Samples still queued are dropped. Producers must be stopped before.
+ *
+ * @param queue Pointer to queue object
+ */
+void
+ingest_queue_destroy(ingest_queue_t *queue);
+/**
+ * @brief Push sample into the queue
+ *
+ * Safe to call from any thread, never blocks.
+ *
+ * @param queue   Pointer to queue object
+ * @param sample  Sample to copy into the queue
+ *
+ * @return 0 on success, -1 when the queue is full and the sample was dropped.
+ */
+int
+ingest_queue_push(ingest_queue_t *queue, const ingest_sample_t *sample);
+/**
+ * @brief Apply queued samples right away
+ *
+ * Must be called from the loop thread.
+ *
+ * @param queue      Pointer to queue object
+ * @param max_count  Max number of samples to apply
+ *
+ * @return number of applied samples.
+ */
+size_t
+ingest_queue_drain(ingest_queue_t *queue, size_t max_count);
+/**
+ * @brief Get queue counters
+ *
+ * @param queue      Pointer to queue object
+ * @param out_stats  Filled with current counters
+ */
+void
+ingest_queue_get_stats(const ingest_queue_t *queue, ingest_stats_t *out_stats);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_INGEST
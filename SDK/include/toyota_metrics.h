@@ -0,0 +1,135 @@
+#ifndef TOYOTA_METRICS
+#define TOYOTA_METRICS
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "toyota_histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METRICS_NAME_SIZE           32
+#define METRICS_PUBLISH_INTERVAL    1000    // how often writers publish a snapshot, in milliseconds
+#define METRICS_DEFAULT_INTERVAL    10000   // period of dump file writes, in milliseconds
+
+typedef enum {
+    METRIC_WAKEUPS,             // event loop iterations
+    METRIC_READY_SOCKETS,       // descriptors reported by epoll
+    METRIC_SERVE_FAILED,        // anjay_serve() errors
+    METRIC_SCHED_JOBS,          // scheduler jobs run
+    METRIC_CONNECTIONS_FAILED,  // anjay_all_connections_failed() reports
+    METRIC_TIMERS_FIRED,        // event loop timers fired
+    METRIC_NOTIFIES,            // anjay_notify_changed() calls
+    METRIC_FW_BYTES,            // firmware bytes written
+    METRICS_COUNTER_COUNT
+} metrics_counter_t;
+
+typedef enum {
+    METRIC_LOOP_BUSY,           // one loop iteration without the wait
+    METRIC_SERVE,               // anjay_serve() of one socket
+    METRIC_SCHED,               // anjay_sched_run() with a job due
+    METRIC_NOTIFY,              // flush of queued notifications
+    METRIC_FW_WRITE,            // one firmware block written
+    METRICS_LATENCY_COUNT
+} metrics_latency_t;
+
+// Counters and latency histograms (in ns) of one thread. Only the owner
+// thread writes them, without locks; once per METRICS_PUBLISH_INTERVAL it
+// copies them to a snapshot which exporters read under a mutex.
+typedef struct metrics metrics_t;
+
+/**
+ * @brief Create metrics of a thread and register them for export
+ *
+ * @param name Name of the thread in reports, e.g. loop-0
+ *
+ * @return new metrics, NULL in case of error.
+ */
+metrics_t *
+metrics_create(const char *name);
+/**
+ * @brief Unregister and destroy metrics
+ */
+void
+metrics_destroy(metrics_t *metrics);
+/**
+ * @brief Set metrics of the calling thread
+ *
+ * Code which has no access to its event loop, e.g. object handlers,
+ * records through metrics_current().
+ */
+void
+metrics_set_current(metrics_t *metrics);
+/**
+ * @brief Metrics of the calling thread, NULL if none
+ */
+metrics_t *
+metrics_current(void);
+/**
+ * @brief Increment counter, no-op for NULL metrics
+ */
+void
+metrics_count(metrics_t *metrics, metrics_counter_t counter, uint64_t value);
+/**
+ * @brief Start of a measured operation, 0 for NULL metrics
+ */
+int64_t
+metrics_start(const metrics_t *metrics);
+/**
+ * @brief Record time elapsed since metrics_start(), no-op for NULL metrics
+ */
+void
+metrics_stop(metrics_t *metrics, metrics_latency_t latency, int64_t start_ns);
+/**
+ * @brief Copy values to the snapshot seen by exporters, if it is due
+ *
+ * Called by the owner thread, e.g. after each event loop iteration.
+ */
+void
+metrics_publish(metrics_t *metrics);
+/**
+ * @brief Write last snapshots of all registered threads
+ *
+ * Report is in Prometheus text format: counters as *_total, latencies as
+ * summaries with p50, p90, p99, p99.9 and max quantiles.
+ *
+ * The report is formatted in memory first, so locks shared with the loops
+ * are not held while it is written.
+ *
+ * @param fd Descriptor to write to, e.g. file or accepted socket
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int
+metrics_write_report(int fd);
+
+typedef struct metrics_exporter metrics_exporter_t;
+
+/**
+ * @brief Start thread exporting reports
+ *
+ * @param dump_path   File rewritten every interval_ms, replaced atomically,
+ *                    NULL - none
+ * @param socket_path Unix socket answering every connection with a report,
+ *                    NULL - none
+ * @param interval_ms Period of dump file writes
+ *
+ * @return new exporter, NULL in case of error.
+ */
+metrics_exporter_t *
+metrics_exporter_start(const char *dump_path,
+                       const char *socket_path,
+                       int interval_ms);
+/**
+ * @brief Stop exporter thread and remove its socket
+ */
+void
+metrics_exporter_stop(metrics_exporter_t *exporter);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_METRICS
@@ -0,0 +1,95 @@
+#ifndef TOYOTA_NOTIFY
+#define TOYOTA_NOTIFY
+
+#include <anjay/anjay.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "toyota_event_loop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NOTIFY_BATCH_MAX_RESOURCES 8  // max number of distinct resources pending in a batch
+#define NOTIFY_BATCH_DEFAULT_WINDOW 200 // default batching window, in milliseconds
+
+typedef struct {
+    uint64_t requested;  // resource notifications that plain per-push notifying would issue
+    uint64_t issued;     // anjay_notify_changed() calls actually made
+    uint64_t avoided;    // notifications suppressed by change detection and batching
+} notify_stats_t;
+
+typedef struct {
+    anjay_t             *anjay;
+    anjay_oid_t         oid;
+    anjay_iid_t         iid;
+    int                 window_ms;   // batching window, 0 - notify immediately
+    event_loop_timer_t  *timer;      // flushes the batch when the window closes
+    size_t              pending_count;
+    anjay_rid_t         pending[NOTIFY_BATCH_MAX_RESOURCES];
+    notify_stats_t      stats;
+} notify_batch_t;
+
+/**
+ * @brief Initialize notification batch of an object instance
+ *
+ * @param batch      Batch to initialize
+ * @param anjay      Anjay instance the object is registered in
+ * @param event_loop Loop used to close batching windows, NULL disables batching
+ * @param oid        Object ID
+ * @param iid        Instance ID
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int
+notify_batch_init(notify_batch_t *batch,
+                  anjay_t *anjay,
+                  event_loop_t *event_loop,
+                  anjay_oid_t oid,
+                  anjay_iid_t iid);
+/**
+ * @brief Release notification batch
+ *
+ * Pending notifications are dropped.
+ */
+void
+notify_batch_release(notify_batch_t *batch);
+/**
+ * @brief Set batching window
+ *
+ * @param window_ms Window in milliseconds, 0 - notify on every change
+ */
+void
+notify_batch_set_window(notify_batch_t *batch, int window_ms);
+/**
+ * @brief Mark resource as changed
+ *
+ * Resource marked several times within one window is notified once.
+ */
+void
+notify_batch_mark(notify_batch_t *batch, anjay_rid_t rid);
+/**
+ * @brief Submit one data update to the batch
+ *
+ * Opens the batching window when some resource is pending, or notifies
+ * at once when batching is disabled.
+ *
+ * @param batch                Notification batch
+ * @param resources_in_update  Number of resources the update would
+ *                             notify without change detection
+ */
+void
+notify_batch_submit(notify_batch_t *batch, size_t resources_in_update);
+/**
+ * @brief Notify all pending resources now
+ */
+void
+notify_batch_flush(notify_batch_t *batch);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_NOTIFY
@@ -0,0 +1,286 @@
+#ifndef TOYOTA_OBJECT
+#define TOYOTA_OBJECT
+
+#include <anjay/anjay.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "toyota_utils.h"
+#include "toyota_notify.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// returned by schema read/write for resources the object serves by itself
+#define OBJECT_SCHEMA_CUSTOM    1
+#define OBJECT_SCHEMA_NOT_STORED SIZE_MAX   // resource has no slot in the values struct
+
+#define OBJECT_OP_READ          0x01
+#define OBJECT_OP_WRITE         0x02
+#define OBJECT_OP_EXECUTE       0x04
+
+typedef enum {
+    OBJECT_RES_NONE,        // executable
+    OBJECT_RES_FLOAT,       // stored as float
+    OBJECT_RES_INTEGER,     // stored as int64_t
+    OBJECT_RES_BOOLEAN,     // stored as bool
+    OBJECT_RES_STRING,
+    OBJECT_RES_OPAQUE,
+    OBJECT_RES_TIME
+} object_res_type_t;
+
+typedef struct {
+    anjay_rid_t rid;
+    uint8_t     type;           // object_res_type_t
+    uint8_t     operations;     // OBJECT_OP_* flags
+    bool        multiple;
+    bool        has_range;
+    size_t      offset;         // offset in the values struct, OBJECT_SCHEMA_NOT_STORED
+    double      min;            // valid when has_range
+    double      max;
+} object_resource_t;
+
+// Generated from xmls/<oid>.xml at build time, see SDK/cmake/object_schema.cmake.
+// Writable single-instance scalars are stored by the engine in the generated
+// object_<oid>_values_t struct, other resources are served by the object.
+typedef struct {
+    anjay_oid_t             oid;
+    anjay_rid_t             first_rid;
+    const uint8_t           *index;         // rid - first_rid -> position in resources + 1, 0 if none
+    size_t                  index_size;
+    const object_resource_t *resources;
+    size_t                  resource_count;
+} object_schema_t;
+
+/**
+ * @brief Find resource in schema
+ *
+ * @return resource definition, NULL if rid is not part of the object.
+ */
+static inline const object_resource_t *
+object_schema_find(const object_schema_t *schema, anjay_rid_t rid) {
+    size_t slot = (size_t) (rid - schema->first_rid);
+    if (rid < schema->first_rid || slot >= schema->index_size
+            || !schema->index[slot]) {
+        return NULL;
+    }
+    return &schema->resources[schema->index[slot] - 1];
+}
+/**
+ * @brief Read resource stored in values struct
+ *
+ * @param schema  Schema of the object
+ * @param values  Values struct generated for the object
+ * @param rid     Resource ID
+ * @param ctx     Output context
+ *
+ * @return 0 on success, anjay error code, or OBJECT_SCHEMA_CUSTOM when
+ *         the resource is not stored by the engine.
+ */
+int
+object_schema_read(const object_schema_t *schema,
+                   const void *values,
+                   anjay_rid_t rid,
+                   anjay_output_ctx_t *ctx);
+/**
+ * @brief Write resource stored in values struct
+ *
+ * Value is checked against RangeEnumeration of the schema before it is
+ * stored.
+ *
+ * @return 0 on success, anjay error code, or OBJECT_SCHEMA_CUSTOM when
+ *         the resource is not stored by the engine.
+ */
+int
+object_schema_write(const object_schema_t *schema,
+                    void *values,
+                    anjay_rid_t rid,
+                    anjay_input_ctx_t *ctx);
+
+/**
+ * @brief Check stored resources of one instance against their ranges
+ *
+ * @return 0 when all values are valid, ANJAY_ERR_BAD_REQUEST otherwise.
+ */
+int
+object_schema_validate(const object_schema_t *schema, const void *values);
+
+// Copy-on-write state of a transaction over an array of values structs
+// indexed by IID. The first write of a transaction copies the live array,
+// later writes change the copy only and commit swaps the arrays, so reads
+// never see half-applied writes and a failed write leaves live values intact.
+typedef struct {
+    void    *staged;        // copy of the live array written by the transaction
+    bool    *written;       // instances written within the transaction
+    size_t  capacity;       // instances both arrays are sized for
+    size_t  value_size;     // size of one values struct
+    size_t  written_count;
+    bool    copied;         // staged holds live values of this transaction
+} object_staging_t;
+
+/**
+ * @brief Get staged values of an instance for writing
+ *
+ * @param staging     Staging state of the object
+ * @param live        Live values array read by the server
+ * @param value_size  Size of one values struct
+ * @param count       Number of instances
+ * @param iid         Instance to write
+ *
+ * @return staged values struct, NULL when out of memory.
+ */
+void *
+object_staging_get(object_staging_t *staging,
+                   const void *live,
+                   size_t value_size,
+                   size_t count,
+                   anjay_iid_t iid);
+/**
+ * @brief Make staged values live
+ *
+ * Written flags stay set until object_staging_end(), so the object can
+ * update state of written instances.
+ *
+ * @return new live array, the old one is kept for the next transaction.
+ */
+void *
+object_staging_commit(object_staging_t *staging, void *live);
+/**
+ * @brief Check staged values of written instances against their ranges
+ *
+ * @param schema   Schema of the object
+ * @param staging  Staging state of the object
+ * @param count    Number of instances
+ *
+ * @return 0 when all written instances are valid or nothing was written,
+ *         ANJAY_ERR_BAD_REQUEST otherwise.
+ */
+int
+object_staging_validate(const object_schema_t *schema,
+                        const object_staging_t *staging,
+                        size_t count);
+/**
+ * @brief Finish transaction, staged values are dropped if not committed
+ */
+void
+object_staging_end(object_staging_t *staging);
+/**
+ * @brief Release staging buffers
+ */
+void
+object_staging_release(object_staging_t *staging);
+
+/**
+ * @brief Step of instance_it handler over dense instance IDs 0..count-1
+ *
+ * Cookie holds the next instance ID, so iterating all instances is a
+ * linear scan of the storage arrays indexed by IID.
+ *
+ * @param count   Number of instances
+ * @param out     Set to the next IID, ANJAY_IID_INVALID after the last one
+ * @param cookie  Iteration cookie passed by anjay
+ */
+static inline void
+object_dense_instance_next(size_t count, anjay_iid_t *out, void **cookie) {
+    uintptr_t next = (uintptr_t) *cookie;
+    if (next < count) {
+        *out = (anjay_iid_t) next;
+        *cookie = (void *) (next + 1);
+    } else {
+        *out = ANJAY_IID_INVALID;
+    }
+}
+
+// Per-instance state of an object with dense IIDs 0..count-1, every array
+// is indexed by IID. Arrays are rebuilt rather than reallocated on resize,
+// notification batches own timers that point at the batch itself.
+typedef struct {
+    anjay_t                  *anjay;
+    event_loop_t             *event_loop;
+    anjay_oid_t              oid;
+    size_t                   value_size;        // size of one values struct
+    const void               *defaults;         // values of a new instance
+    int                      notify_window_ms;  // batching window of every instance
+    notify_stats_t           released_stats;    // counters of removed instances
+
+    size_t                   count;
+    void                     *values;           // values structs, written through the schema
+    toyota_timestamp_t       *changed_at;       // moment of the last change
+    toyota_timestamp_cache_t *changed_at_text;  // formatted changed_at
+    notify_batch_t           *notify;           // resources changed within the batching window
+} object_instances_t;
+
+/**
+ * @brief Initialize empty instance set, instances are created by resize
+ *
+ * @param instances   Instance set of the object
+ * @param anjay       Anjay instance the object is registered in
+ * @param event_loop  Loop closing batching windows, NULL disables batching
+ * @param oid         Object ID
+ * @param value_size  Size of one values struct
+ * @param defaults    Values of a new instance, not copied
+ */
+void
+object_instances_init(object_instances_t *instances,
+                      anjay_t *anjay,
+                      event_loop_t *event_loop,
+                      anjay_oid_t oid,
+                      size_t value_size,
+                      const void *defaults);
+/**
+ * @brief Change number of instances
+ *
+ * Instances below the new count keep their values, time stamps and
+ * notification counters, changes waiting in batching windows are notified.
+ *
+ * @return 0 on success, -1 when out of memory, the set is left untouched.
+ */
+int
+object_instances_resize(object_instances_t *instances, size_t count);
+/**
+ * @brief Called for every instance written by a committed transaction
+ */
+typedef void object_commit_hook_t(void *arg, anjay_iid_t iid);
+
+/**
+ * @brief Make staged values live and finish transaction
+ *
+ * Values are swapped as a whole, reads see either old or new values of all
+ * resources. Time stamps of written instances are marked before the hook
+ * runs.
+ *
+ * @param instances  Instance set of the object
+ * @param staging    Staging state of the object
+ * @param hook       Called for every written instance, NULL - none
+ * @param arg        Passed to hook
+ */
+void
+object_instances_commit(object_instances_t *instances,
+                        object_staging_t *staging,
+                        object_commit_hook_t *hook,
+                        void *arg);
+/**
+ * @brief Set batching window of every instance
+ */
+void
+object_instances_set_notify_window(object_instances_t *instances, int window_ms);
+/**
+ * @brief Sum notification counters of current and removed instances
+ */
+void
+object_instances_notify_stats(const object_instances_t *instances,
+                              notify_stats_t *out_stats);
+/**
+ * @brief Release arrays of all instances
+ */
+void
+object_instances_release(object_instances_t *instances);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_OBJECT
@@ -0,0 +1,162 @@
+#ifndef TOYOTA_SAMPLER
+#define TOYOTA_SAMPLER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "toyota_event_loop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SAMPLER_DEFAULT_MIN_INTERVAL 100    // fastest sampling, while the value moves, in milliseconds
+#define SAMPLER_DEFAULT_MAX_INTERVAL 10000  // slowest sampling, while the value is stable, in milliseconds
+#define SAMPLER_DEFAULT_THRESHOLD    0.1f   // change between samples treated as movement
+#define SAMPLER_MAX_CHANNELS         4096
+
+typedef struct sensor_driver sensor_driver_t;
+
+// Access to sensor hardware, called from the event loop thread.
+typedef struct {
+    const char *name;
+    // measure the channel; returns 0 on success, -1 in case of error
+    int (*read)(sensor_driver_t *driver, size_t channel, float *out_value);
+    void (*destroy)(sensor_driver_t *driver);
+} sensor_driver_vtable_t;
+
+struct sensor_driver {
+    const sensor_driver_vtable_t *vtable;
+};
+
+/**
+ * @brief Create driver reading values from text files
+ *
+ * Every read opens the file, parses one number and returns
+ * number * scale + offset. Works with sysfs attributes, e.g. IIO
+ * in_humidityrelative_input in milli-percents with scale 0.001.
+ *
+ * @param path_format Path of the file, may contain one %zu replaced by the
+ *                    channel, e.g. /sys/bus/iio/devices/iio:device%zu/in_humidityrelative_input
+ * @param scale       Multiplier of the read number
+ * @param offset      Added to the scaled number
+ *
+ * @return new driver, NULL in case of error.
+ */
+sensor_driver_t *
+sensor_driver_file_create(const char *path_format, float scale, float offset);
+
+typedef struct {
+    float    base;          // value of stable phases
+    float    amplitude;     // peak deviation of moving phases
+    float    noise;         // peak uniform noise added to every read
+    int      stable_ms;     // length of phases with constant value
+    int      moving_ms;     // length of phases with one sine period
+    unsigned seed;          // seed of the noise generator
+} sensor_synthetic_config_t;
+
+/**
+ * @brief Create driver generating values in memory
+ *
+ * Values alternate between stable phases and moving phases, which lets
+ * samplers be exercised without hardware. Phases of channel N are shifted
+ * by N * moving_ms / 4.
+ *
+ * @return new driver, NULL in case of error.
+ */
+sensor_driver_t *
+sensor_driver_synthetic_create(const sensor_synthetic_config_t *config);
+/**
+ * @brief Value generated by a synthetic driver, without noise
+ *
+ * @param elapsed_ms Time since the driver was created
+ */
+float
+sensor_driver_synthetic_value(const sensor_driver_t *driver,
+                              size_t channel,
+                              int64_t elapsed_ms);
+/**
+ * @brief Destroy driver
+ */
+void
+sensor_driver_destroy(sensor_driver_t *driver);
+
+// Sampling interval bounds of a channel.
+typedef struct {
+    int   min_interval_ms;
+    int   max_interval_ms;
+    float threshold;        // change between samples treated as movement
+} sampler_limits_t;
+
+typedef struct {
+    // take a measured value of the channel
+    void (*apply)(void *arg, size_t channel, float value);
+    // optional, narrow the limits before the next interval is chosen,
+    // e.g. from pmin, pmax and step attributes set by the server
+    void (*limits)(void *arg, size_t channel, sampler_limits_t *inout_limits);
+} sampler_handlers_t;
+
+typedef struct {
+    uint64_t reads;     // successful driver reads, one timer wakeup each
+    uint64_t failed;    // failed driver reads
+    uint64_t moving;    // reads that saw the value move
+} sampler_stats_t;
+
+typedef struct sampler sampler_t;
+
+/**
+ * @brief Start sampling channels 0..channel_count-1 of the driver
+ *
+ * Every channel has its own timer in the event loop. After each read the
+ * next interval is chosen from the observed rate of change: a change of at
+ * least threshold brings the channel to min_interval_ms, slower changes
+ * give the time the value needs to move by threshold, and a stable value
+ * doubles the interval up to max_interval_ms.
+ *
+ * @param loop          Event loop firing the timers, must outlive the sampler
+ * @param driver        Driver, owned by the sampler from now on
+ * @param channel_count Number of sampled channels
+ * @param limits        Default limits of every channel, NULL for defaults
+ * @param handlers      Receivers of values and limits
+ * @param arg           Argument passed to the handlers
+ *
+ * @return new sampler, NULL in case of error (driver is destroyed).
+ */
+sampler_t *
+sampler_create(event_loop_t             *loop,
+               sensor_driver_t          *driver,
+               size_t                   channel_count,
+               const sampler_limits_t   *limits,
+               const sampler_handlers_t *handlers,
+               void                     *arg);
+/**
+ * @brief Change number of sampled channels
+ *
+ * Remaining channels keep their state, new ones are read right away.
+ *
+ * @return 0 on success, -1 in case of error.
+ */
+int
+sampler_set_channel_count(sampler_t *sampler, size_t channel_count);
+/**
+ * @brief Current sampling interval of the channel in milliseconds, -1 for unknown channel
+ */
+int
+sampler_channel_interval(const sampler_t *sampler, size_t channel);
+/**
+ * @brief Copy counters of all channels
+ */
+void
+sampler_get_stats(const sampler_t *sampler, sampler_stats_t *out_stats);
+/**
+ * @brief Stop timers and destroy the driver
+ */
+void
+sampler_destroy(sampler_t *sampler);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_SAMPLER
@@ -0,0 +1,75 @@
+#ifndef TOYOTA_SENML
+#define TOYOTA_SENML
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// SenML labels in CBOR representation (RFC 8428, section 6)
+#define SENML_LABEL_BASE_NAME   (-2)
+#define SENML_LABEL_BASE_TIME   (-3)
+#define SENML_LABEL_NAME        0
+#define SENML_LABEL_VALUE       2
+#define SENML_LABEL_BOOL_VALUE  4
+#define SENML_LABEL_TIME        6
+
+#define SENML_RECORD_MAX_SIZE   64  // upper bound of an encoded record with short names
+
+// writes into a fixed buffer, overflow is sticky and checked once at the end
+typedef struct {
+    uint8_t *data;
+    size_t  capacity;
+    size_t  size;
+    bool    overflow;
+} cbor_writer_t;
+
+typedef struct {
+    uint64_t values;         // values queued for reporting
+    uint64_t batches;        // payloads published
+    uint64_t payload_bytes;  // bytes of published payloads
+    uint64_t delivered;      // batches served to the server by a read or notification
+    uint64_t refused;        // values not queued while published batches waited
+} report_stats_t;
+
+typedef enum {
+    SENML_VALUE_FLOAT,
+    SENML_VALUE_INT,
+    SENML_VALUE_BOOL
+} senml_value_type_t;
+
+typedef struct {
+    const char *base_name;      // NULL - keep base name of previous records
+    bool       has_base_time;
+    double     base_time;       // seconds since epoch
+    const char *name;
+    double     time;            // seconds relative to base time, 0 - omitted
+    senml_value_type_t type;
+    union {
+        double  f;
+        int64_t i;
+        bool    b;
+    } value;
+} senml_record_t;
+
+void cbor_writer_init(cbor_writer_t *writer, uint8_t *data, size_t capacity);
+
+void cbor_write_array(cbor_writer_t *writer, size_t count);
+void cbor_write_map(cbor_writer_t *writer, size_t count);
+void cbor_write_int(cbor_writer_t *writer, int64_t value);
+void cbor_write_text(cbor_writer_t *writer, const char *text);
+void cbor_write_bool(cbor_writer_t *writer, bool value);
+// single precision is used when it holds the value exactly
+void cbor_write_double(cbor_writer_t *writer, double value);
+
+// encode record as a CBOR map, pack records with cbor_write_array()
+void senml_write_record(cbor_writer_t *writer, const senml_record_t *record);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif //  TOYOTA_SENML
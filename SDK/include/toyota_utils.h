@@ -7,6 +7,7 @@
 #include "anjay/dm.h"
 
 #include "time.h"
+#include "stdint.h"
 
 // standard log levels
 #define log_trace(Module, ...) avs_log(Module, TRACE, __VA_ARGS__)      // anjay log level trace
@@ -24,6 +25,27 @@
 #define ANSI_COLOR_CYAN    "\x1b[36m" // cyan
 #define ANSI_COLOR_RESET   "\x1b[0m"  // reset color code
 
-char *get_current_time(void);         // get current time (return value - string (char * pointer))
+#define TIMESTAMP_TEXT_SIZE 32        // size of formatted timestamp buffer
+
+// moment of the last change, recorded once and formatted only when read
+typedef struct {
+    int64_t monotonic_ms;             // monotonic clock at the moment of change
+    int64_t real_s;                   // wall clock (seconds since epoch) at the moment of change
+} toyota_timestamp_t;
+
+// per-reader formatting cache, reformatted at most once per wall-clock second
+typedef struct {
+    int64_t formatted_s;              // wall-clock second of cached text, -1 if empty
+    char text[TIMESTAMP_TEXT_SIZE];   // formatted timestamp
+} toyota_timestamp_cache_t;
+
+char *get_current_time(void);         // get current time (return value - string (char * pointer), thread-local buffer)
+int64_t get_monotonic_time_ms(void);  // get monotonic clock value in milliseconds
+int64_t get_real_time_ms(void);       // get wall clock value in milliseconds since epoch
+
+void timestamp_mark(toyota_timestamp_t *timestamp);               // record current time as the moment of change
+void timestamp_cache_init(toyota_timestamp_cache_t *cache);       // empty formatting cache
+const char *timestamp_format(const toyota_timestamp_t *timestamp,
+                             toyota_timestamp_cache_t *cache);    // formatted moment of change (reentrant)
 
 #endif // TOYOTA_UTILS
@@ -0,0 +1,254 @@
+#define _POSIX_C_SOURCE 200809L
+#include "firmware_compress.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <anjay/fw_update.h>
+#include <avsystem/commons/log.h>
+#include <avsystem/commons/memory.h>
+
+#ifdef TOYOTA_WITH_ZSTD
+#    include <zstd.h>
+#endif
+#ifdef TOYOTA_WITH_LZ4
+#    include <lz4frame.h>
+#endif
+
+#define firmware_compress_log(level, ...) avs_log(toyota_fw_compress, level, __VA_ARGS__)
+
+static const uint8_t ZSTD_FRAME_MAGIC[FW_COMPRESS_MAGIC_SIZE] = { 0x28, 0xB5, 0x2F, 0xFD };
+static const uint8_t LZ4_FRAME_MAGIC[FW_COMPRESS_MAGIC_SIZE] = { 0x04, 0x22, 0x4D, 0x18 };
+
+static int64_t
+now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+
+fw_compression_t
+fw_compression_detect(const uint8_t *magic) {
+    if (!memcmp(magic, ZSTD_FRAME_MAGIC, FW_COMPRESS_MAGIC_SIZE)) {
+        return FW_COMPRESSION_ZSTD;
+    }
+    if (!memcmp(magic, LZ4_FRAME_MAGIC, FW_COMPRESS_MAGIC_SIZE)) {
+        return FW_COMPRESSION_LZ4;
+    }
+    return FW_COMPRESSION_NONE;
+}
+
+//------------------------------------------------------------------------------
+
+const char *
+fw_compression_name(fw_compression_t type) {
+    switch (type) {
+    case FW_COMPRESSION_ZSTD:
+        return "zstd";
+    case FW_COMPRESSION_LZ4:
+        return "lz4";
+    default:
+        return "none";
+    }
+}
+
+//------------------------------------------------------------------------------
+
+int
+fw_decompress_open(fw_decompress_t *decompress, fw_compression_t type) {
+    memset(decompress, 0, sizeof(*decompress));
+    decompress->type = type;
+
+    switch (type) {
+#ifdef TOYOTA_WITH_ZSTD
+    case FW_COMPRESSION_ZSTD: {
+        ZSTD_DStream *stream = ZSTD_createDStream();
+        if (!stream) {
+            break;
+        }
+        // window bounds decoder memory regardless of what the frame asks for
+        ZSTD_initDStream(stream);
+        ZSTD_DCtx_setParameter(stream, ZSTD_d_windowLogMax,
+                               FW_COMPRESS_WINDOW_LOG_MAX);
+        decompress->context = stream;
+        break;
+    }
+#endif
+#ifdef TOYOTA_WITH_LZ4
+    case FW_COMPRESSION_LZ4: {
+        LZ4F_dctx *context = NULL;
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&context, LZ4F_VERSION))) {
+            break;
+        }
+        decompress->context = context;
+        break;
+    }
+#endif
+    default:
+        firmware_compress_log(ERROR, "%s compressed packages are not supported",
+                              fw_compression_name(type));
+        return ANJAY_FW_UPDATE_ERR_UNSUPPORTED_PACKAGE_TYPE;
+    }
+
+    if (!decompress->context
+            || !(decompress->output = (uint8_t *) avs_malloc(FW_COMPRESS_OUTPUT_SIZE))) {
+        firmware_compress_log(ERROR, "out of memory");
+        fw_decompress_close(decompress);
+        return ANJAY_FW_UPDATE_ERR_OUT_OF_MEMORY;
+    }
+    firmware_compress_log(INFO, "%s compressed package", fw_compression_name(type));
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+fw_decompress_close(fw_decompress_t *decompress) {
+    if (decompress->context) {
+        switch (decompress->type) {
+#ifdef TOYOTA_WITH_ZSTD
+        case FW_COMPRESSION_ZSTD:
+            ZSTD_freeDStream((ZSTD_DStream *) decompress->context);
+            break;
+#endif
+#ifdef TOYOTA_WITH_LZ4
+        case FW_COMPRESSION_LZ4:
+            LZ4F_freeDecompressionContext((LZ4F_dctx *) decompress->context);
+            break;
+#endif
+        default:
+            break;
+        }
+    }
+    avs_free(decompress->output);
+    memset(decompress, 0, sizeof(*decompress));
+}
+
+//------------------------------------------------------------------------------
+
+#ifdef TOYOTA_WITH_ZSTD
+static int
+zstd_write(fw_decompress_t *decompress,
+           const void *data,
+           size_t length,
+           fw_decompress_sink_t *sink,
+           void *sink_arg) {
+    ZSTD_inBuffer input = { data, length, 0 };
+    ZSTD_outBuffer output;
+    do {
+        output.dst = decompress->output;
+        output.size = FW_COMPRESS_OUTPUT_SIZE;
+        output.pos = 0;
+        size_t hint = ZSTD_decompressStream((ZSTD_DStream *) decompress->context,
+                                            &output, &input);
+        if (ZSTD_isError(hint)) {
+            firmware_compress_log(ERROR, "zstd: %s", ZSTD_getErrorName(hint));
+            return ANJAY_FW_UPDATE_ERR_INTEGRITY_FAILURE;
+        }
+        // concatenated frames are decoded one after another
+        decompress->frame_done = !hint;
+        if (output.pos) {
+            int result = sink(sink_arg, decompress->output, output.pos);
+            if (result) {
+                return result;
+            }
+            decompress->decompressed += output.pos;
+        }
+    } while (input.pos < input.size || output.pos == output.size);
+    return 0;
+}
+#endif
+
+//------------------------------------------------------------------------------
+
+#ifdef TOYOTA_WITH_LZ4
+static int
+lz4_write(fw_decompress_t *decompress,
+          const void *data,
+          size_t length,
+          fw_decompress_sink_t *sink,
+          void *sink_arg) {
+    const uint8_t *input = (const uint8_t *) data;
+    size_t output_size;
+    do {
+        size_t input_size = length;
+        output_size = FW_COMPRESS_OUTPUT_SIZE;
+        size_t hint = LZ4F_decompress((LZ4F_dctx *) decompress->context,
+                                      decompress->output, &output_size,
+                                      input, &input_size, NULL);
+        if (LZ4F_isError(hint)) {
+            firmware_compress_log(ERROR, "lz4: %s", LZ4F_getErrorName(hint));
+            return ANJAY_FW_UPDATE_ERR_INTEGRITY_FAILURE;
+        }
+        decompress->frame_done = !hint;
+        input += input_size;
+        length -= input_size;
+        if (output_size) {
+            int result = sink(sink_arg, decompress->output, output_size);
+            if (result) {
+                return result;
+            }
+            decompress->decompressed += output_size;
+        }
+    } while (length || output_size == FW_COMPRESS_OUTPUT_SIZE);
+    return 0;
+}
+#endif
+
+//------------------------------------------------------------------------------
+
+int
+fw_decompress_write(fw_decompress_t *decompress,
+                    const void *data,
+                    size_t length,
+                    fw_decompress_sink_t *sink,
+                    void *sink_arg) {
+    int64_t start = now_ns();
+    int result = -1;
+    switch (decompress->type) {
+#ifdef TOYOTA_WITH_ZSTD
+    case FW_COMPRESSION_ZSTD:
+        result = zstd_write(decompress, data, length, sink, sink_arg);
+        break;
+#endif
+#ifdef TOYOTA_WITH_LZ4
+    case FW_COMPRESSION_LZ4:
+        result = lz4_write(decompress, data, length, sink, sink_arg);
+        break;
+#endif
+    default:
+        (void) data;
+        (void) sink;
+        (void) sink_arg;
+        break;
+    }
+    decompress->compressed += length;
+    // sink time is included, it is bounded by output chunk size
+    decompress->busy_ns += now_ns() - start;
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+int
+fw_decompress_finish(fw_decompress_t *decompress) {
+    if (!decompress->frame_done) {
+        firmware_compress_log(ERROR, "compressed package truncated");
+        return ANJAY_FW_UPDATE_ERR_INTEGRITY_FAILURE;
+    }
+    double seconds = (double) decompress->busy_ns / 1e9;
+    firmware_compress_log(INFO, "%s: %llu -> %llu bytes, ratio %.2f, %.1f MB/s",
+                          fw_compression_name(decompress->type),
+                          (unsigned long long) decompress->compressed,
+                          (unsigned long long) decompress->decompressed,
+                          decompress->compressed
+                                  ? (double) decompress->decompressed
+                                            / (double) decompress->compressed
+                                  : 0.0,
+                          seconds > 0.0 ? (double) decompress->decompressed
+                                                  / (1024.0 * 1024.0) / seconds
+                                        : 0.0);
+    return 0;
+}
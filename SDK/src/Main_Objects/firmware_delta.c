@@ -0,0 +1,450 @@
+#define _POSIX_C_SOURCE 200809L
+#include "firmware_delta.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <anjay/fw_update.h>
+#include <avsystem/commons/log.h>
+#include <avsystem/commons/memory.h>
+
+#include "../toyota_hash.h"
+
+#define FW_DELTA_ENCODE_BLOCK       32          // granularity of base index
+#define FW_DELTA_ENCODE_MIN_MATCH   64          // shorter matches are sent as data
+#define FW_DELTA_ENCODE_MAX_RECORD  (1u << 30)  // longest record produced by encoder
+
+#define firmware_delta_log(level, ...) avs_log(toyota_fw_delta, level, __VA_ARGS__)
+
+static uint64_t
+read_u64_be(const uint8_t *bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+static uint32_t
+read_u32_be(const uint8_t *bytes) {
+    return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16
+           | (uint32_t) bytes[2] << 8 | (uint32_t) bytes[3];
+}
+
+static void
+write_u64_be(uint8_t *bytes, uint64_t value) {
+    for (int i = 7; i >= 0; --i) {
+        bytes[i] = (uint8_t) value;
+        value >>= 8;
+    }
+}
+
+static void
+write_u32_be(uint8_t *bytes, uint32_t value) {
+    bytes[0] = (uint8_t) (value >> 24);
+    bytes[1] = (uint8_t) (value >> 16);
+    bytes[2] = (uint8_t) (value >> 8);
+    bytes[3] = (uint8_t) value;
+}
+
+//------------------------------------------------------------------------------
+
+int
+fw_delta_open(fw_delta_t *delta, const char *base_path) {
+    memset(delta, 0, sizeof(*delta));
+    if (!(delta->buffer = (uint8_t *) avs_malloc(FW_DELTA_BUFFER_SIZE))) {
+        firmware_delta_log(ERROR, "out of memory");
+        return ANJAY_FW_UPDATE_ERR_OUT_OF_MEMORY;
+    }
+    delta->base_fd = open(base_path, O_RDONLY | O_CLOEXEC);
+    if (delta->base_fd < 0) {
+        firmware_delta_log(ERROR, "could not open delta base %s: %s",
+                           base_path, strerror(errno));
+        avs_free(delta->buffer);
+        delta->buffer = NULL;
+        return ANJAY_FW_UPDATE_ERR_UNSUPPORTED_PACKAGE_TYPE;
+    }
+    delta->base_open = true;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+fw_delta_close(fw_delta_t *delta) {
+    if (delta->base_open) {
+        close(delta->base_fd);
+    }
+    avs_free(delta->buffer);
+    memset(delta, 0, sizeof(*delta));
+}
+
+//------------------------------------------------------------------------------
+
+static int
+read_base(fw_delta_t *delta, uint64_t offset, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t got = pread(delta->base_fd, delta->buffer + done, length - done,
+                            (off_t) (offset + done));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            firmware_delta_log(ERROR, "could not read delta base");
+            return -1;
+        }
+        done += (size_t) got;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+check_preamble(fw_delta_t *delta) {
+    if (memcmp(delta->pending, FW_DELTA_MAGIC, FW_DELTA_MAGIC_SIZE)) {
+        firmware_delta_log(ERROR, "invalid delta preamble");
+        return ANJAY_FW_UPDATE_ERR_UNSUPPORTED_PACKAGE_TYPE;
+    }
+    uint64_t expected_size = read_u64_be(&delta->pending[4]);
+    uint32_t expected_crc = read_u32_be(&delta->pending[12]);
+
+    struct stat base_stat;
+    if (fstat(delta->base_fd, &base_stat)
+            || (uint64_t) base_stat.st_size != expected_size) {
+        firmware_delta_log(ERROR, "delta was made for another base image");
+        return ANJAY_FW_UPDATE_ERR_UNSUPPORTED_PACKAGE_TYPE;
+    }
+
+    // whole base is checked up front, so records never patch a wrong image
+    uint32_t crc = 0;
+    for (uint64_t offset = 0; offset < expected_size; offset += FW_DELTA_BUFFER_SIZE) {
+        size_t chunk = expected_size - offset < FW_DELTA_BUFFER_SIZE
+                               ? (size_t) (expected_size - offset)
+                               : FW_DELTA_BUFFER_SIZE;
+        if (read_base(delta, offset, chunk)) {
+            return -1;
+        }
+        crc = crc32c_update(crc, delta->buffer, chunk);
+    }
+    if (crc != expected_crc) {
+        firmware_delta_log(ERROR, "delta was made for another base image");
+        return ANJAY_FW_UPDATE_ERR_UNSUPPORTED_PACKAGE_TYPE;
+    }
+    delta->base_size = expected_size;
+    firmware_delta_log(INFO, "delta base verified, %llu bytes",
+                       (unsigned long long) expected_size);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static size_t
+record_header_size(uint8_t op) {
+    switch (op) {
+    case FW_DELTA_COPY:
+    case FW_DELTA_ADD:
+        return 13;
+    case FW_DELTA_INSERT:
+        return 5;
+    default:
+        return 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static int
+copy_from_base(fw_delta_t *delta, fw_delta_sink_t *sink, void *sink_arg) {
+    while (delta->remaining) {
+        size_t chunk = delta->remaining < FW_DELTA_BUFFER_SIZE
+                               ? delta->remaining
+                               : FW_DELTA_BUFFER_SIZE;
+        int result = read_base(delta, delta->base_offset, chunk);
+        if (result || (result = sink(sink_arg, delta->buffer, chunk))) {
+            return result;
+        }
+        delta->base_offset += chunk;
+        delta->remaining -= (uint32_t) chunk;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+start_record(fw_delta_t *delta, fw_delta_sink_t *sink, void *sink_arg) {
+    delta->op = delta->pending[0];
+    if (delta->op == FW_DELTA_INSERT) {
+        delta->base_offset = 0;
+        delta->remaining = read_u32_be(&delta->pending[1]);
+    } else {
+        delta->base_offset = read_u64_be(&delta->pending[1]);
+        delta->remaining = read_u32_be(&delta->pending[9]);
+        if (delta->base_offset > delta->base_size
+                || delta->remaining > delta->base_size - delta->base_offset) {
+            firmware_delta_log(ERROR, "delta record out of base image");
+            return ANJAY_FW_UPDATE_ERR_INTEGRITY_FAILURE;
+        }
+    }
+
+    int result = 0;
+    if (delta->op == FW_DELTA_COPY) {
+        // copied data is not carried in the delta, produce it right away
+        result = copy_from_base(delta, sink, sink_arg);
+    }
+    if (!delta->remaining) {
+        delta->op = 0;
+    }
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+int
+fw_delta_write(fw_delta_t *delta,
+               const void *data,
+               size_t length,
+               fw_delta_sink_t *sink,
+               void *sink_arg) {
+    const uint8_t *bytes = (const uint8_t *) data;
+    int result = 0;
+
+    while (length) {
+        if (!delta->preamble_done) {
+            size_t chunk = FW_DELTA_PREAMBLE_SIZE - delta->pending_size;
+            if (chunk > length) {
+                chunk = length;
+            }
+            memcpy(delta->pending + delta->pending_size, bytes, chunk);
+            delta->pending_size += chunk;
+            bytes += chunk;
+            length -= chunk;
+            if (delta->pending_size == FW_DELTA_PREAMBLE_SIZE) {
+                if ((result = check_preamble(delta))) {
+                    return result;
+                }
+                delta->pending_size = 0;
+                delta->preamble_done = true;
+            }
+            continue;
+        }
+
+        if (!delta->op) {
+            // record headers are tiny, they are collected byte by byte
+            delta->pending[delta->pending_size++] = *bytes++;
+            --length;
+            size_t header_size = record_header_size(delta->pending[0]);
+            if (!header_size) {
+                firmware_delta_log(ERROR, "unknown delta record %u",
+                                   (unsigned) delta->pending[0]);
+                return ANJAY_FW_UPDATE_ERR_INTEGRITY_FAILURE;
+            }
+            if (delta->pending_size == header_size) {
+                delta->pending_size = 0;
+                if ((result = start_record(delta, sink, sink_arg))) {
+                    return result;
+                }
+            }
+            continue;
+        }
+
+        size_t chunk = delta->remaining < length ? delta->remaining : length;
+        if (delta->op == FW_DELTA_INSERT) {
+            result = sink(sink_arg, bytes, chunk);
+        } else {
+            if (chunk > FW_DELTA_BUFFER_SIZE) {
+                chunk = FW_DELTA_BUFFER_SIZE;
+            }
+            if (!(result = read_base(delta, delta->base_offset, chunk))) {
+                for (size_t i = 0; i < chunk; ++i) {
+                    delta->buffer[i] = (uint8_t) (delta->buffer[i] + bytes[i]);
+                }
+                result = sink(sink_arg, delta->buffer, chunk);
+            }
+            delta->base_offset += chunk;
+        }
+        if (result) {
+            return result;
+        }
+        bytes += chunk;
+        length -= chunk;
+        delta->remaining -= (uint32_t) chunk;
+        if (!delta->remaining) {
+            delta->op = 0;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+int
+fw_delta_finish(const fw_delta_t *delta) {
+    if (!delta->preamble_done || delta->op || delta->pending_size) {
+        firmware_delta_log(ERROR, "delta truncated");
+        return ANJAY_FW_UPDATE_ERR_INTEGRITY_FAILURE;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+encode_record(uint8_t op,
+              uint64_t base_offset,
+              const uint8_t *payload,
+              size_t length,
+              fw_delta_sink_t *sink,
+              void *sink_arg) {
+    while (length) {
+        uint32_t chunk = length < FW_DELTA_ENCODE_MAX_RECORD
+                                 ? (uint32_t) length
+                                 : FW_DELTA_ENCODE_MAX_RECORD;
+        uint8_t header[FW_DELTA_RECORD_HEADER_MAX];
+        size_t header_size = record_header_size(op);
+        header[0] = op;
+        if (op == FW_DELTA_INSERT) {
+            write_u32_be(&header[1], chunk);
+        } else {
+            write_u64_be(&header[1], base_offset);
+            write_u32_be(&header[9], chunk);
+        }
+        int result = sink(sink_arg, header, header_size);
+        if (!result && payload) {
+            result = sink(sink_arg, payload, chunk);
+        }
+        if (result) {
+            return result;
+        }
+        base_offset += chunk;
+        if (payload) {
+            payload += chunk;
+        }
+        length -= chunk;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+encode_data(const uint8_t *base,
+            size_t base_size,
+            size_t base_offset,
+            const uint8_t *data,
+            size_t length,
+            fw_delta_sink_t *sink,
+            void *sink_arg) {
+    if (!length) {
+        return 0;
+    }
+    // data in place of an old base region is sent as byte differences,
+    // which are mostly zeros and compress well; new data is sent as is
+    if (base_offset + length > base_size) {
+        return encode_record(FW_DELTA_INSERT, 0, data, length, sink, sink_arg);
+    }
+    uint8_t *diff = (uint8_t *) avs_malloc(length);
+    if (!diff) {
+        return -1;
+    }
+    size_t zeros = 0;
+    for (size_t i = 0; i < length; ++i) {
+        diff[i] = (uint8_t) (data[i] - base[base_offset + i]);
+        zeros += !diff[i];
+    }
+    int result = zeros * 2 >= length
+                         ? encode_record(FW_DELTA_ADD, base_offset, diff, length,
+                                         sink, sink_arg)
+                         : encode_record(FW_DELTA_INSERT, 0, data, length,
+                                         sink, sink_arg);
+    avs_free(diff);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+int
+fw_delta_encode(const uint8_t *base,
+                size_t base_size,
+                const uint8_t *image,
+                size_t image_size,
+                fw_delta_sink_t *sink,
+                void *sink_arg) {
+    uint8_t preamble[FW_DELTA_PREAMBLE_SIZE];
+    memcpy(preamble, FW_DELTA_MAGIC, FW_DELTA_MAGIC_SIZE);
+    write_u64_be(&preamble[4], base_size);
+    write_u32_be(&preamble[12], crc32c_update(0, base, base_size));
+    int result = sink(sink_arg, preamble, sizeof(preamble));
+    if (result) {
+        return result;
+    }
+
+    // index of base blocks, entries hold offset + 1, 0 marks empty slot
+    size_t table_size = 1024;
+    while (table_size < 2 * (base_size / FW_DELTA_ENCODE_BLOCK)) {
+        table_size *= 2;
+    }
+    size_t *table = (size_t *) avs_calloc(table_size, sizeof(size_t));
+    if (!table) {
+        return -1;
+    }
+    for (size_t offset = 0; offset + FW_DELTA_ENCODE_BLOCK <= base_size;
+         offset += FW_DELTA_ENCODE_BLOCK) {
+        uint32_t hash = crc32c_update(0, base + offset, FW_DELTA_ENCODE_BLOCK);
+        table[hash & (table_size - 1)] = offset + 1;
+    }
+
+    size_t position = 0;
+    size_t data_start = 0;      // first image byte not covered by records
+    size_t expected_base = 0;   // base position following the last match
+    while (!result && position + FW_DELTA_ENCODE_BLOCK <= image_size) {
+        uint32_t hash = crc32c_update(0, image + position, FW_DELTA_ENCODE_BLOCK);
+        size_t candidate = table[hash & (table_size - 1)];
+        if (!candidate
+                || memcmp(base + candidate - 1, image + position,
+                          FW_DELTA_ENCODE_BLOCK)) {
+            ++position;
+            continue;
+        }
+
+        size_t match_image = position;
+        size_t match_base = candidate - 1;
+        while (match_image > data_start && match_base > 0
+               && image[match_image - 1] == base[match_base - 1]) {
+            --match_image;
+            --match_base;
+        }
+        size_t match_length = position - match_image + FW_DELTA_ENCODE_BLOCK;
+        while (match_image + match_length < image_size
+               && match_base + match_length < base_size
+               && image[match_image + match_length]
+                          == base[match_base + match_length]) {
+            ++match_length;
+        }
+        if (match_length < FW_DELTA_ENCODE_MIN_MATCH) {
+            ++position;
+            continue;
+        }
+
+        if (!(result = encode_data(base, base_size, expected_base,
+                                   image + data_start, match_image - data_start,
+                                   sink, sink_arg))) {
+            result = encode_record(FW_DELTA_COPY, match_base, NULL, match_length,
+                                   sink, sink_arg);
+        }
+        position = match_image + match_length;
+        data_start = position;
+        expected_base = match_base + match_length;
+    }
+    if (!result) {
+        result = encode_data(base, base_size, expected_base, image + data_start,
+                             image_size - data_start, sink, sink_arg);
+    }
+    avs_free(table);
+    return result;
+}
@@ -0,0 +1,400 @@
+#include "firmware_package.h"
+
+#include <string.h>
+
+#include <anjay/fw_update.h>
+#include <avsystem/commons/persistence.h>
+#include <avsystem/commons/log.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+#define firmware_package_log(level, ...) avs_log(toyota_fw_package, level, __VA_ARGS__)
+
+static uint64_t
+read_u64_be(const uint8_t *bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+static void
+write_u64_be(uint8_t *bytes, uint64_t value) {
+    for (int i = 7; i >= 0; --i) {
+        bytes[i] = (uint8_t) value;
+        value >>= 8;
+    }
+}
+
+static uint16_t
+read_u16_be(const uint8_t *bytes) {
+    return (uint16_t) (bytes[0] << 8 | bytes[1]);
+}
+
+void
+fw_package_reset(fw_package_t *package, const char *delta_base) {
+    memset(package, 0, sizeof(*package));
+    sha256_init(&package->sha);
+    package->delta_base = delta_base;
+}
+
+void
+fw_package_release(fw_package_t *package) {
+    if (package->delta.base_open) {
+        fw_delta_close(&package->delta);
+    }
+    if (package->decompress.type != FW_COMPRESSION_NONE) {
+        fw_decompress_close(&package->decompress);
+    }
+}
+
+bool
+fw_package_resumable(const fw_package_t *package) {
+    return !(package->flags & FW_PACKAGE_FLAG_DELTA)
+           && package->decompress.type == FW_COMPRESSION_NONE;
+}
+
+static int
+parse_header(fw_package_t *package) {
+    const uint8_t *header = package->header;
+    if (header[4] != FW_PACKAGE_VERSION) {
+        firmware_package_log(ERROR, "unsupported package version %u",
+                             (unsigned) header[4]);
+        return ANJAY_FW_UPDATE_ERR_UNSUPPORTED_PACKAGE_TYPE;
+    }
+
+    package->digest_type = (fw_digest_type_t) header[5];
+    if (package->digest_type != FW_DIGEST_NONE
+            && package->digest_type != FW_DIGEST_CRC32C
+            && package->digest_type != FW_DIGEST_SHA256) {
+        firmware_package_log(ERROR, "unsupported digest type %u",
+                             (unsigned) header[5]);
+        return ANJAY_FW_UPDATE_ERR_UNSUPPORTED_PACKAGE_TYPE;
+    }
+    package->flags = read_u16_be(&header[6]);
+    if (package->flags & ~FW_PACKAGE_FLAG_DELTA) {
+        firmware_package_log(ERROR, "unsupported package flags 0x%04x",
+                             (unsigned) package->flags);
+        return ANJAY_FW_UPDATE_ERR_UNSUPPORTED_PACKAGE_TYPE;
+    }
+    package->image_size = read_u64_be(&header[8]);
+    memcpy(package->expected_digest, &header[16], SHA256_DIGEST_SIZE);
+
+    firmware_package_log(INFO, "package: image of %llu bytes, digest type %d%s",
+                         (unsigned long long) package->image_size,
+                         (int) package->digest_type,
+                         (package->flags & FW_PACKAGE_FLAG_DELTA) ? ", delta" : "");
+    if (package->flags & FW_PACKAGE_FLAG_DELTA) {
+        if (!package->delta_base) {
+            firmware_package_log(ERROR, "delta packages are not accepted");
+            return ANJAY_FW_UPDATE_ERR_UNSUPPORTED_PACKAGE_TYPE;
+        }
+        return fw_delta_open(&package->delta, package->delta_base);
+    }
+    return 0;
+}
+
+static int
+emit_image(fw_package_t *package,
+           const void *data,
+           size_t length,
+           fw_package_sink_t *sink,
+           void *sink_arg) {
+    if (!length) {
+        return 0;
+    }
+    if (!package->legacy
+            && length > package->image_size - package->image_received) {
+        firmware_package_log(ERROR, "package is longer than declared image size");
+        return ANJAY_FW_UPDATE_ERR_INTEGRITY_FAILURE;
+    }
+
+    // digest is updated while the block is hot in cache, so the image is
+    // never read back from storage for verification; CRC32C is kept for
+    // every package, it also validates stored prefix on resume
+    package->crc = crc32c_update(package->crc, data, length);
+    if (package->digest_type == FW_DIGEST_SHA256) {
+        sha256_update(&package->sha, data, length);
+    }
+    package->image_received += length;
+    return sink(sink_arg, data, length);
+}
+
+typedef struct {
+    fw_package_t *package;
+    fw_package_sink_t *sink;
+    void *sink_arg;
+} stage_output_t;
+
+static int
+delta_output_sink(void *output_, const void *data, size_t length) {
+    stage_output_t *output = (stage_output_t *) output_;
+    return emit_image(output->package, data, length, output->sink,
+                      output->sink_arg);
+}
+
+static int
+emit_plain(fw_package_t *package,
+           const void *data,
+           size_t length,
+           fw_package_sink_t *sink,
+           void *sink_arg) {
+    if (package->flags & FW_PACKAGE_FLAG_DELTA) {
+        stage_output_t output = { package, sink, sink_arg };
+        return fw_delta_write(&package->delta, data, length,
+                              delta_output_sink, &output);
+    }
+    return emit_image(package, data, length, sink, sink_arg);
+}
+
+static int
+decompress_output_sink(void *output_, const void *data, size_t length) {
+    stage_output_t *output = (stage_output_t *) output_;
+    return emit_plain(output->package, data, length, output->sink,
+                      output->sink_arg);
+}
+
+static int
+decode_payload(fw_package_t *package,
+               const void *data,
+               size_t length,
+               fw_package_sink_t *sink,
+               void *sink_arg) {
+    if (!length) {
+        return 0;
+    }
+    if (package->decompress.type != FW_COMPRESSION_NONE) {
+        stage_output_t output = { package, sink, sink_arg };
+        return fw_decompress_write(&package->decompress, data, length,
+                                   decompress_output_sink, &output);
+    }
+    return emit_plain(package, data, length, sink, sink_arg);
+}
+
+static int
+detect_payload(fw_package_t *package, fw_package_sink_t *sink, void *sink_arg) {
+    package->payload_detected = true;
+    fw_compression_t compression = FW_COMPRESSION_NONE;
+    if (package->magic_received == FW_COMPRESS_MAGIC_SIZE) {
+        compression = fw_compression_detect(package->payload_magic);
+    }
+    if (compression != FW_COMPRESSION_NONE) {
+        int result = fw_decompress_open(&package->decompress, compression);
+        if (result) {
+            return result;
+        }
+    }
+    return decode_payload(package, package->payload_magic,
+                          package->magic_received, sink, sink_arg);
+}
+
+// payload goes through decompression, delta and digest stages, every one
+// of them works on bounded chunks, so the image is produced in one pass
+static int
+emit_payload(fw_package_t *package,
+             const void *data,
+             size_t length,
+             fw_package_sink_t *sink,
+             void *sink_arg) {
+    const uint8_t *bytes = (const uint8_t *) data;
+    package->payload_received += length;
+
+    if (!package->payload_detected && length) {
+        size_t chunk = FW_COMPRESS_MAGIC_SIZE - package->magic_received;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(package->payload_magic + package->magic_received, bytes, chunk);
+        package->magic_received += chunk;
+        bytes += chunk;
+        length -= chunk;
+        if (package->magic_received < FW_COMPRESS_MAGIC_SIZE) {
+            return 0;
+        }
+        int result = detect_payload(package, sink, sink_arg);
+        if (result) {
+            return result;
+        }
+    }
+    return decode_payload(package, bytes, length, sink, sink_arg);
+}
+
+int
+fw_package_write(fw_package_t *package,
+                 const void *data,
+                 size_t length,
+                 fw_package_sink_t *sink,
+                 void *sink_arg) {
+    const uint8_t *bytes = (const uint8_t *) data;
+
+    while (!package->header_done && length) {
+        size_t chunk = FW_PACKAGE_HEADER_SIZE - package->header_received;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(package->header + package->header_received, bytes, chunk);
+        package->header_received += chunk;
+        bytes += chunk;
+        length -= chunk;
+
+        size_t magic_received = package->header_received < FW_PACKAGE_MAGIC_SIZE
+                                        ? package->header_received
+                                        : FW_PACKAGE_MAGIC_SIZE;
+        if (memcmp(package->header, FW_PACKAGE_MAGIC, magic_received)) {
+            firmware_package_log(WARNING, "package without header, "
+                                 "image integrity will not be verified");
+            package->legacy = true;
+            package->header_done = true;
+            int result = emit_payload(package, package->header,
+                                      package->header_received, sink, sink_arg);
+            if (result) {
+                return result;
+            }
+        } else if (package->header_received == FW_PACKAGE_HEADER_SIZE) {
+            int result = parse_header(package);
+            if (result) {
+                return result;
+            }
+            package->header_done = true;
+        }
+    }
+
+    return emit_payload(package, bytes, length, sink, sink_arg);
+}
+
+int
+fw_package_finish(fw_package_t *package,
+                  fw_package_sink_t *sink,
+                  void *sink_arg) {
+    int result = 0;
+    if (!package->header_done) {
+        if (package->header_received >= FW_PACKAGE_MAGIC_SIZE) {
+            firmware_package_log(ERROR, "package truncated inside header");
+            return ANJAY_FW_UPDATE_ERR_INTEGRITY_FAILURE;
+        }
+        // too short to carry a header, treat it as a tiny raw image
+        package->legacy = true;
+        package->header_done = true;
+        if ((result = emit_payload(package, package->header,
+                                   package->header_received, sink, sink_arg))) {
+            return result;
+        }
+    }
+    if (!package->payload_detected
+            && (result = detect_payload(package, sink, sink_arg))) {
+        return result;
+    }
+    if (package->decompress.type != FW_COMPRESSION_NONE
+            && (result = fw_decompress_finish(&package->decompress))) {
+        return result;
+    }
+    if (package->flags & FW_PACKAGE_FLAG_DELTA
+            && (result = fw_delta_finish(&package->delta))) {
+        return result;
+    }
+    if (package->legacy) {
+        return 0;
+    }
+
+    if (package->image_received != package->image_size) {
+        firmware_package_log(ERROR, "image truncated: %llu of %llu bytes",
+                             (unsigned long long) package->image_received,
+                             (unsigned long long) package->image_size);
+        return ANJAY_FW_UPDATE_ERR_INTEGRITY_FAILURE;
+    }
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    memset(digest, 0, sizeof(digest));
+    size_t digest_size = 0;
+    switch (package->digest_type) {
+    case FW_DIGEST_CRC32C:
+        digest[0] = (uint8_t) (package->crc >> 24);
+        digest[1] = (uint8_t) (package->crc >> 16);
+        digest[2] = (uint8_t) (package->crc >> 8);
+        digest[3] = (uint8_t) package->crc;
+        digest_size = 4;
+        break;
+    case FW_DIGEST_SHA256:
+        sha256_final(&package->sha, digest);
+        digest_size = SHA256_DIGEST_SIZE;
+        break;
+    default:
+        firmware_package_log(WARNING, "package carries no digest");
+        return 0;
+    }
+
+    if (memcmp(digest, package->expected_digest, digest_size)) {
+        firmware_package_log(ERROR, "image digest mismatch");
+        return ANJAY_FW_UPDATE_ERR_INTEGRITY_FAILURE;
+    }
+    firmware_package_log(INFO, "image digest verified");
+    return 0;
+}
+
+uint64_t
+fw_package_offset(const fw_package_t *package) {
+    // header bytes of a legacy image are counted as image bytes
+    return (package->legacy ? 0 : package->header_received)
+           + package->payload_received;
+}
+
+int
+fw_package_persistence(avs_persistence_context_t *ctx, fw_package_t *package) {
+    uint32_t header_received = (uint32_t) package->header_received;
+    uint8_t digest_type = (uint8_t) package->digest_type;
+    uint32_t sha_buffered = (uint32_t) package->sha.buffered;
+    if (!fw_package_resumable(package)) {
+        return -1;
+    }
+
+    // the same sequence serves both store and restore contexts
+    int result = avs_persistence_bytes(ctx, package->header, sizeof(package->header))
+                 || avs_persistence_u32(ctx, &header_received)
+                 || avs_persistence_bool(ctx, &package->header_done)
+                 || avs_persistence_bool(ctx, &package->legacy)
+                 || avs_persistence_bool(ctx, &package->payload_detected)
+                 || avs_persistence_bytes(ctx, &digest_type, 1)
+                 || avs_persistence_bytes(ctx, package->expected_digest,
+                                          sizeof(package->expected_digest))
+                 || avs_persistence_u16(ctx, &package->flags)
+                 || avs_persistence_u64(ctx, &package->image_size)
+                 || avs_persistence_u64(ctx, &package->payload_received)
+                 || avs_persistence_u64(ctx, &package->image_received)
+                 || avs_persistence_u32(ctx, &package->crc)
+                 || avs_persistence_u64(ctx, &package->sha.length)
+                 || avs_persistence_bytes(ctx, package->sha.buffer,
+                                          sizeof(package->sha.buffer))
+                 || avs_persistence_u32(ctx, &sha_buffered);
+    for (size_t i = 0; !result && i < ARRAY_SIZE(package->sha.state); ++i) {
+        result = avs_persistence_u32(ctx, &package->sha.state[i]);
+    }
+    if (result || header_received > FW_PACKAGE_HEADER_SIZE
+            || digest_type > FW_DIGEST_SHA256
+            || sha_buffered >= SHA256_BLOCK_SIZE
+            || !fw_package_resumable(package)) {
+        return -1;
+    }
+    package->header_received = header_received;
+    package->digest_type = (fw_digest_type_t) digest_type;
+    package->sha.buffered = sha_buffered;
+    return 0;
+}
+
+void
+fw_package_encode_header(uint8_t out[FW_PACKAGE_HEADER_SIZE],
+                         fw_digest_type_t digest_type,
+                         uint16_t flags,
+                         uint64_t image_size,
+                         const uint8_t *digest) {
+    memset(out, 0, FW_PACKAGE_HEADER_SIZE);
+    memcpy(out, FW_PACKAGE_MAGIC, FW_PACKAGE_MAGIC_SIZE);
+    out[4] = FW_PACKAGE_VERSION;
+    out[5] = (uint8_t) digest_type;
+    out[6] = (uint8_t) (flags >> 8);
+    out[7] = (uint8_t) flags;
+    write_u64_be(&out[8], image_size);
+    if (digest) {
+        memcpy(&out[16], digest,
+               digest_type == FW_DIGEST_CRC32C ? 4 : SHA256_DIGEST_SIZE);
+    }
+}
@@ -1,7 +1,9 @@
-#define  _BSD_SOURCE
+#define  _GNU_SOURCE
 #include "firmware_update.h"
 
+#include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -19,6 +21,7 @@
 #include <anjay/dm.h>
 #include <toyota_client.h>
 #include <toyota_utils.h>
+#include <toyota_metrics.h>
 
 #define FORCE_ERROR_OUT_OF_MEMORY 1
 #define FORCE_ERROR_FAILED_UPDATE 2
@@ -26,6 +29,12 @@
 #define FIRMWARE_UPDATE_PACKAGE_NAME        "Toyota_FW"                // name of firmware update package
 #define FIRMWARE_UPDATE_PACKAGE_VERSION     "1.0"                      // version of firmware update package
 #define FIRMWARE_UPDATE_RANDOM_FILE_PATH    "/tmp/toyota_fw-XXXXXX"    // random file path for firmware update process
+#define FIRMWARE_UPDATE_PREALLOCATION_CHUNK (1024 * 1024)              // target space reserved at once
+#define FIRMWARE_UPDATE_CHECKPOINT_INTERVAL (256 * 1024)               // image bytes between checkpoints
+#define FIRMWARE_UPDATE_CHECKPOINT_SUFFIX   ".ckpt"                    // checkpoint file name suffix
+#define FIRMWARE_UPDATE_CHECKPOINT_VERSION  1                          // checkpoint file format version
+#define FIRMWARE_UPDATE_VERIFY_CHUNK        (64 * 1024)                // read size of prefix verification
+#define FIRMWARE_UPDATE_DELTA_BASE          "/proc/self/exe"           // running image, base of delta packages
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 #define firmware_log(level, ...) avs_log(toyota_fw, level, __VA_ARGS__)
@@ -90,7 +99,7 @@ maybe_delete_firmware_file(firmware_update_logic_t *fw_update) {
 void
 firmware_update_set_package_path(firmware_update_logic_t *fw_update,
                                  const char *file_path) {
-    AVS_ASSERT(!fw_update->firmware_update_stream,
+    AVS_ASSERT(fw_update->firmware_update_fd < 0,
                "cannot set package path while a downloading in progress");
     char *new_target_path = avs_strdup(file_path);
     if (!new_target_path) {
@@ -104,104 +113,316 @@ firmware_update_set_package_path(firmware_update_logic_t *fw_update,
                  fw_update->administratively_set_target_path);
 }
 
+static const char *
+delta_base_path(const firmware_update_logic_t *fw_update) {
+    return fw_update->delta_base_path ? fw_update->delta_base_path
+                                      : FIRMWARE_UPDATE_DELTA_BASE;
+}
+
+void
+firmware_update_set_delta_base(firmware_update_logic_t *fw_update,
+                               const char *file_path) {
+    AVS_ASSERT(fw_update->firmware_update_fd < 0,
+               "cannot set delta base while a downloading in progress");
+    char *new_base_path = NULL;
+    if (file_path && !(new_base_path = avs_strdup(file_path))) {
+        firmware_log(ERROR, "out of memory");
+        return;
+    }
+    avs_free(fw_update->delta_base_path);
+    fw_update->delta_base_path = new_base_path;
+}
+
+void
+firmware_update_set_checkpoint_interval(firmware_update_logic_t *fw_update,
+                                        size_t interval) {
+    fw_update->checkpoint_interval = interval;
+}
+
+void
+firmware_update_set_restart_handler(firmware_update_logic_t *fw_update,
+                                    firmware_update_restart_handler_t *handler,
+                                    void *arg) {
+    fw_update->restart_handler = handler;
+    fw_update->restart_handler_arg = arg;
+}
+
 static int
-copy_file_content(FILE *destination, FILE *source) {
-    while (!feof(source)) {
-        char buffer[4096];
+open_firmware_target(firmware_update_logic_t *fw_update, int flags) {
+    assert(fw_update->firmware_update_fd < 0);
+    fw_update->firmware_update_fd =
+            open(fw_update->next_target_path, O_WRONLY | O_CLOEXEC | flags, 0600);
+    if (fw_update->firmware_update_fd < 0) {
+        firmware_log(ERROR, "could not open file %s: %s",
+                     fw_update->next_target_path, strerror(errno));
+        return -1;
+    }
+    fw_update->write_offset = 0;
+    fw_update->preallocated_size = 0;
+    fw_update->preallocation_supported = true;
+    fw_update->checkpoint_offset = 0;
+    return 0;
+}
 
-        size_t bytes_read = fread(buffer, 1, sizeof(buffer), source);
-        if (bytes_read == 0 && ferror(source)) {
-            firmware_log(ERROR, "could not read data from source file");
-            return -1;
-        }
+static void
+close_firmware_target(firmware_update_logic_t *fw_update) {
+    if (fw_update->firmware_update_fd >= 0) {
+        close(fw_update->firmware_update_fd);
+        fw_update->firmware_update_fd = -1;
+    }
+}
+
+static void
+preallocate_firmware_target(firmware_update_logic_t *fw_update, size_t end) {
+    if (!fw_update->preallocation_supported
+            || end <= fw_update->preallocated_size) {
+        return;
+    }
+    // reserve space in big chunks, so the filesystem lays out the image
+    // contiguously; file size still grows only with written data, which
+    // keeps download progress observable by file size
+    size_t new_size = end + FIRMWARE_UPDATE_PREALLOCATION_CHUNK
+                      - end % FIRMWARE_UPDATE_PREALLOCATION_CHUNK;
+    if (fallocate(fw_update->firmware_update_fd, FALLOC_FL_KEEP_SIZE,
+                  (off_t) fw_update->preallocated_size,
+                  (off_t) (new_size - fw_update->preallocated_size))) {
+        firmware_log(DEBUG, "fallocate not available (%s), writing without "
+                     "preallocation", strerror(errno));
+        fw_update->preallocation_supported = false;
+        return;
+    }
+    fw_update->preallocated_size = new_size;
+}
 
-        if (fwrite(buffer, 1, bytes_read, destination) != bytes_read) {
-            firmware_log(ERROR, "could not write data to destination file");
+static int
+write_firmware_block(firmware_update_logic_t *fw_update,
+                     const void *data,
+                     size_t length) {
+    preallocate_firmware_target(fw_update, fw_update->write_offset + length);
+
+    // one pwrite() per block, page cache makes the data visible at once
+    const char *bytes = (const char *) data;
+    while (length) {
+        ssize_t written = pwrite(fw_update->firmware_update_fd, bytes, length,
+                                 (off_t) fw_update->write_offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            firmware_log(ERROR, "pwrite failed: %s", strerror(errno));
             return -1;
         }
+        bytes += written;
+        length -= (size_t) written;
+        fw_update->write_offset += (size_t) written;
     }
-
-    firmware_log(INFO, "successfully copy content from source file to destination file");
     return 0;
 }
 
 static int
-unpack_firmware_to_file(const char *fw_package_path,
-                        const char *target_path) {
-    int result = -1;
-    FILE *firmware = fopen(fw_package_path, "rb");
-    FILE *temporary = NULL;
-
-    if (!firmware) {
-        firmware_log(ERROR, "could not open file %s", fw_package_path);
-        goto cleanup;
+firmware_image_sink(void *fw_, const void *data, size_t length) {
+    if (write_firmware_block((firmware_update_logic_t *) fw_, data, length)) {
+        return ANJAY_FW_UPDATE_ERR_NOT_ENOUGH_SPACE;
     }
+    return 0;
+}
 
-    temporary = fopen(target_path, "wb");
-    if (!temporary) {
-        firmware_log(ERROR, "could not open file: %s", target_path);
-        goto cleanup;
+static int
+finalize_firmware_target(firmware_update_logic_t *fw_update) {
+    int fd = fw_update->firmware_update_fd;
+    // release preallocated space past the image, make it durable and
+    // executable in place - no second copy of the image is made
+    if (ftruncate(fd, (off_t) fw_update->write_offset)
+            || fdatasync(fd)
+            || fchmod(fd, 0700)) {
+        firmware_log(ERROR, "could not finalize %s: %s",
+                     fw_update->next_target_path, strerror(errno));
+        close_firmware_target(fw_update);
+        return -1;
     }
-    result = copy_file_content(temporary, firmware);
+    close_firmware_target(fw_update);
+    firmware_log(DEBUG, "firmware image of %zu bytes stored in %s",
+                 fw_update->write_offset, fw_update->next_target_path);
+    return 0;
+}
+
+static char *
+concat_path(const char *path, const char *suffix) {
+    size_t path_length = strlen(path);
+    size_t suffix_length = strlen(suffix);
+    char *result = (char *) avs_malloc(path_length + suffix_length + 1);
     if (result) {
-        firmware_log(ERROR, "could not copy firmware from %s to %s", fw_package_path,
-                     target_path);
-        goto cleanup;
+        memcpy(result, path, path_length);
+        memcpy(result + path_length, suffix, suffix_length + 1);
     }
+    return result;
+}
 
-    result = 0;
+static int
+sync_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
 
-cleanup:
-    if (firmware) {
-        firmware_log(DEBUG, "close firmware file");
-        fclose(firmware);
+static int
+checkpoint_persistence(avs_persistence_context_t *ctx,
+                       firmware_update_logic_t *fw_update,
+                       uint64_t *image_offset) {
+    uint32_t version = FIRMWARE_UPDATE_CHECKPOINT_VERSION;
+    if (avs_persistence_u32(ctx, &version)
+            || version != FIRMWARE_UPDATE_CHECKPOINT_VERSION
+            || avs_persistence_u64(ctx, image_offset)
+            || fw_package_persistence(ctx, &fw_update->package)) {
+        return -1;
     }
-    if (temporary) {
-        firmware_log(DEBUG, "close temporary file");
-        fclose(temporary);
+    return 0;
+}
+
+static void
+delete_checkpoint_file(const firmware_update_logic_t *fw_update) {
+    if (fw_update->checkpoint_file) {
+        unlink(fw_update->checkpoint_file);
     }
-    return result;
 }
 
 static int
-unpack_firmware_in_place(firmware_update_logic_t *firmware_update) {
-    char *temporary_path = generate_random_target_filepath();
-    if (!temporary_path) {
-        firmware_log(ERROR, "could not generate temporary file to unpack firmware");
+write_checkpoint(firmware_update_logic_t *fw_update) {
+    // group commit: a single fdatasync makes all blocks since the previous
+    // checkpoint durable, then the checkpoint is replaced atomically, so it
+    // never describes data that could still be lost
+    if (fdatasync(fw_update->firmware_update_fd)) {
+        firmware_log(WARNING, "fdatasync failed: %s", strerror(errno));
         return -1;
     }
 
-    int result =
-            unpack_firmware_to_file(firmware_update->next_target_path,
-                                    temporary_path);
+    char *tmp_path = concat_path(fw_update->checkpoint_file, ".tmp");
+    if (!tmp_path) {
+        firmware_log(ERROR, "out of memory");
+        return -1;
+    }
+    avs_stream_abstract_t *stream = NULL;
+    avs_persistence_context_t *ctx = NULL;
+    uint64_t image_offset = fw_update->write_offset;
+    int result = 0;
+    if (!(stream = avs_stream_file_create(tmp_path, AVS_STREAM_FILE_WRITE))
+            || !(ctx = avs_persistence_store_context_new(stream))
+            || checkpoint_persistence(ctx, fw_update, &image_offset)) {
+        result = -1;
+    }
+    if (ctx) {
+        avs_persistence_context_delete(ctx);
+    }
+    if (stream) {
+        avs_stream_cleanup(&stream);
+    }
+    if (!result && (sync_file(tmp_path)
+                    || rename(tmp_path, fw_update->checkpoint_file))) {
+        result = -1;
+    }
     if (result) {
-        goto cleanup;
+        firmware_log(WARNING, "could not write download checkpoint");
+        unlink(tmp_path);
+    } else {
+        fw_update->checkpoint_offset = fw_update->write_offset;
+        firmware_log(DEBUG, "download checkpoint at %zu bytes",
+                     fw_update->write_offset);
     }
+    avs_free(tmp_path);
+    return result;
+}
 
-    if ((result = rename(temporary_path, firmware_update->next_target_path)) ==-1) {
-        firmware_log(ERROR, "сould not rename %s to %s: %s", temporary_path,
-                     firmware_update->next_target_path, strerror(errno));
-        goto cleanup;
+static int
+verify_stored_prefix(firmware_update_logic_t *fw_update, uint64_t length) {
+    char *buffer = (char *) avs_malloc(FIRMWARE_UPDATE_VERIFY_CHUNK);
+    if (!buffer) {
+        return -1;
     }
-    if ((result = chmod(firmware_update->next_target_path, 0700)) == -1) {
-        firmware_log(ERROR, "сould not set permissions for %s: %s",
-                     firmware_update->next_target_path, strerror(errno));
-        goto cleanup;
+    uint32_t crc = 0;
+    uint64_t offset = 0;
+    while (offset < length) {
+        size_t chunk = length - offset < FIRMWARE_UPDATE_VERIFY_CHUNK
+                               ? (size_t) (length - offset)
+                               : FIRMWARE_UPDATE_VERIFY_CHUNK;
+        ssize_t got = pread(fw_update->firmware_update_fd, buffer, chunk,
+                            (off_t) offset);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        crc = crc32c_update(crc, buffer, (size_t) got);
+        offset += (uint64_t) got;
     }
+    avs_free(buffer);
+    return offset == length && crc == fw_update->package.crc ? 0 : -1;
+}
 
-cleanup:
-    unlink(temporary_path);
-    avs_free(temporary_path);
+static int
+restore_checkpoint(firmware_update_logic_t *fw_update, size_t *out_resume_offset) {
+    avs_stream_abstract_t *stream = NULL;
+    avs_persistence_context_t *ctx = NULL;
+    uint64_t image_offset = 0;
+    int result = 0;
+    fw_package_reset(&fw_update->package, delta_base_path(fw_update));
+    if (!fw_update->checkpoint_file
+            || !(stream = avs_stream_file_create(fw_update->checkpoint_file,
+                                                 AVS_STREAM_FILE_READ))
+            || !(ctx = avs_persistence_restore_context_new(stream))
+            || checkpoint_persistence(ctx, fw_update, &image_offset)
+            || image_offset != fw_update->package.image_received) {
+        result = -1;
+    }
+    if (ctx) {
+        avs_persistence_context_delete(ctx);
+    }
+    if (stream) {
+        avs_stream_cleanup(&stream);
+    }
     if (result) {
-        maybe_delete_firmware_file(firmware_update);
+        delete_checkpoint_file(fw_update);
+        fw_package_reset(&fw_update->package, delta_base_path(fw_update));
+        return -1;
     }
 
-    return result;
+    // the checkpoint covers only data made durable before it was written;
+    // anything after it is dropped, the prefix is checked against its CRC.
+    // A valid checkpoint stays on disk until write_checkpoint() replaces it,
+    // so another crash before the next checkpoint resumes from it again.
+    if (open_firmware_target(fw_update, 0)
+            || verify_stored_prefix(fw_update, image_offset)
+            || ftruncate(fw_update->firmware_update_fd, (off_t) image_offset)) {
+        firmware_log(WARNING, "stored firmware prefix does not match checkpoint");
+        delete_checkpoint_file(fw_update);
+        close_firmware_target(fw_update);
+        fw_package_reset(&fw_update->package, delta_base_path(fw_update));
+        return -1;
+    }
+    fw_update->write_offset = (size_t) image_offset;
+    fw_update->preallocated_size = (size_t) image_offset;
+    fw_update->checkpoint_offset = (size_t) image_offset;
+    *out_resume_offset = (size_t) fw_package_offset(&fw_update->package);
+    firmware_log(INFO, "resuming firmware download at %zu bytes",
+                 *out_resume_offset);
+    return 0;
 }
 
 static int preprocess_firmware(firmware_update_logic_t *fw_update) {
-    if (unpack_firmware_in_place(fw_update)) {
-        return ANJAY_FW_UPDATE_ERR_UNSUPPORTED_PACKAGE_TYPE;
+    // digest was computed while the image streamed in, nothing is read back
+    int result = fw_package_finish(&fw_update->package, firmware_image_sink,
+                                   fw_update);
+    fw_package_release(&fw_update->package);
+    if (result) {
+        close_firmware_target(fw_update);
+        return result;
+    }
+    if (finalize_firmware_target(fw_update)) {
+        return ANJAY_FW_UPDATE_ERR_NOT_ENOUGH_SPACE;
     }
 
     firmware_log(INFO, "firmware downloaded successfully");
@@ -260,13 +481,12 @@ static void delete_persistence_file(const firmware_update_logic_t *fw_update) {
 static void fw_reset(void *fw_) {
     firmware_log(DEBUG, "reset firmware update process");
     firmware_update_logic_t *fw_update = (firmware_update_logic_t *) fw_;
-    if (fw_update->firmware_update_stream) {
-        fclose(fw_update->firmware_update_stream);
-        fw_update->firmware_update_stream = NULL;
-    }
+    close_firmware_target(fw_update);
+    fw_package_release(&fw_update->package);
     avs_free(fw_update->package_uri);
     fw_update->package_uri = NULL;
     maybe_delete_firmware_file(fw_update);
+    delete_checkpoint_file(fw_update);
     delete_persistence_file(fw_update);
 }
 
@@ -276,7 +496,7 @@ static int fw_stream_open(void *fw_,
     (void) package_uri;
     (void) package_etag;
     firmware_update_logic_t *fw_update = (firmware_update_logic_t *) fw_;
-    assert(!fw_update->firmware_update_stream);
+    assert(fw_update->firmware_update_fd < 0);
     firmware_log(INFO, "open firmware update stream");
     char *uri = NULL;
     if (package_uri && !(uri = avs_strdup(package_uri))) {
@@ -289,11 +509,13 @@ static int fw_stream_open(void *fw_,
         return -1;
     }
 
-    if (!(fw_update->firmware_update_stream = fopen(fw_update->next_target_path, "wb"))) {
-        firmware_log(ERROR, "could not open file: %s", fw_update->next_target_path);
+    if (open_firmware_target(fw_update, O_CREAT | O_TRUNC)) {
         avs_free(uri);
         return -1;
     }
+    fw_package_release(&fw_update->package);
+    fw_package_reset(&fw_update->package, delta_base_path(fw_update));
+    delete_checkpoint_file(fw_update);
 
     avs_free(fw_update->package_uri);
     fw_update->package_uri = uri;
@@ -311,31 +533,32 @@ static int fw_stream_open(void *fw_,
 
 static int fw_stream_write(void *fw_, const void *data, size_t length) {
     firmware_update_logic_t *fw_update = (firmware_update_logic_t *) fw_;
-    if (!fw_update->firmware_update_stream) {
+    if (fw_update->firmware_update_fd < 0) {
         firmware_log(ERROR, "stream not open");
         return -1;
     }
-    if (length
-            && (fwrite(data, length, 1, fw_update->firmware_update_stream) != 1
-                // Firmware update integration tests measure download
-                // progress by checking file size, so avoiding buffering
-                // is required.
-                || fflush(fw_update->firmware_update_stream) != 0)) {
-        firmware_log(ERROR, "fwrite or fflush failed: %s", strerror(errno));
-        return ANJAY_FW_UPDATE_ERR_NOT_ENOUGH_SPACE;
+    metrics_t *metrics = metrics_current();
+    int64_t start_ns = metrics_start(metrics);
+    int result = fw_package_write(&fw_update->package, data, length,
+                                  firmware_image_sink, fw_update);
+    metrics_stop(metrics, METRIC_FW_WRITE, start_ns);
+    metrics_count(metrics, METRIC_FW_BYTES, length);
+    if (!result && fw_update->checkpoint_interval
+            && fw_package_resumable(&fw_update->package)
+            && fw_update->write_offset - fw_update->checkpoint_offset
+                       >= fw_update->checkpoint_interval) {
+        // failed checkpoint only limits resume, the download goes on
+        write_checkpoint(fw_update);
     }
-
-    return 0;
+    return result;
 }
 
 static int fw_stream_finish(void *fw_) {
     firmware_update_logic_t *fw_update = (firmware_update_logic_t *) fw_;
-    if (!fw_update->firmware_update_stream) {
+    if (fw_update->firmware_update_fd < 0) {
         firmware_log(ERROR, "stream not open");
         return -1;
     }
-    fclose(fw_update->firmware_update_stream);
-    fw_update->firmware_update_stream = NULL;
 
     int result = 0;
     if ((result = preprocess_firmware(fw_update))
@@ -346,6 +569,7 @@ static int fw_stream_finish(void *fw_) {
                         !!fw_update->administratively_set_target_path, NULL))) {
         fw_reset(fw_update);
     }
+    delete_checkpoint_file(fw_update);
     firmware_log(DEBUG, "firmware stream finished");
     return result;
 }
@@ -371,6 +595,9 @@ static int fw_perform_upgrade(void *fw_) {
     }
 
     firmware_log(INFO, "|| =========== FIRMWARE UPDATE STARTED: %s =========== ||", fw_update->next_target_path);
+    if (fw_update->restart_handler) {
+        fw_update->restart_handler(fw_update->restart_handler_arg);
+    }
     execv(fw_update->next_target_path, fw_update->startup_args);
     firmware_log(ERROR, "execv failed (%s)", strerror(errno));
     delete_persistence_file(fw_update);
@@ -386,16 +613,14 @@ static int fw_get_security_info(void *fw_,
     return 0;
 }
 
-static avs_coap_tx_params_t g_tx_params;
-
-static avs_coap_tx_params_t fw_get_coap_tx_params(void *user_ptr,
+static avs_coap_tx_params_t fw_get_coap_tx_params(void *fw_,
                                                   const char *download_uri) {
-    (void) user_ptr;
+    firmware_update_logic_t *fw_update = (firmware_update_logic_t *) fw_;
     (void) download_uri;
-    return g_tx_params;
+    return fw_update->tx_params;
 }
 
-static anjay_fw_update_handlers_t FW_UPDATE_HANDLERS = {
+static const anjay_fw_update_handlers_t FW_UPDATE_HANDLERS = {
     .stream_open = fw_stream_open,
     .stream_write = fw_stream_write,
     .stream_finish = fw_stream_finish,
@@ -522,30 +747,33 @@ int firmware_update_install(anjay_t *anjay,
                             const avs_net_security_info_t *security_info,
                             const avs_coap_tx_params_t *tx_params,
                             const char *const *startup_args) {
+    fw_update->firmware_update_fd = -1;
     fw_update->startup_args = argv_copy(startup_args);
-    if (!fw_update->startup_args) {
-        firmware_log(ERROR, "out of memory");
-        return -1;
-    }
-
     fw_update->persistence_file = avs_strdup(persistence_file);
-    if (!fw_update->persistence_file) {
+    fw_update->checkpoint_file =
+            concat_path(persistence_file, FIRMWARE_UPDATE_CHECKPOINT_SUFFIX);
+    if (!fw_update->startup_args || !fw_update->persistence_file
+            || !fw_update->checkpoint_file) {
         firmware_log(ERROR, "out of memory");
+        firmware_update_destroy(fw_update);
         return -1;
     }
     firmware_log(DEBUG, "persistence file: %s", persistence_file);
+    fw_update->checkpoint_interval = FIRMWARE_UPDATE_CHECKPOINT_INTERVAL;
+    // handlers are kept per instance, so many clients can live in one process
+    fw_update->handlers = FW_UPDATE_HANDLERS;
     if (security_info) {
         memcpy(&fw_update->security_info, security_info, sizeof(fw_update->security_info));
-        FW_UPDATE_HANDLERS.get_security_info = fw_get_security_info;
+        fw_update->handlers.get_security_info = fw_get_security_info;
     } else {
-        FW_UPDATE_HANDLERS.get_security_info = NULL;
+        fw_update->handlers.get_security_info = NULL;
     }
 
     if (tx_params) {
-        g_tx_params = *tx_params;
-        FW_UPDATE_HANDLERS.get_coap_tx_params = fw_get_coap_tx_params;
+        fw_update->tx_params = *tx_params;
+        fw_update->handlers.get_coap_tx_params = fw_get_coap_tx_params;
     } else {
-        FW_UPDATE_HANDLERS.get_coap_tx_params = NULL;
+        fw_update->handlers.get_coap_tx_params = NULL;
     }
 
     persistence_file_data_t data = read_persistence_file(persistence_file);
@@ -566,18 +794,19 @@ int firmware_update_install(anjay_t *anjay,
     };
 
     if (state.result == ANJAY_FW_UPDATE_INITIAL_DOWNLOADING) {
-        long offset;
-        if (!fw_update->next_target_path
-                || !(fw_update->firmware_update_stream = fopen(fw_update->next_target_path, "ab"))
-                || (offset = ftell(fw_update->firmware_update_stream)) < 0) {
-            if (fw_update->firmware_update_stream) {
-                fclose(fw_update->firmware_update_stream);
-                fw_update->firmware_update_stream = NULL;
-            }
+        // without a valid checkpoint the package is fetched again from the
+        // beginning, so that its digest can still be verified
+        if (!fw_update->next_target_path) {
             state.result = ANJAY_FW_UPDATE_INITIAL_NEUTRAL;
-        } else {
-            state.resume_offset = (size_t) offset;
+        } else if (restore_checkpoint(fw_update, &state.resume_offset)) {
+            state.resume_offset = 0;
+            if (open_firmware_target(fw_update, O_TRUNC)) {
+                close_firmware_target(fw_update);
+                state.result = ANJAY_FW_UPDATE_INITIAL_NEUTRAL;
+            }
         }
+    } else {
+        delete_checkpoint_file(fw_update);
     }
     if (state.result >= 0) {
         // we're initializing in the "Idle" state, so the firmware file is not
@@ -586,7 +815,7 @@ int firmware_update_install(anjay_t *anjay,
     }
 
     int result =
-            anjay_fw_update_install(anjay, &FW_UPDATE_HANDLERS, fw_update, &state);
+            anjay_fw_update_install(anjay, &fw_update->handlers, fw_update, &state);
     avs_free(data.uri);
     avs_free(data.etag);
     if (result) {
@@ -597,13 +826,17 @@ int firmware_update_install(anjay_t *anjay,
 
 void firmware_update_destroy(firmware_update_logic_t *fw_update) {
     firmware_log(ERROR, "destroy firmware update");
-    if (fw_update->firmware_update_stream) {
-        fclose(fw_update->firmware_update_stream);
-    }
+    close_firmware_target(fw_update);
+    fw_package_release(&fw_update->package);
     avs_free(fw_update->package_uri);
     avs_free(fw_update->administratively_set_target_path);
+    avs_free(fw_update->delta_base_path);
     avs_free(fw_update->next_target_path);
     avs_free(fw_update->persistence_file);
+    avs_free(fw_update->checkpoint_file);
     argv_free(fw_update->startup_args);
+    // allow safe repeated destroy on error paths
+    memset(fw_update, 0, sizeof(*fw_update));
+    fw_update->firmware_update_fd = -1;
 }
 
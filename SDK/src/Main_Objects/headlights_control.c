@@ -1,4 +1,5 @@
 #include "headlights_control.h"
+#include "object_33205_schema.h"
 #include "sys/stat.h"
 #include "unistd.h"
 #include "assert.h"
@@ -7,22 +8,39 @@
 
 #define headlights_control_log( level, ...) avs_log(toyota_headlights_control, level, __VA_ARGS__)
 
-typedef struct headlights_instance{
-    anjay_iid_t iid;
-    char reserved[10];
-    bool control_state;
-    int64_t brightness;
-    char time[30];
-}headlights_instance_t;
+#define HEADLIGHTS_CONTROL_RESOURCES_NUM 3 // number of resources notified by a plain push
 
-typedef struct{
+// values scanned by bulk reads (state and brightness) are kept in one small
+// array of the instance set
+struct headlights_object {
     const anjay_dm_object_def_t *obj_def;
-    headlights_instance_t headlights;
-}headlights_object_t;
+    anjay_t *anjay;
+
+    object_instances_t instances;           // dense IIDs 0..count-1
+    object_staging_t staging;               // values written by the current transaction
+    actuator_t *actuator;                   // drives committed values, NULL - none
+};
+
+static const object_33205_values_t HEADLIGHTS_CONTROL_DEFAULTS = {
+    // headlights control relay is OFF
+    .control_state = false,
+    // default brightness of the headlights
+    .brightness = 50
+};
+
+//------------------------------------------------------------------------------
+
+static inline headlights_object_t *
+get_object(const anjay_dm_object_def_t *const *obj_ptr) {
+    return AVS_CONTAINER_OF(obj_ptr, headlights_object_t, obj_def);
+}
 
 //------------------------------------------------------------------------------
 
-static headlights_object_t *this = NULL;
+static inline object_33205_values_t *
+values_of(const headlights_object_t *object) {
+    return (object_33205_values_t *) object->instances.values;
+}
 
 //------------------------------------------------------------------------------
 
@@ -33,25 +51,22 @@ int headlights_control_resource_read(anjay_t *anjay,
                                      anjay_rid_t rid,
                                      anjay_output_ctx_t *ctx) {
     (void) anjay;
-    (void) obj_ptr;
-    (void) iid;
 
     headlights_control_log(DEBUG, "Read /%i/%i/%i", HEADLIGHTS_CONTROL_OBJECT_ID, iid, rid);
-    headlights_instance_t *inst = &this->headlights;
-    assert(inst);
+    headlights_object_t *object = get_object(obj_ptr);
+    assert(iid < object->instances.count);
 
-    switch (rid) {
-    case HEADLIGHTS_CONTROL_STATE: {
-        headlights_control_log(DEBUG, "|| === || Read headlights control state value || === ||");
-        return anjay_ret_bool(ctx, inst->control_state);
-    }
-    case HEADLIGHTS_CONTROL_BRIGHTNESS: {
-        headlights_control_log(DEBUG, "|| === || Read headlights control brightness value || === ||");
-        return anjay_ret_i64(ctx, inst->brightness);
+    int result = object_schema_read(&OBJECT_33205_SCHEMA, &values_of(object)[iid],
+                                    rid, ctx);
+    if (result != OBJECT_SCHEMA_CUSTOM) {
+        return result;
     }
+
+    switch (rid) {
     case HEADLIGHTS_CONTROL_TIME_STAMP: {
         headlights_control_log(DEBUG, "|| === || Read headlights control time stamp value || === ||");
-        return anjay_ret_string(ctx, get_current_time());
+        return anjay_ret_string(ctx, timestamp_format(&object->instances.changed_at[iid],
+                                                     &object->instances.changed_at_text[iid]));
     }
     default:
     return ANJAY_ERR_NOT_FOUND;
@@ -67,141 +82,287 @@ int headlights_control_resource_write(anjay_t *anjay,
                                       anjay_rid_t rid,
                                       anjay_input_ctx_t *ctx) {
     (void) anjay;
-    (void) obj_ptr;
-    (void) iid;
 
     headlights_control_log(DEBUG, "Write /%i/%i/%i", HEADLIGHTS_CONTROL_OBJECT_ID, iid, rid);
-    headlights_instance_t *inst = &this->headlights;
-    assert(inst);
-
-    switch (rid) {
-    case HEADLIGHTS_CONTROL_STATE: {
-        bool temp_state;
-        headlights_control_log(DEBUG, "|| === || Write headlights control state by server|| === ||");
-        bool result = anjay_get_bool(ctx, &temp_state);
-        if (result) {
-            return result;
-        }
-        if (temp_state < 0 || temp_state > 1) {
-            return ANJAY_ERR_BAD_REQUEST;
-        }
-        inst->control_state = temp_state;
-        return 0;
+    headlights_object_t *object = get_object(obj_ptr);
+    assert(iid < object->instances.count);
+
+    // brightness range comes from RangeEnumeration of xmls/33205.xml
+    // live values change only on commit
+    object_33205_values_t *values = (object_33205_values_t *) object_staging_get(
+            &object->staging, object->instances.values, sizeof(object_33205_values_t),
+            object->instances.count, iid);
+    if (!values) {
+        return ANJAY_ERR_INTERNAL;
     }
-    case HEADLIGHTS_CONTROL_BRIGHTNESS: {
-        int64_t temp_value;
-        headlights_control_log(DEBUG, "|| === || Write headlights control brightness value by server || === ||");
-        int result = anjay_get_i64(ctx, &temp_value);
-        if (result) {
-            return result;
-        }
-        if (temp_value < 0 || temp_value > 100) {
-            return ANJAY_ERR_BAD_REQUEST;
-        }
-        inst->brightness = temp_value;
-        return 0;
+    return object_schema_write(&OBJECT_33205_SCHEMA, values, rid, ctx);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+apply_instance(void *arg, anjay_iid_t iid) {
+    headlights_object_t *object = (headlights_object_t *) arg;
+    if (!object->actuator) {
+        return;
     }
-    default:
-    return ANJAY_ERR_NOT_FOUND;
+    // hardware is driven by the actuator thread, the loop never waits for it
+    if (actuator_request(object->actuator, iid, values_of(object)[iid].control_state,
+                         values_of(object)[iid].brightness)) {
+        headlights_control_log(WARNING, "No actuator unit for instance %u",
+                               (unsigned) iid);
     }
 }
 
 //------------------------------------------------------------------------------
 
+static
+int headlights_control_transaction_validate(anjay_t *anjay,
+                                            const anjay_dm_object_def_t *const *obj_ptr) {
+    (void) anjay;
+
+    headlights_object_t *object = get_object(obj_ptr);
+    return object_staging_validate(&OBJECT_33205_SCHEMA, &object->staging,
+                                   object->instances.count);
+}
+
+//------------------------------------------------------------------------------
+
+static
+int headlights_control_transaction_commit(anjay_t *anjay,
+                                          const anjay_dm_object_def_t *const *obj_ptr) {
+    (void) anjay;
+
+    headlights_object_t *object = get_object(obj_ptr);
+    // committed values drive the hardware
+    object_instances_commit(&object->instances, &object->staging, apply_instance, object);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static
+int headlights_control_transaction_rollback(anjay_t *anjay,
+                                            const anjay_dm_object_def_t *const *obj_ptr) {
+    (void) anjay;
+    object_staging_end(&get_object(obj_ptr)->staging);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static
+int headlights_control_instance_it(anjay_t *anjay,
+                                   const anjay_dm_object_def_t *const *obj_ptr,
+                                   anjay_iid_t *out,
+                                   void **cookie) {
+    (void) anjay;
+    object_dense_instance_next(get_object(obj_ptr)->instances.count, out, cookie);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static
+int headlights_control_instance_present(anjay_t *anjay,
+                                        const anjay_dm_object_def_t *const *obj_ptr,
+                                        anjay_iid_t iid) {
+    (void) anjay;
+    return iid < get_object(obj_ptr)->instances.count;
+}
+
+//------------------------------------------------------------------------------
+
 static 
 const anjay_dm_object_def_t HEADLIGHTS_CONTROL_OBJECT_DEFINE = {
     .oid = HEADLIGHTS_CONTROL_OBJECT_ID,
 
-    .supported_rids = ANJAY_DM_SUPPORTED_RIDS(HEADLIGHTS_CONTROL_STATE,
-                                              HEADLIGHTS_CONTROL_BRIGHTNESS,
-                                              HEADLIGHTS_CONTROL_TIME_STAMP),
+    .supported_rids = OBJECT_33205_SUPPORTED_RIDS,
 
     .handlers = {
 
-        .instance_it            = anjay_dm_instance_it_SINGLE,
-        .instance_present       = anjay_dm_instance_present_SINGLE,
+        .instance_it            = headlights_control_instance_it,
+        .instance_present       = headlights_control_instance_present,
 
         .resource_present       = anjay_dm_resource_present_TRUE,
         .resource_read          = headlights_control_resource_read,
         .resource_write         = headlights_control_resource_write,
 
         .transaction_begin      = anjay_dm_transaction_NOOP,
-        .transaction_validate   = anjay_dm_transaction_NOOP,
-        .transaction_commit     = anjay_dm_transaction_NOOP,
-        .transaction_rollback   = anjay_dm_transaction_NOOP
+        .transaction_validate   = headlights_control_transaction_validate,
+        .transaction_commit     = headlights_control_transaction_commit,
+        .transaction_rollback   = headlights_control_transaction_rollback
     }
 };
 
 //------------------------------------------------------------------------------
 
-void
-headlights_control_init_object(anjay_t * anjay) {
+headlights_object_t *
+headlights_control_init_object(anjay_t * anjay,
+                               event_loop_t *event_loop,
+                               size_t instance_count) {
     assert(anjay);
 
-    this=
+    headlights_object_t *object =
     (headlights_object_t*)avs_calloc(1, sizeof(headlights_object_t));
-    if (!this) {
+    if (!object) {
         headlights_control_log(ERROR, "Out of memory");
-        return;
+        return NULL;
     }
 
     // initialize
-    this->obj_def = &HEADLIGHTS_CONTROL_OBJECT_DEFINE;
-
-    // headlights control relay is OFF
-    this->headlights.control_state = false;
-    // default brightness of the headlights
-    this->headlights.brightness = 50;
-    // return current date and time as string 
-    memset(this->headlights.time, 0x00, sizeof(this->headlights.time));
-    sprintf(this->headlights.time, "%s", get_current_time());
+    object->obj_def = &HEADLIGHTS_CONTROL_OBJECT_DEFINE;
+    object->anjay = anjay;
+    object_instances_init(&object->instances, anjay, event_loop,
+                          HEADLIGHTS_CONTROL_OBJECT_ID, sizeof(object_33205_values_t),
+                          &HEADLIGHTS_CONTROL_DEFAULTS);
+
+    if (!instance_count || instance_count > HEADLIGHTS_CONTROL_MAX_INSTANCES
+            || object_instances_resize(&object->instances, instance_count)) {
+        headlights_control_log(ERROR, "Could not create %u instances",
+                               (unsigned) instance_count);
+        avs_free(object);
+        return NULL;
+    }
 
     // register
-    if (anjay_register_object(anjay, &this->obj_def)) {
+    if (anjay_register_object(anjay, &object->obj_def)) {
         headlights_control_log(ERROR, "Failed to register humidity object");
-        avs_free(this);
-        this = NULL;
-        return;
+        object_instances_release(&object->instances);
+        avs_free(object);
+        return NULL;
     }
+    return object;
 }
 
 //------------------------------------------------------------------------------
 
-void
+int
+headlights_control_set_instance_count(headlights_object_t *object, size_t count) {
+    assert(object);
+
+    if (!count || count > HEADLIGHTS_CONTROL_MAX_INSTANCES) {
+        return -1;
+    }
+    if (count == object->instances.count) {
+        return 0;
+    }
+    if (object_instances_resize(&object->instances, count)) {
+        headlights_control_log(ERROR, "Out of memory");
+        return -1;
+    }
+    (void) anjay_notify_instances_changed(object->anjay, HEADLIGHTS_CONTROL_OBJECT_ID);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+size_t
+headlights_control_instance_count(const headlights_object_t *object) {
+    assert(object);
+    return object->instances.count;
+}
+
+//------------------------------------------------------------------------------
+
+int
 headlights_control_set_data(anjay_t * anjay,
-                                 bool control_state,
-                                 int64_t brightness) {
+                            headlights_object_t *object,
+                            anjay_iid_t iid,
+                            bool control_state,
+                            int64_t brightness) {
     assert(anjay);
+    assert(object);
 
-    this->headlights.control_state = control_state;
-    this->headlights.brightness = brightness;
-    sprintf(this->headlights.time, "%s", get_current_time());
+    (void) anjay;
 
-    anjay_notify_changed(anjay,
-                         HEADLIGHTS_CONTROL_OBJECT_ID,
-                         0,
-                         HEADLIGHTS_CONTROL_STATE);
-    anjay_notify_changed(anjay,
-                         HEADLIGHTS_CONTROL_OBJECT_ID,
-                         0,
-                         HEADLIGHTS_CONTROL_BRIGHTNESS);
-    anjay_notify_changed(anjay,
-                         HEADLIGHTS_CONTROL_OBJECT_ID,
-                         0,
-                         HEADLIGHTS_CONTROL_TIME_STAMP);
+    if (iid >= object->instances.count) {
+        return -1;
+    }
+    object_33205_values_t *values = &values_of(object)[iid];
+    notify_batch_t *notify = &object->instances.notify[iid];
+
+    int changed = 0;
+    if (control_state != values->control_state) {
+        notify_batch_mark(notify, HEADLIGHTS_CONTROL_STATE);
+        values->control_state = control_state;
+        ++changed;
+    }
+    if (brightness != values->brightness) {
+        notify_batch_mark(notify, HEADLIGHTS_CONTROL_BRIGHTNESS);
+        values->brightness = brightness;
+        ++changed;
+    }
+    if (changed) {
+        timestamp_mark(&object->instances.changed_at[iid]);
+        notify_batch_mark(notify, HEADLIGHTS_CONTROL_TIME_STAMP);
+        ++changed;
+    }
+
+    notify_batch_submit(notify, HEADLIGHTS_CONTROL_RESOURCES_NUM);
+    return changed;
+}
+
+//------------------------------------------------------------------------------
+
+int
+headlights_control_get_data(const headlights_object_t *object,
+                            anjay_iid_t iid,
+                            bool *out_control_state,
+                            int64_t *out_brightness) {
+    assert(object);
+
+    if (iid >= object->instances.count) {
+        return -1;
+    }
+    *out_control_state = values_of(object)[iid].control_state;
+    *out_brightness = values_of(object)[iid].brightness;
+    return 0;
 }
 
 //------------------------------------------------------------------------------
 
 void
-headlights_control_object_release(anjay_t *anjay){
+headlights_control_set_notify_window(headlights_object_t *object, int window_ms) {
+    assert(object);
+    object_instances_set_notify_window(&object->instances, window_ms);
+}
+
+//------------------------------------------------------------------------------
+
+void
+headlights_control_set_actuator(headlights_object_t *object, actuator_t *actuator) {
+    assert(object);
+
+    object->actuator = actuator;
+    // bring hardware to the current state
+    for (size_t iid = 0; iid < object->instances.count; ++iid) {
+        apply_instance(object, (anjay_iid_t) iid);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+headlights_control_notify_stats(const headlights_object_t *object,
+                                notify_stats_t *out_stats) {
+    assert(object);
+
+    object_instances_notify_stats(&object->instances, out_stats);
+}
+
+//------------------------------------------------------------------------------
+
+void
+headlights_control_object_release(anjay_t *anjay, headlights_object_t *object){
     assert(anjay);
 
-    if (!this) {
+    if (!object) {
         return;
     }
 
-    anjay_unregister_object(anjay,&this->obj_def);
-    avs_free(this);
-    this = NULL;
-}
\ No newline at end of file
+    anjay_unregister_object(anjay,&object->obj_def);
+    object_instances_release(&object->instances);
+    object_staging_release(&object->staging);
+    avs_free(object);
+}
@@ -1,4 +1,6 @@
 #include "humidity.h"
+#include "object_33204_schema.h"
+#include "math.h"
 #include "sys/stat.h"
 #include "unistd.h"
 #include "assert.h"
@@ -7,22 +9,91 @@
 
 #define humidity_sensor_log( level, ...) avs_log(toyota_humidity, level, __VA_ARGS__)
 
-typedef struct humidity_instance{
+#define HUMIDITY_SENSOR_RESOURCES_NUM   3     // number of resources notified by a plain push
+#define HUMIDITY_SENSOR_DEFAULT_DEADBAND 0.1f // smallest change of value worth a notification
+
+#define ATTRS_OBJECT_IID ANJAY_IID_INVALID          // iid of object attributes
+#define ATTRS_NO_RID     ((anjay_rid_t) UINT16_MAX) // rid of instance and object attributes
+
+// attributes of a resource, an instance or the object set by one server;
+// instance and object ones use only the common part
+typedef struct {
     anjay_iid_t iid;
-    char reserved[10];
-    float sensor_value;
-    bool sensor_state;
-    char time[30];
-}humidity_instance_t;
+    anjay_rid_t rid;
+    anjay_ssid_t ssid;
+    anjay_dm_resource_attributes_t attrs;
+} resource_attrs_t;
 
-typedef struct{
+static const object_33204_values_t HUMIDITY_SENSOR_DEFAULTS = {
+    // default (most comfortable) hudimity
+    .sensor_value = 35.0f,
+    // hudimity control relay is OFF
+    .sensor_state = false
+};
+
+// Values scanned by bulk reads are kept apart from timestamps, notification
+// batches and history, so a read of /33204 walks one small array. Arrays of
+// the object are indexed by IID like those of the instance set.
+struct humidity_object {
     const anjay_dm_object_def_t *obj_def;
-    humidity_instance_t humidity;
-}humidity_object_t;
+    anjay_t *anjay;
+    float deadband;         // changes of value below deadband are not notified
+
+    object_instances_t instances;           // dense IIDs 0..count-1
+    object_staging_t staging;               // values written by the current transaction
+    float *notified_values;                 // value at the time of the last notification
+    sample_history_t *history;              // samples pushed since the last upload
+
+    resource_attrs_t *attrs;    // resource attributes written by servers, few entries
+    size_t attr_count;
+};
 
 //------------------------------------------------------------------------------
 
-static humidity_object_t *this = NULL;
+static inline humidity_object_t *
+get_object(const anjay_dm_object_def_t *const *obj_ptr) {
+    return AVS_CONTAINER_OF(obj_ptr, humidity_object_t, obj_def);
+}
+
+//------------------------------------------------------------------------------
+
+static inline object_33204_values_t *
+values_of(const humidity_object_t *object) {
+    return (object_33204_values_t *) object->instances.values;
+}
+
+//------------------------------------------------------------------------------
+
+// RIIDs count from the oldest sample left by the last clear; a history not
+// cleared for 65535 samples wraps, then RIIDs stop increasing in a payload
+static int
+read_history(sample_history_t *history,
+             anjay_rid_t rid,
+             anjay_output_ctx_t *ctx) {
+    anjay_output_ctx_t *array = anjay_ret_array_start(ctx);
+    if (!array) {
+        return ANJAY_ERR_INTERNAL;
+    }
+    for (size_t i = 0; i < history->count; ++i) {
+        // same instance id in both resources, so server can pair them
+        anjay_riid_t riid =
+                (anjay_riid_t) (sample_history_number(history, i) % ANJAY_IID_INVALID);
+        int result = anjay_ret_array_index(array, riid);
+        if (!result) {
+            result = rid == HUMIDITY_SENSOR_HISTORY
+                             ? anjay_ret_float(array, sample_history_value(history, i))
+                             : anjay_ret_i64(array, sample_history_time_ms(history, i));
+        }
+        if (result) {
+            return result;
+        }
+    }
+    int result = anjay_ret_array_finish(array);
+    if (!result) {
+        sample_history_mark_served(history);
+    }
+    return result;
+}
 
 //------------------------------------------------------------------------------
 
@@ -33,26 +104,32 @@ int humidity_resource_read(anjay_t *anjay,
                            anjay_rid_t rid,
                            anjay_output_ctx_t *ctx) {
     (void) anjay;
-    (void) obj_ptr;
-    (void) iid;
 
     humidity_sensor_log(DEBUG, "Read /%i/%i/%i", HUMIDITY_SENSOR_OBJECT_ID, iid, rid);
-    humidity_instance_t *inst = &this->humidity;
-    assert(inst);
+    humidity_object_t *object = get_object(obj_ptr);
+    assert(iid < object->instances.count);
 
-    switch (rid) {
-    case HUMIDITY_SENSOR_VALUE: {
-        humidity_sensor_log(DEBUG, "|| === || Read humidity sensor value || === ||");
-        return anjay_ret_float(ctx, inst->sensor_value);
-    }
-    case HUMIDITY_SENSOR_STATE: {
-        humidity_sensor_log(DEBUG, "|| === || Read humidity sensor state  || === ||");
-        return anjay_ret_bool(ctx, inst->sensor_state);
+    int result = object_schema_read(&OBJECT_33204_SCHEMA, &values_of(object)[iid],
+                                    rid, ctx);
+    if (result != OBJECT_SCHEMA_CUSTOM) {
+        return result;
     }
+
+    switch (rid) {
     case HUMIDITY_SENSOR_TIME_STAMP: {
         humidity_sensor_log(DEBUG, "|| === || Read time stamp of last change || === ||");
-        return anjay_ret_string(ctx, get_current_time());
+        return anjay_ret_string(ctx, timestamp_format(&object->instances.changed_at[iid],
+                                                     &object->instances.changed_at_text[iid]));
     }
+    case HUMIDITY_SENSOR_MEAN_VALUE:
+        return anjay_ret_float(ctx, sample_history_mean(&object->history[iid]));
+    case HUMIDITY_SENSOR_HISTORY:
+    case HUMIDITY_SENSOR_HISTORY_TIME:
+        return read_history(&object->history[iid], rid, ctx);
+    case HUMIDITY_SENSOR_MIN_VALUE:
+        return anjay_ret_float(ctx, object->history[iid].min);
+    case HUMIDITY_SENSOR_MAX_VALUE:
+        return anjay_ret_float(ctx, object->history[iid].max);
     default:
     return ANJAY_ERR_NOT_FOUND;
     }
@@ -67,43 +144,297 @@ int humidity_resource_write(anjay_t *anjay,
                             anjay_rid_t rid,
                             anjay_input_ctx_t *ctx) {
     (void) anjay;
-    (void) obj_ptr;
-    (void) iid;
 
     humidity_sensor_log(DEBUG, "Write /%i/%i/%i", HUMIDITY_SENSOR_OBJECT_ID, iid, rid);
-    humidity_instance_t *inst = &this->humidity;
-    assert(inst);
+    humidity_object_t *object = get_object(obj_ptr);
+    assert(iid < object->instances.count);
+
+    // value range comes from RangeEnumeration of xmls/33204.xml
+    // live values change only on commit
+    object_33204_values_t *values = (object_33204_values_t *) object_staging_get(
+            &object->staging, object->instances.values, sizeof(object_33204_values_t),
+            object->instances.count, iid);
+    if (!values) {
+        return ANJAY_ERR_INTERNAL;
+    }
+    return object_schema_write(&OBJECT_33204_SCHEMA, values, rid, ctx);
+}
+
+//------------------------------------------------------------------------------
+
+static
+int humidity_resource_execute(anjay_t *anjay,
+                              const anjay_dm_object_def_t *const *obj_ptr,
+                              anjay_iid_t iid,
+                              anjay_rid_t rid,
+                              anjay_execute_ctx_t *ctx) {
+    (void) anjay;
+    (void) ctx;
+
+    humidity_sensor_log(DEBUG, "Execute /%i/%i/%i", HUMIDITY_SENSOR_OBJECT_ID, iid, rid);
+    humidity_object_t *object = get_object(obj_ptr);
+    assert(iid < object->instances.count);
+    sample_history_t *history = &object->history[iid];
 
     switch (rid) {
-    case HUMIDITY_SENSOR_VALUE: {
-        float temp_value;
-        humidity_sensor_log(DEBUG, "|| === || Write humidity sensor value by server || === ||");
-        int result = anjay_get_float(ctx, &temp_value);
-        if (result) {
-            return result;
+    case HUMIDITY_SENSOR_HISTORY_CLEAR: {
+        // only samples the server has read are dropped, those pushed between
+        // its Read of 5507/5508 and this Execute are left for the next read
+        size_t dropped = sample_history_clear_served(history);
+        humidity_sensor_log(DEBUG, "|| === || Clear history of %u samples, %u kept || === ||",
+                            (unsigned) dropped, (unsigned) history->count);
+        return 0;
+    }
+    case HUMIDITY_SENSOR_RESET_MIN_MAX:
+        humidity_sensor_log(DEBUG, "|| === || Reset min and max values || === ||");
+        sample_history_reset_aggregates(history);
+        return 0;
+    default:
+    return ANJAY_ERR_METHOD_NOT_ALLOWED;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static
+int humidity_transaction_validate(anjay_t *anjay,
+                                  const anjay_dm_object_def_t *const *obj_ptr) {
+    (void) anjay;
+
+    humidity_object_t *object = get_object(obj_ptr);
+    return object_staging_validate(&OBJECT_33204_SCHEMA, &object->staging,
+                                   object->instances.count);
+}
+
+//------------------------------------------------------------------------------
+
+static
+int humidity_transaction_commit(anjay_t *anjay,
+                                const anjay_dm_object_def_t *const *obj_ptr) {
+    (void) anjay;
+
+    humidity_object_t *object = get_object(obj_ptr);
+    object_instances_commit(&object->instances, &object->staging, NULL, NULL);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static
+int humidity_transaction_rollback(anjay_t *anjay,
+                                  const anjay_dm_object_def_t *const *obj_ptr) {
+    (void) anjay;
+    object_staging_end(&get_object(obj_ptr)->staging);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static resource_attrs_t *
+find_attrs(humidity_object_t *object,
+           anjay_iid_t iid,
+           anjay_rid_t rid,
+           anjay_ssid_t ssid) {
+    for (size_t i = 0; i < object->attr_count; ++i) {
+        resource_attrs_t *entry = &object->attrs[i];
+        if (entry->iid == iid && entry->rid == rid && entry->ssid == ssid) {
+            return entry;
         }
-        if (temp_value < 0 || temp_value > 40) {
-            return ANJAY_ERR_BAD_REQUEST;
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+static const anjay_dm_resource_attributes_t *
+attrs_at(const humidity_object_t *object,
+         anjay_iid_t iid,
+         anjay_rid_t rid,
+         anjay_ssid_t ssid) {
+    for (size_t i = 0; i < object->attr_count; ++i) {
+        const resource_attrs_t *entry = &object->attrs[i];
+        if (entry->iid == iid && entry->rid == rid && entry->ssid == ssid) {
+            return &entry->attrs;
         }
-        inst->sensor_value = temp_value;
-        return 0;
     }
-    case HUMIDITY_SENSOR_STATE: {
-        bool temp_state;
-        humidity_sensor_log(DEBUG, "|| === || Write humidity sensor state by server || === ||");
-        bool result = anjay_get_bool(ctx, &temp_state);
-        if (result) {
-            return result;
+    return &ANJAY_RES_ATTRIBS_EMPTY;
+}
+
+//------------------------------------------------------------------------------
+
+static bool
+attrs_empty(const anjay_dm_resource_attributes_t *attrs) {
+    return attrs->common.min_period == ANJAY_ATTRIB_PERIOD_NONE
+           && attrs->common.max_period == ANJAY_ATTRIB_PERIOD_NONE
+           && isnan(attrs->greater_than)
+           && isnan(attrs->less_than)
+           && isnan(attrs->step);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+remove_attrs_from(humidity_object_t *object, size_t instance_count) {
+    size_t kept = 0;
+    for (size_t i = 0; i < object->attr_count; ++i) {
+        if (object->attrs[i].iid < instance_count
+                || object->attrs[i].iid == ATTRS_OBJECT_IID) {
+            object->attrs[kept++] = object->attrs[i];
         }
-        if (temp_state < 0 || temp_state > 1) {
-            return ANJAY_ERR_BAD_REQUEST;
+    }
+    object->attr_count = kept;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+store_attrs(humidity_object_t *object,
+            anjay_iid_t iid,
+            anjay_rid_t rid,
+            anjay_ssid_t ssid,
+            const anjay_dm_resource_attributes_t *attrs) {
+    resource_attrs_t *entry = find_attrs(object, iid, rid, ssid);
+    if (attrs_empty(attrs)) {
+        if (entry) {
+            *entry = object->attrs[--object->attr_count];
         }
-        inst->sensor_state = temp_state;
         return 0;
     }
-    default:
-    return ANJAY_ERR_NOT_FOUND;
+    if (!entry) {
+        resource_attrs_t *grown = (resource_attrs_t *) avs_realloc(
+                object->attrs, (object->attr_count + 1) * sizeof(resource_attrs_t));
+        if (!grown) {
+            return ANJAY_ERR_INTERNAL;
+        }
+        object->attrs = grown;
+        entry = &object->attrs[object->attr_count++];
+        entry->iid = iid;
+        entry->rid = rid;
+        entry->ssid = ssid;
     }
+    entry->attrs = *attrs;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+store_default_attrs(humidity_object_t *object,
+                    anjay_iid_t iid,
+                    anjay_ssid_t ssid,
+                    const anjay_dm_attributes_t *attrs) {
+    anjay_dm_resource_attributes_t stored = ANJAY_RES_ATTRIBS_EMPTY;
+    stored.common = *attrs;
+    return store_attrs(object, iid, ATTRS_NO_RID, ssid, &stored);
+}
+
+//------------------------------------------------------------------------------
+
+// attributes of all levels are kept by the object rather than by attr_storage,
+// so the sampler can follow effective pmin, pmax and step of the humidity value
+static
+int humidity_object_read_default_attrs(anjay_t *anjay,
+                                       const anjay_dm_object_def_t *const *obj_ptr,
+                                       anjay_ssid_t ssid,
+                                       anjay_dm_attributes_t *out) {
+    (void) anjay;
+    *out = attrs_at(get_object(obj_ptr), ATTRS_OBJECT_IID, ATTRS_NO_RID, ssid)->common;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static
+int humidity_object_write_default_attrs(anjay_t *anjay,
+                                        const anjay_dm_object_def_t *const *obj_ptr,
+                                        anjay_ssid_t ssid,
+                                        const anjay_dm_attributes_t *attrs) {
+    (void) anjay;
+
+    humidity_sensor_log(DEBUG, "Write attributes /%i of server %u",
+                        HUMIDITY_SENSOR_OBJECT_ID, (unsigned) ssid);
+    return store_default_attrs(get_object(obj_ptr), ATTRS_OBJECT_IID, ssid, attrs);
+}
+
+//------------------------------------------------------------------------------
+
+static
+int humidity_instance_read_default_attrs(anjay_t *anjay,
+                                         const anjay_dm_object_def_t *const *obj_ptr,
+                                         anjay_iid_t iid,
+                                         anjay_ssid_t ssid,
+                                         anjay_dm_attributes_t *out) {
+    (void) anjay;
+    *out = attrs_at(get_object(obj_ptr), iid, ATTRS_NO_RID, ssid)->common;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static
+int humidity_instance_write_default_attrs(anjay_t *anjay,
+                                          const anjay_dm_object_def_t *const *obj_ptr,
+                                          anjay_iid_t iid,
+                                          anjay_ssid_t ssid,
+                                          const anjay_dm_attributes_t *attrs) {
+    (void) anjay;
+
+    humidity_sensor_log(DEBUG, "Write attributes /%i/%i of server %u",
+                        HUMIDITY_SENSOR_OBJECT_ID, iid, (unsigned) ssid);
+    return store_default_attrs(get_object(obj_ptr), iid, ssid, attrs);
+}
+
+//------------------------------------------------------------------------------
+
+static
+int humidity_resource_read_attrs(anjay_t *anjay,
+                                 const anjay_dm_object_def_t *const *obj_ptr,
+                                 anjay_iid_t iid,
+                                 anjay_rid_t rid,
+                                 anjay_ssid_t ssid,
+                                 anjay_dm_resource_attributes_t *out) {
+    (void) anjay;
+
+    *out = *attrs_at(get_object(obj_ptr), iid, rid, ssid);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static
+int humidity_resource_write_attrs(anjay_t *anjay,
+                                  const anjay_dm_object_def_t *const *obj_ptr,
+                                  anjay_iid_t iid,
+                                  anjay_rid_t rid,
+                                  anjay_ssid_t ssid,
+                                  const anjay_dm_resource_attributes_t *attrs) {
+    (void) anjay;
+
+    humidity_sensor_log(DEBUG, "Write attributes /%i/%i/%i of server %u",
+                        HUMIDITY_SENSOR_OBJECT_ID, iid, rid, (unsigned) ssid);
+    return store_attrs(get_object(obj_ptr), iid, rid, ssid, attrs);
+}
+
+//------------------------------------------------------------------------------
+
+static
+int humidity_instance_it(anjay_t *anjay,
+                         const anjay_dm_object_def_t *const *obj_ptr,
+                         anjay_iid_t *out,
+                         void **cookie) {
+    (void) anjay;
+    object_dense_instance_next(get_object(obj_ptr)->instances.count, out, cookie);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static
+int humidity_instance_present(anjay_t *anjay,
+                              const anjay_dm_object_def_t *const *obj_ptr,
+                              anjay_iid_t iid) {
+    (void) anjay;
+    return iid < get_object(obj_ptr)->instances.count;
 }
 
 //------------------------------------------------------------------------------
@@ -112,98 +443,467 @@ static
 const anjay_dm_object_def_t HUMIDITY_SENSOR_OBJECT_DEFINE = {
     .oid = HUMIDITY_SENSOR_OBJECT_ID,
 
-    .supported_rids = ANJAY_DM_SUPPORTED_RIDS(HUMIDITY_SENSOR_VALUE,
-                                              HUMIDITY_SENSOR_STATE,
-                                              HUMIDITY_SENSOR_TIME_STAMP),
+    .supported_rids = OBJECT_33204_SUPPORTED_RIDS,
 
     .handlers = {
 
-        .instance_it            = anjay_dm_instance_it_SINGLE,
-        .instance_present       = anjay_dm_instance_present_SINGLE,
+        .object_read_default_attrs  = humidity_object_read_default_attrs,
+        .object_write_default_attrs = humidity_object_write_default_attrs,
+
+        .instance_it            = humidity_instance_it,
+        .instance_present       = humidity_instance_present,
+        .instance_read_default_attrs  = humidity_instance_read_default_attrs,
+        .instance_write_default_attrs = humidity_instance_write_default_attrs,
 
         .resource_present       = anjay_dm_resource_present_TRUE,
         .resource_read          = humidity_resource_read,
         .resource_write         = humidity_resource_write,
+        .resource_execute       = humidity_resource_execute,
+        .resource_read_attrs    = humidity_resource_read_attrs,
+        .resource_write_attrs   = humidity_resource_write_attrs,
 
         .transaction_begin      = anjay_dm_transaction_NOOP,
-        .transaction_validate   = anjay_dm_transaction_NOOP,
-        .transaction_commit     = anjay_dm_transaction_NOOP,
-        .transaction_rollback   = anjay_dm_transaction_NOOP
+        .transaction_validate   = humidity_transaction_validate,
+        .transaction_commit     = humidity_transaction_commit,
+        .transaction_rollback   = humidity_transaction_rollback
     }
 };
 
 //------------------------------------------------------------------------------
 
-void
-humidity_sensor_init_object(anjay_t * anjay) {
+static void
+release_histories(humidity_object_t *object) {
+    for (size_t i = 0; object->history && i < object->instances.count; ++i) {
+        sample_history_release(&object->history[i]);
+    }
+    avs_free(object->history);
+    avs_free(object->notified_values);
+}
+
+//------------------------------------------------------------------------------
+
+// arrays of the object are prepared first, once the instance set is resized
+// nothing can fail; on failure the object is left untouched
+static int
+resize_instances(humidity_object_t *object, size_t count) {
+    float *notified_values = (float *) avs_calloc(count, sizeof(float));
+    sample_history_t *history =
+            (sample_history_t *) avs_calloc(count, sizeof(sample_history_t));
+    size_t old_count = object->instances.count;
+    size_t kept = count < old_count ? count : old_count;
+    size_t ready = kept;    // histories initialized or moved
+    if (!notified_values || !history) {
+        goto error;
+    }
+    for (; ready < count; ++ready) {
+        if (sample_history_init(&history[ready], HISTORY_DEFAULT_CAPACITY)) {
+            goto error;
+        }
+    }
+    if (object_instances_resize(&object->instances, count)) {
+        goto error;
+    }
+
+    // history buffers move with the struct
+    if (kept) {
+        memcpy(history, object->history, kept * sizeof(sample_history_t));
+        memcpy(notified_values, object->notified_values, kept * sizeof(float));
+    }
+    for (size_t i = kept; i < count; ++i) {
+        notified_values[i] = values_of(object)[i].sensor_value;
+    }
+    for (size_t i = kept; object->history && i < old_count; ++i) {
+        sample_history_release(&object->history[i]);
+    }
+    avs_free(object->history);
+    avs_free(object->notified_values);
+    object->history = history;
+    object->notified_values = notified_values;
+    return 0;
+
+error:
+    for (size_t i = kept; i < ready; ++i) {
+        sample_history_release(&history[i]);
+    }
+    avs_free(history);
+    avs_free(notified_values);
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+humidity_object_t *
+humidity_sensor_init_object(anjay_t * anjay,
+                            event_loop_t *event_loop,
+                            size_t instance_count) {
     assert(anjay);
 
-    this=
+    humidity_object_t *object =
     (humidity_object_t*)avs_calloc(1, sizeof(humidity_object_t));
-    if (!this) {
+    if (!object) {
         humidity_sensor_log(ERROR, "Out of memory");
-        return;
+        return NULL;
     }
 
     // initialize
-    this->obj_def = &HUMIDITY_SENSOR_OBJECT_DEFINE;
-
-    // default (most comfortable) hudimity
-    this->humidity.sensor_value = 35.0;
-    // hudimity control relay is OFF
-    this->humidity.sensor_state = false;
-    // return current date and time as string
-    memset(this->humidity.time, 0x00, sizeof(this->humidity.time));
-    sprintf(this->humidity.time, "%s", get_current_time());
+    object->obj_def = &HUMIDITY_SENSOR_OBJECT_DEFINE;
+    object->anjay = anjay;
+    object->deadband = HUMIDITY_SENSOR_DEFAULT_DEADBAND;
+    object_instances_init(&object->instances, anjay, event_loop,
+                          HUMIDITY_SENSOR_OBJECT_ID, sizeof(object_33204_values_t),
+                          &HUMIDITY_SENSOR_DEFAULTS);
+
+    if (!instance_count || instance_count > HUMIDITY_SENSOR_MAX_INSTANCES
+            || resize_instances(object, instance_count)) {
+        humidity_sensor_log(ERROR, "Could not create %u instances",
+                            (unsigned) instance_count);
+        avs_free(object);
+        return NULL;
+    }
 
     // register
-    if (anjay_register_object(anjay, &this->obj_def)) {
+    if (anjay_register_object(anjay, &object->obj_def)) {
         humidity_sensor_log(ERROR, "Failed to register humidity object");
-        avs_free(this);
-        this = NULL;
-        return;
+        release_histories(object);
+        object_instances_release(&object->instances);
+        avs_free(object);
+        return NULL;
     }
+    return object;
 }
 
 //------------------------------------------------------------------------------
 
-void
+int
+humidity_sensor_set_instance_count(humidity_object_t *object, size_t count) {
+    assert(object);
+
+    if (!count || count > HUMIDITY_SENSOR_MAX_INSTANCES) {
+        return -1;
+    }
+    if (count == object->instances.count) {
+        // restored attributes may name zones beyond count
+        remove_attrs_from(object, count);
+        return 0;
+    }
+    if (resize_instances(object, count)) {
+        humidity_sensor_log(ERROR, "Out of memory");
+        return -1;
+    }
+    remove_attrs_from(object, count);
+    (void) anjay_notify_instances_changed(object->anjay, HUMIDITY_SENSOR_OBJECT_ID);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+size_t
+humidity_sensor_instance_count(const humidity_object_t *object) {
+    assert(object);
+    return object->instances.count;
+}
+
+//------------------------------------------------------------------------------
+
+int
 humidity_sensor_set_data(anjay_t * anjay,
+                         humidity_object_t *object,
+                         anjay_iid_t iid,
                          float sensor_value,
                          bool sensor_state) {
     assert(anjay);
+    assert(object);
 
-    this->humidity.sensor_value = sensor_value;
-    this->humidity.sensor_state = sensor_state;
-    sprintf(this->humidity.time, "%s", get_current_time());
+    (void) anjay;
 
-    anjay_notify_changed(anjay,
-                         HUMIDITY_SENSOR_OBJECT_ID,
-                         0,
-                         HUMIDITY_SENSOR_VALUE);
+    if (iid >= object->instances.count) {
+        return -1;
+    }
+    object_33204_values_t *values = &values_of(object)[iid];
+    notify_batch_t *notify = &object->instances.notify[iid];
+
+    int changed = 0;
+    float delta = fabsf(sensor_value - object->notified_values[iid]);
+    if (delta > 0.0f && delta >= object->deadband) {
+        notify_batch_mark(notify, HUMIDITY_SENSOR_VALUE);
+        object->notified_values[iid] = sensor_value;
+        ++changed;
+    }
+    if (sensor_state != values->sensor_state) {
+        notify_batch_mark(notify, HUMIDITY_SENSOR_STATE);
+        ++changed;
+    }
 
-    anjay_notify_changed(anjay,
-                         HUMIDITY_SENSOR_OBJECT_ID,
-                         0,
-                         HUMIDITY_SENSOR_STATE);
+    // value inside the deadband is still stored, reads stay exact
+    sample_history_push(&object->history[iid], get_real_time_ms(), sensor_value);
+    values->sensor_value = sensor_value;
+    values->sensor_state = sensor_state;
+    if (changed) {
+        timestamp_mark(&object->instances.changed_at[iid]);
+        notify_batch_mark(notify, HUMIDITY_SENSOR_TIME_STAMP);
+        ++changed;
+    }
 
-    anjay_notify_changed(anjay,
-                         HUMIDITY_SENSOR_OBJECT_ID,
-                         0,
-                         HUMIDITY_SENSOR_TIME_STAMP);
+    notify_batch_submit(notify, HUMIDITY_SENSOR_RESOURCES_NUM);
+    return changed;
+}
+
+//------------------------------------------------------------------------------
+
+int
+humidity_sensor_get_data(const humidity_object_t *object,
+                         anjay_iid_t iid,
+                         float *out_value,
+                         bool *out_state) {
+    assert(object);
+
+    if (iid >= object->instances.count) {
+        return -1;
+    }
+    *out_value = values_of(object)[iid].sensor_value;
+    *out_state = values_of(object)[iid].sensor_state;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int32_t
+first_period(int32_t resource, int32_t instance, int32_t object, int32_t server) {
+    if (resource != ANJAY_ATTRIB_PERIOD_NONE) {
+        return resource;
+    }
+    if (instance != ANJAY_ATTRIB_PERIOD_NONE) {
+        return instance;
+    }
+    return object != ANJAY_ATTRIB_PERIOD_NONE ? object : server;
+}
+
+//------------------------------------------------------------------------------
+
+// the most demanding server wins
+static void
+merge_demanding(anjay_dm_resource_attributes_t *out,
+                const anjay_dm_resource_attributes_t *attrs) {
+    if (attrs->common.min_period != ANJAY_ATTRIB_PERIOD_NONE
+            && (out->common.min_period == ANJAY_ATTRIB_PERIOD_NONE
+                || attrs->common.min_period < out->common.min_period)) {
+        out->common.min_period = attrs->common.min_period;
+    }
+    if (attrs->common.max_period != ANJAY_ATTRIB_PERIOD_NONE
+            && (out->common.max_period == ANJAY_ATTRIB_PERIOD_NONE
+                || attrs->common.max_period < out->common.max_period)) {
+        out->common.max_period = attrs->common.max_period;
+    }
+    if (!isnan(attrs->step) && (isnan(out->step) || attrs->step < out->step)) {
+        out->step = attrs->step;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// pmin and pmax of the value resource as seen by one server: resource
+// attributes fall back to instance, object and Server object defaults;
+// step exists on resources only
+static void
+effective_attrs(const humidity_object_t *object,
+                anjay_iid_t iid,
+                anjay_ssid_t ssid,
+                const anjay_dm_attributes_t *server_defaults,
+                anjay_dm_resource_attributes_t *out) {
+    const anjay_dm_resource_attributes_t *resource =
+            attrs_at(object, iid, HUMIDITY_SENSOR_VALUE, ssid);
+    const anjay_dm_attributes_t *instance =
+            &attrs_at(object, iid, ATTRS_NO_RID, ssid)->common;
+    const anjay_dm_attributes_t *object_attrs =
+            &attrs_at(object, ATTRS_OBJECT_IID, ATTRS_NO_RID, ssid)->common;
+    *out = *resource;
+    out->common.min_period = first_period(resource->common.min_period,
+                                          instance->min_period, object_attrs->min_period,
+                                          server_defaults->min_period);
+    out->common.max_period = first_period(resource->common.max_period,
+                                          instance->max_period, object_attrs->max_period,
+                                          server_defaults->max_period);
+}
+
+//------------------------------------------------------------------------------
+
+static bool
+attrs_on_path(const resource_attrs_t *entry, anjay_iid_t iid) {
+    return entry->iid == ATTRS_OBJECT_IID
+           || (entry->iid == iid
+               && (entry->rid == HUMIDITY_SENSOR_VALUE || entry->rid == ATTRS_NO_RID));
+}
+
+//------------------------------------------------------------------------------
+
+int
+humidity_sensor_value_attrs(const humidity_object_t *object,
+                            anjay_iid_t iid,
+                            const anjay_dm_attributes_t *server_defaults,
+                            anjay_dm_resource_attributes_t *out_attrs) {
+    assert(object);
+    assert(server_defaults);
+
+    if (iid >= object->instances.count) {
+        return -1;
+    }
+    *out_attrs = ANJAY_RES_ATTRIBS_EMPTY;
+    bool resolved = false;
+    for (size_t i = 0; i < object->attr_count; ++i) {
+        const resource_attrs_t *entry = &object->attrs[i];
+        if (!attrs_on_path(entry, iid)) {
+            continue;
+        }
+        // every server is resolved once, at its first entry on the path
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; ++j) {
+            seen = object->attrs[j].ssid == entry->ssid
+                   && attrs_on_path(&object->attrs[j], iid);
+        }
+        if (!seen) {
+            anjay_dm_resource_attributes_t attrs;
+            effective_attrs(object, iid, entry->ssid, server_defaults, &attrs);
+            merge_demanding(out_attrs, &attrs);
+            resolved = true;
+        }
+    }
+    if (!resolved) {
+        // no attributes written, Server object defaults apply
+        out_attrs->common = *server_defaults;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+// the same sequence serves both store and restore contexts
+static int
+attrs_entry_persistence(avs_persistence_context_t *ctx, resource_attrs_t *entry) {
+    uint32_t min_period = (uint32_t) entry->attrs.common.min_period;
+    uint32_t max_period = (uint32_t) entry->attrs.common.max_period;
+    if (avs_persistence_u16(ctx, &entry->iid)
+            || avs_persistence_u16(ctx, &entry->rid)
+            || avs_persistence_u16(ctx, &entry->ssid)
+            || avs_persistence_u32(ctx, &min_period)
+            || avs_persistence_u32(ctx, &max_period)
+            || avs_persistence_bytes(ctx, (uint8_t *) &entry->attrs.greater_than,
+                                     sizeof(entry->attrs.greater_than))
+            || avs_persistence_bytes(ctx, (uint8_t *) &entry->attrs.less_than,
+                                     sizeof(entry->attrs.less_than))
+            || avs_persistence_bytes(ctx, (uint8_t *) &entry->attrs.step,
+                                     sizeof(entry->attrs.step))) {
+        return -1;
+    }
+    entry->attrs.common.min_period = (int32_t) min_period;
+    entry->attrs.common.max_period = (int32_t) max_period;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+int
+humidity_sensor_persist_attrs(const humidity_object_t *object,
+                              avs_persistence_context_t *ctx) {
+    assert(object);
+
+    uint32_t count = (uint32_t) object->attr_count;
+    if (avs_persistence_u32(ctx, &count)) {
+        return -1;
+    }
+    for (size_t i = 0; i < object->attr_count; ++i) {
+        resource_attrs_t entry = object->attrs[i];
+        if (attrs_entry_persistence(ctx, &entry)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+int
+humidity_sensor_restore_attrs(humidity_object_t *object,
+                              avs_persistence_context_t *ctx) {
+    assert(object);
+
+    uint32_t count;
+    if (avs_persistence_u32(ctx, &count) || count > UINT16_MAX) {
+        return -1;
+    }
+    resource_attrs_t *attrs = NULL;
+    if (count && !(attrs = (resource_attrs_t *) avs_calloc(count, sizeof(resource_attrs_t)))) {
+        humidity_sensor_log(ERROR, "Out of memory");
+        return -1;
+    }
+    size_t kept = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        resource_attrs_t *entry = &attrs[kept];
+        entry->attrs = ANJAY_RES_ATTRIBS_EMPTY;
+        if (attrs_entry_persistence(ctx, entry)) {
+            avs_free(attrs);
+            return -1;
+        }
+        // restored before the configured zone count is applied, entries of
+        // zones beyond it are dropped by humidity_sensor_set_instance_count()
+        if ((entry->iid < HUMIDITY_SENSOR_MAX_INSTANCES || entry->iid == ATTRS_OBJECT_IID)
+                && !attrs_empty(&entry->attrs)) {
+            ++kept;
+        }
+    }
+    avs_free(object->attrs);
+    object->attrs = attrs;
+    object->attr_count = kept;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+humidity_sensor_set_deadband(humidity_object_t *object, float deadband) {
+    assert(object);
+    object->deadband = deadband > 0.0f ? deadband : 0.0f;
 }
 
 //------------------------------------------------------------------------------
 
 void
-humidity_sensor_object_release(anjay_t *anjay){
+humidity_sensor_set_notify_window(humidity_object_t *object, int window_ms) {
+    assert(object);
+    object_instances_set_notify_window(&object->instances, window_ms);
+}
+
+//------------------------------------------------------------------------------
+
+const sample_history_t *
+humidity_sensor_history(const humidity_object_t *object, anjay_iid_t iid) {
+    assert(object);
+    return iid < object->instances.count ? &object->history[iid] : NULL;
+}
+
+//------------------------------------------------------------------------------
+
+void
+humidity_sensor_notify_stats(const humidity_object_t *object,
+                             notify_stats_t *out_stats) {
+    assert(object);
+
+    object_instances_notify_stats(&object->instances, out_stats);
+}
+
+//------------------------------------------------------------------------------
+
+void
+humidity_sensor_object_release(anjay_t *anjay, humidity_object_t *object){
     assert(anjay);
 
-    if (!this) {
+    if (!object) {
         return;
     }
 
-    anjay_unregister_object(anjay,&this->obj_def);
-    avs_free(this);
-    this = NULL;
-}
\ No newline at end of file
+    anjay_unregister_object(anjay,&object->obj_def);
+    release_histories(object);
+    object_instances_release(&object->instances);
+    object_staging_release(&object->staging);
+    avs_free(object->attrs);
+    avs_free(object);
+}
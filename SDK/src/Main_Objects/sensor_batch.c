@@ -0,0 +1,468 @@
+#include "sensor_batch.h"
+#include "object_33206_schema.h"
+#include "toyota_metrics.h"
+#include "assert.h"
+#include "stdio.h"
+#include "string.h"
+
+#define sensor_batch_log( level, ...) avs_log(toyota_sensor_batch, level, __VA_ARGS__)
+
+#define SENSOR_BATCH_ARRAY_HEAD_MAX 3   // CBOR head of an array shorter than 65536 records
+#define SENSOR_BATCH_NAME_SIZE      24  // "/65535/65535/" or "65535"
+#define SENSOR_BATCH_MESSAGE_HEAD   64  // CoAP header, token, options and resource TLV
+#define SENSOR_BATCH_ENTRY_HEAD     8   // TLV header of one batch in the notification
+
+typedef struct {
+    uint8_t *data;              // SENSOR_BATCH_CAPACITY bytes of the queue storage
+    size_t size;
+    size_t count;               // values in the batch
+    uint64_t sequence;
+} published_batch_t;
+
+struct sensor_batch_object {
+    const anjay_dm_object_def_t *obj_def;
+    anjay_t *anjay;
+
+    uint8_t *pending;           // encoded records waiting for publishing
+    size_t pending_size;
+    size_t pending_count;
+    int64_t base_time_ms;       // time of the first pending record
+    bool has_base;              // base name was set by a pending record
+    anjay_oid_t base_oid;
+    anjay_iid_t base_iid;
+
+    // Published batches wait in a ring until a read of the payload resource
+    // serves them: anjay reads the value only when the notification is sent,
+    // after pmin, and one notification carries all batches queued until then.
+    published_batch_t queue[SENSOR_BATCH_QUEUE_LENGTH];
+    uint8_t *queue_data;
+    size_t queue_head;          // oldest batch not read yet
+    size_t queue_count;
+    size_t queue_bytes;         // notification bytes taken by the queued batches
+    size_t message_bytes;       // notification bytes available for batches
+    size_t last_count;          // values in the last published batch
+    uint64_t sequence;
+    bool flush_refused;         // pending records wait for room in the queue
+
+    size_t max_bytes;
+    int window_ms;
+    event_loop_timer_t *timer;  // publishes pending records when the window closes
+    report_stats_t stats;
+};
+
+//------------------------------------------------------------------------------
+
+static inline sensor_batch_object_t *
+get_object(const anjay_dm_object_def_t *const *obj_ptr) {
+    return AVS_CONTAINER_OF(obj_ptr, sensor_batch_object_t, obj_def);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+drain_queue(sensor_batch_object_t *object, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        object->queue_bytes -= SENSOR_BATCH_ENTRY_HEAD + object->queue[object->queue_head].size;
+        object->queue_head = (object->queue_head + 1) % SENSOR_BATCH_QUEUE_LENGTH;
+    }
+    object->queue_count -= count;
+    object->stats.delivered += count;
+    if (object->flush_refused && object->timer) {
+        // publish the records left behind as soon as the loop runs timers
+        (void) event_loop_timer_arm(object->timer, 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// batches are instances of the payload resource keyed by their sequence
+// number, those served by a complete read leave the queue
+static int
+read_queue(sensor_batch_object_t *object, anjay_output_ctx_t *ctx) {
+    anjay_output_ctx_t *array = anjay_ret_array_start(ctx);
+    if (!array) {
+        return ANJAY_ERR_INTERNAL;
+    }
+    size_t count = object->queue_count;
+    for (size_t i = 0; i < count; ++i) {
+        const published_batch_t *batch =
+                &object->queue[(object->queue_head + i) % SENSOR_BATCH_QUEUE_LENGTH];
+        int result = anjay_ret_array_index(
+                array, (anjay_riid_t) (batch->sequence % ANJAY_IID_INVALID));
+        if (!result) {
+            result = anjay_ret_bytes(array, batch->data, batch->size);
+        }
+        if (result) {
+            return result;
+        }
+    }
+    int result = anjay_ret_array_finish(array);
+    if (!result) {
+        drain_queue(object, count);
+    }
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+static
+int sensor_batch_resource_read(anjay_t *anjay,
+                               const anjay_dm_object_def_t *const *obj_ptr,
+                               anjay_iid_t iid,
+                               anjay_rid_t rid,
+                               anjay_output_ctx_t *ctx) {
+    (void) anjay;
+    (void) iid;
+
+    sensor_batch_log(DEBUG, "Read /%i/%i/%i", SENSOR_BATCH_OBJECT_ID, iid, rid);
+    sensor_batch_object_t *object = get_object(obj_ptr);
+    // nothing is stored by the engine, it only checks rid and operations
+    int result = object_schema_read(&OBJECT_33206_SCHEMA, NULL, rid, ctx);
+    if (result != OBJECT_SCHEMA_CUSTOM) {
+        return result;
+    }
+
+    switch (rid) {
+    case SENSOR_BATCH_PAYLOAD:
+        return read_queue(object, ctx);
+    case SENSOR_BATCH_SEQUENCE:
+        return anjay_ret_i64(ctx, (int64_t) object->sequence);
+    case SENSOR_BATCH_VALUES:
+        return anjay_ret_i64(ctx, (int64_t) object->last_count);
+    default:
+    return ANJAY_ERR_NOT_FOUND;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static
+int sensor_batch_resource_execute(anjay_t *anjay,
+                                  const anjay_dm_object_def_t *const *obj_ptr,
+                                  anjay_iid_t iid,
+                                  anjay_rid_t rid,
+                                  anjay_execute_ctx_t *ctx) {
+    (void) anjay;
+    (void) iid;
+    (void) ctx;
+
+    sensor_batch_log(DEBUG, "Execute /%i/%i/%i", SENSOR_BATCH_OBJECT_ID, iid, rid);
+    if (rid != SENSOR_BATCH_FLUSH) {
+        return ANJAY_ERR_METHOD_NOT_ALLOWED;
+    }
+    (void) sensor_batch_flush(get_object(obj_ptr));
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static
+const anjay_dm_object_def_t SENSOR_BATCH_OBJECT_DEFINE = {
+    .oid = SENSOR_BATCH_OBJECT_ID,
+
+    .supported_rids = OBJECT_33206_SUPPORTED_RIDS,
+
+    .handlers = {
+
+        .instance_it            = anjay_dm_instance_it_SINGLE,
+        .instance_present       = anjay_dm_instance_present_SINGLE,
+
+        .resource_present       = anjay_dm_resource_present_TRUE,
+        .resource_read          = sensor_batch_resource_read,
+        .resource_execute       = sensor_batch_resource_execute,
+
+        .transaction_begin      = anjay_dm_transaction_NOOP,
+        .transaction_validate   = anjay_dm_transaction_NOOP,
+        .transaction_commit     = anjay_dm_transaction_NOOP,
+        .transaction_rollback   = anjay_dm_transaction_NOOP
+    }
+};
+
+//------------------------------------------------------------------------------
+
+static void
+flush_timer_handler(void *object_) {
+    (void) sensor_batch_flush((sensor_batch_object_t *) object_);
+}
+
+//------------------------------------------------------------------------------
+
+sensor_batch_object_t *
+sensor_batch_init_object(anjay_t *anjay, event_loop_t *event_loop) {
+    assert(anjay);
+
+    sensor_batch_object_t *object =
+    (sensor_batch_object_t *) avs_calloc(1, sizeof(sensor_batch_object_t));
+    if (!object) {
+        sensor_batch_log(ERROR, "Out of memory");
+        return NULL;
+    }
+    object->obj_def = &SENSOR_BATCH_OBJECT_DEFINE;
+    object->anjay = anjay;
+    object->max_bytes = SENSOR_BATCH_DEFAULT_BYTES;
+    object->window_ms = SENSOR_BATCH_DEFAULT_WINDOW;
+    object->message_bytes = SENSOR_BATCH_QUEUE_LENGTH
+                            * (SENSOR_BATCH_ENTRY_HEAD + SENSOR_BATCH_CAPACITY);
+
+    if (!(object->pending = (uint8_t *) avs_malloc(SENSOR_BATCH_CAPACITY))
+            || !(object->queue_data = (uint8_t *) avs_malloc(
+                         SENSOR_BATCH_QUEUE_LENGTH * SENSOR_BATCH_CAPACITY))
+            || (event_loop && !(object->timer = event_loop_timer_create(
+                                        event_loop, flush_timer_handler, object)))) {
+        sensor_batch_log(ERROR, "Out of memory");
+        goto error;
+    }
+    for (size_t i = 0; i < SENSOR_BATCH_QUEUE_LENGTH; ++i) {
+        object->queue[i].data = object->queue_data + i * SENSOR_BATCH_CAPACITY;
+    }
+
+    // register
+    if (anjay_register_object(anjay, &object->obj_def)) {
+        sensor_batch_log(ERROR, "Failed to register sensor batch object");
+        goto error;
+    }
+    return object;
+
+error:
+    event_loop_timer_destroy(object->timer);
+    avs_free(object->queue_data);
+    avs_free(object->pending);
+    avs_free(object);
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+add_record(sensor_batch_object_t *object,
+           anjay_oid_t oid,
+           anjay_iid_t iid,
+           anjay_rid_t rid,
+           senml_record_t *record) {
+    assert(object);
+    int64_t now_ms = get_real_time_ms();
+
+    char base_name[SENSOR_BATCH_NAME_SIZE];
+    char name[SENSOR_BATCH_NAME_SIZE];
+    snprintf(base_name, sizeof(base_name), "/%u/%u/", (unsigned) oid, (unsigned) iid);
+    snprintf(name, sizeof(name), "%u", (unsigned) rid);
+    record->name = name;
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        // records of the same instance share the base name of the first one
+        bool new_base = !object->has_base || object->base_oid != oid
+                        || object->base_iid != iid;
+        record->base_name = new_base ? base_name : NULL;
+        record->has_base_time = !object->pending_count;
+        record->base_time = (double) now_ms / 1000.0;
+        // offsets rounded to single precision keep ms resolution for hours
+        // and are encoded in 5 bytes instead of 9
+        record->time = object->pending_count
+                               ? (double) (float) ((double) (now_ms - object->base_time_ms)
+                                                   / 1000.0)
+                               : 0.0;
+
+        cbor_writer_t writer;
+        cbor_writer_init(&writer, object->pending + object->pending_size,
+                         object->max_bytes - SENSOR_BATCH_ARRAY_HEAD_MAX
+                                 - object->pending_size);
+        senml_write_record(&writer, record);
+        if (writer.overflow) {
+            // payload is full, publish it and start a new one
+            if (!object->pending_count) {
+                sensor_batch_log(ERROR, "value of /%u/%u/%u does not fit in a batch",
+                                 (unsigned) oid, (unsigned) iid, (unsigned) rid);
+                return -1;
+            }
+            if (sensor_batch_flush(object) < 0) {
+                ++object->stats.refused;
+                return -1;
+            }
+            continue;
+        }
+
+        if (!object->pending_count) {
+            object->base_time_ms = now_ms;
+            if (object->window_ms > 0 && object->timer) {
+                (void) event_loop_timer_arm(object->timer, object->window_ms);
+            }
+        }
+        object->has_base = true;
+        object->base_oid = oid;
+        object->base_iid = iid;
+        object->pending_size += writer.size;
+        ++object->pending_count;
+        ++object->stats.values;
+
+        if (object->window_ms <= 0
+                || object->max_bytes - SENSOR_BATCH_ARRAY_HEAD_MAX - object->pending_size
+                           < SENML_RECORD_MAX_SIZE) {
+            (void) sensor_batch_flush(object);
+        }
+        return 0;
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+int
+sensor_batch_add_float(sensor_batch_object_t *object,
+                       anjay_oid_t oid,
+                       anjay_iid_t iid,
+                       anjay_rid_t rid,
+                       double value) {
+    senml_record_t record = {
+        .type = SENML_VALUE_FLOAT,
+        .value.f = value
+    };
+    return add_record(object, oid, iid, rid, &record);
+}
+
+//------------------------------------------------------------------------------
+
+int
+sensor_batch_add_int(sensor_batch_object_t *object,
+                     anjay_oid_t oid,
+                     anjay_iid_t iid,
+                     anjay_rid_t rid,
+                     int64_t value) {
+    senml_record_t record = {
+        .type = SENML_VALUE_INT,
+        .value.i = value
+    };
+    return add_record(object, oid, iid, rid, &record);
+}
+
+//------------------------------------------------------------------------------
+
+int
+sensor_batch_add_bool(sensor_batch_object_t *object,
+                      anjay_oid_t oid,
+                      anjay_iid_t iid,
+                      anjay_rid_t rid,
+                      bool value) {
+    senml_record_t record = {
+        .type = SENML_VALUE_BOOL,
+        .value.b = value
+    };
+    return add_record(object, oid, iid, rid, &record);
+}
+
+//------------------------------------------------------------------------------
+
+int
+sensor_batch_flush(sensor_batch_object_t *object) {
+    assert(object);
+
+    event_loop_timer_cancel(object->timer);
+    if (!object->pending_count) {
+        return 0;
+    }
+    // one notification carries the whole queue, the first batch always fits
+    size_t batch_bytes = SENSOR_BATCH_ENTRY_HEAD + SENSOR_BATCH_ARRAY_HEAD_MAX
+                         + object->pending_size;
+    if (object->queue_count == SENSOR_BATCH_QUEUE_LENGTH
+            || (object->queue_count
+                && object->queue_bytes + batch_bytes > object->message_bytes)) {
+        // batches not read yet are never overwritten
+        object->flush_refused = true;
+        sensor_batch_log(WARNING, "%u batches wait for the server, batch not published",
+                         (unsigned) object->queue_count);
+        return -1;
+    }
+    object->flush_refused = false;
+
+    // array length is known only now, records are copied behind its head
+    published_batch_t *batch =
+            &object->queue[(object->queue_head + object->queue_count)
+                           % SENSOR_BATCH_QUEUE_LENGTH];
+    cbor_writer_t writer;
+    cbor_writer_init(&writer, batch->data, SENSOR_BATCH_CAPACITY);
+    cbor_write_array(&writer, object->pending_count);
+    memcpy(batch->data + writer.size, object->pending, object->pending_size);
+    batch->size = writer.size + object->pending_size;
+    batch->count = object->pending_count;
+    batch->sequence = ++object->sequence;
+    ++object->queue_count;
+    object->queue_bytes += SENSOR_BATCH_ENTRY_HEAD + batch->size;
+    object->last_count = batch->count;
+
+    object->stats.batches++;
+    object->stats.payload_bytes += batch->size;
+    sensor_batch_log(DEBUG, "Publish batch %llu: %u values, %u bytes",
+                     (unsigned long long) batch->sequence,
+                     (unsigned) batch->count,
+                     (unsigned) batch->size);
+
+    object->pending_size = 0;
+    object->pending_count = 0;
+    object->has_base = false;
+
+    // one notification carries the whole batch
+    metrics_t *metrics = metrics_current();
+    int64_t start_ns = metrics_start(metrics);
+    (void) anjay_notify_changed(object->anjay, SENSOR_BATCH_OBJECT_ID, 0,
+                                SENSOR_BATCH_PAYLOAD);
+    metrics_stop(metrics, METRIC_NOTIFY, start_ns);
+    metrics_count(metrics, METRIC_NOTIFIES, 1);
+    return (int) batch->count;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sensor_batch_set_limits(sensor_batch_object_t *object,
+                        size_t max_bytes,
+                        int window_ms) {
+    assert(object);
+
+    // queued records were sized for the old limit
+    (void) sensor_batch_flush(object);
+    if (max_bytes < SENML_RECORD_MAX_SIZE + SENSOR_BATCH_ARRAY_HEAD_MAX) {
+        max_bytes = SENML_RECORD_MAX_SIZE + SENSOR_BATCH_ARRAY_HEAD_MAX;
+    }
+    // records left behind by a full queue stay in the batch being built
+    if (max_bytes < object->pending_size + SENSOR_BATCH_ARRAY_HEAD_MAX) {
+        max_bytes = object->pending_size + SENSOR_BATCH_ARRAY_HEAD_MAX;
+    }
+    object->max_bytes = max_bytes < SENSOR_BATCH_CAPACITY ? max_bytes
+                                                         : SENSOR_BATCH_CAPACITY;
+    object->window_ms = window_ms > 0 ? window_ms : 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sensor_batch_set_message_size(sensor_batch_object_t *object,
+                              size_t out_buffer_size) {
+    assert(object);
+    object->message_bytes = out_buffer_size > SENSOR_BATCH_MESSAGE_HEAD
+                                    ? out_buffer_size - SENSOR_BATCH_MESSAGE_HEAD
+                                    : 0;
+}
+
+//------------------------------------------------------------------------------
+
+const report_stats_t *
+sensor_batch_stats(const sensor_batch_object_t *object) {
+    assert(object);
+    return &object->stats;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sensor_batch_object_release(anjay_t *anjay, sensor_batch_object_t *object) {
+    assert(anjay);
+
+    if (!object) {
+        return;
+    }
+
+    event_loop_timer_destroy(object->timer);
+    anjay_unregister_object(anjay, &object->obj_def);
+    avs_free(object->queue_data);
+    avs_free(object->pending);
+    avs_free(object);
+}
@@ -0,0 +1,538 @@
+#define _POSIX_C_SOURCE 200809L
+#include "toyota_actuator.h"
+
+#include <avsystem/commons/defs.h>
+#include <avsystem/commons/log.h>
+#include <avsystem/commons/memory.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define actuator_log(level, ...) avs_log(toyota_actuator, level, __VA_ARGS__)
+
+#define SYSFS_PATH_SIZE 256
+#define SYSFS_VALUE_SIZE 32
+
+// latest value of a unit waiting for the worker
+typedef struct {
+    bool    pending;
+    bool    state;
+    int64_t brightness;
+    int64_t requested_ns;   // first request since the last apply
+    int64_t applied_ns;     // start of the last apply, 0 - never applied
+} unit_slot_t;
+
+struct actuator {
+    actuator_backend_t  *backend;
+    int64_t             interval_ns;
+    pthread_t           thread;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      wake;       // new pending unit or stop
+    pthread_cond_t      idle;       // nothing pending and nothing being applied
+    bool                stop;
+    size_t              pending_count;
+    size_t              in_flight;
+    unit_slot_t         units[ACTUATOR_MAX_UNITS];
+    actuator_stats_t    stats;
+};
+
+typedef struct {
+    anjay_iid_t unit;
+    bool        state;
+    int64_t     brightness;
+    int64_t     requested_ns;
+} apply_job_t;
+
+//------------------------------------------------------------------------------
+
+static int64_t
+now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+
+// takes units due for apply, returns their number; *out_next_due_ns is set
+// to the moment the next rate-limited unit gets due, 0 if there is none
+static size_t
+take_due_units(actuator_t *actuator, apply_job_t *jobs, int64_t *out_next_due_ns) {
+    int64_t now = now_ns();
+    size_t count = 0;
+    *out_next_due_ns = 0;
+    for (size_t i = 0; i < ACTUATOR_MAX_UNITS; ++i) {
+        unit_slot_t *slot = &actuator->units[i];
+        if (!slot->pending) {
+            continue;
+        }
+        int64_t due = slot->applied_ns ? slot->applied_ns + actuator->interval_ns : 0;
+        if (due > now && !actuator->stop) {
+            // applied recently, later requests keep coalescing until due
+            if (!*out_next_due_ns || due < *out_next_due_ns) {
+                *out_next_due_ns = due;
+            }
+            continue;
+        }
+        jobs[count++] = (apply_job_t) {
+            .unit = (anjay_iid_t) i,
+            .state = slot->state,
+            .brightness = slot->brightness,
+            .requested_ns = slot->requested_ns
+        };
+        slot->pending = false;
+        slot->applied_ns = now;
+        --actuator->pending_count;
+        ++actuator->in_flight;
+    }
+    return count;
+}
+
+//------------------------------------------------------------------------------
+
+static void *
+worker_run(void *actuator_) {
+    actuator_t *actuator = (actuator_t *) actuator_;
+    apply_job_t jobs[ACTUATOR_MAX_UNITS];
+
+    pthread_mutex_lock(&actuator->mutex);
+    while (true) {
+        while (!actuator->pending_count && !actuator->stop) {
+            pthread_cond_wait(&actuator->wake, &actuator->mutex);
+        }
+        if (!actuator->pending_count) {
+            break;
+        }
+
+        int64_t next_due_ns;
+        size_t count = take_due_units(actuator, jobs, &next_due_ns);
+        if (!count) {
+            struct timespec deadline = {
+                .tv_sec = (time_t) (next_due_ns / 1000000000),
+                .tv_nsec = (long) (next_due_ns % 1000000000)
+            };
+            (void) pthread_cond_timedwait(&actuator->wake, &actuator->mutex, &deadline);
+            continue;
+        }
+
+        // hardware is slow, requests keep landing in the slots meanwhile
+        pthread_mutex_unlock(&actuator->mutex);
+        int64_t apply_ns[ACTUATOR_MAX_UNITS];
+        int64_t done_ns[ACTUATOR_MAX_UNITS];
+        int results[ACTUATOR_MAX_UNITS];
+        for (size_t i = 0; i < count; ++i) {
+            int64_t start = now_ns();
+            results[i] = actuator->backend->vtable->apply(actuator->backend,
+                                                          jobs[i].unit,
+                                                          jobs[i].state,
+                                                          jobs[i].brightness);
+            done_ns[i] = now_ns();
+            apply_ns[i] = done_ns[i] - start;
+        }
+        pthread_mutex_lock(&actuator->mutex);
+
+        for (size_t i = 0; i < count; ++i) {
+            if (results[i]) {
+                ++actuator->stats.failed;
+                actuator_log(WARNING, "Could not apply unit %u", (unsigned) jobs[i].unit);
+                continue;
+            }
+            ++actuator->stats.applied;
+            histogram_record(&actuator->stats.apply_ns, (uint64_t) apply_ns[i]);
+            histogram_record(&actuator->stats.latency_ns,
+                             (uint64_t) (done_ns[i] - jobs[i].requested_ns));
+        }
+        actuator->in_flight -= count;
+        if (!actuator->pending_count && !actuator->in_flight) {
+            pthread_cond_broadcast(&actuator->idle);
+        }
+    }
+    pthread_cond_broadcast(&actuator->idle);
+    pthread_mutex_unlock(&actuator->mutex);
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+actuator_t *
+actuator_create(actuator_backend_t *backend, int interval_ms) {
+    assert(backend);
+
+    actuator_t *actuator = (actuator_t *) avs_calloc(1, sizeof(actuator_t));
+    if (!actuator) {
+        actuator_log(ERROR, "Out of memory");
+        backend->vtable->destroy(backend);
+        return NULL;
+    }
+    actuator->backend = backend;
+    actuator->interval_ns = (int64_t) (interval_ms > 0 ? interval_ms : 0) * 1000000;
+    histogram_init(&actuator->stats.apply_ns);
+    histogram_init(&actuator->stats.latency_ns);
+
+    pthread_condattr_t attr;
+    bool has_mutex = false;
+    bool has_wake = false;
+    bool has_idle = false;
+    if (pthread_condattr_init(&attr)) {
+        goto error;
+    }
+    // rate limit deadlines come from the monotonic clock
+    (void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    has_mutex = !pthread_mutex_init(&actuator->mutex, NULL);
+    has_wake = !pthread_cond_init(&actuator->wake, &attr);
+    has_idle = !pthread_cond_init(&actuator->idle, NULL);
+    pthread_condattr_destroy(&attr);
+    if (!has_mutex || !has_wake || !has_idle
+            || pthread_create(&actuator->thread, NULL, worker_run, actuator)) {
+        goto error;
+    }
+    actuator_log(INFO, "Actuator started, backend %s", backend->vtable->name);
+    return actuator;
+
+error:
+    actuator_log(ERROR, "Could not start actuator worker");
+    if (has_idle) {
+        pthread_cond_destroy(&actuator->idle);
+    }
+    if (has_wake) {
+        pthread_cond_destroy(&actuator->wake);
+    }
+    if (has_mutex) {
+        pthread_mutex_destroy(&actuator->mutex);
+    }
+    backend->vtable->destroy(backend);
+    avs_free(actuator);
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+int
+actuator_request(actuator_t *actuator,
+                 anjay_iid_t unit,
+                 bool state,
+                 int64_t brightness) {
+    assert(actuator);
+
+    if (unit >= ACTUATOR_MAX_UNITS) {
+        return -1;
+    }
+    pthread_mutex_lock(&actuator->mutex);
+    unit_slot_t *slot = &actuator->units[unit];
+    ++actuator->stats.requested;
+    if (slot->pending) {
+        ++actuator->stats.coalesced;
+    } else {
+        slot->pending = true;
+        slot->requested_ns = now_ns();
+        if (!actuator->pending_count++) {
+            pthread_cond_signal(&actuator->wake);
+        }
+    }
+    slot->state = state;
+    slot->brightness = brightness;
+    pthread_mutex_unlock(&actuator->mutex);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+actuator_flush(actuator_t *actuator) {
+    assert(actuator);
+
+    pthread_mutex_lock(&actuator->mutex);
+    while (actuator->pending_count || actuator->in_flight) {
+        pthread_cond_wait(&actuator->idle, &actuator->mutex);
+    }
+    pthread_mutex_unlock(&actuator->mutex);
+}
+
+//------------------------------------------------------------------------------
+
+void
+actuator_get_stats(actuator_t *actuator, actuator_stats_t *out_stats) {
+    assert(actuator);
+
+    pthread_mutex_lock(&actuator->mutex);
+    *out_stats = actuator->stats;
+    pthread_mutex_unlock(&actuator->mutex);
+}
+
+//------------------------------------------------------------------------------
+
+void
+actuator_destroy(actuator_t *actuator) {
+    if (!actuator) {
+        return;
+    }
+
+    pthread_mutex_lock(&actuator->mutex);
+    actuator->stop = true;
+    pthread_cond_signal(&actuator->wake);
+    pthread_mutex_unlock(&actuator->mutex);
+    pthread_join(actuator->thread, NULL);
+
+    pthread_cond_destroy(&actuator->idle);
+    pthread_cond_destroy(&actuator->wake);
+    pthread_mutex_destroy(&actuator->mutex);
+    actuator->backend->vtable->destroy(actuator->backend);
+    avs_free(actuator);
+}
+
+//------------------------------------------------------------------------------
+// simulated backend
+
+typedef struct {
+    actuator_backend_t  base;
+    unsigned            apply_delay_us;
+    pthread_mutex_t     mutex;      // values are read by other threads
+    bool                state[ACTUATOR_MAX_UNITS];
+    int64_t             brightness[ACTUATOR_MAX_UNITS];
+    uint64_t            applies[ACTUATOR_MAX_UNITS];
+} sim_backend_t;
+
+static int
+sim_apply(actuator_backend_t *backend_,
+          anjay_iid_t unit,
+          bool state,
+          int64_t brightness) {
+    sim_backend_t *backend = AVS_CONTAINER_OF(backend_, sim_backend_t, base);
+    if (backend->apply_delay_us) {
+        struct timespec delay = {
+            .tv_sec = (time_t) (backend->apply_delay_us / 1000000),
+            .tv_nsec = (long) (backend->apply_delay_us % 1000000) * 1000
+        };
+        while (nanosleep(&delay, &delay) && errno == EINTR) {
+        }
+    }
+    pthread_mutex_lock(&backend->mutex);
+    backend->state[unit] = state;
+    backend->brightness[unit] = brightness;
+    ++backend->applies[unit];
+    pthread_mutex_unlock(&backend->mutex);
+    return 0;
+}
+
+static void
+sim_destroy(actuator_backend_t *backend_) {
+    sim_backend_t *backend = AVS_CONTAINER_OF(backend_, sim_backend_t, base);
+    pthread_mutex_destroy(&backend->mutex);
+    avs_free(backend);
+}
+
+static const actuator_backend_vtable_t SIM_BACKEND_VTABLE = {
+    .name = "sim",
+    .apply = sim_apply,
+    .destroy = sim_destroy
+};
+
+//------------------------------------------------------------------------------
+
+actuator_backend_t *
+actuator_backend_sim_create(unsigned apply_delay_us) {
+    sim_backend_t *backend = (sim_backend_t *) avs_calloc(1, sizeof(sim_backend_t));
+    if (!backend) {
+        return NULL;
+    }
+    if (pthread_mutex_init(&backend->mutex, NULL)) {
+        avs_free(backend);
+        return NULL;
+    }
+    backend->base.vtable = &SIM_BACKEND_VTABLE;
+    backend->apply_delay_us = apply_delay_us;
+    return &backend->base;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t
+actuator_backend_sim_get(actuator_backend_t *backend_,
+                         anjay_iid_t unit,
+                         bool *out_state,
+                         int64_t *out_brightness) {
+    assert(backend_->vtable == &SIM_BACKEND_VTABLE);
+    sim_backend_t *backend = AVS_CONTAINER_OF(backend_, sim_backend_t, base);
+    if (unit >= ACTUATOR_MAX_UNITS) {
+        return 0;
+    }
+    pthread_mutex_lock(&backend->mutex);
+    *out_state = backend->state[unit];
+    *out_brightness = backend->brightness[unit];
+    uint64_t applies = backend->applies[unit];
+    pthread_mutex_unlock(&backend->mutex);
+    return applies;
+}
+
+//------------------------------------------------------------------------------
+// sysfs backend
+
+typedef struct {
+    actuator_backend_t  base;
+    char                pwm_chip[SYSFS_PATH_SIZE];
+    char                gpio_root[SYSFS_PATH_SIZE];
+    int                 relay_gpio_base;
+    bool                opened[ACTUATOR_MAX_UNITS];
+    int                 duty_fd[ACTUATOR_MAX_UNITS];
+    int                 relay_fd[ACTUATOR_MAX_UNITS];   // -1 without relay
+    int64_t             period_ns[ACTUATOR_MAX_UNITS];
+} sysfs_backend_t;
+
+static int
+write_value(int fd, int64_t value) {
+    char text[SYSFS_VALUE_SIZE];
+    int size = snprintf(text, sizeof(text), "%" PRId64, value);
+    // sysfs attributes take the whole value in one write at offset 0
+    return pwrite(fd, text, (size_t) size, 0) == size ? 0 : -1;
+}
+
+static int
+write_file(const char *path, int64_t value) {
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    int result = write_value(fd, value);
+    close(fd);
+    return result;
+}
+
+static int
+read_file(const char *path, int64_t *out_value) {
+    char text[SYSFS_VALUE_SIZE];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t size = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (size <= 0) {
+        return -1;
+    }
+    text[size] = '\0';
+    char *end;
+    long long value = strtoll(text, &end, 10);
+    if (end == text || value <= 0) {
+        return -1;
+    }
+    *out_value = (int64_t) value;
+    return 0;
+}
+
+static int
+sysfs_open_unit(sysfs_backend_t *backend, anjay_iid_t unit) {
+    char path[SYSFS_PATH_SIZE + 32];
+
+    snprintf(path, sizeof(path), "%s/pwm%u/period", backend->pwm_chip, (unsigned) unit);
+    if (read_file(path, &backend->period_ns[unit])) {
+        actuator_log(ERROR, "Could not read %s", path);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/pwm%u/duty_cycle", backend->pwm_chip, (unsigned) unit);
+    if ((backend->duty_fd[unit] = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+        actuator_log(ERROR, "Could not open %s", path);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/pwm%u/enable", backend->pwm_chip, (unsigned) unit);
+    if (write_file(path, 1)) {
+        actuator_log(ERROR, "Could not enable %s", path);
+        goto error;
+    }
+    if (backend->gpio_root[0]) {
+        snprintf(path, sizeof(path), "%s/gpio%d/value", backend->gpio_root,
+                 backend->relay_gpio_base + (int) unit);
+        if ((backend->relay_fd[unit] = open(path, O_WRONLY | O_CLOEXEC)) < 0) {
+            actuator_log(ERROR, "Could not open %s", path);
+            goto error;
+        }
+    }
+    backend->opened[unit] = true;
+    return 0;
+
+error:
+    close(backend->duty_fd[unit]);
+    backend->duty_fd[unit] = -1;
+    return -1;
+}
+
+static int
+sysfs_apply(actuator_backend_t *backend_,
+            anjay_iid_t unit,
+            bool state,
+            int64_t brightness) {
+    sysfs_backend_t *backend = AVS_CONTAINER_OF(backend_, sysfs_backend_t, base);
+    if (!backend->opened[unit] && sysfs_open_unit(backend, unit)) {
+        return -1;
+    }
+    if (brightness < 0) {
+        brightness = 0;
+    } else if (brightness > 100) {
+        brightness = 100;
+    }
+    int64_t duty = state ? backend->period_ns[unit] * brightness / 100 : 0;
+    int relay_fd = backend->relay_fd[unit];
+    // relay switches while PWM is at the target level of the state
+    if (state) {
+        return write_value(backend->duty_fd[unit], duty)
+               || (relay_fd >= 0 && write_value(relay_fd, 1)) ? -1 : 0;
+    }
+    return (relay_fd >= 0 && write_value(relay_fd, 0))
+           || write_value(backend->duty_fd[unit], duty) ? -1 : 0;
+}
+
+static void
+sysfs_destroy(actuator_backend_t *backend_) {
+    sysfs_backend_t *backend = AVS_CONTAINER_OF(backend_, sysfs_backend_t, base);
+    for (size_t i = 0; i < ACTUATOR_MAX_UNITS; ++i) {
+        if (backend->duty_fd[i] >= 0) {
+            close(backend->duty_fd[i]);
+        }
+        if (backend->relay_fd[i] >= 0) {
+            close(backend->relay_fd[i]);
+        }
+    }
+    avs_free(backend);
+}
+
+static const actuator_backend_vtable_t SYSFS_BACKEND_VTABLE = {
+    .name = "sysfs",
+    .apply = sysfs_apply,
+    .destroy = sysfs_destroy
+};
+
+//------------------------------------------------------------------------------
+
+actuator_backend_t *
+actuator_backend_sysfs_create(const actuator_sysfs_config_t *config) {
+    assert(config);
+    assert(config->pwm_chip);
+
+    if (strlen(config->pwm_chip) >= SYSFS_PATH_SIZE
+            || (config->gpio_root && strlen(config->gpio_root) >= SYSFS_PATH_SIZE)) {
+        actuator_log(ERROR, "sysfs path too long");
+        return NULL;
+    }
+    sysfs_backend_t *backend = (sysfs_backend_t *) avs_calloc(1, sizeof(sysfs_backend_t));
+    if (!backend) {
+        return NULL;
+    }
+    backend->base.vtable = &SYSFS_BACKEND_VTABLE;
+    strcpy(backend->pwm_chip, config->pwm_chip);
+    if (config->gpio_root) {
+        strcpy(backend->gpio_root, config->gpio_root);
+    }
+    backend->relay_gpio_base = config->relay_gpio_base;
+    for (size_t i = 0; i < ACTUATOR_MAX_UNITS; ++i) {
+        backend->duty_fd[i] = -1;
+        backend->relay_fd[i] = -1;
+    }
+    return &backend->base;
+}
@@ -0,0 +1,370 @@
+#include "toyota_arena.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avsystem/commons/log.h>
+#include <avsystem/commons/memory.h>
+
+#define ARENA_MIN_CLASS_BITS    4   // 16 bytes, room for the free list link
+#define ARENA_MAX_CLASS_BITS    12  // 4 KiB, larger blocks come from the system heap
+#define ARENA_CLASS_COUNT       (ARENA_MAX_CLASS_BITS - ARENA_MIN_CLASS_BITS + 1)
+#define ARENA_MAX_CLASS         ((size_t) 1 << ARENA_MAX_CLASS_BITS)
+
+#define arena_log(level, ...) avs_log(toyota_arena, level, __VA_ARGS__)
+
+// Header in front of every block handed out by the avs routines. Arena
+// bookkeeping uses the system allocator directly, it must not recurse.
+typedef struct block {
+    alignas(max_align_t) arena_t *arena;    // owner, NULL - block of the system heap
+    size_t size;                            // usable bytes, the size class in chunks
+} block_t;
+
+typedef struct chunk {
+    alignas(max_align_t) struct chunk *next;
+} chunk_t;
+
+struct arena {
+    pthread_mutex_t mutex;                  // blocks may be freed by other threads
+    block_t         *free_lists[ARENA_CLASS_COUNT]; // linked through the payload
+    chunk_t         *chunks;
+    char            *bump;                  // not yet carved part of the newest chunk
+    char            *bump_end;
+    arena_stats_t   stats;
+    bool            destroyed;              // released with the last live block
+};
+
+static _Thread_local arena_t *current_arena;
+
+//------------------------------------------------------------------------------
+
+static void
+release_arena(arena_t *arena) {
+    while (arena->chunks) {
+        chunk_t *next = arena->chunks->next;
+        free(arena->chunks);
+        arena->chunks = next;
+    }
+    pthread_mutex_destroy(&arena->mutex);
+    free(arena);
+}
+
+//------------------------------------------------------------------------------
+
+bool
+arena_enabled(void) {
+#ifdef TOYOTA_WITH_CLIENT_ARENA
+    return true;
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+arena_t *
+arena_create(void) {
+    arena_t *arena = (arena_t *) calloc(1, sizeof(arena_t));
+    if (!arena) {
+        arena_log(ERROR, "out of memory");
+        return NULL;
+    }
+    if (pthread_mutex_init(&arena->mutex, NULL)) {
+        arena_log(ERROR, "could not create mutex");
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+//------------------------------------------------------------------------------
+
+void
+arena_destroy(arena_t *arena) {
+    if (!arena) {
+        return;
+    }
+    if (current_arena == arena) {
+        current_arena = NULL;
+    }
+
+    pthread_mutex_lock(&arena->mutex);
+    arena->destroyed = true;
+    size_t blocks = arena->stats.blocks;
+    size_t in_use = arena->stats.in_use;
+    pthread_mutex_unlock(&arena->mutex);
+    if (!blocks) {
+        release_arena(arena);
+        return;
+    }
+    arena_log(DEBUG, "%zu blocks (%zu bytes) outlive the arena, "
+              "released with the last one", blocks, in_use);
+}
+
+//------------------------------------------------------------------------------
+
+arena_t *
+arena_enter(arena_t *arena) {
+    arena_t *previous = current_arena;
+    current_arena = arena;
+    return previous;
+}
+
+//------------------------------------------------------------------------------
+
+void
+arena_leave(arena_t *previous) {
+    current_arena = previous;
+}
+
+//------------------------------------------------------------------------------
+
+void
+arena_get_stats(arena_t *arena, arena_stats_t *out_stats) {
+    assert(arena);
+    pthread_mutex_lock(&arena->mutex);
+    *out_stats = arena->stats;
+    pthread_mutex_unlock(&arena->mutex);
+}
+
+//------------------------------------------------------------------------------
+
+#ifdef TOYOTA_WITH_CLIENT_ARENA
+
+static size_t
+class_of(size_t size) {
+    if (size <= ((size_t) 1 << ARENA_MIN_CLASS_BITS)) {
+        return 0;
+    }
+    unsigned bits = 64 - (unsigned) __builtin_clzll((unsigned long long) (size - 1));
+    return bits - ARENA_MIN_CLASS_BITS;
+}
+
+//------------------------------------------------------------------------------
+
+static size_t
+class_size(size_t index) {
+    return (size_t) 1 << (index + ARENA_MIN_CLASS_BITS);
+}
+
+//------------------------------------------------------------------------------
+
+static block_t **
+next_free(block_t *block) {
+    return (block_t **) (block + 1);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+push_free(arena_t *arena, size_t index, block_t *block) {
+    *next_free(block) = arena->free_lists[index];
+    arena->free_lists[index] = block;
+}
+
+//------------------------------------------------------------------------------
+
+// the tail of a full chunk is cut into the largest classes that fit,
+// so nothing but a header-sized scrap is lost
+static void
+retire_bump(arena_t *arena) {
+    for (size_t index = ARENA_CLASS_COUNT; index-- > 0;) {
+        size_t size = sizeof(block_t) + class_size(index);
+        while ((size_t) (arena->bump_end - arena->bump) >= size) {
+            push_free(arena, index, (block_t *) arena->bump);
+            arena->bump += size;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static block_t *
+carve(arena_t *arena, size_t index) {
+    size_t size = sizeof(block_t) + class_size(index);
+    if ((size_t) (arena->bump_end - arena->bump) < size) {
+        chunk_t *chunk = (chunk_t *) malloc(ARENA_CHUNK_SIZE);
+        if (!chunk) {
+            return NULL;
+        }
+        if (arena->bump) {
+            retire_bump(arena);
+        }
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->bump = (char *) (chunk + 1);
+        arena->bump_end = (char *) chunk + ARENA_CHUNK_SIZE;
+        arena->stats.reserved += ARENA_CHUNK_SIZE;
+    }
+    block_t *block = (block_t *) arena->bump;
+    arena->bump += size;
+    return block;
+}
+
+//------------------------------------------------------------------------------
+
+static block_t *
+arena_alloc(arena_t *arena, size_t size) {
+    block_t *block = NULL;
+    pthread_mutex_lock(&arena->mutex);
+    if (size > ARENA_MAX_CLASS) {
+        if ((block = (block_t *) malloc(sizeof(block_t) + size))) {
+            block->size = size;
+            arena->stats.reserved += size;
+        }
+    } else {
+        size_t index = class_of(size);
+        if ((block = arena->free_lists[index])) {
+            arena->free_lists[index] = *next_free(block);
+        } else {
+            block = carve(arena, index);
+        }
+        if (block) {
+            block->size = class_size(index);
+        }
+    }
+    if (block) {
+        block->arena = arena;
+        arena->stats.in_use += block->size;
+        if (arena->stats.in_use > arena->stats.peak) {
+            arena->stats.peak = arena->stats.in_use;
+        }
+        ++arena->stats.blocks;
+    }
+    pthread_mutex_unlock(&arena->mutex);
+    return block;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+arena_release(block_t *block) {
+    arena_t *arena = block->arena;
+    pthread_mutex_lock(&arena->mutex);
+    arena->stats.in_use -= block->size;
+    --arena->stats.blocks;
+    if (block->size > ARENA_MAX_CLASS) {
+        arena->stats.reserved -= block->size;
+        free(block);
+    } else {
+        push_free(arena, class_of(block->size), block);
+    }
+    bool last = arena->destroyed && !arena->stats.blocks;
+    pthread_mutex_unlock(&arena->mutex);
+    if (last) {
+        release_arena(arena);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void *
+block_alloc(arena_t *arena, size_t size) {
+    if (size > SIZE_MAX - sizeof(block_t)) {
+        return NULL;
+    }
+    // reading destroyed without the lock is fine, only the owner thread
+    // destroys an arena it may still have entered
+    if (arena && !arena->destroyed) {
+        block_t *block = arena_alloc(arena, size);
+        return block ? block + 1 : NULL;
+    }
+    block_t *block = (block_t *) malloc(sizeof(block_t) + size);
+    if (!block) {
+        return NULL;
+    }
+    block->arena = NULL;
+    block->size = size;
+    return block + 1;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+block_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    block_t *block = (block_t *) ptr - 1;
+    if (block->arena) {
+        arena_release(block);
+    } else {
+        free(block);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void *
+block_realloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return block_alloc(current_arena, size);
+    }
+    if (!size) {
+        block_free(ptr);
+        return NULL;
+    }
+    block_t *block = (block_t *) ptr - 1;
+    if (!block->arena) {
+        if (size > SIZE_MAX - sizeof(block_t)
+                || !(block = (block_t *) realloc(block, sizeof(block_t) + size))) {
+            return NULL;
+        }
+        block->size = size;
+        return block + 1;
+    }
+    if (size <= block->size) {
+        return ptr;
+    }
+    // grown blocks stay with their owner, whichever arena is entered now
+    void *grown = block_alloc(block->arena, size);
+    if (grown) {
+        memcpy(grown, ptr, block->size);
+        arena_release(block);
+    }
+    return grown;
+}
+
+//------------------------------------------------------------------------------
+
+// avs_commons built with WITH_STANDARD_ALLOCATOR=OFF leaves these to the
+// application; avs_strdup() and the rest allocate through them
+
+void *
+avs_malloc(size_t size) {
+    return block_alloc(current_arena, size);
+}
+
+//------------------------------------------------------------------------------
+
+void *
+avs_calloc(size_t nmemb, size_t size) {
+    if (size && nmemb > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *ptr = block_alloc(current_arena, nmemb * size);
+    if (ptr) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+//------------------------------------------------------------------------------
+
+void *
+avs_realloc(void *ptr, size_t size) {
+    return block_realloc(ptr, size);
+}
+
+//------------------------------------------------------------------------------
+
+void
+avs_free(void *ptr) {
+    block_free(ptr);
+}
+
+#endif // TOYOTA_WITH_CLIENT_ARENA
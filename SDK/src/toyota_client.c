@@ -1,13 +1,22 @@
 #include "toyota_client.h"
+#include "toyota_event_loop.h"
+#include "toyota_ingest.h"
 
 #include "assert.h"
+#include "limits.h"
+#include "math.h"
 #include "signal.h"
+#include "stdint.h"
 #include "stdio.h"
+#include "string.h"
 #include "time.h"
-#include "poll.h"
+#include "unistd.h"
 
 #include <avsystem/commons/log.h>
 #include <avsystem/commons/defs.h>
+#include <avsystem/commons/memory.h>
+#include <avsystem/commons/persistence.h>
+#include <avsystem/commons/stream/stream_file.h>
 #include <anjay/anjay.h>
 #include <anjay/security.h>
 #include <anjay/server.h>
@@ -16,98 +25,409 @@
 #include "Main_Objects/humidity.h"
 #include "Main_Objects/firmware_update.h"
 #include "Main_Objects/headlights_control.h"
+#include "Main_Objects/sensor_batch.h"
 
-#define INPUT_BUFFER_SIZE  10000
-#define OUTPUT_BUFFER_SIZE 10000
 #define DEFAULT_MIN_PERIOD -1
 #define DEFAULT_MAX_PERIOD -1
 #define DISABLE_TIMEOUT    -1
+#define SECURITY_OID       0
+#define SERVER_OID         1
+#define DEFAULT_PSK_IDENTITY "yurii.shostak"          // default PSK identity
+#define DEFAULT_PSK_KEY      "18041994yayura18041994" // default PSK key
+#define DATAGRAM_BUFFER_SIZE 10000                    // whole CoAP message in one datagram
+#define ATTRS_FILE_SUFFIX    ".attrs"                 // next to the firmware persistence file
+#define ATTRS_FILE_VERSION   2
+
+typedef struct {
+    const char                *scheme;                // with "://"
+    client_transport_t        transport;
+    anjay_udp_security_mode_t security_mode;
+    const char                *binding;               // default binding mode
+    size_t                    buffer_size;            // default in and out buffer size
+} transport_info_t;
+
+// longer schemes first, "coap" is a prefix of "coaps"
+static const transport_info_t TRANSPORTS[] = {
+    { "coaps://",     CLIENT_TRANSPORT_DTLS, ANJAY_UDP_SECURITY_PSK,   "U", DATAGRAM_BUFFER_SIZE },
+    { "coap://",      CLIENT_TRANSPORT_UDP,  ANJAY_UDP_SECURITY_NOSEC, "U", DATAGRAM_BUFFER_SIZE }
+};
+
+// anjay 1.x speaks LwM2M 1.0 over UDP only, its Server object rejects the
+// "T" binding; these schemes are named in the error instead of passing as
+// unknown ones
+static const char *const TCP_SCHEMES[] = { "coap+tcp://", "coaps+tcp://" };
 
 struct client {
     anjay_t *anjay;                                   // main lwm2m context
     firmware_update_logic_t  firmware_update;         // main structure of firmware_update object
     const char               *fw_updated_marker_path; // firmware update marker filepath
+    event_loop_t             *event_loop;             // epoll-based loop serving client sockets
+    event_loop_endpoint_t    *loop_endpoint;          // client registration in the event loop
+    bool                     owns_event_loop;         // loop created by the client itself
+    bool                     has_firmware_update;     // firmware update object installed
+    humidity_object_t        *humidity;               // humidity sensor object state
+    headlights_object_t      *headlights;             // headlights control object state
+    ingest_queue_t           *ingest;                 // samples pushed by acquisition threads
+    sensor_batch_object_t    *reports;                // SenML batches of reported values
+    actuator_t               *actuator;               // drives headlights hardware, NULL - none
+    sampler_t                *sampler;                // reads humidity sensors, NULL - none
+    client_config_t          config;                  // running configuration, strings owned
+    anjay_iid_t              security_iid;            // instance of the server in Security object
+    anjay_iid_t              server_iid;              // instance of the server in Server object
+    char                     *attrs_file;             // attributes kept over restarts, NULL - none
+    arena_t                  *arena;                  // memory of the client, NULL - system heap
 };
 
-void 
-remote_client_poll_sockets(client_t *self, int max_wait_time_ms) {
-    
-    anjay_t *anjay = self->anjay;
-
-    // Obtain all network data sources
-    AVS_LIST(avs_net_abstract_socket_t *const) sockets = anjay_get_sockets(anjay);
-
-    // Prepare to poll() on them
-    size_t numsocks = AVS_LIST_SIZE(sockets);
-    struct pollfd pollfds[numsocks];
-    size_t i = 0;
-
-    AVS_LIST(avs_net_abstract_socket_t *const) sock;
-    AVS_LIST_FOREACH(sock, sockets) {
-        pollfds[i].fd = *(const int *) avs_net_socket_get_system(*sock);
-        pollfds[i].events = POLLIN;
-        pollfds[i].revents = 0;
-        ++i;
-    }
-
-    // Determine the expected time to the next job in milliseconds.
-    // If there is no job we will wait till something arrives for
-    // at most 1 second (i.e. max_wait_time_ms).
-    int wait_ms = anjay_sched_calculate_wait_time_ms(anjay, max_wait_time_ms);
-
-    // Wait for the events if necessary, and handle them.
-    if (poll(pollfds, numsocks, wait_ms) > 0) {
-        int socket_id = 0;
-        AVS_LIST(avs_net_abstract_socket_t *const) socket = NULL;
-        AVS_LIST_FOREACH(socket, sockets) {
-            if (pollfds[socket_id].revents) {
-                if (anjay_serve(anjay, *socket)) {
-                    avs_log(toyota_client, ERROR, "anjay_serve failed");
-
-                }
-            }
-            ++socket_id;
+static void
+apply_ingested_sample(void *client_, const ingest_sample_t *sample) {
+    client_t *client = (client_t *) client_;
+    // every sample reaches the object, batching of notifications is up to it
+    switch (sample->kind) {
+    case INGEST_SAMPLE_HUMIDITY:
+        (void) humidity_sensor_set_data(client->anjay, client->humidity, sample->iid,
+                                        sample->data.humidity.value,
+                                        sample->data.humidity.state);
+        break;
+    case INGEST_SAMPLE_HEADLIGHTS:
+        (void) headlights_control_set_data(client->anjay, client->headlights,
+                                           sample->iid,
+                                           sample->data.headlights.state,
+                                           sample->data.headlights.brightness);
+        break;
+    }
+}
+
+static void
+apply_sampled_humidity(void *client_, size_t channel, float value) {
+    client_t *client = (client_t *) client_;
+    float current;
+    bool state;
+    // the driver measures the value only, relay state stays as it is
+    if (!humidity_sensor_get_data(client->humidity, (anjay_iid_t) channel,
+                                  &current, &state)) {
+        (void) humidity_sensor_set_data(client->anjay, client->humidity,
+                                        (anjay_iid_t) channel, value, state);
+    }
+}
+
+static int
+period_to_ms(int32_t period_s) {
+    return period_s < INT_MAX / 1000 ? (int) period_s * 1000 : INT_MAX;
+}
+
+static void
+limit_humidity_sampling(void *client_, size_t channel, sampler_limits_t *limits) {
+    client_t *client = (client_t *) client_;
+    // as set in the Server object instance by add_server_instance()
+    static const anjay_dm_attributes_t SERVER_DEFAULTS = {
+        .min_period = DEFAULT_MIN_PERIOD,
+        .max_period = DEFAULT_MAX_PERIOD
+    };
+    anjay_dm_resource_attributes_t attrs;
+    if (humidity_sensor_value_attrs(client->humidity, (anjay_iid_t) channel,
+                                    &SERVER_DEFAULTS, &attrs)) {
+        return;
+    }
+    // notifications are not sent more often than pmin, faster samples are
+    // never seen by the server
+    if (attrs.common.min_period != ANJAY_ATTRIB_PERIOD_NONE
+            && period_to_ms(attrs.common.min_period) > limits->min_interval_ms) {
+        limits->min_interval_ms = period_to_ms(attrs.common.min_period);
+    }
+    // the value notified every pmax should be fresh
+    if (attrs.common.max_period > 0
+            && period_to_ms(attrs.common.max_period) < limits->max_interval_ms) {
+        limits->max_interval_ms = period_to_ms(attrs.common.max_period);
+    }
+    // smaller steps notify the server, they have to be seen as movement
+    if (!isnan(attrs.step) && attrs.step < limits->threshold) {
+        limits->threshold = (float) attrs.step;
+    }
+}
+
+static const transport_info_t *
+find_transport(const char *server_uri) {
+    for (size_t i = 0; i < AVS_ARRAY_SIZE(TRANSPORTS); ++i) {
+        if (!strncmp(server_uri, TRANSPORTS[i].scheme, strlen(TRANSPORTS[i].scheme))) {
+            return &TRANSPORTS[i];
         }
     }
+    return NULL;
+}
 
-    if (anjay_all_connections_failed(anjay)) {
-        avs_log(toyota_client, ERROR, "All connections failed, trying to reconnect...");
-        anjay_schedule_reconnect(anjay);
+const char *
+remote_client_uri_error(const char *server_uri) {
+    if (find_transport(server_uri)) {
+        return NULL;
+    }
+    for (size_t i = 0; i < AVS_ARRAY_SIZE(TCP_SCHEMES); ++i) {
+        if (!strncmp(server_uri, TCP_SCHEMES[i], strlen(TCP_SCHEMES[i]))) {
+            return "CoAP over TCP is not supported by anjay 1.x - coap or coaps expected";
+        }
     }
+    return "unknown protocol - coap or coaps expected";
+}
 
+int
+remote_client_transport(const char *server_uri, client_transport_t *out_transport) {
+    const transport_info_t *info = find_transport(server_uri);
+    if (!info) {
+        return -1;
+    }
+    *out_transport = info->transport;
+    return 0;
+}
 
-    // Finally run the scheduler (ignoring its return value, which
-    // is the number of tasks executed)
-    (void) anjay_sched_run(anjay);
+static const char *
+binding_of(const client_config_t *config) {
+    return config->binding_mode ? config->binding_mode
+                                : find_transport(config->server_uri)->binding;
+}
 
+static void
+buffer_sizes_of(const client_config_t *config, size_t *out_in, size_t *out_out) {
+    size_t size = find_transport(config->server_uri)->buffer_size;
+    *out_in = config->in_buffer_size ? config->in_buffer_size : size;
+    *out_out = config->out_buffer_size ? config->out_buffer_size : size;
 }
 
-client_t *
-remote_client_create(uint16_t          ssid,
-                     const char        *endpoint_name,
-                     const char        *server_uri,
-                     const char        *binding_mode,
-                     int               lifetime,
-                     bool              bootstrap_state,
-                     const char        *fw_updated_marker_path,
-                     const char *const *fw_update_args) {
+static bool
+strings_equal(const char *a, const char *b) {
+    return a == b || (a && b && !strcmp(a, b));
+}
+
+static void
+release_config(client_config_t *config) {
+    avs_free((char *) (intptr_t) config->endpoint_name);
+    avs_free((char *) (intptr_t) config->server_uri);
+    avs_free((char *) (intptr_t) config->binding_mode);
+    avs_free((char *) (intptr_t) config->psk_identity);
+    avs_free((char *) (intptr_t) config->psk_key);
+    avs_free((char *) (intptr_t) config->fw_updated_marker_path);
+    memset(config, 0, sizeof(*config));
+}
+
+static int
+copy_string(const char **out, const char *string) {
+    *out = NULL;
+    return string && !(*out = avs_strdup(string)) ? -1 : 0;
+}
+
+// strings are copied, the caller's configuration may be released right after
+static int
+copy_config(client_config_t *out, const client_config_t *config) {
+    *out = *config;
+    if (copy_string(&out->endpoint_name, config->endpoint_name)
+            || copy_string(&out->server_uri, config->server_uri)
+            || copy_string(&out->binding_mode, config->binding_mode)
+            || copy_string(&out->psk_identity, config->psk_identity)
+            || copy_string(&out->psk_key, config->psk_key)
+            || copy_string(&out->fw_updated_marker_path,
+                           config->fw_updated_marker_path)) {
+        release_config(out);
+        return -1;
+    }
+    return 0;
+}
 
-    assert(endpoint_name);
-    assert(server_uri);
-    assert(binding_mode);
-    assert(lifetime > 0);
+static int
+add_security_instance(anjay_t *anjay,
+                      const client_config_t *config,
+                      anjay_iid_t *inout_iid) {
+    const char *psk_identity =
+            config->psk_identity ? config->psk_identity : DEFAULT_PSK_IDENTITY;
+    const char *psk_key = config->psk_key ? config->psk_key : DEFAULT_PSK_KEY;
 
-    const char PSK_IDENTITY[] = "yurii.shostak";          // default PSK identity
-    const char PSK_KEY[]      = "18041994yayura18041994"; // default PSK key
+    anjay_security_instance_t security_instance = {
+        .ssid                             = config->ssid,
+        .bootstrap_server                 = config->bootstrap_state,
+        .server_uri                       = config->server_uri,
+        .security_mode                    = find_transport(config->server_uri)->security_mode,
+    };
+    if (security_instance.security_mode == ANJAY_UDP_SECURITY_PSK) {
+        security_instance.public_cert_or_psk_identity      = (const uint8_t *) psk_identity;
+        security_instance.public_cert_or_psk_identity_size = strlen(psk_identity);
+        security_instance.private_cert_or_psk_key          = (const uint8_t *) psk_key;
+        security_instance.private_cert_or_psk_key_size     = strlen(psk_key);
+    }
+    return anjay_security_object_add_instance(anjay, &security_instance, inout_iid);
+}
+
+static int
+add_server_instance(anjay_t *anjay,
+                    const client_config_t *config,
+                    anjay_iid_t *inout_iid) {
+    anjay_server_instance_t server_instance = {
+        .ssid               = config->ssid,
+        .lifetime           = config->lifetime,
+        .default_min_period = DEFAULT_MIN_PERIOD,
+        .default_max_period = DEFAULT_MAX_PERIOD,
+        .disable_timeout    = DISABLE_TIMEOUT,
+        .binding            = binding_of(config),
+    };
+    return anjay_server_object_add_instance(anjay, &server_instance, inout_iid);
+}
+
+// header of the attribute state file: the stored state belongs to one endpoint
+// registered to one server
+static int
+attrs_header_persistence(avs_persistence_context_t *ctx, char **endpoint_name,
+                         char **server_uri) {
+    uint32_t version = ATTRS_FILE_VERSION;
+    if (avs_persistence_u32(ctx, &version)
+            || version != ATTRS_FILE_VERSION
+            || avs_persistence_string(ctx, endpoint_name)
+            || avs_persistence_string(ctx, server_uri)) {
+        return -1;
+    }
+    return 0;
+}
+
+// attributes written by the server (pmin, pmax, steps) survive a restart,
+// so the server does not have to set them again after an upgrade; those of
+// the humidity object are kept by the object, the others by attr_storage
+static void
+store_attrs_state(client_t *client) {
+    if (!client->attrs_file) {
+        return;
+    }
+    size_t tmp_path_size = strlen(client->attrs_file) + sizeof(".tmp");
+    char *tmp_path = (char *) avs_malloc(tmp_path_size);
+    if (!tmp_path) {
+        log_warn(toyota_client, "Could not store attribute state, out of memory");
+        return;
+    }
+    snprintf(tmp_path, tmp_path_size, "%s.tmp", client->attrs_file);
+    avs_stream_abstract_t *stream = NULL;
+    avs_persistence_context_t *ctx = NULL;
+    char *endpoint_name = (char *) (intptr_t) client->config.endpoint_name;
+    char *server_uri = (char *) (intptr_t) client->config.server_uri;
+    int result = 0;
+    if (!(stream = avs_stream_file_create(tmp_path, AVS_STREAM_FILE_WRITE))
+            || !(ctx = avs_persistence_store_context_new(stream))
+            || attrs_header_persistence(ctx, &endpoint_name, &server_uri)
+            || humidity_sensor_persist_attrs(client->humidity, ctx)
+            || anjay_attr_storage_persist(client->anjay, stream)) {
+        result = -1;
+    }
+    if (ctx) {
+        avs_persistence_context_delete(ctx);
+    }
+    if (stream) {
+        avs_stream_cleanup(&stream);
+    }
+    if (result || rename(tmp_path, client->attrs_file)) {
+        log_warn(toyota_client, "Could not store attribute state in %s",
+                 client->attrs_file);
+        unlink(tmp_path);
+    }
+    avs_free(tmp_path);
+}
+
+// a restored file is consumed: a crash must not bring back state older than
+// the last clean exit or upgrade; a file that could not be applied is kept
+// until the next store replaces it
+static void
+restore_attrs_state(client_t *client) {
+    avs_stream_abstract_t *stream = NULL;
+    avs_persistence_context_t *ctx = NULL;
+    char *endpoint_name = NULL;
+    char *server_uri = NULL;
+    bool restored = false;
+    if (!(stream = avs_stream_file_create(client->attrs_file, AVS_STREAM_FILE_READ))) {
+        return;
+    }
+    if (!(ctx = avs_persistence_restore_context_new(stream))
+            || attrs_header_persistence(ctx, &endpoint_name, &server_uri)) {
+        log_warn(toyota_client, "Invalid attribute state in %s", client->attrs_file);
+    } else if (!strings_equal(endpoint_name, client->config.endpoint_name)
+               || !strings_equal(server_uri, client->config.server_uri)) {
+        log_info(toyota_client, "Attribute state of %s at %s dropped", endpoint_name,
+                 server_uri);
+    } else if (humidity_sensor_restore_attrs(client->humidity, ctx)
+               || anjay_attr_storage_restore(client->anjay, stream)) {
+        log_warn(toyota_client, "Could not restore attributes from %s",
+                 client->attrs_file);
+    } else {
+        log_info(toyota_client, "Attribute state restored from %s", client->attrs_file);
+        restored = true;
+    }
+    avs_free(endpoint_name);
+    avs_free(server_uri);
+    if (ctx) {
+        avs_persistence_context_delete(ctx);
+    }
+    avs_stream_cleanup(&stream);
+    if (restored) {
+        unlink(client->attrs_file);
+    }
+}
+
+static void
+store_attrs_before_upgrade(void *client) {
+    store_attrs_state((client_t *) client);
+}
+
+static void
+release_client_resources(client_t *client) {
+    // sampler, queue and objects own watches and timers of the event loop,
+    // release them first
+    sampler_destroy(client->sampler);
+    ingest_queue_destroy(client->ingest);
+    sensor_batch_object_release(client->anjay, client->reports);
+    humidity_sensor_object_release(client->anjay, client->humidity);
+    headlights_control_object_release(client->anjay, client->headlights);
+    actuator_destroy(client->actuator);
+    if (client->has_firmware_update) {
+        firmware_update_destroy(&client->firmware_update);
+    }
+    event_loop_detach(client->event_loop, client->loop_endpoint);
+    if (client->owns_event_loop) {
+        event_loop_destroy(client->event_loop);
+    }
+    release_config(&client->config);
+    avs_free(client->attrs_file);
+}
+
+void 
+remote_client_poll_sockets(client_t *self, int max_wait_time_ms) {
+    (void) event_loop_run_once(self->event_loop, max_wait_time_ms);
+}
+
+client_t *
+remote_client_create_with_config(event_loop_t          *event_loop,
+                                 const client_config_t *config) {
+
+    assert(config);
+    assert(config->endpoint_name);
+    assert(config->server_uri);
+    assert(config->lifetime > 0);
 
     client_t *client = NULL;                              // main lwm2m client pointer 
     anjay_t  *anjay  = NULL;                              // main anjay-object pointer
+
+    if (!find_transport(config->server_uri)) {
+        log_error(toyota_client, "Unsupported server URI %s: %s", config->server_uri,
+                  remote_client_uri_error(config->server_uri));
+        return NULL;
+    }
+    size_t in_buffer_size;
+    size_t out_buffer_size;
+    buffer_sizes_of(config, &in_buffer_size, &out_buffer_size);
+
+    // anjay, objects and the client itself are allocated from one arena
+    arena_t *arena = NULL;
+    if (arena_enabled() && !(arena = arena_create())) {
+        log_error(toyota_client, "Could not create memory arena");
+        return NULL;
+    }
+    arena_t *previous_arena = arena_enter(arena);
     
     // setup main cinfiguration
     anjay_configuration_t connection_config = {
-        .endpoint_name             = endpoint_name,
-        .in_buffer_size            = INPUT_BUFFER_SIZE,
-        .out_buffer_size           = OUTPUT_BUFFER_SIZE,
+        .endpoint_name             = config->endpoint_name,
+        .in_buffer_size            = in_buffer_size,
+        .out_buffer_size           = out_buffer_size,
         .dtls_version              = AVS_NET_SSL_VERSION_TLSv1_2,
         .confirmable_notifications = true,
     };
@@ -125,46 +445,20 @@ remote_client_create(uint16_t          ssid,
         goto error;
     }
     
-    anjay_security_instance_t security_instance = {
-        .ssid                             = ssid,
-        .bootstrap_server                 = bootstrap_state,
-        .server_uri                       = server_uri,
-        .security_mode                    = ANJAY_UDP_SECURITY_PSK,
-        .public_cert_or_psk_identity      = (const uint8_t *) PSK_IDENTITY,
-        .public_cert_or_psk_identity_size = strlen(PSK_IDENTITY),
-        .private_cert_or_psk_key          = (const uint8_t *) PSK_KEY,
-        .private_cert_or_psk_key_size     = strlen(PSK_KEY),
-    };
-
+    // setup security instance
     anjay_iid_t security_instance_id = ANJAY_IID_INVALID;
-    if (anjay_security_object_add_instance(anjay, &security_instance,
-            &security_instance_id)) {
+    if (add_security_instance(anjay, config, &security_instance_id)) {
         log_error(toyota_client, "Could not add security instance");
         goto error;
     }
 
     // setup server instance
-    anjay_server_instance_t server_instance = {
-        .ssid               = ssid,
-        .lifetime           = lifetime,
-        .default_min_period = DEFAULT_MIN_PERIOD,
-        .default_max_period = DEFAULT_MAX_PERIOD,
-        .disable_timeout    = DISABLE_TIMEOUT,
-        .binding            = binding_mode,
-    };
-
     anjay_iid_t server_instance_id = ANJAY_IID_INVALID;
-    if (anjay_server_object_add_instance(anjay, &server_instance,
-            &server_instance_id)) {
+    if (add_server_instance(anjay, config, &server_instance_id)) {
         log_error(toyota_client, "Could not add server instance");
         goto error;
     }
 
-    // setup custom objects
-    humidity_sensor_init_object(anjay);
-    headlights_control_init_object(anjay);
-
-
     // setup client
     client = (client_t *) avs_calloc(1, sizeof(client_t));
     if (!client) {
@@ -172,52 +466,500 @@ remote_client_create(uint16_t          ssid,
         goto error;
     }
     client->anjay = anjay;
+    client->arena = arena;
+    client->security_iid = security_instance_id;
+    client->server_iid = server_instance_id;
+    if (copy_config(&client->config, config)) {
+        log_error(toyota_client, "Could not store client configuration");
+        goto error;
+    }
 
-    // install firmware update object
-    if (firmware_update_install(anjay, &client->firmware_update,
-                                fw_updated_marker_path, NULL, NULL,
-                                fw_update_args)) {
-        log_error(toyota_client, "Could not install firmware update object");
+    // setup event loop
+    if (!event_loop) {
+        if (!(event_loop = event_loop_create())) {
+            log_error(toyota_client, "Could not create event loop");
+            goto error;
+        }
+        client->owns_event_loop = true;
+    }
+    client->event_loop = event_loop;
+    if (!(client->loop_endpoint = event_loop_attach(event_loop, anjay))) {
+        log_error(toyota_client, "Could not attach client to event loop");
         goto error;
     }
+    event_loop_endpoint_set_arena(client->loop_endpoint, arena);
 
+    // setup custom objects
+    if (!(client->humidity = humidity_sensor_init_object(
+                  anjay, event_loop, HUMIDITY_SENSOR_DEFAULT_INSTANCES))
+            || !(client->headlights = headlights_control_init_object(
+                         anjay, event_loop, HEADLIGHTS_CONTROL_DEFAULT_INSTANCES))
+            || !(client->reports = sensor_batch_init_object(anjay, event_loop))) {
+        log_error(toyota_client, "Could not install custom object(s)");
+        goto error;
+    }
+    sensor_batch_set_message_size(client->reports, out_buffer_size);
+
+    // setup queue of samples from acquisition threads
+    if (!(client->ingest = ingest_queue_create(event_loop, INGEST_DEFAULT_CAPACITY,
+                                               apply_ingested_sample, client))) {
+        log_error(toyota_client, "Could not create sample queue");
+        goto error;
+    }
+
+    // install firmware update object
+    if (config->fw_updated_marker_path) {
+        if (firmware_update_install(anjay, &client->firmware_update,
+                                    config->fw_updated_marker_path, NULL, NULL,
+                                    config->fw_update_args)) {
+            log_error(toyota_client, "Could not install firmware update object");
+            goto error;
+        }
+        client->has_firmware_update = true;
+
+        size_t attrs_file_size = strlen(config->fw_updated_marker_path)
+                                 + sizeof(ATTRS_FILE_SUFFIX);
+        if (!(client->attrs_file = (char *) avs_malloc(attrs_file_size))) {
+            log_error(toyota_client, "Could not allocate attribute state file path");
+            goto error;
+        }
+        snprintf(client->attrs_file, attrs_file_size, "%s%s",
+                 config->fw_updated_marker_path, ATTRS_FILE_SUFFIX);
+        firmware_update_set_restart_handler(&client->firmware_update,
+                                            store_attrs_before_upgrade, client);
+        restore_attrs_state(client);
+    }
+
+    arena_leave(previous_arena);
     return client;
 
 error:
+    if (client) {
+        release_client_resources(client);
+        avs_free(client);
+    }
     if(anjay) anjay_delete(anjay);
-    if(client) avs_free(client);
-    if(client) firmware_update_destroy(&client->firmware_update);
+    arena_leave(previous_arena);
+    arena_destroy(arena);
     return NULL;
 }
 
+client_t *
+remote_client_create_in_loop(event_loop_t      *event_loop,
+                             uint16_t          ssid,
+                             const char        *endpoint_name,
+                             const char        *server_uri,
+                             const char        *binding_mode,
+                             int               lifetime,
+                             bool              bootstrap_state,
+                             const char        *fw_updated_marker_path,
+                             const char *const *fw_update_args) {
+    client_config_t config = {
+        .ssid                   = ssid,
+        .endpoint_name          = endpoint_name,
+        .server_uri             = server_uri,
+        .binding_mode           = binding_mode,
+        .lifetime               = lifetime,
+        .bootstrap_state        = bootstrap_state,
+        .fw_updated_marker_path = fw_updated_marker_path,
+        .fw_update_args         = fw_update_args,
+    };
+    return remote_client_create_with_config(event_loop, &config);
+}
+
+client_t *
+remote_client_create(uint16_t          ssid,
+                     const char        *endpoint_name,
+                     const char        *server_uri,
+                     const char        *binding_mode,
+                     int               lifetime,
+                     bool              bootstrap_state,
+                     const char        *fw_updated_marker_path,
+                     const char *const *fw_update_args) {
+    return remote_client_create_in_loop(NULL, ssid, endpoint_name, server_uri,
+                                        binding_mode, lifetime, bootstrap_state,
+                                        fw_updated_marker_path, fw_update_args);
+}
+
 void
 client_destroy(client_t *client_self) {
     if (!client_self) {
         return;
     }
 
+    arena_t *arena = client_self->arena;
+    if (arena) {
+        arena_stats_t stats;
+        arena_get_stats(arena, &stats);
+        log_debug(toyota_client, "%s used %zu bytes (peak %zu) in %zu blocks, "
+                  "%zu bytes reserved", client_self->config.endpoint_name,
+                  stats.in_use, stats.peak, stats.blocks, stats.reserved);
+    }
+
     // release resources
-    humidity_sensor_object_release(client_self->anjay);
-    headlights_control_object_release(client_self->anjay);
-    firmware_update_destroy(&client_self->firmware_update);
+    arena_t *previous_arena = arena_enter(arena);
+    store_attrs_state(client_self);
+    release_client_resources(client_self);
 
     anjay_delete(client_self->anjay);
     avs_free(client_self);
+    arena_leave(previous_arena);
+    // chunks go back to the system at once, not block by block
+    arena_destroy(arena);
 }
 
-void
+static int
+reconfigure_client(client_t *self, const client_config_t *config) {
+    assert(config);
+    assert(config->endpoint_name);
+    assert(config->server_uri);
+    assert(config->lifetime > 0);
+
+    if (!find_transport(config->server_uri)) {
+        log_error(toyota_client, "Unsupported server URI %s: %s", config->server_uri,
+                  remote_client_uri_error(config->server_uri));
+        return -1;
+    }
+    const client_config_t *current = &self->config;
+    size_t current_in;
+    size_t current_out;
+    size_t next_in;
+    size_t next_out;
+    buffer_sizes_of(current, &current_in, &current_out);
+    buffer_sizes_of(config, &next_in, &next_out);
+    // anjay and firmware object are bound to these at creation
+    if (current->ssid != config->ssid
+            || !strings_equal(current->endpoint_name, config->endpoint_name)
+            || !strings_equal(current->fw_updated_marker_path,
+                              config->fw_updated_marker_path)
+            || current_in != next_in || current_out != next_out) {
+        return CLIENT_RECONFIGURE_RECREATE;
+    }
+    bool security_changed =
+            !strings_equal(current->server_uri, config->server_uri)
+            || current->bootstrap_state != config->bootstrap_state
+            || !strings_equal(current->psk_identity, config->psk_identity)
+            || !strings_equal(current->psk_key, config->psk_key);
+    bool server_changed =
+            current->lifetime != config->lifetime
+            || !strings_equal(binding_of(current), binding_of(config));
+    if (!security_changed && !server_changed) {
+        return CLIENT_RECONFIGURE_UNCHANGED;
+    }
+
+    client_config_t next;
+    if (copy_config(&next, config)) {
+        log_error(toyota_client, "Could not store client configuration");
+        return -1;
+    }
+    next.fw_update_args = current->fw_update_args;
+
+    // instances are re-added under the same IIDs before anjay runs its
+    // scheduler, so it sees a modified server rather than a removed one:
+    // lifetime and binding changes go out as Update on the open session,
+    // only a new URI or new credentials need a new handshake
+    if (security_changed) {
+        anjay_iid_t iid = self->security_iid;
+        anjay_security_object_purge(self->anjay);
+        if (add_security_instance(self->anjay, &next, &iid)) {
+            log_error(toyota_client, "Could not update security instance");
+            iid = self->security_iid;
+            (void) add_security_instance(self->anjay, current, &iid);
+            release_config(&next);
+            return -1;
+        }
+    }
+    if (server_changed) {
+        anjay_iid_t iid = self->server_iid;
+        anjay_server_object_purge(self->anjay);
+        if (add_server_instance(self->anjay, &next, &iid)) {
+            log_error(toyota_client, "Could not update server instance");
+            iid = self->server_iid;
+            (void) add_server_instance(self->anjay, current, &iid);
+            if (security_changed) {
+                iid = self->security_iid;
+                anjay_security_object_purge(self->anjay);
+                (void) add_security_instance(self->anjay, current, &iid);
+            }
+            release_config(&next);
+            return -1;
+        }
+    }
+    if (security_changed) {
+        (void) anjay_notify_instances_changed(self->anjay, SECURITY_OID);
+    }
+    if (server_changed) {
+        (void) anjay_notify_instances_changed(self->anjay, SERVER_OID);
+    }
+
+    log_info(toyota_client, "Reconfigured %s:%s%s", next.endpoint_name,
+             security_changed ? " security" : "", server_changed ? " server" : "");
+    release_config(&self->config);
+    self->config = next;
+    return CLIENT_RECONFIGURE_UPDATED;
+}
+
+int
+remote_client_reconfigure(client_t *self, const client_config_t *config) {
+    // new configuration strings and instances belong to the client as well
+    arena_t *previous_arena = arena_enter(self->arena);
+    int result = reconfigure_client(self, config);
+    arena_leave(previous_arena);
+    return result;
+}
+
+bool
+remote_client_has_traffic(const client_t *self) {
+    return event_loop_endpoint_served(self->loop_endpoint) > 0;
+}
+
+int
+toyota_client_set_instance_count(client_t *self,
+                                 size_t   humidity_zones,
+                                 size_t   headlight_units) {
+    log_info(toyota_client, "Instances: %u humidity zones, %u headlight units",
+             (unsigned) humidity_zones, (unsigned) headlight_units);
+    if (humidity_sensor_set_instance_count(self->humidity, humidity_zones)
+            || headlights_control_set_instance_count(self->headlights,
+                                                     headlight_units)
+            || (self->sampler
+                && sampler_set_channel_count(self->sampler, humidity_zones))) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+toyota_client_push_humidity_instance(client_t    *self,
+                                     anjay_iid_t iid,
+                                     float       sensor_value,
+                                     bool        sensor_state) {
+    log_info(toyota_client, "Push HUMIDITY SENSOR object %u: sensor_value %lf, sensor_state %i", (unsigned) iid, sensor_value, (int) sensor_state);
+    return humidity_sensor_set_data(self->anjay, self->humidity, iid,
+                                    sensor_value, sensor_state);
+}
+
+int
 toyota_client_push_humidity(client_t *self,
                             float sensor_value,
                             bool sensor_state) {
-    log_info(toyota_client, "Push HUMIDITY SENSOR object: sensor_value %lf, sensor_state %i",  sensor_value, (int) sensor_state);
-    humidity_sensor_set_data(self->anjay, sensor_value, sensor_state);
+    return toyota_client_push_humidity_instance(self, 0, sensor_value, sensor_state);
 }
 
-void
+int
+toyota_client_push_headlights_control_instance(client_t    *self,
+                                               anjay_iid_t iid,
+                                               bool        control_state,
+                                               int64_t     brightness) {
+    log_info(toyota_client, "Push HEADLIGHTS CONTROL object %u: control state %i, brightness %li", (unsigned) iid, (int) control_state, brightness);
+    return headlights_control_set_data(self->anjay, self->headlights, iid,
+                                       control_state, brightness);
+}
+
+int
 toyota_client_push_headlights_control(client_t *self,
                                       bool     control_state,
                                       int64_t  brightness) {
-    log_info(toyota_client, "Push HEADLIGHTS CONTROL object: control state %i, brightness %li", (int) control_state, brightness);
-    headlights_control_set_data(self->anjay, control_state, brightness);
+    return toyota_client_push_headlights_control_instance(self, 0, control_state,
+                                                          brightness);
+}
+
+int
+toyota_client_enqueue_humidity_instance(client_t    *self,
+                                        anjay_iid_t iid,
+                                        float       sensor_value,
+                                        bool        sensor_state) {
+    ingest_sample_t sample = {
+        .kind = INGEST_SAMPLE_HUMIDITY,
+        .iid = iid,
+        .data.humidity = {
+            .value = sensor_value,
+            .state = sensor_state,
+        },
+    };
+    return ingest_queue_push(self->ingest, &sample);
+}
+
+int
+toyota_client_enqueue_humidity(client_t *self,
+                               float sensor_value,
+                               bool sensor_state) {
+    return toyota_client_enqueue_humidity_instance(self, 0, sensor_value,
+                                                   sensor_state);
+}
+
+int
+toyota_client_enqueue_headlights_control_instance(client_t    *self,
+                                                  anjay_iid_t iid,
+                                                  bool        control_state,
+                                                  int64_t     brightness) {
+    ingest_sample_t sample = {
+        .kind = INGEST_SAMPLE_HEADLIGHTS,
+        .iid = iid,
+        .data.headlights = {
+            .state = control_state,
+            .brightness = brightness,
+        },
+    };
+    return ingest_queue_push(self->ingest, &sample);
+}
+
+int
+toyota_client_enqueue_headlights_control(client_t *self,
+                                         bool     control_state,
+                                         int64_t  brightness) {
+    return toyota_client_enqueue_headlights_control_instance(self, 0, control_state,
+                                                             brightness);
+}
+
+void
+toyota_client_get_ingest_stats(const client_t *self, ingest_stats_t *out_stats) {
+    ingest_queue_get_stats(self->ingest, out_stats);
+}
+
+int
+toyota_client_report_humidity_instance(client_t    *self,
+                                       anjay_iid_t iid,
+                                       float       sensor_value,
+                                       bool        sensor_state) {
+    if (humidity_sensor_set_data(self->anjay, self->humidity, iid,
+                                 sensor_value, sensor_state) < 0
+            || sensor_batch_add_float(self->reports, HUMIDITY_SENSOR_OBJECT_ID, iid,
+                                      HUMIDITY_SENSOR_VALUE, sensor_value)
+            || sensor_batch_add_bool(self->reports, HUMIDITY_SENSOR_OBJECT_ID, iid,
+                                     HUMIDITY_SENSOR_STATE, sensor_state)) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+toyota_client_report_humidity(client_t *self,
+                              float sensor_value,
+                              bool sensor_state) {
+    return toyota_client_report_humidity_instance(self, 0, sensor_value,
+                                                  sensor_state);
+}
+
+int
+toyota_client_report_headlights_control_instance(client_t    *self,
+                                                 anjay_iid_t iid,
+                                                 bool        control_state,
+                                                 int64_t     brightness) {
+    if (headlights_control_set_data(self->anjay, self->headlights, iid,
+                                    control_state, brightness) < 0
+            || sensor_batch_add_bool(self->reports, HEADLIGHTS_CONTROL_OBJECT_ID, iid,
+                                     HEADLIGHTS_CONTROL_STATE, control_state)
+            || sensor_batch_add_int(self->reports, HEADLIGHTS_CONTROL_OBJECT_ID, iid,
+                                    HEADLIGHTS_CONTROL_BRIGHTNESS, brightness)) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+toyota_client_report_headlights_control(client_t *self,
+                                        bool     control_state,
+                                        int64_t  brightness) {
+    return toyota_client_report_headlights_control_instance(self, 0, control_state,
+                                                            brightness);
+}
+
+int
+toyota_client_flush_reports(client_t *self) {
+    return sensor_batch_flush(self->reports);
+}
+
+void
+toyota_client_set_report_limits(client_t *self, size_t max_bytes, int window_ms) {
+    sensor_batch_set_limits(self->reports, max_bytes, window_ms);
+}
+
+void
+toyota_client_get_report_stats(const client_t *self, report_stats_t *out_stats) {
+    *out_stats = *sensor_batch_stats(self->reports);
+}
+
+int
+toyota_client_set_headlights_backend(client_t           *self,
+                                     actuator_backend_t *backend,
+                                     int                interval_ms) {
+    actuator_t *actuator = NULL;
+    if (backend && !(actuator = actuator_create(backend, interval_ms))) {
+        return -1;
+    }
+    headlights_control_set_actuator(self->headlights, actuator);
+    actuator_destroy(self->actuator);
+    self->actuator = actuator;
+    return 0;
+}
+
+int
+toyota_client_get_actuator_stats(const client_t *self, actuator_stats_t *out_stats) {
+    if (!self->actuator) {
+        return -1;
+    }
+    actuator_get_stats(self->actuator, out_stats);
+    return 0;
+}
+
+int
+toyota_client_set_humidity_driver(client_t               *self,
+                                  sensor_driver_t        *driver,
+                                  const sampler_limits_t *limits) {
+    static const sampler_handlers_t HANDLERS = {
+        .apply = apply_sampled_humidity,
+        .limits = limit_humidity_sampling
+    };
+    sampler_t *sampler = NULL;
+    if (driver
+            && !(sampler = sampler_create(self->event_loop, driver,
+                                          humidity_sensor_instance_count(self->humidity),
+                                          limits, &HANDLERS, self))) {
+        return -1;
+    }
+    sampler_destroy(self->sampler);
+    self->sampler = sampler;
+    return 0;
 }
 
+int
+toyota_client_get_sampler_stats(const client_t *self, sampler_stats_t *out_stats) {
+    if (!self->sampler) {
+        return -1;
+    }
+    sampler_get_stats(self->sampler, out_stats);
+    return 0;
+}
+
+void
+toyota_client_set_notify_window(client_t *self, int window_ms) {
+    humidity_sensor_set_notify_window(self->humidity, window_ms);
+    headlights_control_set_notify_window(self->headlights, window_ms);
+}
+
+void
+toyota_client_set_humidity_deadband(client_t *self, float deadband) {
+    humidity_sensor_set_deadband(self->humidity, deadband);
+}
+
+void
+toyota_client_get_notify_stats(const client_t *self, notify_stats_t *out_stats) {
+    notify_stats_t humidity;
+    notify_stats_t headlights;
+    humidity_sensor_notify_stats(self->humidity, &humidity);
+    headlights_control_notify_stats(self->headlights, &headlights);
+
+    out_stats->requested = humidity.requested + headlights.requested;
+    out_stats->issued    = humidity.issued + headlights.issued;
+    out_stats->avoided   = humidity.avoided + headlights.avoided;
+}
+
+int
+toyota_client_get_memory_stats(const client_t *self, arena_stats_t *out_stats) {
+    if (!self->arena) {
+        return -1;
+    }
+    arena_get_stats(self->arena, out_stats);
+    return 0;
+}
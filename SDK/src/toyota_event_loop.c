@@ -0,0 +1,632 @@
+#include "toyota_event_loop.h"
+#include "toyota_utils.h"
+#include "toyota_metrics.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <avsystem/commons/list.h>
+#include <avsystem/commons/memory.h>
+
+#define EVENT_LOOP_MAX_EVENTS 64 // max number of ready sockets handled per wakeup
+#define TIMER_NOT_ARMED       SIZE_MAX
+
+#define event_loop_log(level, ...) avs_log(toyota_event_loop, level, __VA_ARGS__)
+
+typedef struct event_loop_fd_watch {
+    int fd;                                 // system descriptor registered in epoll
+    avs_net_abstract_socket_t *socket;      // anjay socket to be served
+    event_loop_endpoint_t *endpoint;        // owner, NULL once the watch is released
+    bool seen;                              // still reported by anjay_get_sockets()
+    event_loop_fd_handler_t *handler;       // set for descriptors watched by the user
+    void *arg;
+} fd_watch_t;
+
+struct event_loop_endpoint {
+    anjay_t *anjay;                         // served lwm2m context
+    AVS_LIST(fd_watch_t) watches;           // sockets registered in epoll
+    bool sockets_dirty;                     // socket set may have changed since last sync
+    uint64_t served_count;                  // number of packets handled by anjay_serve()
+    arena_t *arena;                         // entered while anjay runs, NULL - none
+};
+
+struct event_loop_timer {
+    event_loop_t *loop;
+    event_loop_timer_handler_t *handler;
+    void *arg;
+    int64_t deadline_ms;                    // monotonic time of expiration
+    size_t heap_index;                      // position in timer heap, TIMER_NOT_ARMED if idle
+};
+
+struct event_loop {
+    int epoll_fd;                           // long-lived epoll instance
+    AVS_LIST(event_loop_endpoint_t) endpoints;
+    AVS_LIST(fd_watch_t) fd_watches;        // user descriptors, e.g. eventfd of queues
+    AVS_LIST(fd_watch_t) released;          // watches freed after the current dispatch
+    fd_watch_t **fd_owners;                 // watch registered for each fd, by fd
+    size_t fd_owner_capacity;
+    event_loop_timer_t **timers;            // binary min-heap of armed timers
+    size_t timer_count;
+    size_t timer_capacity;
+    metrics_t *metrics;                     // counters and latencies of this loop
+};
+
+static atomic_uint loop_count;              // numbers loops in metrics reports
+
+//------------------------------------------------------------------------------
+
+static void
+timer_heap_set(event_loop_t *loop, size_t index, event_loop_timer_t *timer) {
+    loop->timers[index] = timer;
+    timer->heap_index = index;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+timer_heap_sift_up(event_loop_t *loop, size_t index) {
+    event_loop_timer_t *timer = loop->timers[index];
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (loop->timers[parent]->deadline_ms <= timer->deadline_ms) {
+            break;
+        }
+        timer_heap_set(loop, index, loop->timers[parent]);
+        index = parent;
+    }
+    timer_heap_set(loop, index, timer);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+timer_heap_sift_down(event_loop_t *loop, size_t index) {
+    event_loop_timer_t *timer = loop->timers[index];
+    for (;;) {
+        size_t child = 2 * index + 1;
+        if (child >= loop->timer_count) {
+            break;
+        }
+        if (child + 1 < loop->timer_count
+                && loop->timers[child + 1]->deadline_ms
+                           < loop->timers[child]->deadline_ms) {
+            ++child;
+        }
+        if (timer->deadline_ms <= loop->timers[child]->deadline_ms) {
+            break;
+        }
+        timer_heap_set(loop, index, loop->timers[child]);
+        index = child;
+    }
+    timer_heap_set(loop, index, timer);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+timer_heap_remove(event_loop_t *loop, event_loop_timer_t *timer) {
+    size_t index = timer->heap_index;
+    assert(index < loop->timer_count && loop->timers[index] == timer);
+
+    timer->heap_index = TIMER_NOT_ARMED;
+    event_loop_timer_t *last = loop->timers[--loop->timer_count];
+    if (last != timer) {
+        timer_heap_set(loop, index, last);
+        timer_heap_sift_up(loop, index);
+        timer_heap_sift_down(loop, last->heap_index);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+run_expired_timers(event_loop_t *loop) {
+    int64_t now_ms = get_monotonic_time_ms();
+    while (loop->timer_count && loop->timers[0]->deadline_ms <= now_ms) {
+        event_loop_timer_t *timer = loop->timers[0];
+        timer_heap_remove(loop, timer);
+        metrics_count(loop->metrics, METRIC_TIMERS_FIRED, 1);
+        // handler is free to arm the timer again
+        timer->handler(timer->arg);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static int
+set_fd_owner(event_loop_t *loop, int fd, fd_watch_t *watch) {
+    if ((size_t) fd >= loop->fd_owner_capacity) {
+        size_t new_capacity = loop->fd_owner_capacity ? loop->fd_owner_capacity : 64;
+        while (new_capacity <= (size_t) fd) {
+            new_capacity *= 2;
+        }
+        fd_watch_t **new_owners = (fd_watch_t **) avs_realloc(
+                loop->fd_owners, new_capacity * sizeof(fd_watch_t *));
+        if (!new_owners) {
+            event_loop_log(ERROR, "out of memory");
+            return -1;
+        }
+        memset(new_owners + loop->fd_owner_capacity, 0,
+               (new_capacity - loop->fd_owner_capacity) * sizeof(fd_watch_t *));
+        loop->fd_owners = new_owners;
+        loop->fd_owner_capacity = new_capacity;
+    }
+    loop->fd_owners[fd] = watch;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static bool
+owns_fd(event_loop_t *loop, const fd_watch_t *watch) {
+    return (size_t) watch->fd < loop->fd_owner_capacity
+           && loop->fd_owners[watch->fd] == watch;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+release_watch(event_loop_t *loop, AVS_LIST(fd_watch_t) *watch_ptr) {
+    fd_watch_t *watch = AVS_LIST_DETACH(watch_ptr);
+
+    // In a shared loop the descriptor of a closed socket may already be
+    // reused and registered by another endpoint, only its owner removes it.
+    // Descriptor may be already closed by anjay, epoll drops it by itself then.
+    if (owns_fd(loop, watch)) {
+        loop->fd_owners[watch->fd] = NULL;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, watch->fd, NULL)
+                && errno != EBADF && errno != ENOENT) {
+            event_loop_log(WARNING, "could not remove fd %d from epoll: %s",
+                           watch->fd, strerror(errno));
+        }
+    }
+    // events for this watch may still wait in the current epoll batch
+    watch->endpoint = NULL;
+    watch->handler = NULL;
+    AVS_LIST_INSERT(&loop->released, watch);
+}
+
+//------------------------------------------------------------------------------
+
+// EEXIST means the descriptor is still in the epoll set. A socket that was
+// closed and reconnected on the same descriptor number was dropped from the
+// set by close(), so it is added again here. A descriptor still registered
+// for a stale watch, not yet released by its endpoint, is taken over.
+static int
+register_watch(event_loop_t *loop, fd_watch_t *watch) {
+    if (set_fd_owner(loop, watch->fd, watch)) {
+        return -1;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = watch;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, watch->fd, &event)
+            && (errno != EEXIST
+                || epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, watch->fd, &event))) {
+        event_loop_log(ERROR, "could not add fd %d to epoll: %s", watch->fd,
+                       strerror(errno));
+        loop->fd_owners[watch->fd] = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+add_watch(event_loop_t *loop,
+          event_loop_endpoint_t *endpoint,
+          avs_net_abstract_socket_t *socket,
+          int fd) {
+    fd_watch_t *watch = AVS_LIST_NEW_ELEMENT(fd_watch_t);
+    if (!watch) {
+        event_loop_log(ERROR, "out of memory");
+        return -1;
+    }
+    watch->fd = fd;
+    watch->socket = socket;
+    watch->endpoint = endpoint;
+    watch->seen = true;
+
+    if (register_watch(loop, watch)) {
+        AVS_LIST_DELETE(&watch);
+        return -1;
+    }
+
+    AVS_LIST_INSERT(&endpoint->watches, watch);
+    event_loop_log(DEBUG, "socket fd %d added to event loop", fd);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static fd_watch_t *
+find_watch(event_loop_endpoint_t *endpoint,
+           avs_net_abstract_socket_t *socket,
+           int fd) {
+    AVS_LIST(fd_watch_t) watch;
+    AVS_LIST_FOREACH(watch, endpoint->watches) {
+        if (watch->socket == socket && watch->fd == fd) {
+            return watch;
+        }
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+sync_endpoint_sockets(event_loop_t *loop, event_loop_endpoint_t *endpoint) {
+    AVS_LIST(avs_net_abstract_socket_t *const) sockets =
+            anjay_get_sockets(endpoint->anjay);
+    AVS_LIST(avs_net_abstract_socket_t *const) sock;
+    AVS_LIST(fd_watch_t) watch;
+
+    AVS_LIST_FOREACH(watch, endpoint->watches) {
+        watch->seen = false;
+    }
+    AVS_LIST_FOREACH(sock, sockets) {
+        const int *fd = (const int *) avs_net_socket_get_system(*sock);
+        if (fd && (watch = find_watch(endpoint, *sock, *fd))) {
+            // anjay reconnects by reopening the same socket object
+            watch->seen = !register_watch(loop, watch);
+        }
+    }
+
+    // remove closed sockets first, their descriptors may be reused by new ones
+    AVS_LIST(fd_watch_t) *watch_ptr = &endpoint->watches;
+    while (*watch_ptr) {
+        if (!(*watch_ptr)->seen) {
+            release_watch(loop, watch_ptr);
+        } else {
+            watch_ptr = AVS_LIST_NEXT_PTR(watch_ptr);
+        }
+    }
+
+    AVS_LIST_FOREACH(sock, sockets) {
+        const int *fd = (const int *) avs_net_socket_get_system(*sock);
+        if (fd && *fd >= 0 && !find_watch(endpoint, *sock, *fd)) {
+            (void) add_watch(loop, endpoint, *sock, *fd);
+        }
+    }
+
+    endpoint->sockets_dirty = false;
+}
+
+//------------------------------------------------------------------------------
+
+event_loop_t *
+event_loop_create(void) {
+    event_loop_t *loop = (event_loop_t *) avs_calloc(1, sizeof(event_loop_t));
+    if (!loop) {
+        event_loop_log(ERROR, "out of memory");
+        return NULL;
+    }
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        event_loop_log(ERROR, "could not create epoll instance: %s",
+                       strerror(errno));
+        avs_free(loop);
+        return NULL;
+    }
+
+    char name[METRICS_NAME_SIZE];
+    snprintf(name, sizeof(name), "loop-%u", atomic_fetch_add(&loop_count, 1));
+    // the loop runs without metrics rather than not at all
+    if (!(loop->metrics = metrics_create(name))) {
+        event_loop_log(WARNING, "metrics of %s disabled", name);
+    }
+    return loop;
+}
+
+//------------------------------------------------------------------------------
+
+void
+event_loop_destroy(event_loop_t *loop) {
+    if (!loop) {
+        return;
+    }
+
+    assert(!loop->endpoints);
+    assert(!loop->fd_watches);
+    assert(!loop->timer_count);
+    AVS_LIST_CLEAR(&loop->released);
+    avs_free(loop->fd_owners);
+    avs_free(loop->timers);
+    metrics_destroy(loop->metrics);
+    close(loop->epoll_fd);
+    avs_free(loop);
+}
+
+//------------------------------------------------------------------------------
+
+event_loop_endpoint_t *
+event_loop_attach(event_loop_t *loop, anjay_t *anjay) {
+    assert(loop);
+    assert(anjay);
+
+    event_loop_endpoint_t *endpoint = AVS_LIST_NEW_ELEMENT(event_loop_endpoint_t);
+    if (!endpoint) {
+        event_loop_log(ERROR, "out of memory");
+        return NULL;
+    }
+    endpoint->anjay = anjay;
+    // sockets are registered lazily, right before the first wait
+    endpoint->sockets_dirty = true;
+
+    AVS_LIST_INSERT(&loop->endpoints, endpoint);
+    return endpoint;
+}
+
+//------------------------------------------------------------------------------
+
+void
+event_loop_detach(event_loop_t *loop, event_loop_endpoint_t *endpoint) {
+    if (!loop || !endpoint) {
+        return;
+    }
+
+    while (endpoint->watches) {
+        release_watch(loop, &endpoint->watches);
+    }
+
+    AVS_LIST(event_loop_endpoint_t) *endpoint_ptr;
+    AVS_LIST_FOREACH_PTR(endpoint_ptr, &loop->endpoints) {
+        if (*endpoint_ptr == endpoint) {
+            AVS_LIST_DELETE(endpoint_ptr);
+            return;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t
+event_loop_endpoint_served(const event_loop_endpoint_t *endpoint) {
+    return endpoint ? endpoint->served_count : 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+event_loop_endpoint_set_arena(event_loop_endpoint_t *endpoint, arena_t *arena) {
+    assert(endpoint);
+    endpoint->arena = arena;
+}
+
+//------------------------------------------------------------------------------
+
+event_loop_fd_watch_t *
+event_loop_watch_fd(event_loop_t *loop,
+                    int fd,
+                    event_loop_fd_handler_t *handler,
+                    void *arg) {
+    assert(loop);
+    assert(handler);
+
+    fd_watch_t *watch = AVS_LIST_NEW_ELEMENT(fd_watch_t);
+    if (!watch) {
+        event_loop_log(ERROR, "out of memory");
+        return NULL;
+    }
+    watch->fd = fd;
+    watch->handler = handler;
+    watch->arg = arg;
+
+    if (register_watch(loop, watch)) {
+        AVS_LIST_DELETE(&watch);
+        return NULL;
+    }
+
+    AVS_LIST_INSERT(&loop->fd_watches, watch);
+    return watch;
+}
+
+//------------------------------------------------------------------------------
+
+void
+event_loop_unwatch_fd(event_loop_t *loop, event_loop_fd_watch_t *watch) {
+    if (!loop || !watch) {
+        return;
+    }
+
+    AVS_LIST(fd_watch_t) *watch_ptr;
+    AVS_LIST_FOREACH_PTR(watch_ptr, &loop->fd_watches) {
+        if (*watch_ptr == watch) {
+            release_watch(loop, watch_ptr);
+            return;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+event_loop_timer_t *
+event_loop_timer_create(event_loop_t *loop,
+                        event_loop_timer_handler_t *handler,
+                        void *arg) {
+    assert(loop);
+    assert(handler);
+
+    event_loop_timer_t *timer =
+            (event_loop_timer_t *) avs_calloc(1, sizeof(event_loop_timer_t));
+    if (!timer) {
+        event_loop_log(ERROR, "out of memory");
+        return NULL;
+    }
+    timer->loop = loop;
+    timer->handler = handler;
+    timer->arg = arg;
+    timer->heap_index = TIMER_NOT_ARMED;
+    return timer;
+}
+
+//------------------------------------------------------------------------------
+
+int
+event_loop_timer_arm(event_loop_timer_t *timer, int delay_ms) {
+    assert(timer);
+    event_loop_t *loop = timer->loop;
+
+    if (timer->heap_index != TIMER_NOT_ARMED) {
+        timer_heap_remove(loop, timer);
+    }
+    if (loop->timer_count == loop->timer_capacity) {
+        size_t new_capacity = loop->timer_capacity ? 2 * loop->timer_capacity : 16;
+        event_loop_timer_t **new_timers = (event_loop_timer_t **) avs_realloc(
+                loop->timers, new_capacity * sizeof(event_loop_timer_t *));
+        if (!new_timers) {
+            event_loop_log(ERROR, "out of memory");
+            return -1;
+        }
+        loop->timers = new_timers;
+        loop->timer_capacity = new_capacity;
+    }
+
+    timer->deadline_ms = get_monotonic_time_ms() + (delay_ms > 0 ? delay_ms : 0);
+    timer_heap_set(loop, loop->timer_count++, timer);
+    timer_heap_sift_up(loop, timer->heap_index);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+bool
+event_loop_timer_is_armed(const event_loop_timer_t *timer) {
+    return timer && timer->heap_index != TIMER_NOT_ARMED;
+}
+
+//------------------------------------------------------------------------------
+
+void
+event_loop_timer_cancel(event_loop_timer_t *timer) {
+    if (event_loop_timer_is_armed(timer)) {
+        timer_heap_remove(timer->loop, timer);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+event_loop_timer_destroy(event_loop_timer_t *timer) {
+    if (!timer) {
+        return;
+    }
+    event_loop_timer_cancel(timer);
+    avs_free(timer);
+}
+
+//------------------------------------------------------------------------------
+
+int
+event_loop_run_once(event_loop_t *loop, int max_wait_time_ms) {
+    assert(loop);
+
+    // Determine the expected time to the nearest job of all endpoints.
+    // If there is no job we will wait till something arrives for
+    // at most max_wait_time_ms.
+    int wait_ms = max_wait_time_ms;
+    AVS_LIST(event_loop_endpoint_t) endpoint;
+    AVS_LIST_FOREACH(endpoint, loop->endpoints) {
+        if (endpoint->sockets_dirty) {
+            sync_endpoint_sockets(loop, endpoint);
+        }
+        wait_ms = anjay_sched_calculate_wait_time_ms(endpoint->anjay, wait_ms);
+    }
+    if (loop->timer_count) {
+        int64_t timer_wait_ms =
+                loop->timers[0]->deadline_ms - get_monotonic_time_ms();
+        if (timer_wait_ms < wait_ms) {
+            wait_ms = timer_wait_ms > 0 ? (int) timer_wait_ms : 0;
+        }
+    }
+
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    int ready = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, wait_ms);
+    if (ready < 0) {
+        if (errno != EINTR) {
+            event_loop_log(ERROR, "epoll_wait failed: %s", strerror(errno));
+        }
+        ready = 0;
+    }
+
+    // handlers called below record into the metrics of this loop
+    metrics_t *metrics = loop->metrics;
+    metrics_set_current(metrics);
+    int64_t busy_start_ns = metrics_start(metrics);
+    metrics_count(metrics, METRIC_WAKEUPS, 1);
+    metrics_count(metrics, METRIC_READY_SOCKETS, (uint64_t) ready);
+
+    // dispatch only the sockets that are ready
+    for (int i = 0; i < ready; ++i) {
+        fd_watch_t *watch = (fd_watch_t *) events[i].data.ptr;
+        if (watch->handler) {
+            watch->handler(watch->arg);
+            continue;
+        }
+        event_loop_endpoint_t *owner = watch->endpoint;
+        if (!owner) {
+            continue;
+        }
+        // previous anjay_serve() of the same endpoint may have closed it
+        if (owner->sockets_dirty) {
+            sync_endpoint_sockets(loop, owner);
+            if (!watch->endpoint) {
+                continue;
+            }
+        }
+        int64_t serve_start_ns = metrics_start(metrics);
+        arena_t *previous = arena_enter(owner->arena);
+        int serve_result = anjay_serve(owner->anjay, watch->socket);
+        arena_leave(previous);
+        metrics_stop(metrics, METRIC_SERVE, serve_start_ns);
+        if (serve_result) {
+            event_loop_log(ERROR, "anjay_serve failed");
+            metrics_count(metrics, METRIC_SERVE_FAILED, 1);
+            // the socket may have been closed on the error path
+            owner->sockets_dirty = true;
+        } else {
+            ++owner->served_count;
+        }
+    }
+
+    // timers may queue notifications, let the schedulers below send them
+    run_expired_timers(loop);
+
+    AVS_LIST_FOREACH(endpoint, loop->endpoints) {
+        arena_t *previous = arena_enter(endpoint->arena);
+        if (anjay_all_connections_failed(endpoint->anjay)) {
+            event_loop_log(ERROR, "All connections failed, trying to reconnect...");
+            metrics_count(metrics, METRIC_CONNECTIONS_FAILED, 1);
+            anjay_schedule_reconnect(endpoint->anjay);
+        }
+
+        // sockets are opened, reconnected and closed by scheduler jobs, a
+        // served request only schedules them, so resync only when a job was due
+        if (anjay_sched_calculate_wait_time_ms(endpoint->anjay, 1)) {
+            (void) anjay_sched_run(endpoint->anjay);
+            arena_leave(previous);
+            continue;
+        }
+        endpoint->sockets_dirty = true;
+        // only runs with a job due are timed, the others return at once
+        int64_t sched_start_ns = metrics_start(metrics);
+        int jobs = anjay_sched_run(endpoint->anjay);
+        metrics_stop(metrics, METRIC_SCHED, sched_start_ns);
+        metrics_count(metrics, METRIC_SCHED_JOBS, jobs > 0 ? (uint64_t) jobs : 0);
+        arena_leave(previous);
+    }
+
+    AVS_LIST_CLEAR(&loop->released);
+    metrics_stop(metrics, METRIC_LOOP_BUSY, busy_start_ns);
+    metrics_publish(metrics);
+    return ready;
+}
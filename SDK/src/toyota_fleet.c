@@ -0,0 +1,461 @@
+#define _POSIX_C_SOURCE 200809L
+#include "toyota_fleet.h"
+#include "toyota_client.h"
+#include "toyota_event_loop.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avsystem/commons/log.h>
+#include <avsystem/commons/memory.h>
+
+#define FLEET_MAX_WAIT_MS         100  // max time to wait in worker event loop
+#define FLEET_STATS_CHECK         250  // period of registration and notify checks, in milliseconds
+
+#define fleet_log(level, ...) avs_log(toyota_fleet, level, __VA_ARGS__)
+
+typedef struct {
+    fleet_t                 *fleet;
+    pthread_t               thread;
+    bool                    thread_started;
+    size_t                  index;              // worker number
+    size_t                  first_endpoint;     // index of the first hosted vehicle
+    size_t                  endpoint_count;     // number of hosted vehicles
+    char                    (*names)[FLEET_MAX_ENDPOINT_NAME];
+    client_t                **clients;
+    bool                    *has_traffic;       // the server has answered the vehicle
+    event_loop_t            *event_loop;        // loop shared by all hosted vehicles
+    unsigned                seed;               // simulated sensor noise
+    int                     push_interval_ms;   // own copy, the fleet one changes on reload
+    uint64_t                generation;         // last configuration applied by the worker
+    atomic_uint_fast64_t    endpoints_with_traffic;
+    atomic_uint_fast64_t    notifications;      // anjay_notify_changed() calls issued
+    atomic_uint_fast64_t    notifications_avoided;
+    atomic_size_t           memory_in_use;      // bytes of all client arenas
+    atomic_size_t           memory_peak;        // highest peak of a single client arena
+    uint64_t                reported_with_traffic;
+    uint64_t                reported_notifications;
+    uint64_t                reported_avoided;
+} fleet_worker_t;
+
+typedef struct {
+    size_t                  unchanged;
+    size_t                  updated;
+    size_t                  recreated;
+    size_t                  failed;
+} reload_stats_t;
+
+struct fleet {
+    fleet_config_t          config;
+    atomic_bool             running;
+    fleet_worker_t          *workers;
+    int64_t                 last_report_ms;
+
+    // fleet_reload() hands the new configuration to every worker and waits
+    pthread_mutex_t         reload_mutex;
+    pthread_cond_t          reload_done;
+    atomic_uint_fast64_t    generation;
+    const fleet_config_t    *pending;           // valid while acks are missing
+    size_t                  pending_acks;
+    reload_stats_t          reload_stats;
+};
+
+//------------------------------------------------------------------------------
+
+static void
+worker_collect_stats(fleet_worker_t *worker) {
+    uint64_t issued = 0;
+    uint64_t avoided = 0;
+    size_t in_use = 0;
+    size_t peak = 0;
+    for (size_t i = 0; i < worker->endpoint_count; ++i) {
+        if (!worker->clients[i]) {
+            continue;
+        }
+        if (!worker->has_traffic[i]
+                && remote_client_has_traffic(worker->clients[i])) {
+            worker->has_traffic[i] = true;
+            atomic_fetch_add(&worker->endpoints_with_traffic, 1);
+        }
+        notify_stats_t stats;
+        toyota_client_get_notify_stats(worker->clients[i], &stats);
+        issued += stats.issued;
+        avoided += stats.avoided;
+
+        arena_stats_t memory;
+        if (!toyota_client_get_memory_stats(worker->clients[i], &memory)) {
+            in_use += memory.in_use;
+            peak = memory.peak > peak ? memory.peak : peak;
+        }
+    }
+    atomic_store(&worker->notifications, issued);
+    atomic_store(&worker->notifications_avoided, avoided);
+    atomic_store(&worker->memory_in_use, in_use);
+    atomic_store(&worker->memory_peak, peak);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+worker_push_samples(fleet_worker_t *worker) {
+    for (size_t i = 0; i < worker->endpoint_count; ++i) {
+        if (!worker->clients[i]) {
+            continue;
+        }
+        // simulated vehicle: humidity drifting in the 0-40 % range
+        float humidity = (float) (rand_r(&worker->seed) % 4000) / 100.0f;
+        (void) toyota_client_push_humidity(worker->clients[i], humidity, true);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// configuration of hosted endpoint i, its name is kept in worker->names
+static void
+worker_client_config(fleet_worker_t *worker, const fleet_config_t *config,
+                     size_t i, client_config_t *out) {
+    *out = (client_config_t) {
+        .ssid            = 1,
+        .endpoint_name   = worker->names[i],
+        .server_uri      = config->server_uri,
+        .binding_mode    = config->binding_mode,
+        .lifetime        = config->lifetime,
+        .bootstrap_state = config->bootstrap_state,
+        .psk_identity    = config->psk_identity,
+        .psk_key         = config->psk_key,
+        .in_buffer_size  = config->in_buffer_size,
+        .out_buffer_size = config->out_buffer_size,
+    };
+    if (config->endpoints) {
+        const fleet_endpoint_t *endpoint =
+                &config->endpoints[worker->first_endpoint + i];
+        snprintf(worker->names[i], FLEET_MAX_ENDPOINT_NAME, "%s", endpoint->name);
+        if (endpoint->psk_identity) {
+            out->psk_identity = endpoint->psk_identity;
+        }
+        if (endpoint->psk_key) {
+            out->psk_key = endpoint->psk_key;
+        }
+    } else {
+        snprintf(worker->names[i], FLEET_MAX_ENDPOINT_NAME, "%s-%06zu",
+                 config->endpoint_prefix, worker->first_endpoint + i);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+worker_recreate_client(fleet_worker_t *worker, size_t i,
+                       const client_config_t *client_config) {
+    client_destroy(worker->clients[i]);
+    if (worker->has_traffic[i]) {
+        worker->has_traffic[i] = false;
+        atomic_fetch_sub(&worker->endpoints_with_traffic, 1);
+    }
+    worker->clients[i] =
+            remote_client_create_with_config(worker->event_loop, client_config);
+    if (!worker->clients[i]) {
+        fleet_log(WARNING, "could not create endpoint %s", worker->names[i]);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// runs between two event loop iterations, so no client is in the middle
+// of a request; clients whose settings did not change are not touched
+static void
+worker_reload(fleet_worker_t *worker) {
+    fleet_t *fleet = worker->fleet;
+    pthread_mutex_lock(&fleet->reload_mutex);
+    const fleet_config_t *config = fleet->pending;
+    worker->generation = atomic_load(&fleet->generation);
+    pthread_mutex_unlock(&fleet->reload_mutex);
+
+    reload_stats_t stats = { 0 };
+    for (size_t i = 0; i < worker->endpoint_count; ++i) {
+        client_config_t client_config;
+        worker_client_config(worker, config, i, &client_config);
+        int result = worker->clients[i]
+                ? remote_client_reconfigure(worker->clients[i], &client_config)
+                : CLIENT_RECONFIGURE_RECREATE;
+        if (result == CLIENT_RECONFIGURE_RECREATE) {
+            worker_recreate_client(worker, i, &client_config);
+            ++*(worker->clients[i] ? &stats.recreated : &stats.failed);
+        } else if (result == CLIENT_RECONFIGURE_UPDATED) {
+            ++stats.updated;
+        } else if (result == CLIENT_RECONFIGURE_UNCHANGED) {
+            ++stats.unchanged;
+        } else {
+            ++stats.failed;
+        }
+    }
+    worker->push_interval_ms = config->push_interval_ms;
+
+    pthread_mutex_lock(&fleet->reload_mutex);
+    fleet->reload_stats.unchanged += stats.unchanged;
+    fleet->reload_stats.updated += stats.updated;
+    fleet->reload_stats.recreated += stats.recreated;
+    fleet->reload_stats.failed += stats.failed;
+    if (!--fleet->pending_acks) {
+        pthread_cond_signal(&fleet->reload_done);
+    }
+    pthread_mutex_unlock(&fleet->reload_mutex);
+}
+
+//------------------------------------------------------------------------------
+
+static void *
+worker_run(void *worker_) {
+    fleet_worker_t *worker = (fleet_worker_t *) worker_;
+    fleet_t *fleet = worker->fleet;
+    const fleet_config_t *config = &fleet->config;
+
+    // every anjay instance is created, served and destroyed by its worker only
+    for (size_t i = 0; i < worker->endpoint_count
+                       && atomic_load(&fleet->running); ++i) {
+        client_config_t client_config;
+        worker_client_config(worker, config, i, &client_config);
+        worker->clients[i] =
+                remote_client_create_with_config(worker->event_loop, &client_config);
+        if (!worker->clients[i]) {
+            fleet_log(WARNING, "could not create endpoint %s", worker->names[i]);
+        }
+    }
+    fleet_log(INFO, "worker %zu hosts %zu endpoints", worker->index,
+              worker->endpoint_count);
+
+    int64_t next_check_ms = get_monotonic_time_ms() + FLEET_STATS_CHECK;
+    int64_t next_push_ms = get_monotonic_time_ms() + worker->push_interval_ms;
+    while (atomic_load(&fleet->running)) {
+        event_loop_run_once(worker->event_loop, FLEET_MAX_WAIT_MS);
+
+        if (atomic_load(&fleet->generation) != worker->generation) {
+            worker_reload(worker);
+        }
+        int64_t now_ms = get_monotonic_time_ms();
+        if (now_ms >= next_check_ms) {
+            worker_collect_stats(worker);
+            next_check_ms = now_ms + FLEET_STATS_CHECK;
+        }
+        if (worker->push_interval_ms > 0 && now_ms >= next_push_ms) {
+            worker_push_samples(worker);
+            next_push_ms = now_ms + worker->push_interval_ms;
+        }
+    }
+
+    for (size_t i = 0; i < worker->endpoint_count; ++i) {
+        client_destroy(worker->clients[i]);
+        worker->clients[i] = NULL;
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+worker_init(fleet_t *fleet, fleet_worker_t *worker, size_t index,
+            size_t first_endpoint, size_t endpoint_count) {
+    worker->fleet = fleet;
+    worker->index = index;
+    worker->first_endpoint = first_endpoint;
+    worker->endpoint_count = endpoint_count;
+    worker->seed = (unsigned) (index + 1);
+    worker->push_interval_ms = fleet->config.push_interval_ms;
+    atomic_init(&worker->endpoints_with_traffic, 0);
+    atomic_init(&worker->notifications, 0);
+    atomic_init(&worker->notifications_avoided, 0);
+
+    if (!(worker->names = avs_calloc(endpoint_count ? endpoint_count : 1,
+                                     sizeof(*worker->names)))
+            || !(worker->clients = (client_t **) avs_calloc(
+                         endpoint_count ? endpoint_count : 1, sizeof(client_t *)))
+            || !(worker->has_traffic = (bool *) avs_calloc(
+                         endpoint_count ? endpoint_count : 1, sizeof(bool)))
+            || !(worker->event_loop = event_loop_create())) {
+        fleet_log(ERROR, "out of memory");
+        return -1;
+    }
+
+    if (pthread_create(&worker->thread, NULL, worker_run, worker)) {
+        fleet_log(ERROR, "could not start worker thread %zu", index);
+        return -1;
+    }
+    worker->thread_started = true;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+fleet_t *
+fleet_create(const fleet_config_t *config) {
+    assert(config);
+    assert(config->endpoint_prefix || config->endpoints);
+    assert(config->server_uri);
+
+    if (!config->endpoint_count || !config->thread_count) {
+        fleet_log(ERROR, "fleet needs at least one endpoint and one thread");
+        return NULL;
+    }
+
+    fleet_t *fleet = (fleet_t *) avs_calloc(1, sizeof(fleet_t));
+    if (!fleet) {
+        fleet_log(ERROR, "out of memory");
+        return NULL;
+    }
+    fleet->config = *config;
+    if (fleet->config.thread_count > fleet->config.endpoint_count) {
+        fleet->config.thread_count = fleet->config.endpoint_count;
+    }
+    atomic_init(&fleet->running, true);
+    atomic_init(&fleet->generation, 0);
+    pthread_mutex_init(&fleet->reload_mutex, NULL);
+    pthread_cond_init(&fleet->reload_done, NULL);
+    fleet->last_report_ms = get_monotonic_time_ms();
+
+    fleet->workers = (fleet_worker_t *) avs_calloc(fleet->config.thread_count,
+                                                   sizeof(fleet_worker_t));
+    if (!fleet->workers) {
+        fleet_log(ERROR, "out of memory");
+        pthread_cond_destroy(&fleet->reload_done);
+        pthread_mutex_destroy(&fleet->reload_mutex);
+        avs_free(fleet);
+        return NULL;
+    }
+
+    // spread endpoints evenly, first workers take the remainder
+    size_t per_worker = fleet->config.endpoint_count / fleet->config.thread_count;
+    size_t remainder = fleet->config.endpoint_count % fleet->config.thread_count;
+    size_t first_endpoint = 0;
+    for (size_t i = 0; i < fleet->config.thread_count; ++i) {
+        size_t count = per_worker + (i < remainder ? 1 : 0);
+        if (worker_init(fleet, &fleet->workers[i], i, first_endpoint, count)) {
+            fleet_destroy(fleet);
+            return NULL;
+        }
+        first_endpoint += count;
+    }
+
+    fleet_log(INFO, "fleet of %zu endpoints started on %zu threads",
+              fleet->config.endpoint_count, fleet->config.thread_count);
+    return fleet;
+}
+
+//------------------------------------------------------------------------------
+
+int
+fleet_reload(fleet_t *fleet, const fleet_config_t *config) {
+    assert(fleet);
+    assert(config);
+    assert(config->endpoint_prefix || config->endpoints);
+    assert(config->server_uri);
+
+    if (config->endpoints && config->endpoint_count < fleet->config.endpoint_count) {
+        fleet_log(ERROR, "%zu endpoints listed, %zu running",
+                  config->endpoint_count, fleet->config.endpoint_count);
+        return -1;
+    }
+    // workers and their shares of endpoints are fixed at creation
+    if (config->endpoint_count != fleet->config.endpoint_count
+            || config->thread_count != fleet->config.thread_count) {
+        fleet_log(WARNING, "fleet size and threads are not reloaded, "
+                  "running %zu endpoints on %zu threads",
+                  fleet->config.endpoint_count, fleet->config.thread_count);
+    }
+
+    pthread_mutex_lock(&fleet->reload_mutex);
+    fleet->pending = config;
+    fleet->reload_stats = (reload_stats_t) { 0 };
+    for (size_t i = 0; i < fleet->config.thread_count; ++i) {
+        fleet->pending_acks += fleet->workers[i].thread_started ? 1 : 0;
+    }
+    atomic_fetch_add(&fleet->generation, 1);
+    while (fleet->pending_acks) {
+        pthread_cond_wait(&fleet->reload_done, &fleet->reload_mutex);
+    }
+    reload_stats_t stats = fleet->reload_stats;
+    fleet->pending = NULL;
+    pthread_mutex_unlock(&fleet->reload_mutex);
+
+    // no worker refers to the previous strings any more
+    size_t endpoint_count = fleet->config.endpoint_count;
+    size_t thread_count = fleet->config.thread_count;
+    fleet->config = *config;
+    fleet->config.endpoint_count = endpoint_count;
+    fleet->config.thread_count = thread_count;
+
+    fleet_log(INFO, "configuration reloaded: %zu unchanged, %zu updated, "
+              "%zu recreated, %zu failed", stats.unchanged, stats.updated,
+              stats.recreated, stats.failed);
+    return stats.failed ? -1 : 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+fleet_report_stats(fleet_t *fleet) {
+    assert(fleet);
+
+    int64_t now_ms = get_monotonic_time_ms();
+    double elapsed_s = (double) (now_ms - fleet->last_report_ms) / 1000.0;
+    if (elapsed_s <= 0.0) {
+        return;
+    }
+    fleet->last_report_ms = now_ms;
+
+    for (size_t i = 0; i < fleet->config.thread_count; ++i) {
+        fleet_worker_t *worker = &fleet->workers[i];
+        uint64_t with_traffic = atomic_load(&worker->endpoints_with_traffic);
+        uint64_t notifications = atomic_load(&worker->notifications);
+        uint64_t avoided = atomic_load(&worker->notifications_avoided);
+
+        fleet_log(INFO, "worker %zu: %" PRIu64 "/%zu endpoints with traffic, "
+                  "%.1f first responses/s, %.1f notifications/s, "
+                  "%.1f notifications avoided/s", i,
+                  with_traffic, worker->endpoint_count,
+                  (double) (with_traffic - worker->reported_with_traffic) / elapsed_s,
+                  (double) (notifications - worker->reported_notifications) / elapsed_s,
+                  (double) (avoided - worker->reported_avoided) / elapsed_s);
+
+        worker->reported_with_traffic = with_traffic;
+        worker->reported_notifications = notifications;
+        worker->reported_avoided = avoided;
+
+        if (arena_enabled() && worker->endpoint_count) {
+            size_t in_use = atomic_load(&worker->memory_in_use);
+            fleet_log(INFO, "worker %zu: %zu KiB in use, %zu KiB/endpoint, "
+                      "largest endpoint peak %zu KiB", i, in_use / 1024,
+                      in_use / worker->endpoint_count / 1024,
+                      atomic_load(&worker->memory_peak) / 1024);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+fleet_destroy(fleet_t *fleet) {
+    if (!fleet) {
+        return;
+    }
+
+    atomic_store(&fleet->running, false);
+    for (size_t i = 0; i < fleet->config.thread_count; ++i) {
+        fleet_worker_t *worker = &fleet->workers[i];
+        if (worker->thread_started) {
+            pthread_join(worker->thread, NULL);
+        }
+        event_loop_destroy(worker->event_loop);
+        avs_free(worker->has_traffic);
+        avs_free(worker->clients);
+        avs_free(worker->names);
+    }
+    avs_free(fleet->workers);
+    pthread_cond_destroy(&fleet->reload_done);
+    pthread_mutex_destroy(&fleet->reload_mutex);
+    avs_free(fleet);
+}
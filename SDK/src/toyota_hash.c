@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+#include "toyota_hash.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#    define CRC32C_HW_X86 1
+#    include <nmmintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#    define CRC32C_HW_ARM 1
+#    include <arm_acle.h>
+#    include <sys/auxv.h>
+#    include <asm/hwcap.h>
+#endif
+
+#define CRC32C_POLYNOMIAL 0x82F63B78u // reversed Castagnoli polynomial
+
+typedef uint32_t crc32c_impl_t(uint32_t crc, const uint8_t *data, size_t length);
+
+static uint32_t crc32c_table[8][256];
+static crc32c_impl_t *crc32c_impl;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+//------------------------------------------------------------------------------
+
+static uint32_t
+crc32c_sw(uint32_t crc, const uint8_t *data, size_t length) {
+    // byte-wise until aligned, then slicing-by-8
+    while (length && ((uintptr_t) data & 7)) {
+        crc = crc32c_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        --length;
+    }
+    while (length >= 8) {
+        uint32_t low = crc ^ ((uint32_t) data[0] | (uint32_t) data[1] << 8
+                              | (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24);
+        crc = crc32c_table[7][low & 0xFF]
+              ^ crc32c_table[6][(low >> 8) & 0xFF]
+              ^ crc32c_table[5][(low >> 16) & 0xFF]
+              ^ crc32c_table[4][low >> 24]
+              ^ crc32c_table[3][data[4]]
+              ^ crc32c_table[2][data[5]]
+              ^ crc32c_table[1][data[6]]
+              ^ crc32c_table[0][data[7]];
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = crc32c_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+//------------------------------------------------------------------------------
+
+#if defined(CRC32C_HW_X86)
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_hw(uint32_t crc, const uint8_t *data, size_t length) {
+    while (length && ((uintptr_t) data & 7)) {
+        crc = _mm_crc32_u8(crc, *data++);
+        --length;
+    }
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        length -= 8;
+    }
+    crc = (uint32_t) crc64;
+    while (length--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+
+static bool
+cpu_has_crc32c(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(CRC32C_HW_ARM)
+__attribute__((target("+crc")))
+static uint32_t
+crc32c_hw(uint32_t crc, const uint8_t *data, size_t length) {
+    while (length && ((uintptr_t) data & 7)) {
+        crc = __crc32cb(crc, *data++);
+        --length;
+    }
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+
+static bool
+cpu_has_crc32c(void) {
+    return !!(getauxval(AT_HWCAP) & HWCAP_CRC32);
+}
+#endif
+
+//------------------------------------------------------------------------------
+
+static void
+crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0u - (crc & 1)));
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int slice = 1; slice < 8; ++slice) {
+            uint32_t prev = crc32c_table[slice - 1][i];
+            crc32c_table[slice][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+
+    crc32c_impl = crc32c_sw;
+#if defined(CRC32C_HW_X86) || defined(CRC32C_HW_ARM)
+    if (cpu_has_crc32c()) {
+        crc32c_impl = crc32c_hw;
+    }
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t
+crc32c_update(uint32_t crc, const void *data, size_t length) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return ~crc32c_impl(~crc, (const uint8_t *) data, length);
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t
+crc32c_update_sw(uint32_t crc, const void *data, size_t length) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return ~crc32c_sw(~crc, (const uint8_t *) data, length);
+}
+
+//------------------------------------------------------------------------------
+
+bool
+crc32c_is_hw_accelerated(void) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_impl != crc32c_sw;
+}
+
+//------------------------------------------------------------------------------
+
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+sha256_transform(uint32_t state[8], const uint8_t block[SHA256_BLOCK_SIZE]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t) block[4 * i] << 24 | (uint32_t) block[4 * i + 1] << 16
+               | (uint32_t) block[4 * i + 2] << 8 | (uint32_t) block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + SHA256_K[i] + w[i];
+        uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sha256_init(sha256_ctx_t *ctx) {
+    static const uint32_t SHA256_IV[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, SHA256_IV, sizeof(SHA256_IV));
+    ctx->length = 0;
+    ctx->buffered = 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sha256_update(sha256_ctx_t *ctx, const void *data, size_t length) {
+    const uint8_t *bytes = (const uint8_t *) data;
+    ctx->length += length;
+
+    if (ctx->buffered) {
+        size_t chunk = SHA256_BLOCK_SIZE - ctx->buffered;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(ctx->buffer + ctx->buffered, bytes, chunk);
+        ctx->buffered += chunk;
+        bytes += chunk;
+        length -= chunk;
+        if (ctx->buffered < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        sha256_transform(ctx->state, ctx->buffer);
+        ctx->buffered = 0;
+    }
+    // whole blocks are hashed straight from the input, without copying
+    while (length >= SHA256_BLOCK_SIZE) {
+        sha256_transform(ctx->state, bytes);
+        bytes += SHA256_BLOCK_SIZE;
+        length -= SHA256_BLOCK_SIZE;
+    }
+    memcpy(ctx->buffer, bytes, length);
+    ctx->buffered = length;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    uint64_t bit_length = ctx->length * 8;
+
+    ctx->buffer[ctx->buffered++] = 0x80;
+    if (ctx->buffered > SHA256_BLOCK_SIZE - 8) {
+        memset(ctx->buffer + ctx->buffered, 0, SHA256_BLOCK_SIZE - ctx->buffered);
+        sha256_transform(ctx->state, ctx->buffer);
+        ctx->buffered = 0;
+    }
+    memset(ctx->buffer + ctx->buffered, 0, SHA256_BLOCK_SIZE - 8 - ctx->buffered);
+    for (int i = 0; i < 8; ++i) {
+        ctx->buffer[SHA256_BLOCK_SIZE - 1 - i] = (uint8_t) (bit_length >> (8 * i));
+    }
+    sha256_transform(ctx->state, ctx->buffer);
+
+    for (int i = 0; i < 8; ++i) {
+        digest[4 * i]     = (uint8_t) (ctx->state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t) (ctx->state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t) (ctx->state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t) ctx->state[i];
+    }
+}
@@ -0,0 +1,108 @@
+#include "toyota_histogram.h"
+
+#include <string.h>
+
+#define HISTOGRAM_SUB_BITS 3    // log2(HISTOGRAM_SUB_BUCKETS)
+
+//------------------------------------------------------------------------------
+
+// values below HISTOGRAM_SUB_BUCKETS get exact buckets, above that every
+// power of two is split into HISTOGRAM_SUB_BUCKETS linear buckets
+static size_t
+bucket_of(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (size_t) value;
+    }
+    unsigned msb = 63 - (unsigned) __builtin_clzll(value);
+    unsigned shift = msb - HISTOGRAM_SUB_BITS;
+    size_t sub = (size_t) ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+    return (size_t) (shift + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+//------------------------------------------------------------------------------
+
+static uint64_t
+bucket_upper_bound(size_t bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return (uint64_t) bucket;
+    }
+    unsigned shift = (unsigned) (bucket / HISTOGRAM_SUB_BUCKETS) - 1;
+    uint64_t sub = (uint64_t) (bucket % HISTOGRAM_SUB_BUCKETS);
+    uint64_t base = ((uint64_t) HISTOGRAM_SUB_BUCKETS + sub) << shift;
+    return base + ((uint64_t) 1 << shift) - 1;
+}
+
+//------------------------------------------------------------------------------
+
+void
+histogram_init(histogram_t *histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->min = UINT64_MAX;
+}
+
+//------------------------------------------------------------------------------
+
+void
+histogram_record(histogram_t *histogram, uint64_t value) {
+    ++histogram->counts[bucket_of(value)];
+    ++histogram->count;
+    histogram->sum += value;
+    if (value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+histogram_merge(histogram_t *target, const histogram_t *source) {
+    if (!source->count) {
+        return;
+    }
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        target->counts[i] += source->counts[i];
+    }
+    target->count += source->count;
+    target->sum += source->sum;
+    if (source->min < target->min) {
+        target->min = source->min;
+    }
+    if (source->max > target->max) {
+        target->max = source->max;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t
+histogram_percentile(const histogram_t *histogram, double percentile) {
+    if (!histogram->count) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) ((double) histogram->count * percentile / 100.0);
+    if (rank >= histogram->count) {
+        rank = histogram->count - 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram->counts[i];
+        if (seen > rank) {
+            uint64_t bound = bucket_upper_bound(i);
+            return bound < histogram->max ? bound : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+//------------------------------------------------------------------------------
+
+double
+histogram_mean(const histogram_t *histogram) {
+    if (!histogram->count) {
+        return 0.0;
+    }
+    return (double) histogram->sum / (double) histogram->count;
+}
@@ -0,0 +1,153 @@
+#include "toyota_history.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <avsystem/commons/memory.h>
+
+//------------------------------------------------------------------------------
+
+static size_t
+slot_of(const sample_history_t *history, size_t index) {
+    assert(index < history->count);
+    // oldest sample sits count slots behind head
+    size_t slot = history->head + history->capacity - history->count + index;
+    return slot >= history->capacity ? slot - history->capacity : slot;
+}
+
+//------------------------------------------------------------------------------
+
+int
+sample_history_init(sample_history_t *history, size_t capacity) {
+    assert(capacity);
+    memset(history, 0, sizeof(*history));
+
+    // one block for both arrays, timestamps first keep values aligned
+    void *storage = avs_malloc(capacity * (sizeof(int64_t) + sizeof(float)));
+    if (!storage) {
+        return -1;
+    }
+    history->times_ms = (int64_t *) storage;
+    history->values = (float *) (history->times_ms + capacity);
+    history->capacity = capacity;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sample_history_release(sample_history_t *history) {
+    avs_free(history->times_ms);
+    memset(history, 0, sizeof(*history));
+}
+
+//------------------------------------------------------------------------------
+
+void
+sample_history_push(sample_history_t *history, int64_t time_ms, float value) {
+    history->times_ms[history->head] = time_ms;
+    history->values[history->head] = value;
+    if (++history->head == history->capacity) {
+        history->head = 0;
+    }
+    if (history->count < history->capacity) {
+        ++history->count;
+    }
+    ++history->sequence;
+
+    if (!history->aggregate_count++) {
+        history->min = value;
+        history->max = value;
+    } else if (value < history->min) {
+        history->min = value;
+    } else if (value > history->max) {
+        history->max = value;
+    }
+    history->aggregate_sum += value;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sample_history_clear(sample_history_t *history) {
+    history->count = 0;
+    history->base = history->sequence;
+    history->served = false;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sample_history_mark_served(sample_history_t *history) {
+    if (!history->served || history->sequence < history->served_end) {
+        history->served_end = history->sequence;
+    }
+    history->served = true;
+}
+
+//------------------------------------------------------------------------------
+
+size_t
+sample_history_clear_served(sample_history_t *history) {
+    size_t dropped = 0;
+    if (history->served) {
+        // samples pushed after the reads are the newest count - dropped ones
+        uint64_t unserved = history->sequence - history->served_end;
+        if (unserved < history->count) {
+            dropped = history->count - (size_t) unserved;
+            history->count = (size_t) unserved;
+        }
+    }
+    history->base = history->sequence - history->count;
+    history->served = false;
+    return dropped;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sample_history_reset_aggregates(sample_history_t *history) {
+    history->aggregate_count = 0;
+    history->aggregate_sum = 0.0;
+    history->min = 0.0f;
+    history->max = 0.0f;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t
+sample_history_sequence(const sample_history_t *history, size_t index) {
+    assert(index < history->count);
+    return history->sequence - history->count + index;
+}
+
+//------------------------------------------------------------------------------
+
+uint64_t
+sample_history_number(const sample_history_t *history, size_t index) {
+    return sample_history_sequence(history, index) - history->base;
+}
+
+//------------------------------------------------------------------------------
+
+float
+sample_history_value(const sample_history_t *history, size_t index) {
+    return history->values[slot_of(history, index)];
+}
+
+//------------------------------------------------------------------------------
+
+int64_t
+sample_history_time_ms(const sample_history_t *history, size_t index) {
+    return history->times_ms[slot_of(history, index)];
+}
+
+//------------------------------------------------------------------------------
+
+float
+sample_history_mean(const sample_history_t *history) {
+    if (!history->aggregate_count) {
+        return 0.0f;
+    }
+    return (float) (history->aggregate_sum / (double) history->aggregate_count);
+}
@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#include "toyota_ingest.h"
+#include "toyota_utils.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <avsystem/commons/memory.h>
+
+#define INGEST_CACHE_LINE 64
+
+#define ingest_log(level, ...) avs_log(toyota_ingest, level, __VA_ARGS__)
+
+// slot of the ring, sequence tells whose turn it is:
+// index - free for the producer of that position,
+// index + 1 - filled, waiting for the consumer
+typedef struct {
+    atomic_size_t   sequence;
+    ingest_sample_t sample;
+} ingest_cell_t;
+
+struct ingest_queue {
+    // producer and consumer positions live on separate cache lines
+    alignas(INGEST_CACHE_LINE) atomic_size_t enqueue_pos;
+    alignas(INGEST_CACHE_LINE) atomic_size_t dequeue_pos;
+    alignas(INGEST_CACHE_LINE) atomic_bool wakeup_pending; // eventfd already signalled
+    atomic_uint_fast64_t enqueued;
+    atomic_uint_fast64_t dropped;
+
+    alignas(INGEST_CACHE_LINE) ingest_cell_t *cells;
+    size_t mask;                                // capacity - 1
+    int event_fd;                               // wakes the loop when queue turns non-empty
+    event_loop_t *loop;
+    event_loop_fd_watch_t *watch;
+    ingest_consumer_t *consumer;
+    void *consumer_arg;
+    atomic_uint_fast64_t drained;
+    atomic_uint_fast64_t wakeups;
+    atomic_uint_fast64_t max_batch;
+};
+
+//------------------------------------------------------------------------------
+
+static bool
+pop_sample(ingest_queue_t *queue, ingest_sample_t *out_sample) {
+    size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        ingest_cell_t *cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) (pos + 1);
+        if (diff < 0) {
+            return false;
+        }
+        if (diff > 0) {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos,
+                                                  pos + 1, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            *out_sample = cell->sample;
+            // hand the slot back to producers of the next lap
+            atomic_store_explicit(&cell->sequence, pos + queue->mask + 1,
+                                  memory_order_release);
+            return true;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+signal_loop(ingest_queue_t *queue) {
+    uint64_t one = 1;
+    while (write(queue->event_fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+event_fd_handler(void *queue_) {
+    ingest_queue_t *queue = (ingest_queue_t *) queue_;
+    uint64_t count;
+    while (read(queue->event_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+    atomic_fetch_add_explicit(&queue->wakeups, 1, memory_order_relaxed);
+
+    // producers pushing from now on signal again; the fence pairs with the
+    // one in ingest_queue_push(), so either they see the flag cleared or
+    // the drain below sees their sample
+    atomic_store_explicit(&queue->wakeup_pending, false, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (ingest_queue_drain(queue, INGEST_DRAIN_BATCH) == INGEST_DRAIN_BATCH
+            && !atomic_exchange(&queue->wakeup_pending, true)) {
+        // more left, continue on the next iteration after serving sockets
+        signal_loop(queue);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+ingest_queue_t *
+ingest_queue_create(event_loop_t *loop,
+                    size_t capacity,
+                    ingest_consumer_t *consumer,
+                    void *arg) {
+    assert(loop);
+    assert(consumer);
+
+    size_t slots = 2;
+    while (slots < capacity) {
+        slots *= 2;
+    }
+
+    ingest_queue_t *queue = (ingest_queue_t *) avs_calloc(1, sizeof(ingest_queue_t));
+    if (!queue) {
+        ingest_log(ERROR, "out of memory");
+        return NULL;
+    }
+    queue->event_fd = -1;
+    if (!(queue->cells = (ingest_cell_t *) avs_calloc(slots, sizeof(ingest_cell_t)))) {
+        ingest_log(ERROR, "out of memory");
+        goto error;
+    }
+    for (size_t i = 0; i < slots; ++i) {
+        atomic_init(&queue->cells[i].sequence, i);
+    }
+    queue->mask = slots - 1;
+    queue->loop = loop;
+    queue->consumer = consumer;
+    queue->consumer_arg = arg;
+
+    queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (queue->event_fd < 0) {
+        ingest_log(ERROR, "could not create eventfd: %s", strerror(errno));
+        goto error;
+    }
+    if (!(queue->watch = event_loop_watch_fd(loop, queue->event_fd,
+                                             event_fd_handler, queue))) {
+        goto error;
+    }
+    return queue;
+
+error:
+    ingest_queue_destroy(queue);
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+void
+ingest_queue_destroy(ingest_queue_t *queue) {
+    if (!queue) {
+        return;
+    }
+    event_loop_unwatch_fd(queue->loop, queue->watch);
+    if (queue->event_fd >= 0) {
+        close(queue->event_fd);
+    }
+    avs_free(queue->cells);
+    avs_free(queue);
+}
+
+//------------------------------------------------------------------------------
+
+int
+ingest_queue_push(ingest_queue_t *queue, const ingest_sample_t *sample) {
+    ingest_cell_t *cell;
+    size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos,
+                                                      pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // slot of the previous lap not consumed yet, queue is full
+            atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+    cell->sample = *sample;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    atomic_fetch_add_explicit(&queue->enqueued, 1, memory_order_relaxed);
+
+    // only the producer which finds the queue idle pays for the syscall
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&queue->wakeup_pending, memory_order_relaxed)
+            && !atomic_exchange(&queue->wakeup_pending, true)) {
+        signal_loop(queue);
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+size_t
+ingest_queue_drain(ingest_queue_t *queue, size_t max_count) {
+    ingest_sample_t sample;
+    size_t count = 0;
+    while (count < max_count && pop_sample(queue, &sample)) {
+        queue->consumer(queue->consumer_arg, &sample);
+        ++count;
+    }
+    if (count) {
+        atomic_fetch_add_explicit(&queue->drained, count, memory_order_relaxed);
+        if (count > atomic_load_explicit(&queue->max_batch, memory_order_relaxed)) {
+            atomic_store_explicit(&queue->max_batch, count, memory_order_relaxed);
+        }
+    }
+    return count;
+}
+
+//------------------------------------------------------------------------------
+
+void
+ingest_queue_get_stats(const ingest_queue_t *queue, ingest_stats_t *out_stats) {
+    // counters are read one by one, they may be slightly out of step
+    out_stats->enqueued  = atomic_load_explicit(&queue->enqueued, memory_order_relaxed);
+    out_stats->dropped   = atomic_load_explicit(&queue->dropped, memory_order_relaxed);
+    out_stats->drained   = atomic_load_explicit(&queue->drained, memory_order_relaxed);
+    out_stats->wakeups   = atomic_load_explicit(&queue->wakeups, memory_order_relaxed);
+    out_stats->max_batch = atomic_load_explicit(&queue->max_batch, memory_order_relaxed);
+}
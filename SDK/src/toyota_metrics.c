@@ -0,0 +1,496 @@
+#define _POSIX_C_SOURCE 200809L
+#include "toyota_metrics.h"
+
+#include <avsystem/commons/defs.h>
+#include <avsystem/commons/log.h>
+#include <avsystem/commons/memory.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define metrics_log(level, ...) avs_log(toyota_metrics, level, __VA_ARGS__)
+
+#define METRICS_PATH_SIZE       256
+#define METRICS_LISTEN_BACKLOG  4
+#define METRICS_CLIENT_TIMEOUT  1000    // longest wait for a reading client, in milliseconds
+
+static const char *const COUNTER_NAMES[METRICS_COUNTER_COUNT] = {
+    [METRIC_WAKEUPS]            = "wakeups",
+    [METRIC_READY_SOCKETS]      = "ready_sockets",
+    [METRIC_SERVE_FAILED]       = "serve_failed",
+    [METRIC_SCHED_JOBS]         = "sched_jobs",
+    [METRIC_CONNECTIONS_FAILED] = "connections_failed",
+    [METRIC_TIMERS_FIRED]       = "timers_fired",
+    [METRIC_NOTIFIES]           = "notifies",
+    [METRIC_FW_BYTES]           = "fw_bytes"
+};
+
+static const char *const LATENCY_NAMES[METRICS_LATENCY_COUNT] = {
+    [METRIC_LOOP_BUSY]          = "loop_busy",
+    [METRIC_SERVE]              = "serve",
+    [METRIC_SCHED]              = "sched",
+    [METRIC_NOTIFY]             = "notify",
+    [METRIC_FW_WRITE]           = "fw_write"
+};
+
+static const double QUANTILES[] = { 50.0, 90.0, 99.0, 99.9 };
+
+typedef struct {
+    uint64_t    counters[METRICS_COUNTER_COUNT];
+    histogram_t latencies[METRICS_LATENCY_COUNT];
+} metrics_values_t;
+
+struct metrics {
+    char                name[METRICS_NAME_SIZE];
+    metrics_values_t    live;           // written by the owner thread only
+    int64_t             next_publish_ns;
+    pthread_mutex_t     mutex;          // guards published
+    metrics_values_t    published;
+    metrics_t           *next;          // registry list
+};
+
+struct metrics_exporter {
+    char        dump_path[METRICS_PATH_SIZE];
+    char        socket_path[METRICS_PATH_SIZE];
+    int         interval_ms;
+    int         listen_fd;              // -1 - no socket
+    int         stop_pipe[2];           // written once to stop the thread
+    pthread_t   thread;
+};
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static metrics_t *registry;
+
+static _Thread_local metrics_t *current_metrics;
+
+//------------------------------------------------------------------------------
+
+static int64_t
+now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+values_init(metrics_values_t *values) {
+    memset(values->counters, 0, sizeof(values->counters));
+    for (size_t i = 0; i < METRICS_LATENCY_COUNT; ++i) {
+        histogram_init(&values->latencies[i]);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+metrics_t *
+metrics_create(const char *name) {
+    assert(name);
+
+    metrics_t *metrics = (metrics_t *) avs_calloc(1, sizeof(metrics_t));
+    if (!metrics) {
+        metrics_log(ERROR, "out of memory");
+        return NULL;
+    }
+    if (pthread_mutex_init(&metrics->mutex, NULL)) {
+        metrics_log(ERROR, "could not create mutex");
+        avs_free(metrics);
+        return NULL;
+    }
+    snprintf(metrics->name, sizeof(metrics->name), "%s", name);
+    values_init(&metrics->live);
+    values_init(&metrics->published);
+
+    pthread_mutex_lock(&registry_mutex);
+    metrics_t **tail = &registry;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = metrics;
+    pthread_mutex_unlock(&registry_mutex);
+    return metrics;
+}
+
+//------------------------------------------------------------------------------
+
+void
+metrics_destroy(metrics_t *metrics) {
+    if (!metrics) {
+        return;
+    }
+
+    pthread_mutex_lock(&registry_mutex);
+    for (metrics_t **entry = &registry; *entry; entry = &(*entry)->next) {
+        if (*entry == metrics) {
+            *entry = metrics->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    if (current_metrics == metrics) {
+        current_metrics = NULL;
+    }
+    pthread_mutex_destroy(&metrics->mutex);
+    avs_free(metrics);
+}
+
+//------------------------------------------------------------------------------
+
+void
+metrics_set_current(metrics_t *metrics) {
+    current_metrics = metrics;
+}
+
+//------------------------------------------------------------------------------
+
+metrics_t *
+metrics_current(void) {
+    return current_metrics;
+}
+
+//------------------------------------------------------------------------------
+
+void
+metrics_count(metrics_t *metrics, metrics_counter_t counter, uint64_t value) {
+    if (metrics) {
+        metrics->live.counters[counter] += value;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+int64_t
+metrics_start(const metrics_t *metrics) {
+    return metrics ? now_ns() : 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+metrics_stop(metrics_t *metrics, metrics_latency_t latency, int64_t start_ns) {
+    if (metrics) {
+        int64_t elapsed_ns = now_ns() - start_ns;
+        histogram_record(&metrics->live.latencies[latency],
+                         elapsed_ns > 0 ? (uint64_t) elapsed_ns : 0);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+metrics_publish(metrics_t *metrics) {
+    if (!metrics) {
+        return;
+    }
+    int64_t now = now_ns();
+    if (now < metrics->next_publish_ns) {
+        return;
+    }
+    metrics->next_publish_ns = now + (int64_t) METRICS_PUBLISH_INTERVAL * 1000000;
+
+    pthread_mutex_lock(&metrics->mutex);
+    metrics->published = metrics->live;
+    pthread_mutex_unlock(&metrics->mutex);
+}
+
+//------------------------------------------------------------------------------
+
+static int
+format_values(FILE *out, const char *name, const metrics_values_t *values) {
+    for (size_t i = 0; i < METRICS_COUNTER_COUNT; ++i) {
+        if (fprintf(out, "toyota_%s_total{thread=\"%s\"} %" PRIu64 "\n",
+                    COUNTER_NAMES[i], name, values->counters[i]) < 0) {
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < METRICS_LATENCY_COUNT; ++i) {
+        const histogram_t *histogram = &values->latencies[i];
+        for (size_t q = 0; q < AVS_ARRAY_SIZE(QUANTILES); ++q) {
+            if (fprintf(out, "toyota_%s_ns{thread=\"%s\",quantile=\"%g\"} %" PRIu64 "\n",
+                        LATENCY_NAMES[i], name, QUANTILES[q] / 100.0,
+                        histogram_percentile(histogram, QUANTILES[q])) < 0) {
+                return -1;
+            }
+        }
+        if (fprintf(out, "toyota_%s_ns{thread=\"%s\",quantile=\"1\"} %" PRIu64 "\n"
+                         "toyota_%s_ns_sum{thread=\"%s\"} %" PRIu64 "\n"
+                         "toyota_%s_ns_count{thread=\"%s\"} %" PRIu64 "\n",
+                    LATENCY_NAMES[i], name, histogram->max,
+                    LATENCY_NAMES[i], name, histogram->sum,
+                    LATENCY_NAMES[i], name, histogram->count) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+write_all(int fd, const char *data, size_t size) {
+    while (size) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        size -= (size_t) written;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+int
+metrics_write_report(int fd) {
+    // one snapshot at a time keeps the copy off the stack of exporter thread
+    static pthread_mutex_t report_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static metrics_values_t snapshot;
+
+    // the report is formatted under the locks and written after they are
+    // released, so a slow reader never holds up metrics_create()/_destroy()
+    char *report = NULL;
+    size_t report_size = 0;
+    FILE *out = open_memstream(&report, &report_size);
+    if (!out) {
+        return -1;
+    }
+    int result = 0;
+    pthread_mutex_lock(&report_mutex);
+    pthread_mutex_lock(&registry_mutex);
+    for (metrics_t *metrics = registry; metrics && !result; metrics = metrics->next) {
+        pthread_mutex_lock(&metrics->mutex);
+        snapshot = metrics->published;
+        pthread_mutex_unlock(&metrics->mutex);
+        result = format_values(out, metrics->name, &snapshot);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    pthread_mutex_unlock(&report_mutex);
+    if (fclose(out)) {
+        result = -1;
+    }
+    if (!result) {
+        result = write_all(fd, report, report_size);
+    }
+    // allocated by libc, not by the avs allocator
+    free(report);
+    return result;
+}
+
+//------------------------------------------------------------------------------
+
+// readers never see a half-written file
+static void
+write_dump(const metrics_exporter_t *exporter) {
+    char tmp_path[METRICS_PATH_SIZE + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", exporter->dump_path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        metrics_log(WARNING, "could not open %s: %s", tmp_path, strerror(errno));
+        return;
+    }
+    int result = metrics_write_report(fd);
+    if (close(fd) || result || rename(tmp_path, exporter->dump_path)) {
+        metrics_log(WARNING, "could not write %s", exporter->dump_path);
+        unlink(tmp_path);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+answer_client(const metrics_exporter_t *exporter) {
+    int fd = accept(exporter->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    // a client that connects and never reads must not stall the exporter
+    struct timeval timeout = {
+        .tv_sec = METRICS_CLIENT_TIMEOUT / 1000,
+        .tv_usec = (METRICS_CLIENT_TIMEOUT % 1000) * 1000
+    };
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))) {
+        metrics_log(WARNING, "could not set send timeout: %s", strerror(errno));
+        close(fd);
+        return;
+    }
+    if (metrics_write_report(fd)) {
+        metrics_log(DEBUG, "metrics client went away");
+    }
+    close(fd);
+}
+
+//------------------------------------------------------------------------------
+
+static void *
+exporter_run(void *exporter_) {
+    metrics_exporter_t *exporter = (metrics_exporter_t *) exporter_;
+    int64_t next_dump_ns = now_ns();
+
+    // a client closing early must fail the write, not kill the process
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    for (;;) {
+        int timeout_ms = -1;
+        if (exporter->dump_path[0]) {
+            int64_t wait_ns = next_dump_ns - now_ns();
+            if (wait_ns <= 0) {
+                write_dump(exporter);
+                next_dump_ns += (int64_t) exporter->interval_ms * 1000000;
+                continue;
+            }
+            timeout_ms = (int) (wait_ns / 1000000) + 1;
+        }
+
+        struct pollfd fds[2] = {
+            { .fd = exporter->stop_pipe[0], .events = POLLIN },
+            { .fd = exporter->listen_fd, .events = POLLIN }
+        };
+        int ready = poll(fds, exporter->listen_fd >= 0 ? 2 : 1, timeout_ms);
+        if (ready < 0 && errno != EINTR) {
+            metrics_log(ERROR, "poll failed: %s", strerror(errno));
+            break;
+        }
+        if (ready > 0 && fds[0].revents) {
+            break;
+        }
+        if (ready > 0 && fds[1].revents) {
+            answer_client(exporter);
+        }
+    }
+    if (exporter->dump_path[0]) {
+        write_dump(exporter);
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+open_socket(metrics_exporter_t *exporter) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(exporter->socket_path) >= sizeof(address.sun_path)) {
+        metrics_log(ERROR, "socket path too long: %s", exporter->socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, exporter->socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        metrics_log(ERROR, "could not create socket: %s", strerror(errno));
+        return -1;
+    }
+    (void) fcntl(fd, F_SETFD, FD_CLOEXEC);
+    // socket left by a previous run
+    (void) unlink(exporter->socket_path);
+    if (bind(fd, (const struct sockaddr *) &address, sizeof(address))
+            || listen(fd, METRICS_LISTEN_BACKLOG)) {
+        metrics_log(ERROR, "could not listen on %s: %s", exporter->socket_path,
+                    strerror(errno));
+        close(fd);
+        return -1;
+    }
+    exporter->listen_fd = fd;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+metrics_exporter_t *
+metrics_exporter_start(const char *dump_path,
+                       const char *socket_path,
+                       int interval_ms) {
+    assert(dump_path || socket_path);
+
+    metrics_exporter_t *exporter =
+            (metrics_exporter_t *) avs_calloc(1, sizeof(metrics_exporter_t));
+    if (!exporter) {
+        metrics_log(ERROR, "out of memory");
+        return NULL;
+    }
+    exporter->listen_fd = -1;
+    exporter->stop_pipe[0] = exporter->stop_pipe[1] = -1;
+    exporter->interval_ms = interval_ms > 0 ? interval_ms : METRICS_DEFAULT_INTERVAL;
+    if ((dump_path && strlen(dump_path) >= sizeof(exporter->dump_path))
+            || (socket_path && strlen(socket_path) >= sizeof(exporter->socket_path))) {
+        metrics_log(ERROR, "metrics path too long");
+        goto error;
+    }
+    if (dump_path) {
+        strcpy(exporter->dump_path, dump_path);
+    }
+    if (socket_path) {
+        strcpy(exporter->socket_path, socket_path);
+        if (open_socket(exporter)) {
+            goto error;
+        }
+    }
+    if (pipe(exporter->stop_pipe)) {
+        metrics_log(ERROR, "could not create pipe: %s", strerror(errno));
+        goto error;
+    }
+    if (pthread_create(&exporter->thread, NULL, exporter_run, exporter)) {
+        metrics_log(ERROR, "could not start exporter thread");
+        goto error;
+    }
+    return exporter;
+
+error:
+    if (exporter->stop_pipe[0] >= 0) {
+        close(exporter->stop_pipe[0]);
+        close(exporter->stop_pipe[1]);
+    }
+    if (exporter->listen_fd >= 0) {
+        close(exporter->listen_fd);
+        unlink(exporter->socket_path);
+    }
+    avs_free(exporter);
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+void
+metrics_exporter_stop(metrics_exporter_t *exporter) {
+    if (!exporter) {
+        return;
+    }
+
+    ssize_t written;
+    do {
+        written = write(exporter->stop_pipe[1], "", 1);
+    } while (written < 0 && errno == EINTR);
+    pthread_join(exporter->thread, NULL);
+
+    close(exporter->stop_pipe[0]);
+    close(exporter->stop_pipe[1]);
+    if (exporter->listen_fd >= 0) {
+        close(exporter->listen_fd);
+        unlink(exporter->socket_path);
+    }
+    avs_free(exporter);
+}
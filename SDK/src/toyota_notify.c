@@ -0,0 +1,141 @@
+#include "toyota_notify.h"
+#include "toyota_utils.h"
+#include "toyota_metrics.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define notify_log(level, ...) avs_log(toyota_notify, level, __VA_ARGS__)
+
+//------------------------------------------------------------------------------
+
+static void
+update_avoided(notify_batch_t *batch) {
+    // changes still pending in the window are neither issued nor avoided yet
+    uint64_t settled = batch->stats.issued + batch->pending_count;
+    batch->stats.avoided = batch->stats.requested > settled
+                                   ? batch->stats.requested - settled
+                                   : 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+flush_timer_handler(void *batch_) {
+    notify_batch_flush((notify_batch_t *) batch_);
+}
+
+//------------------------------------------------------------------------------
+
+int
+notify_batch_init(notify_batch_t *batch,
+                  anjay_t *anjay,
+                  event_loop_t *event_loop,
+                  anjay_oid_t oid,
+                  anjay_iid_t iid) {
+    assert(batch);
+    assert(anjay);
+
+    memset(batch, 0, sizeof(*batch));
+    batch->anjay = anjay;
+    batch->oid = oid;
+    batch->iid = iid;
+
+    if (event_loop) {
+        if (!(batch->timer = event_loop_timer_create(event_loop,
+                                                     flush_timer_handler,
+                                                     batch))) {
+            return -1;
+        }
+        batch->window_ms = NOTIFY_BATCH_DEFAULT_WINDOW;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+notify_batch_release(notify_batch_t *batch) {
+    if (!batch) {
+        return;
+    }
+    event_loop_timer_destroy(batch->timer);
+    batch->timer = NULL;
+    batch->pending_count = 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+notify_batch_set_window(notify_batch_t *batch, int window_ms) {
+    assert(batch);
+
+    batch->window_ms = (batch->timer && window_ms > 0) ? window_ms : 0;
+    if (!batch->window_ms) {
+        // changes waiting for the old window must not be lost
+        notify_batch_flush(batch);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+notify_batch_mark(notify_batch_t *batch, anjay_rid_t rid) {
+    assert(batch);
+
+    for (size_t i = 0; i < batch->pending_count; ++i) {
+        if (batch->pending[i] == rid) {
+            return;
+        }
+    }
+    if (batch->pending_count == NOTIFY_BATCH_MAX_RESOURCES) {
+        // should not happen with static object definitions, notify right away
+        notify_log(WARNING, "notification batch of /%u/%u is full",
+                   (unsigned) batch->oid, (unsigned) batch->iid);
+        notify_batch_flush(batch);
+    }
+    batch->pending[batch->pending_count++] = rid;
+}
+
+//------------------------------------------------------------------------------
+
+void
+notify_batch_submit(notify_batch_t *batch, size_t resources_in_update) {
+    assert(batch);
+
+    batch->stats.requested += resources_in_update;
+    update_avoided(batch);
+    if (!batch->pending_count) {
+        return;
+    }
+    if (!batch->window_ms) {
+        notify_batch_flush(batch);
+    } else if (!event_loop_timer_is_armed(batch->timer)) {
+        // window starts with the first change, later changes join it
+        if (event_loop_timer_arm(batch->timer, batch->window_ms)) {
+            notify_batch_flush(batch);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+notify_batch_flush(notify_batch_t *batch) {
+    assert(batch);
+
+    event_loop_timer_cancel(batch->timer);
+    metrics_t *metrics = metrics_current();
+    int64_t start_ns = metrics_start(metrics);
+    for (size_t i = 0; i < batch->pending_count; ++i) {
+        // all calls land in one anjay notify queue flush, so an observation
+        // of the whole instance gets a single Notify
+        anjay_notify_changed(batch->anjay, batch->oid, batch->iid,
+                             batch->pending[i]);
+    }
+    metrics_stop(metrics, METRIC_NOTIFY, start_ns);
+    metrics_count(metrics, METRIC_NOTIFIES, batch->pending_count);
+    batch->stats.issued += batch->pending_count;
+    batch->pending_count = 0;
+    update_avoided(batch);
+}
@@ -0,0 +1,379 @@
+#include "toyota_object.h"
+
+#include <avsystem/commons/memory.h>
+
+#include <assert.h>
+#include <string.h>
+
+#define object_log(level, ...) avs_log(toyota_object, level, __VA_ARGS__)
+
+//------------------------------------------------------------------------------
+
+static bool
+in_range(const object_resource_t *resource, double value) {
+    return !resource->has_range
+           || (value >= resource->min && value <= resource->max);
+}
+
+//------------------------------------------------------------------------------
+
+int
+object_schema_read(const object_schema_t *schema,
+                   const void *values,
+                   anjay_rid_t rid,
+                   anjay_output_ctx_t *ctx) {
+    const object_resource_t *resource = object_schema_find(schema, rid);
+    if (!resource) {
+        return ANJAY_ERR_NOT_FOUND;
+    }
+    if (!(resource->operations & OBJECT_OP_READ)) {
+        return ANJAY_ERR_METHOD_NOT_ALLOWED;
+    }
+    if (resource->offset == OBJECT_SCHEMA_NOT_STORED) {
+        return OBJECT_SCHEMA_CUSTOM;
+    }
+
+    const char *slot = (const char *) values + resource->offset;
+    switch (resource->type) {
+    case OBJECT_RES_FLOAT: {
+        float value;
+        memcpy(&value, slot, sizeof(value));
+        return anjay_ret_float(ctx, value);
+    }
+    case OBJECT_RES_INTEGER: {
+        int64_t value;
+        memcpy(&value, slot, sizeof(value));
+        return anjay_ret_i64(ctx, value);
+    }
+    case OBJECT_RES_BOOLEAN: {
+        bool value;
+        memcpy(&value, slot, sizeof(value));
+        return anjay_ret_bool(ctx, value);
+    }
+    default:
+        return ANJAY_ERR_INTERNAL;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+int
+object_schema_write(const object_schema_t *schema,
+                    void *values,
+                    anjay_rid_t rid,
+                    anjay_input_ctx_t *ctx) {
+    const object_resource_t *resource = object_schema_find(schema, rid);
+    if (!resource) {
+        return ANJAY_ERR_NOT_FOUND;
+    }
+    if (!(resource->operations & OBJECT_OP_WRITE)) {
+        return ANJAY_ERR_METHOD_NOT_ALLOWED;
+    }
+    if (resource->offset == OBJECT_SCHEMA_NOT_STORED) {
+        return OBJECT_SCHEMA_CUSTOM;
+    }
+
+    char *slot = (char *) values + resource->offset;
+    int result;
+    switch (resource->type) {
+    case OBJECT_RES_FLOAT: {
+        float value;
+        if (!(result = anjay_get_float(ctx, &value))) {
+            if (!in_range(resource, value)) {
+                return ANJAY_ERR_BAD_REQUEST;
+            }
+            memcpy(slot, &value, sizeof(value));
+        }
+        return result;
+    }
+    case OBJECT_RES_INTEGER: {
+        int64_t value;
+        if (!(result = anjay_get_i64(ctx, &value))) {
+            if (!in_range(resource, (double) value)) {
+                return ANJAY_ERR_BAD_REQUEST;
+            }
+            memcpy(slot, &value, sizeof(value));
+        }
+        return result;
+    }
+    case OBJECT_RES_BOOLEAN: {
+        bool value;
+        if (!(result = anjay_get_bool(ctx, &value))) {
+            memcpy(slot, &value, sizeof(value));
+        }
+        return result;
+    }
+    default:
+        return ANJAY_ERR_INTERNAL;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+int
+object_schema_validate(const object_schema_t *schema, const void *values) {
+    for (size_t i = 0; i < schema->resource_count; ++i) {
+        const object_resource_t *resource = &schema->resources[i];
+        if (!resource->has_range || resource->offset == OBJECT_SCHEMA_NOT_STORED) {
+            continue;
+        }
+        const char *slot = (const char *) values + resource->offset;
+        double value;
+        if (resource->type == OBJECT_RES_FLOAT) {
+            float stored;
+            memcpy(&stored, slot, sizeof(stored));
+            value = stored;
+        } else if (resource->type == OBJECT_RES_INTEGER) {
+            int64_t stored;
+            memcpy(&stored, slot, sizeof(stored));
+            value = (double) stored;
+        } else {
+            continue;
+        }
+        if (!in_range(resource, value)) {
+            return ANJAY_ERR_BAD_REQUEST;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void *
+object_staging_get(object_staging_t *staging,
+                   const void *live,
+                   size_t value_size,
+                   size_t count,
+                   anjay_iid_t iid) {
+    assert(iid < count);
+
+    if (!staging->copied) {
+        if (staging->capacity != count) {
+            // instance count changed since the last transaction
+            object_staging_release(staging);
+            staging->staged = avs_calloc(count, value_size);
+            staging->written = (bool *) avs_calloc(count, sizeof(bool));
+            if (!staging->staged || !staging->written) {
+                object_staging_release(staging);
+                return NULL;
+            }
+            staging->capacity = count;
+            staging->value_size = value_size;
+        }
+        // one copy per transaction, however many resources it writes
+        memcpy(staging->staged, live, count * value_size);
+        staging->copied = true;
+    }
+    if (!staging->written[iid]) {
+        staging->written[iid] = true;
+        ++staging->written_count;
+    }
+    return (char *) staging->staged + (size_t) iid * value_size;
+}
+
+//------------------------------------------------------------------------------
+
+void *
+object_staging_commit(object_staging_t *staging, void *live) {
+    if (!staging->copied) {
+        return live;
+    }
+    void *committed = staging->staged;
+    staging->staged = live;
+    staging->copied = false;
+    return committed;
+}
+
+//------------------------------------------------------------------------------
+
+int
+object_staging_validate(const object_schema_t *schema,
+                        const object_staging_t *staging,
+                        size_t count) {
+    if (!staging->copied) {
+        return 0;
+    }
+    assert(count == staging->capacity);
+    for (size_t iid = 0; iid < count; ++iid) {
+        const void *staged = (const char *) staging->staged + iid * staging->value_size;
+        if (staging->written[iid] && object_schema_validate(schema, staged)) {
+            object_log(DEBUG, "Transaction rejected, invalid values of /%u/%u",
+                       (unsigned) schema->oid, (unsigned) iid);
+            return ANJAY_ERR_BAD_REQUEST;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+object_staging_end(object_staging_t *staging) {
+    if (staging->written_count) {
+        memset(staging->written, 0, staging->capacity * sizeof(bool));
+        staging->written_count = 0;
+    }
+    staging->copied = false;
+}
+
+//------------------------------------------------------------------------------
+
+void
+object_staging_release(object_staging_t *staging) {
+    avs_free(staging->staged);
+    avs_free(staging->written);
+    memset(staging, 0, sizeof(*staging));
+}
+
+//------------------------------------------------------------------------------
+
+static void
+release_arrays(object_instances_t *instances, size_t ready) {
+    for (size_t i = 0; instances->notify && i < ready; ++i) {
+        notify_batch_release(&instances->notify[i]);
+    }
+    avs_free(instances->notify);
+    avs_free(instances->changed_at_text);
+    avs_free(instances->changed_at);
+    avs_free(instances->values);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+add_notify_stats(notify_stats_t *sum, const notify_stats_t *stats) {
+    sum->requested += stats->requested;
+    sum->issued += stats->issued;
+    sum->avoided += stats->avoided;
+}
+
+//------------------------------------------------------------------------------
+
+void
+object_instances_init(object_instances_t *instances,
+                      anjay_t *anjay,
+                      event_loop_t *event_loop,
+                      anjay_oid_t oid,
+                      size_t value_size,
+                      const void *defaults) {
+    memset(instances, 0, sizeof(*instances));
+    instances->anjay = anjay;
+    instances->event_loop = event_loop;
+    instances->oid = oid;
+    instances->value_size = value_size;
+    instances->defaults = defaults;
+    instances->notify_window_ms = NOTIFY_BATCH_DEFAULT_WINDOW;
+}
+
+//------------------------------------------------------------------------------
+
+int
+object_instances_resize(object_instances_t *instances, size_t count) {
+    object_instances_t next = *instances;
+    next.count = count;
+    next.values = avs_calloc(count, instances->value_size);
+    next.changed_at = (toyota_timestamp_t *) avs_calloc(count, sizeof(toyota_timestamp_t));
+    next.changed_at_text = (toyota_timestamp_cache_t *)
+            avs_calloc(count, sizeof(toyota_timestamp_cache_t));
+    next.notify = (notify_batch_t *) avs_calloc(count, sizeof(notify_batch_t));
+    size_t kept = count < instances->count ? count : instances->count;
+    size_t ready = 0;   // instances with initialized batch
+    if (!next.values || !next.changed_at || !next.changed_at_text || !next.notify) {
+        goto error;
+    }
+
+    for (; ready < count; ++ready) {
+        if (notify_batch_init(&next.notify[ready], instances->anjay, instances->event_loop,
+                              instances->oid, (anjay_iid_t) ready)) {
+            goto error;
+        }
+        notify_batch_set_window(&next.notify[ready], instances->notify_window_ms);
+    }
+
+    if (kept) {
+        memcpy(next.values, instances->values, kept * instances->value_size);
+        memcpy(next.changed_at, instances->changed_at, kept * sizeof(toyota_timestamp_t));
+    }
+    for (size_t i = kept; i < count; ++i) {
+        memcpy((char *) next.values + i * instances->value_size, instances->defaults,
+               instances->value_size);
+        // time of the last change is the time of creation
+        timestamp_mark(&next.changed_at[i]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        timestamp_cache_init(&next.changed_at_text[i]);
+    }
+
+    for (size_t i = 0; i < instances->count; ++i) {
+        // changes waiting in old windows must not be lost
+        notify_batch_flush(&instances->notify[i]);
+        if (i >= kept) {
+            add_notify_stats(&next.released_stats, &instances->notify[i].stats);
+        } else {
+            next.notify[i].stats = instances->notify[i].stats;
+        }
+    }
+    release_arrays(instances, instances->count);
+    *instances = next;
+    return 0;
+
+error:
+    release_arrays(&next, ready);
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+void
+object_instances_commit(object_instances_t *instances,
+                        object_staging_t *staging,
+                        object_commit_hook_t *hook,
+                        void *arg) {
+    if (staging->copied) {
+        // pointer swap, reads see either old or new values of all resources
+        instances->values = object_staging_commit(staging, instances->values);
+        for (size_t iid = 0; iid < instances->count; ++iid) {
+            if (!staging->written[iid]) {
+                continue;
+            }
+            timestamp_mark(&instances->changed_at[iid]);
+            if (hook) {
+                hook(arg, (anjay_iid_t) iid);
+            }
+        }
+    }
+    object_staging_end(staging);
+}
+
+//------------------------------------------------------------------------------
+
+void
+object_instances_set_notify_window(object_instances_t *instances, int window_ms) {
+    instances->notify_window_ms = window_ms;
+    for (size_t i = 0; i < instances->count; ++i) {
+        notify_batch_set_window(&instances->notify[i], window_ms);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+object_instances_notify_stats(const object_instances_t *instances,
+                              notify_stats_t *out_stats) {
+    *out_stats = instances->released_stats;
+    for (size_t i = 0; i < instances->count; ++i) {
+        add_notify_stats(out_stats, &instances->notify[i].stats);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+object_instances_release(object_instances_t *instances) {
+    release_arrays(instances, instances->count);
+    instances->count = 0;
+    instances->values = NULL;
+    instances->changed_at = NULL;
+    instances->changed_at_text = NULL;
+    instances->notify = NULL;
+}
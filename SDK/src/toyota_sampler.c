@@ -0,0 +1,471 @@
+#define _POSIX_C_SOURCE 200809L
+#include "toyota_sampler.h"
+#include "toyota_utils.h"
+
+#include <avsystem/commons/defs.h>
+#include <avsystem/commons/log.h>
+#include <avsystem/commons/memory.h>
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define sampler_log(level, ...) avs_log(toyota_sampler, level, __VA_ARGS__)
+
+#define FILE_PATH_SIZE  256
+#define FILE_VALUE_SIZE 32
+#define TWO_PI          6.28318530717958647692
+
+typedef struct {
+    sensor_driver_t driver;
+    char path_format[FILE_PATH_SIZE];
+    bool per_channel;       // path_format contains %zu
+    float scale;
+    float offset;
+} file_driver_t;
+
+typedef struct {
+    sensor_driver_t driver;
+    sensor_synthetic_config_t config;
+    int64_t started_ms;
+    uint32_t noise_state;
+} synthetic_driver_t;
+
+typedef struct {
+    sampler_t *sampler;
+    size_t index;
+    event_loop_timer_t *timer;
+    bool has_value;
+    float last_value;
+    int64_t last_read_ms;
+    int interval_ms;
+} channel_t;
+
+struct sampler {
+    sensor_driver_t *driver;
+    event_loop_t *loop;
+    sampler_limits_t limits;
+    sampler_handlers_t handlers;
+    void *arg;
+    size_t channel_count;
+    channel_t **channels;   // channels own timers pointing at them, array of pointers
+    sampler_stats_t stats;
+};
+
+//------------------------------------------------------------------------------
+
+static int
+file_driver_read(sensor_driver_t *driver_, size_t channel, float *out_value) {
+    file_driver_t *driver = AVS_CONTAINER_OF(driver_, file_driver_t, driver);
+    char path[FILE_PATH_SIZE];
+    if (driver->per_channel) {
+        // format checked in sensor_driver_file_create()
+        int written = snprintf(path, sizeof(path), driver->path_format, channel);
+        if (written < 0 || (size_t) written >= sizeof(path)) {
+            return -1;
+        }
+    } else {
+        memcpy(path, driver->path_format, sizeof(path));
+    }
+
+    // sysfs attributes produce a fresh value on every open
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    char text[FILE_VALUE_SIZE];
+    char *end = NULL;
+    float value = 0.0f;
+    if (fgets(text, sizeof(text), file)) {
+        value = strtof(text, &end);
+    }
+    fclose(file);
+    if (!end || end == text) {
+        return -1;
+    }
+    *out_value = value * driver->scale + driver->offset;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+file_driver_destroy(sensor_driver_t *driver) {
+    avs_free(AVS_CONTAINER_OF(driver, file_driver_t, driver));
+}
+
+//------------------------------------------------------------------------------
+
+static const sensor_driver_vtable_t FILE_DRIVER_VTABLE = {
+    .name = "file",
+    .read = file_driver_read,
+    .destroy = file_driver_destroy
+};
+
+//------------------------------------------------------------------------------
+
+// path_format comes from configuration, allow nothing but one %zu
+static int
+check_path_format(const char *path_format, bool *out_per_channel) {
+    *out_per_channel = false;
+    for (const char *c = strchr(path_format, '%'); c; c = strchr(c + 1, '%')) {
+        if (c[1] == '%') {
+            ++c;
+        } else if (!*out_per_channel && !strncmp(c, "%zu", 3)) {
+            *out_per_channel = true;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+sensor_driver_t *
+sensor_driver_file_create(const char *path_format, float scale, float offset) {
+    assert(path_format);
+
+    bool per_channel;
+    if (strlen(path_format) >= FILE_PATH_SIZE
+            || check_path_format(path_format, &per_channel)) {
+        sampler_log(ERROR, "Invalid sensor path: %s", path_format);
+        return NULL;
+    }
+    file_driver_t *driver = (file_driver_t *) avs_calloc(1, sizeof(file_driver_t));
+    if (!driver) {
+        sampler_log(ERROR, "Out of memory");
+        return NULL;
+    }
+    driver->driver.vtable = &FILE_DRIVER_VTABLE;
+    strcpy(driver->path_format, path_format);
+    driver->per_channel = per_channel;
+    driver->scale = scale;
+    driver->offset = offset;
+    return &driver->driver;
+}
+
+//------------------------------------------------------------------------------
+
+static float
+synthetic_value(const synthetic_driver_t *driver, size_t channel, int64_t elapsed_ms) {
+    const sensor_synthetic_config_t *config = &driver->config;
+    int64_t cycle_ms = (int64_t) config->stable_ms + config->moving_ms;
+    if (config->moving_ms <= 0 || cycle_ms <= 0) {
+        return config->base;
+    }
+    int64_t shift_ms = (int64_t) channel * config->moving_ms / 4;
+    int64_t t = (elapsed_ms + shift_ms) % cycle_ms;
+    if (t < config->stable_ms) {
+        return config->base;
+    }
+    double phase = TWO_PI * (double) (t - config->stable_ms) / config->moving_ms;
+    return config->base + config->amplitude * (float) sin(phase);
+}
+
+//------------------------------------------------------------------------------
+
+static int
+synthetic_driver_read(sensor_driver_t *driver_, size_t channel, float *out_value) {
+    synthetic_driver_t *driver = AVS_CONTAINER_OF(driver_, synthetic_driver_t, driver);
+    float value = synthetic_value(driver, channel,
+                                  get_monotonic_time_ms() - driver->started_ms);
+    if (driver->config.noise > 0.0f) {
+        // xorshift32, uniform in [-noise, noise]
+        uint32_t x = driver->noise_state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        driver->noise_state = x;
+        value += driver->config.noise * ((float) x / (float) UINT32_MAX * 2.0f - 1.0f);
+    }
+    *out_value = value;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+synthetic_driver_destroy(sensor_driver_t *driver) {
+    avs_free(AVS_CONTAINER_OF(driver, synthetic_driver_t, driver));
+}
+
+//------------------------------------------------------------------------------
+
+static const sensor_driver_vtable_t SYNTHETIC_DRIVER_VTABLE = {
+    .name = "synthetic",
+    .read = synthetic_driver_read,
+    .destroy = synthetic_driver_destroy
+};
+
+//------------------------------------------------------------------------------
+
+sensor_driver_t *
+sensor_driver_synthetic_create(const sensor_synthetic_config_t *config) {
+    assert(config);
+
+    synthetic_driver_t *driver =
+            (synthetic_driver_t *) avs_calloc(1, sizeof(synthetic_driver_t));
+    if (!driver) {
+        sampler_log(ERROR, "Out of memory");
+        return NULL;
+    }
+    driver->driver.vtable = &SYNTHETIC_DRIVER_VTABLE;
+    driver->config = *config;
+    driver->started_ms = get_monotonic_time_ms();
+    // xorshift state must not be zero
+    driver->noise_state = config->seed ? config->seed : 1;
+    return &driver->driver;
+}
+
+//------------------------------------------------------------------------------
+
+float
+sensor_driver_synthetic_value(const sensor_driver_t *driver,
+                              size_t channel,
+                              int64_t elapsed_ms) {
+    assert(driver && driver->vtable == &SYNTHETIC_DRIVER_VTABLE);
+    return synthetic_value(AVS_CONTAINER_OF(driver, const synthetic_driver_t, driver),
+                           channel, elapsed_ms);
+}
+
+//------------------------------------------------------------------------------
+
+void
+sensor_driver_destroy(sensor_driver_t *driver) {
+    if (driver) {
+        driver->vtable->destroy(driver);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+normalize_limits(sampler_limits_t *limits) {
+    if (limits->min_interval_ms < 1) {
+        limits->min_interval_ms = 1;
+    }
+    if (limits->max_interval_ms < limits->min_interval_ms) {
+        limits->max_interval_ms = limits->min_interval_ms;
+    }
+    if (!(limits->threshold > 0.0f)) {
+        limits->threshold = 0.0f;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// interval after a read that saw the value move by delta within elapsed_ms
+static int
+next_interval(const sampler_limits_t *limits,
+              int interval_ms,
+              int64_t elapsed_ms,
+              float delta) {
+    double next;
+    if (delta >= limits->threshold && delta > 0.0f) {
+        // moving, stay close to the value
+        next = limits->min_interval_ms;
+    } else if (delta > 0.0f) {
+        // time the value needs to move by threshold at the observed rate,
+        // but do not back off faster than while stable
+        next = (double) elapsed_ms * limits->threshold / delta;
+        if (next > 2.0 * interval_ms) {
+            next = 2.0 * interval_ms;
+        }
+    } else {
+        next = 2.0 * interval_ms;
+    }
+    if (next < limits->min_interval_ms) {
+        return limits->min_interval_ms;
+    }
+    if (next > limits->max_interval_ms) {
+        return limits->max_interval_ms;
+    }
+    return (int) next;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+sample_channel(void *channel_) {
+    channel_t *channel = (channel_t *) channel_;
+    sampler_t *sampler = channel->sampler;
+
+    sampler_limits_t limits = sampler->limits;
+    if (sampler->handlers.limits) {
+        sampler->handlers.limits(sampler->arg, channel->index, &limits);
+        normalize_limits(&limits);
+    }
+
+    float value;
+    int64_t now_ms = get_monotonic_time_ms();
+    if (sampler->driver->vtable->read(sampler->driver, channel->index, &value)) {
+        ++sampler->stats.failed;
+        sampler_log(DEBUG, "%s read of channel %u failed",
+                    sampler->driver->vtable->name, (unsigned) channel->index);
+        // broken or missing sensor, retry without spinning
+        channel->interval_ms = limits.max_interval_ms;
+    } else {
+        ++sampler->stats.reads;
+        if (!channel->has_value) {
+            channel->interval_ms = limits.min_interval_ms;
+        } else {
+            float delta = fabsf(value - channel->last_value);
+            if (delta >= limits.threshold && delta > 0.0f) {
+                ++sampler->stats.moving;
+            }
+            channel->interval_ms = next_interval(&limits, channel->interval_ms,
+                                                 now_ms - channel->last_read_ms,
+                                                 delta);
+        }
+        channel->has_value = true;
+        channel->last_value = value;
+        channel->last_read_ms = now_ms;
+        sampler->handlers.apply(sampler->arg, channel->index, value);
+    }
+    (void) event_loop_timer_arm(channel->timer, channel->interval_ms);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+channel_destroy(channel_t *channel) {
+    if (channel) {
+        event_loop_timer_destroy(channel->timer);
+        avs_free(channel);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static channel_t *
+channel_create(sampler_t *sampler, size_t index) {
+    channel_t *channel = (channel_t *) avs_calloc(1, sizeof(channel_t));
+    if (!channel) {
+        return NULL;
+    }
+    channel->sampler = sampler;
+    channel->index = index;
+    channel->interval_ms = sampler->limits.min_interval_ms;
+    if (!(channel->timer = event_loop_timer_create(sampler->loop, sample_channel,
+                                                   channel))
+            || event_loop_timer_arm(channel->timer, 0)) {
+        channel_destroy(channel);
+        return NULL;
+    }
+    return channel;
+}
+
+//------------------------------------------------------------------------------
+
+int
+sampler_set_channel_count(sampler_t *sampler, size_t channel_count) {
+    assert(sampler);
+
+    if (channel_count > SAMPLER_MAX_CHANNELS) {
+        return -1;
+    }
+    if (channel_count > sampler->channel_count) {
+        channel_t **channels = (channel_t **) avs_realloc(
+                sampler->channels, channel_count * sizeof(channel_t *));
+        if (!channels) {
+            return -1;
+        }
+        sampler->channels = channels;
+        for (size_t i = sampler->channel_count; i < channel_count; ++i) {
+            if (!(channels[i] = channel_create(sampler, i))) {
+                // drop channels created so far, the count is unchanged
+                while (i-- > sampler->channel_count) {
+                    channel_destroy(channels[i]);
+                }
+                return -1;
+            }
+        }
+    } else {
+        for (size_t i = channel_count; i < sampler->channel_count; ++i) {
+            channel_destroy(sampler->channels[i]);
+        }
+    }
+    sampler->channel_count = channel_count;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+sampler_t *
+sampler_create(event_loop_t             *loop,
+               sensor_driver_t          *driver,
+               size_t                   channel_count,
+               const sampler_limits_t   *limits,
+               const sampler_handlers_t *handlers,
+               void                     *arg) {
+    assert(loop);
+    assert(driver);
+    assert(handlers && handlers->apply);
+
+    sampler_t *sampler = (sampler_t *) avs_calloc(1, sizeof(sampler_t));
+    if (!sampler) {
+        sampler_log(ERROR, "Out of memory");
+        sensor_driver_destroy(driver);
+        return NULL;
+    }
+    sampler->driver = driver;
+    sampler->loop = loop;
+    sampler->handlers = *handlers;
+    sampler->arg = arg;
+    if (limits) {
+        sampler->limits = *limits;
+    } else {
+        sampler->limits = (sampler_limits_t) {
+            .min_interval_ms = SAMPLER_DEFAULT_MIN_INTERVAL,
+            .max_interval_ms = SAMPLER_DEFAULT_MAX_INTERVAL,
+            .threshold = SAMPLER_DEFAULT_THRESHOLD
+        };
+    }
+    normalize_limits(&sampler->limits);
+
+    if (sampler_set_channel_count(sampler, channel_count)) {
+        sampler_log(ERROR, "Could not start sampling of %u channels",
+                    (unsigned) channel_count);
+        sampler_destroy(sampler);
+        return NULL;
+    }
+    sampler_log(INFO, "Sampling %u channels of %s driver every %d..%d ms",
+                (unsigned) channel_count, driver->vtable->name,
+                sampler->limits.min_interval_ms, sampler->limits.max_interval_ms);
+    return sampler;
+}
+
+//------------------------------------------------------------------------------
+
+int
+sampler_channel_interval(const sampler_t *sampler, size_t channel) {
+    assert(sampler);
+    return channel < sampler->channel_count ? sampler->channels[channel]->interval_ms
+                                            : -1;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sampler_get_stats(const sampler_t *sampler, sampler_stats_t *out_stats) {
+    assert(sampler);
+    *out_stats = sampler->stats;
+}
+
+//------------------------------------------------------------------------------
+
+void
+sampler_destroy(sampler_t *sampler) {
+    if (!sampler) {
+        return;
+    }
+    for (size_t i = 0; i < sampler->channel_count; ++i) {
+        channel_destroy(sampler->channels[i]);
+    }
+    avs_free(sampler->channels);
+    sensor_driver_destroy(sampler->driver);
+    avs_free(sampler);
+}
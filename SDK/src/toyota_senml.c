@@ -0,0 +1,170 @@
+#include "toyota_senml.h"
+
+#include <string.h>
+
+#define CBOR_MAJOR_UINT     0
+#define CBOR_MAJOR_NINT     1
+#define CBOR_MAJOR_TEXT     3
+#define CBOR_MAJOR_ARRAY    4
+#define CBOR_MAJOR_MAP      5
+#define CBOR_MAJOR_SIMPLE   7
+
+#define CBOR_FALSE          0xF4
+#define CBOR_TRUE           0xF5
+#define CBOR_FLOAT32        0xFA
+#define CBOR_FLOAT64        0xFB
+
+//------------------------------------------------------------------------------
+
+static void
+put_bytes(cbor_writer_t *writer, const void *bytes, size_t length) {
+    if (writer->overflow || writer->capacity - writer->size < length) {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(writer->data + writer->size, bytes, length);
+    writer->size += length;
+}
+
+//------------------------------------------------------------------------------
+
+// initial byte with the shortest argument encoding
+static void
+put_head(cbor_writer_t *writer, uint8_t major, uint64_t argument) {
+    uint8_t head[9];
+    size_t length;
+    if (argument < 24) {
+        head[0] = (uint8_t) (major << 5 | argument);
+        length = 1;
+    } else {
+        size_t size = argument <= UINT8_MAX ? 1
+                      : argument <= UINT16_MAX ? 2
+                      : argument <= UINT32_MAX ? 4 : 8;
+        head[0] = (uint8_t) (major << 5 | (size == 1 ? 24 : size == 2 ? 25
+                                           : size == 4 ? 26 : 27));
+        for (size_t i = 0; i < size; ++i) {
+            head[size - i] = (uint8_t) (argument >> (8 * i));
+        }
+        length = size + 1;
+    }
+    put_bytes(writer, head, length);
+}
+
+//------------------------------------------------------------------------------
+
+void
+cbor_writer_init(cbor_writer_t *writer, uint8_t *data, size_t capacity) {
+    writer->data = data;
+    writer->capacity = capacity;
+    writer->size = 0;
+    writer->overflow = false;
+}
+
+//------------------------------------------------------------------------------
+
+void
+cbor_write_array(cbor_writer_t *writer, size_t count) {
+    put_head(writer, CBOR_MAJOR_ARRAY, count);
+}
+
+//------------------------------------------------------------------------------
+
+void
+cbor_write_map(cbor_writer_t *writer, size_t count) {
+    put_head(writer, CBOR_MAJOR_MAP, count);
+}
+
+//------------------------------------------------------------------------------
+
+void
+cbor_write_int(cbor_writer_t *writer, int64_t value) {
+    if (value >= 0) {
+        put_head(writer, CBOR_MAJOR_UINT, (uint64_t) value);
+    } else {
+        // -1 - n without overflowing on INT64_MIN
+        put_head(writer, CBOR_MAJOR_NINT, ~(uint64_t) value);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+cbor_write_text(cbor_writer_t *writer, const char *text) {
+    size_t length = strlen(text);
+    put_head(writer, CBOR_MAJOR_TEXT, length);
+    put_bytes(writer, text, length);
+}
+
+//------------------------------------------------------------------------------
+
+void
+cbor_write_bool(cbor_writer_t *writer, bool value) {
+    uint8_t byte = value ? CBOR_TRUE : CBOR_FALSE;
+    put_bytes(writer, &byte, 1);
+}
+
+//------------------------------------------------------------------------------
+
+void
+cbor_write_double(cbor_writer_t *writer, double value) {
+    uint8_t bytes[9];
+    size_t length;
+    float single = (float) value;
+    if ((double) single == value || value != value) {
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        bytes[0] = CBOR_FLOAT32;
+        for (int i = 0; i < 4; ++i) {
+            bytes[4 - i] = (uint8_t) (bits >> (8 * i));
+        }
+        length = 5;
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bytes[0] = CBOR_FLOAT64;
+        for (int i = 0; i < 8; ++i) {
+            bytes[8 - i] = (uint8_t) (bits >> (8 * i));
+        }
+        length = 9;
+    }
+    put_bytes(writer, bytes, length);
+}
+
+//------------------------------------------------------------------------------
+
+void
+senml_write_record(cbor_writer_t *writer, const senml_record_t *record) {
+    size_t pairs = 2 + !!record->base_name + record->has_base_time
+                   + (record->time != 0.0);
+    cbor_write_map(writer, pairs);
+
+    if (record->base_name) {
+        cbor_write_int(writer, SENML_LABEL_BASE_NAME);
+        cbor_write_text(writer, record->base_name);
+    }
+    if (record->has_base_time) {
+        cbor_write_int(writer, SENML_LABEL_BASE_TIME);
+        cbor_write_double(writer, record->base_time);
+    }
+    cbor_write_int(writer, SENML_LABEL_NAME);
+    cbor_write_text(writer, record->name);
+    if (record->time != 0.0) {
+        cbor_write_int(writer, SENML_LABEL_TIME);
+        cbor_write_double(writer, record->time);
+    }
+
+    switch (record->type) {
+    case SENML_VALUE_FLOAT:
+        cbor_write_int(writer, SENML_LABEL_VALUE);
+        cbor_write_double(writer, record->value.f);
+        break;
+    case SENML_VALUE_INT:
+        cbor_write_int(writer, SENML_LABEL_VALUE);
+        cbor_write_int(writer, record->value.i);
+        break;
+    case SENML_VALUE_BOOL:
+        cbor_write_int(writer, SENML_LABEL_BOOL_VALUE);
+        cbor_write_bool(writer, record->value.b);
+        break;
+    }
+}
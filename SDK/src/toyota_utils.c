@@ -1,9 +1,54 @@
+#define _POSIX_C_SOURCE 200809L
 #include "toyota_utils.h"
 
+#include <avsystem/commons/time.h>
+
+#define TIMESTAMP_FORMAT "%a %b %e %H:%M:%S %Y\n" // same layout as asctime()
+
+static _Thread_local char current_time[TIMESTAMP_TEXT_SIZE];
+
+static void format_time(time_t seconds, char *buffer, size_t size) {
+    struct tm tm_value;                   // broken-down local time
+    if (!localtime_r(&seconds, &tm_value)
+            || !strftime(buffer, size, TIMESTAMP_FORMAT, &tm_value)) {
+        buffer[0] = '\0';
+    }
+}
+
 char *get_current_time(void) {
-    struct tm *tm_ptr;                    // pointer to time struct
-    time_t local_time;                    // local time system struct
-    local_time = time(0);                 // get local time in milliseconds
-    tm_ptr = localtime(&local_time);      // get local time date and year as string
-    return asctime(tm_ptr);
+    format_time(time(NULL), current_time, sizeof(current_time));
+    return current_time;
+}
+
+int64_t get_monotonic_time_ms(void) {
+    int64_t now_ms = 0;                   // monotonic time in milliseconds
+    avs_time_monotonic_to_scalar(&now_ms, AVS_TIME_MS, avs_time_monotonic_now());
+    return now_ms;
+}
+
+int64_t get_real_time_ms(void) {
+    int64_t now_ms = 0;                   // wall clock in milliseconds
+    avs_time_real_to_scalar(&now_ms, AVS_TIME_MS, avs_time_real_now());
+    return now_ms;
+}
+
+void timestamp_mark(toyota_timestamp_t *timestamp) {
+    timestamp->monotonic_ms = get_monotonic_time_ms();
+    timestamp->real_s = 0;
+    avs_time_real_to_scalar(&timestamp->real_s, AVS_TIME_S, avs_time_real_now());
+}
+
+void timestamp_cache_init(toyota_timestamp_cache_t *cache) {
+    cache->formatted_s = -1;
+    cache->text[0] = '\0';
+}
+
+const char *timestamp_format(const toyota_timestamp_t *timestamp,
+                             toyota_timestamp_cache_t *cache) {
+    // text has one second resolution, so it only changes with the second
+    if (cache->formatted_s != timestamp->real_s) {
+        format_time((time_t) timestamp->real_s, cache->text, sizeof(cache->text));
+        cache->formatted_s = timestamp->real_s;
+    }
+    return cache->text;
 }
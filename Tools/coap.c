@@ -0,0 +1,252 @@
+#include "coap.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+
+static int
+decode_option_field(uint8_t nibble, const uint8_t **cursor, const uint8_t *end,
+                    uint32_t *out_value) {
+    if (nibble < 13) {
+        *out_value = nibble;
+        return 0;
+    }
+    if (nibble == 13 && end - *cursor >= 1) {
+        *out_value = 13u + (*cursor)[0];
+        *cursor += 1;
+        return 0;
+    }
+    if (nibble == 14 && end - *cursor >= 2) {
+        *out_value = 269u + ((uint32_t) (*cursor)[0] << 8 | (*cursor)[1]);
+        *cursor += 2;
+        return 0;
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+int
+coap_parse(coap_msg_t *msg, const uint8_t *data, size_t length) {
+    memset(msg, 0, sizeof(*msg));
+    if (length < COAP_HEADER_SIZE || data[0] >> 6 != COAP_VERSION) {
+        return -1;
+    }
+    msg->type = (uint8_t) (data[0] >> 4 & 0x3);
+    msg->token_length = data[0] & 0xF;
+    msg->code = data[1];
+    msg->msg_id = (uint16_t) (data[2] << 8 | data[3]);
+    if (msg->token_length > COAP_MAX_TOKEN
+            || length < COAP_HEADER_SIZE + msg->token_length) {
+        return -1;
+    }
+    memcpy(msg->raw_token, data + COAP_HEADER_SIZE, msg->token_length);
+    for (size_t i = 0; i < msg->token_length; ++i) {
+        msg->token = msg->token << 8 | msg->raw_token[i];
+    }
+
+    const uint8_t *cursor = data + COAP_HEADER_SIZE + msg->token_length;
+    const uint8_t *end = data + length;
+    uint32_t number = 0;
+    while (cursor < end) {
+        uint8_t byte = *cursor++;
+        if (byte == COAP_PAYLOAD_MARKER) {
+            msg->payload = cursor;
+            msg->payload_length = (size_t) (end - cursor);
+            return msg->payload_length ? 0 : -1;
+        }
+        uint32_t delta;
+        uint32_t option_length;
+        if (decode_option_field(byte >> 4, &cursor, end, &delta)
+                || decode_option_field(byte & 0xF, &cursor, end, &option_length)
+                || (size_t) (end - cursor) < option_length
+                || msg->option_count >= COAP_MAX_OPTIONS) {
+            return -1;
+        }
+        number += delta;
+        msg->options[msg->option_count++] = (coap_option_t) {
+            .number = (uint16_t) number,
+            .value = cursor,
+            .length = option_length
+        };
+        cursor += option_length;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+const coap_option_t *
+coap_find_option(const coap_msg_t *msg, uint16_t number) {
+    for (size_t i = 0; i < msg->option_count; ++i) {
+        if (msg->options[i].number == number) {
+            return &msg->options[i];
+        }
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+
+uint32_t
+coap_option_uint(const coap_option_t *option) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < option->length && i < 4; ++i) {
+        value = value << 8 | option->value[i];
+    }
+    return value;
+}
+
+//------------------------------------------------------------------------------
+
+void
+coap_option_path(const coap_msg_t *msg, uint16_t number, char *out, size_t size) {
+    size_t length = 0;
+    out[0] = '\0';
+    for (size_t i = 0; i < msg->option_count; ++i) {
+        const coap_option_t *option = &msg->options[i];
+        if (option->number != number) {
+            continue;
+        }
+        int written = snprintf(out + length, size - length, "%s%.*s",
+                               length ? "/" : "", (int) option->length,
+                               (const char *) option->value);
+        if (written < 0 || (size_t) written >= size - length) {
+            return;
+        }
+        length += (size_t) written;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+coap_builder_init(coap_builder_t *builder, uint8_t *buffer, size_t capacity,
+                  uint8_t type, uint8_t code, uint16_t msg_id,
+                  const uint8_t *token, size_t token_length) {
+    builder->data = buffer;
+    builder->capacity = capacity;
+    builder->last_option = 0;
+    builder->length = 0;
+    builder->overflow = token_length > COAP_MAX_TOKEN
+                        || capacity < COAP_HEADER_SIZE + token_length;
+    if (builder->overflow) {
+        return;
+    }
+    buffer[0] = (uint8_t) (COAP_VERSION << 6 | type << 4 | token_length);
+    buffer[1] = code;
+    buffer[2] = (uint8_t) (msg_id >> 8);
+    buffer[3] = (uint8_t) msg_id;
+    if (token_length) {
+        memcpy(buffer + COAP_HEADER_SIZE, token, token_length);
+    }
+    builder->length = COAP_HEADER_SIZE + token_length;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+builder_put(coap_builder_t *builder, const void *data, size_t length) {
+    if (builder->overflow || builder->capacity - builder->length < length) {
+        builder->overflow = true;
+        return;
+    }
+    if (length) {
+        memcpy(builder->data + builder->length, data, length);
+        builder->length += length;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// nibble of the option header and its extended bytes
+static size_t
+encode_option_field(uint32_t value, uint8_t *out_nibble, uint8_t *extended) {
+    if (value < 13) {
+        *out_nibble = (uint8_t) value;
+        return 0;
+    }
+    if (value < 269) {
+        *out_nibble = 13;
+        extended[0] = (uint8_t) (value - 13);
+        return 1;
+    }
+    *out_nibble = 14;
+    extended[0] = (uint8_t) ((value - 269) >> 8);
+    extended[1] = (uint8_t) (value - 269);
+    return 2;
+}
+
+//------------------------------------------------------------------------------
+
+void
+coap_builder_option(coap_builder_t *builder, uint16_t number,
+                    const void *value, size_t length) {
+    uint8_t header[5];
+    uint8_t delta_nibble;
+    uint8_t length_nibble;
+    size_t size = 1;
+    size += encode_option_field((uint32_t) (number - builder->last_option),
+                                &delta_nibble, header + size);
+    size += encode_option_field((uint32_t) length, &length_nibble, header + size);
+    header[0] = (uint8_t) (delta_nibble << 4 | length_nibble);
+    builder_put(builder, header, size);
+    builder_put(builder, value, length);
+    builder->last_option = number;
+}
+
+//------------------------------------------------------------------------------
+
+void
+coap_builder_option_uint(coap_builder_t *builder, uint16_t number, uint32_t value) {
+    uint8_t bytes[4];
+    size_t length = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (length || (value >> shift) & 0xFF) {
+            bytes[length++] = (uint8_t) (value >> shift);
+        }
+    }
+    coap_builder_option(builder, number, bytes, length);
+}
+
+//------------------------------------------------------------------------------
+
+void
+coap_builder_path(coap_builder_t *builder, uint16_t number, const char *path) {
+    while (*path == '/') {
+        ++path;
+    }
+    while (*path) {
+        const char *end = strchr(path, '/');
+        size_t length = end ? (size_t) (end - path) : strlen(path);
+        coap_builder_option(builder, number, path, length);
+        path += length;
+        if (*path == '/') {
+            ++path;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+coap_builder_payload(coap_builder_t *builder, const void *payload, size_t length) {
+    if (length) {
+        uint8_t marker = COAP_PAYLOAD_MARKER;
+        builder_put(builder, &marker, 1);
+        builder_put(builder, payload, length);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void
+coap_builder_response(coap_builder_t *builder, uint8_t *buffer, size_t capacity,
+                      const coap_msg_t *request, uint8_t code, uint16_t non_msg_id) {
+    bool confirmable = request->type == COAP_TYPE_CON;
+    coap_builder_init(builder, buffer, capacity,
+                      confirmable ? COAP_TYPE_ACK : COAP_TYPE_NON, code,
+                      confirmable ? request->msg_id : non_msg_id,
+                      request->raw_token, request->token_length);
+}
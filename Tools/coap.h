@@ -0,0 +1,119 @@
+#ifndef TOYOTA_COAP
+#define TOYOTA_COAP
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal CoAP (RFC 7252) message codec of the server-side tools: the
+// LwM2M server emulator and the in-process stand-in of the benches.
+
+#define COAP_VERSION                1
+#define COAP_HEADER_SIZE            4
+#define COAP_MAX_TOKEN              8
+#define COAP_MAX_OPTIONS            32
+#define COAP_PAYLOAD_MARKER         0xFF
+
+#define COAP_TYPE_CON               0
+#define COAP_TYPE_NON               1
+#define COAP_TYPE_ACK               2
+#define COAP_TYPE_RST               3
+
+// codes, class << 5 | detail
+#define COAP_EMPTY                  0x00
+#define COAP_GET                    0x01
+#define COAP_POST                   0x02
+#define COAP_PUT                    0x03
+#define COAP_DELETE                 0x04
+#define COAP_CREATED                0x41    // 2.01
+#define COAP_DELETED                0x42    // 2.02
+#define COAP_CHANGED                0x44    // 2.04
+#define COAP_CONTENT                0x45    // 2.05
+#define COAP_BAD_REQUEST            0x80    // 4.00
+#define COAP_BAD_OPTION             0x82    // 4.02
+#define COAP_NOT_FOUND              0x84    // 4.04
+
+#define COAP_OPTION_OBSERVE         6
+#define COAP_OPTION_LOCATION_PATH   8
+#define COAP_OPTION_URI_PATH        11
+#define COAP_OPTION_CONTENT_FORMAT  12
+#define COAP_OPTION_URI_QUERY       15
+#define COAP_OPTION_BLOCK2          23
+#define COAP_OPTION_SIZE2           28
+
+#define COAP_FORMAT_NONE            -1
+#define COAP_FORMAT_TEXT            0       // text/plain
+#define COAP_FORMAT_OPAQUE          42      // application/octet-stream
+
+#define COAP_BLOCK_SZX_MAX          6       // 1024 byte blocks
+
+#define COAP_IS_REQUEST(code)       ((code) > COAP_EMPTY && (code) < 0x20)
+
+typedef struct {
+    uint16_t      number;
+    const uint8_t *value;
+    size_t        length;
+} coap_option_t;
+
+// parsed message, options and payload point into the datagram
+typedef struct {
+    uint8_t       type;
+    uint8_t       code;
+    uint16_t      msg_id;
+    uint64_t      token;                    // raw token as big-endian integer
+    uint8_t       raw_token[COAP_MAX_TOKEN];
+    size_t        token_length;
+    coap_option_t options[COAP_MAX_OPTIONS];
+    size_t        option_count;
+    const uint8_t *payload;
+    size_t        payload_length;
+} coap_msg_t;
+
+typedef struct {
+    uint8_t  *data;
+    size_t   capacity;
+    size_t   length;
+    uint16_t last_option;
+    bool     overflow;                      // message did not fit, nothing to send
+} coap_builder_t;
+
+// returns 0 on success, -1 for malformed messages
+int
+coap_parse(coap_msg_t *msg, const uint8_t *data, size_t length);
+
+const coap_option_t *
+coap_find_option(const coap_msg_t *msg, uint16_t number);
+
+uint32_t
+coap_option_uint(const coap_option_t *option);
+
+// options of the given number joined with '/', e.g. Uri-Path "rd/1"
+void
+coap_option_path(const coap_msg_t *msg, uint16_t number, char *out, size_t size);
+
+void
+coap_builder_init(coap_builder_t *builder, uint8_t *buffer, size_t capacity,
+                  uint8_t type, uint8_t code, uint16_t msg_id,
+                  const uint8_t *token, size_t token_length);
+
+// options have to be added in ascending order of their numbers
+void
+coap_builder_option(coap_builder_t *builder, uint16_t number,
+                    const void *value, size_t length);
+
+void
+coap_builder_option_uint(coap_builder_t *builder, uint16_t number, uint32_t value);
+
+// one option per segment of a '/' separated path
+void
+coap_builder_path(coap_builder_t *builder, uint16_t number, const char *path);
+
+void
+coap_builder_payload(coap_builder_t *builder, const void *payload, size_t length);
+
+// ACK of a confirmable request, or NON with the given message ID otherwise
+void
+coap_builder_response(coap_builder_t *builder, uint8_t *buffer, size_t capacity,
+                      const coap_msg_t *request, uint8_t code, uint16_t non_msg_id);
+
+#endif // TOYOTA_COAP
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <Main_Objects/firmware_delta.h>
+#include <Main_Objects/firmware_package.h>
+#include <toyota_hash.h>
+
+#ifdef TOYOTA_WITH_ZSTD
+#    include <zstd.h>
+#endif
+#ifdef TOYOTA_WITH_LZ4
+#    include <lz4frame.h>
+#endif
+
+#define ZSTD_LEVEL 19   // packages are built once, decompression speed does not depend on level
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} buffer_t;
+
+static void
+print_usage(const char *program) {
+    printf("Usage: %s [-d none|crc32c|sha256] [-b BASE_IMAGE] [-z zstd|lz4] IMAGE OUTPUT\n\n"
+           "Builds firmware update package of IMAGE. With -b the package carries\n"
+           "a delta against BASE_IMAGE, which has to be the image running on the\n"
+           "device. With -z the payload is compressed. Digest defaults to sha256.\n",
+           program);
+}
+
+static uint8_t *
+read_file(const char *path, size_t *out_size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    uint8_t *data = NULL;
+    long size = -1;
+    if (!fseek(file, 0, SEEK_END) && (size = ftell(file)) >= 0
+            && !fseek(file, 0, SEEK_SET)
+            && (data = (uint8_t *) malloc((size_t) size + 1))
+            && fread(data, 1, (size_t) size, file) == (size_t) size) {
+        *out_size = (size_t) size;
+    } else {
+        fprintf(stderr, "could not read %s\n", path);
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    return data;
+}
+
+static int
+buffer_write(void *buffer_, const void *data, size_t length) {
+    buffer_t *buffer = (buffer_t *) buffer_;
+    if (buffer->size + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->size + length) {
+            capacity *= 2;
+        }
+        uint8_t *data_ = (uint8_t *) realloc(buffer->data, capacity);
+        if (!data_) {
+            return -1;
+        }
+        buffer->data = data_;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+    return 0;
+}
+
+static int
+compress_payload(fw_compression_t compression, buffer_t *payload) {
+    buffer_t compressed = { NULL, 0, 0 };
+    switch (compression) {
+#ifdef TOYOTA_WITH_ZSTD
+    case FW_COMPRESSION_ZSTD:
+        compressed.capacity = ZSTD_compressBound(payload->size);
+        if ((compressed.data = (uint8_t *) malloc(compressed.capacity))) {
+            compressed.size = ZSTD_compress(compressed.data, compressed.capacity,
+                                            payload->data, payload->size, ZSTD_LEVEL);
+            if (ZSTD_isError(compressed.size)) {
+                compressed.size = 0;
+            }
+        }
+        break;
+#endif
+#ifdef TOYOTA_WITH_LZ4
+    case FW_COMPRESSION_LZ4:
+        compressed.capacity = LZ4F_compressFrameBound(payload->size, NULL);
+        if ((compressed.data = (uint8_t *) malloc(compressed.capacity))) {
+            compressed.size = LZ4F_compressFrame(compressed.data, compressed.capacity,
+                                                 payload->data, payload->size, NULL);
+            if (LZ4F_isError(compressed.size)) {
+                compressed.size = 0;
+            }
+        }
+        break;
+#endif
+    default:
+        fprintf(stderr, "%s compression is not compiled in\n",
+                fw_compression_name(compression));
+        return -1;
+    }
+    if (!compressed.size) {
+        fprintf(stderr, "could not compress payload\n");
+        free(compressed.data);
+        return -1;
+    }
+    free(payload->data);
+    *payload = compressed;
+    return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+    fw_digest_type_t digest_type = FW_DIGEST_SHA256;
+    const char *base_path = NULL;
+    fw_compression_t compression = FW_COMPRESSION_NONE;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:b:z:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            if (!strcmp(optarg, "none")) {
+                digest_type = FW_DIGEST_NONE;
+            } else if (!strcmp(optarg, "crc32c")) {
+                digest_type = FW_DIGEST_CRC32C;
+            } else if (!strcmp(optarg, "sha256")) {
+                digest_type = FW_DIGEST_SHA256;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'b':
+            base_path = optarg;
+            break;
+        case 'z':
+            if (!strcmp(optarg, "zstd")) {
+                compression = FW_COMPRESSION_ZSTD;
+            } else if (!strcmp(optarg, "lz4")) {
+                compression = FW_COMPRESSION_LZ4;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (argc - optind != 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    size_t image_size = 0;
+    size_t base_size = 0;
+    uint8_t *image = read_file(argv[optind], &image_size);
+    uint8_t *base = base_path ? read_file(base_path, &base_size) : NULL;
+    if (!image || (base_path && !base)) {
+        free(image);
+        free(base);
+        return 1;
+    }
+
+    uint8_t digest[SHA256_DIGEST_SIZE] = { 0 };
+    if (digest_type == FW_DIGEST_SHA256) {
+        sha256_ctx_t sha;
+        sha256_init(&sha);
+        sha256_update(&sha, image, image_size);
+        sha256_final(&sha, digest);
+    } else if (digest_type == FW_DIGEST_CRC32C) {
+        uint32_t crc = crc32c_update(0, image, image_size);
+        digest[0] = (uint8_t) (crc >> 24);
+        digest[1] = (uint8_t) (crc >> 16);
+        digest[2] = (uint8_t) (crc >> 8);
+        digest[3] = (uint8_t) crc;
+    }
+
+    uint8_t header[FW_PACKAGE_HEADER_SIZE];
+    fw_package_encode_header(header, digest_type,
+                             base ? FW_PACKAGE_FLAG_DELTA : 0, image_size, digest);
+
+    buffer_t payload = { NULL, 0, 0 };
+    int result = base ? fw_delta_encode(base, base_size, image, image_size,
+                                        buffer_write, &payload)
+                      : buffer_write(&payload, image, image_size);
+    if (!result && compression != FW_COMPRESSION_NONE) {
+        result = compress_payload(compression, &payload);
+    }
+
+    FILE *output = NULL;
+    if (!result && !(output = fopen(argv[optind + 1], "wb"))) {
+        perror(argv[optind + 1]);
+        result = -1;
+    }
+    if (output) {
+        if (fwrite(header, 1, sizeof(header), output) != sizeof(header)
+                || fwrite(payload.data, 1, payload.size, output) != payload.size) {
+            result = -1;
+        }
+        if (fclose(output)) {
+            result = -1;
+        }
+    }
+
+    if (result) {
+        fprintf(stderr, "could not write package %s\n", argv[optind + 1]);
+    } else {
+        size_t package_size = sizeof(header) + payload.size;
+        printf("%s: %zu bytes image, %zu bytes package (%.1f%%)\n",
+               argv[optind + 1], image_size, package_size,
+               image_size ? 100.0 * (double) package_size / (double) image_size : 0.0);
+    }
+    free(payload.data);
+    free(image);
+    free(base);
+    return result ? 1 : 0;
+}
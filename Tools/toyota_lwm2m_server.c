@@ -0,0 +1,1552 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#ifdef TOYOTA_WITH_DTLS_SERVER
+#    include <openssl/err.h>
+#    include <openssl/ssl.h>
+#endif
+
+#include "coap.h"
+
+#define DEFAULT_ADDRESS         "127.0.0.1"
+#define DEFAULT_PORT            5684
+#define DEFAULT_NOSEC_PORT      5683
+#define DEFAULT_PSK_KEY         "18041994yayura18041994" // default key of the client
+#define DEFAULT_READ_INTERVAL   1000
+#define DEFAULT_STATS_INTERVAL  1000
+#define FIRMWARE_PATH           "fw"
+#define FIRMWARE_URI_PATH       "5/0/1"
+
+#define MAX_DATAGRAM            2048
+#define MAX_REQUEST             512     // sent by the server
+#define MAX_CACHED_RESPONSE     64      // to Register, Update and De-register
+#define MAX_PATHS               16      // per --observe, --read and --write
+#define MAX_QUEUED_REQUESTS     (3 * MAX_PATHS + 1)
+#define MAX_ENDPOINT_NAME       64
+#define MAX_PATH                128
+#define MAX_EVENTS              64
+#define DTLS_MTU                1400
+#define DTLS_RECORD_HEADER      13
+#define DTLS_CONTENT_HANDSHAKE  22
+#define DTLS_CLIENT_HELLO       1
+#define INITIAL_BUCKETS         1024
+
+// CoAP transmission parameters of RFC 7252
+#define ACK_TIMEOUT_MS          2000
+#define ACK_RANDOM_FACTOR_PCT   150
+#define MAX_RETRANSMIT          4
+
+#define OBSERVE_TOKEN_FLAG      0x80000000u
+
+typedef enum {
+    REQUEST_OBSERVE,
+    REQUEST_READ,
+    REQUEST_WRITE,
+    REQUEST_FIRMWARE,
+    REQUEST_KIND_COUNT
+} request_kind_t;
+
+static const char *const REQUEST_KIND_NAMES[] = {
+    "observe", "read", "write", "firmware"
+};
+
+typedef struct {
+    request_kind_t kind;
+    const char     *path;
+    const char     *payload;                // text/plain, NULL for GET
+} request_t;
+
+typedef struct {
+    bool     active;
+    bool     acked;                         // empty ACK seen, separate response pending
+    request_t request;
+    uint16_t msg_id;
+    uint32_t token;
+    uint8_t  data[MAX_REQUEST];             // plaintext CoAP message for retransmissions
+    size_t   length;
+    int      retransmits;
+    int      timeout_ms;
+    int64_t  sent_ms;
+    uint32_t seq;                           // matches retransmission timer events
+} inflight_t;
+
+typedef struct peer peer_t;
+
+struct peer {
+    struct sockaddr_in address;
+    peer_t             *next;               // chain of the address hash table
+    peer_t             *endpoint_next;      // chain of the endpoint name hash table
+#ifdef TOYOTA_WITH_DTLS_SERVER
+    SSL                *ssl;                // NULL for NoSec or before the first datagram
+    BIO                *rbio;               // datagrams received, owned by ssl
+    BIO                *wbio;               // records to send, owned by ssl
+    bool               handshake_done;
+    uint32_t           dtls_timer_seq;
+#endif
+    bool               registered;
+    uint32_t           registration_id;     // location is rd/<id>
+    char               endpoint_name[MAX_ENDPOINT_NAME];
+    bool               has_last_response;   // response cache for duplicated requests
+    uint16_t           last_request_msg_id;
+    uint8_t            last_response[MAX_CACHED_RESPONSE];
+    size_t             last_response_length;
+    request_t          queue[MAX_QUEUED_REQUESTS];
+    size_t             queue_head;
+    size_t             queue_count;
+    inflight_t         inflight;
+    uint32_t           read_timer_seq;
+};
+
+typedef enum {
+    EVENT_SEND,                             // delayed datagram
+    EVENT_RETRANSMIT,                       // CON request not answered yet
+    EVENT_DTLS,                             // DTLS handshake retransmission
+    EVENT_READ,                             // periodic reads of a peer
+    EVENT_STATS
+} event_kind_t;
+
+typedef struct {
+    int64_t            deadline_ms;
+    event_kind_t       kind;
+    peer_t             *peer;
+    uint32_t           seq;
+    uint8_t            *data;               // EVENT_SEND, owned by the event
+    size_t             length;
+    struct sockaddr_in address;
+} event_t;
+
+typedef struct {
+    uint64_t registrations;
+    uint64_t updates;
+    uint64_t deregistrations;
+    uint64_t completed[REQUEST_KIND_COUNT];
+    uint64_t failed[REQUEST_KIND_COUNT];    // error response, reset or timeout
+    uint64_t notifications;
+    uint64_t blocks_served;
+    uint64_t bytes_served;
+    uint64_t retransmissions;               // of requests sent by the server
+    uint64_t duplicates;                    // client requests seen again
+    uint64_t handshakes;
+    uint64_t handshake_failures;
+    uint64_t dropped_in;
+    uint64_t dropped_out;
+    uint64_t datagrams_in;
+    uint64_t datagrams_out;
+    int64_t  rtt_total_ms;                  // of completed requests
+    uint64_t rtt_count;
+} stats_t;
+
+typedef struct {
+    const char *address;
+    uint16_t   port;
+    bool       nosec;
+    const char *psk_identity;               // NULL accepts any identity
+    const char *psk_key;
+    double     loss;                        // 0..1
+    int        delay_ms;
+    int        jitter_ms;
+    const char *observe[MAX_PATHS];
+    size_t     observe_count;
+    const char *read[MAX_PATHS];
+    size_t     read_count;
+    int        read_interval_ms;
+    char       *write[MAX_PATHS];           // "path=value", split in place
+    const char *write_value[MAX_PATHS];
+    size_t     write_count;
+    const char *firmware_file;
+    unsigned   block_szx;
+    int        stats_interval_ms;
+    uint64_t   seed;
+    bool       verbose;
+} options_t;
+
+typedef struct {
+    options_t     options;
+    int           fd;
+    int           epoll_fd;
+#ifdef TOYOTA_WITH_DTLS_SERVER
+    SSL_CTX       *ssl_ctx;
+#endif
+    peer_t        **buckets;                // peers by address
+    peer_t        **endpoint_buckets;       // registered peers by endpoint name
+    size_t        bucket_count;
+    size_t        peer_count;
+    size_t        registered_count;
+    event_t       *events;                  // binary min-heap by deadline
+    size_t        event_count;
+    size_t        event_capacity;
+    uint64_t      random_state;
+    uint16_t      next_msg_id;
+    uint32_t      next_token;
+    uint32_t      next_registration_id;
+    uint32_t      next_seq;
+    uint8_t       *firmware;
+    size_t        firmware_size;
+    char          firmware_uri[128];
+    stats_t       stats;
+    stats_t       reported;                 // stats at the previous report
+    int64_t       reported_ms;
+    int64_t       start_ms;
+} server_t;
+
+static volatile sig_atomic_t running = true;
+
+//------------------------------------------------------------------------------
+
+static void
+stop_handler(int signal) {
+    (void) signal;
+    running = false;
+}
+
+//------------------------------------------------------------------------------
+
+static int64_t
+now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+//------------------------------------------------------------------------------
+
+// xorshift64*, reproducible with --seed
+static uint64_t
+next_random(server_t *server) {
+    server->random_state ^= server->random_state >> 12;
+    server->random_state ^= server->random_state << 25;
+    server->random_state ^= server->random_state >> 27;
+    return server->random_state * 2685821657736338717ull;
+}
+
+//------------------------------------------------------------------------------
+
+static bool
+random_drop(server_t *server) {
+    return server->options.loss > 0.0
+           && (double) (next_random(server) >> 11) / (double) (1ull << 53)
+                      < server->options.loss;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+event_swap(server_t *server, size_t a, size_t b) {
+    event_t tmp = server->events[a];
+    server->events[a] = server->events[b];
+    server->events[b] = tmp;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+event_push(server_t *server, const event_t *event) {
+    if (server->event_count == server->event_capacity) {
+        size_t capacity = server->event_capacity ? 2 * server->event_capacity : 256;
+        event_t *events = (event_t *) realloc(server->events, capacity * sizeof(event_t));
+        if (!events) {
+            return -1;
+        }
+        server->events = events;
+        server->event_capacity = capacity;
+    }
+    size_t index = server->event_count++;
+    server->events[index] = *event;
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (server->events[parent].deadline_ms <= server->events[index].deadline_ms) {
+            break;
+        }
+        event_swap(server, parent, index);
+        index = parent;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static event_t
+event_pop(server_t *server) {
+    event_t top = server->events[0];
+    server->events[0] = server->events[--server->event_count];
+    size_t index = 0;
+    for (;;) {
+        size_t child = 2 * index + 1;
+        if (child >= server->event_count) {
+            break;
+        }
+        if (child + 1 < server->event_count
+                && server->events[child + 1].deadline_ms
+                           < server->events[child].deadline_ms) {
+            ++child;
+        }
+        if (server->events[index].deadline_ms <= server->events[child].deadline_ms) {
+            break;
+        }
+        event_swap(server, index, child);
+        index = child;
+    }
+    return top;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+schedule(server_t *server, event_kind_t kind, peer_t *peer, uint32_t seq, int delay_ms) {
+    event_t event = {
+        .deadline_ms = now_ms() + delay_ms,
+        .kind = kind,
+        .peer = peer,
+        .seq = seq
+    };
+    if (event_push(server, &event)) {
+        fprintf(stderr, "out of memory, event dropped\n");
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// every datagram sent by the server goes through loss and delay emulation
+static void
+send_datagram(server_t *server, const struct sockaddr_in *address,
+              const uint8_t *data, size_t length) {
+    if (random_drop(server)) {
+        ++server->stats.dropped_out;
+        return;
+    }
+    int delay_ms = server->options.delay_ms;
+    if (server->options.jitter_ms) {
+        delay_ms += (int) (next_random(server) % (uint64_t) (server->options.jitter_ms + 1));
+    }
+    if (delay_ms > 0) {
+        event_t event = {
+            .deadline_ms = now_ms() + delay_ms,
+            .kind = EVENT_SEND,
+            .data = (uint8_t *) malloc(length),
+            .length = length,
+            .address = *address
+        };
+        if (event.data) {
+            memcpy(event.data, data, length);
+            if (!event_push(server, &event)) {
+                return;
+            }
+            free(event.data);
+        }
+        fprintf(stderr, "out of memory, datagram dropped\n");
+        return;
+    }
+    ++server->stats.datagrams_out;
+    (void) sendto(server->fd, data, length, 0, (const struct sockaddr *) address,
+                  sizeof(*address));
+}
+
+//------------------------------------------------------------------------------
+
+#ifdef TOYOTA_WITH_DTLS_SERVER
+
+// records written by OpenSSL are packed into datagrams of at most DTLS_MTU
+static void
+flush_dtls(server_t *server, peer_t *peer) {
+    uint8_t records[4 * MAX_DATAGRAM];
+    int pending;
+    while ((pending = BIO_read(peer->wbio, records, sizeof(records))) > 0) {
+        size_t offset = 0;
+        size_t length = (size_t) pending;
+        while (offset < length) {
+            size_t end = offset;
+            while (end + DTLS_RECORD_HEADER <= length) {
+                size_t record = DTLS_RECORD_HEADER
+                                + ((size_t) records[end + 11] << 8 | records[end + 12]);
+                if (end > offset && end + record - offset > DTLS_MTU) {
+                    break;
+                }
+                end += record;
+            }
+            if (end == offset || end > length) {
+                end = length;
+            }
+            send_datagram(server, &peer->address, records + offset, end - offset);
+            offset = end;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+schedule_dtls_timer(server_t *server, peer_t *peer) {
+    struct timeval timeout;
+    if (peer->ssl && DTLSv1_get_timeout(peer->ssl, &timeout)) {
+        int delay_ms = (int) (timeout.tv_sec * 1000 + timeout.tv_usec / 1000);
+        schedule(server, EVENT_DTLS, peer, ++peer->dtls_timer_seq, delay_ms);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+reset_dtls(peer_t *peer) {
+    if (peer->ssl) {
+        SSL_free(peer->ssl);
+    }
+    peer->ssl = NULL;
+    peer->rbio = NULL;
+    peer->wbio = NULL;
+    peer->handshake_done = false;
+    ++peer->dtls_timer_seq;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+open_dtls(server_t *server, peer_t *peer) {
+    if (!(peer->ssl = SSL_new(server->ssl_ctx))
+            || !(peer->rbio = BIO_new(BIO_s_mem()))
+            || !(peer->wbio = BIO_new(BIO_s_mem()))) {
+        BIO_free(peer->rbio);
+        reset_dtls(peer);
+        return -1;
+    }
+    BIO_set_mem_eof_return(peer->rbio, -1);
+    BIO_set_mem_eof_return(peer->wbio, -1);
+    SSL_set_bio(peer->ssl, peer->rbio, peer->wbio);
+    // memory BIOs cannot report the path MTU
+    SSL_set_options(peer->ssl, SSL_OP_NO_QUERY_MTU);
+    DTLS_set_link_mtu(peer->ssl, DTLS_MTU);
+    SSL_set_accept_state(peer->ssl);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static bool
+is_client_hello(const uint8_t *data, size_t length) {
+    return length > DTLS_RECORD_HEADER
+           && data[0] == DTLS_CONTENT_HANDSHAKE
+           && data[3] == 0 && data[4] == 0 // epoch 0
+           && data[DTLS_RECORD_HEADER] == DTLS_CLIENT_HELLO;
+}
+
+//------------------------------------------------------------------------------
+
+static unsigned int
+psk_server_callback(SSL *ssl, const char *identity, unsigned char *psk,
+                    unsigned int max_psk_length) {
+    server_t *server = (server_t *) SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    const options_t *options = &server->options;
+    size_t key_length = strlen(options->psk_key);
+    if ((options->psk_identity && (!identity || strcmp(identity, options->psk_identity)))
+            || key_length > max_psk_length) {
+        return 0;
+    }
+    memcpy(psk, options->psk_key, key_length);
+    return (unsigned int) key_length;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+create_ssl_ctx(server_t *server) {
+    if (!(server->ssl_ctx = SSL_CTX_new(DTLS_server_method()))) {
+        return -1;
+    }
+    SSL_CTX_set_app_data(server->ssl_ctx, server);
+    SSL_CTX_set_min_proto_version(server->ssl_ctx, DTLS1_2_VERSION);
+    // CCM_8 suites of LwM2M clients are below the default security level
+    SSL_CTX_set_security_level(server->ssl_ctx, 0);
+    SSL_CTX_set_psk_server_callback(server->ssl_ctx, psk_server_callback);
+    if (!SSL_CTX_set_cipher_list(server->ssl_ctx, "PSK")) {
+        return -1;
+    }
+    return 0;
+}
+
+#endif // TOYOTA_WITH_DTLS_SERVER
+
+//------------------------------------------------------------------------------
+
+static void
+send_coap(server_t *server, peer_t *peer, const uint8_t *data, size_t length) {
+#ifdef TOYOTA_WITH_DTLS_SERVER
+    if (!server->options.nosec) {
+        if (!peer->ssl || !peer->handshake_done) {
+            return;
+        }
+        if (SSL_write(peer->ssl, data, (int) length) <= 0) {
+            ERR_clear_error();
+            return;
+        }
+        flush_dtls(server, peer);
+        return;
+    }
+#endif
+    send_datagram(server, &peer->address, data, length);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+send_builder(server_t *server, peer_t *peer, const coap_builder_t *builder) {
+    if (builder->overflow) {
+        fprintf(stderr, "message too large\n");
+        return;
+    }
+    send_coap(server, peer, builder->data, builder->length);
+}
+
+//------------------------------------------------------------------------------
+
+static size_t
+address_hash(const struct sockaddr_in *address, size_t bucket_count) {
+    uint64_t key = (uint64_t) address->sin_addr.s_addr << 16 | address->sin_port;
+    return (size_t) ((key * 11400714819323198485ull) >> 32) & (bucket_count - 1);
+}
+
+//------------------------------------------------------------------------------
+
+static size_t
+name_hash(const char *name, size_t bucket_count) {
+    uint32_t hash = 2166136261u;
+    for (; *name; ++name) {
+        hash = (hash ^ (uint8_t) *name) * 16777619u;
+    }
+    return hash & (bucket_count - 1);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+endpoint_unlink(server_t *server, peer_t *peer) {
+    peer_t **link = &server->endpoint_buckets[name_hash(peer->endpoint_name,
+                                                        server->bucket_count)];
+    while (*link && *link != peer) {
+        link = &(*link)->endpoint_next;
+    }
+    if (*link) {
+        *link = peer->endpoint_next;
+    }
+    peer->endpoint_next = NULL;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+grow_buckets(server_t *server) {
+    size_t count = 2 * server->bucket_count;
+    peer_t **buckets = (peer_t **) calloc(count, sizeof(peer_t *));
+    peer_t **endpoint_buckets = (peer_t **) calloc(count, sizeof(peer_t *));
+    if (!buckets || !endpoint_buckets) {
+        free(buckets);
+        free(endpoint_buckets);
+        return -1;
+    }
+    for (size_t i = 0; i < server->bucket_count; ++i) {
+        peer_t *peer = server->buckets[i];
+        while (peer) {
+            peer_t *next = peer->next;
+            size_t bucket = address_hash(&peer->address, count);
+            peer->next = buckets[bucket];
+            buckets[bucket] = peer;
+            peer = next;
+        }
+        peer = server->endpoint_buckets[i];
+        while (peer) {
+            peer_t *next = peer->endpoint_next;
+            size_t bucket = name_hash(peer->endpoint_name, count);
+            peer->endpoint_next = endpoint_buckets[bucket];
+            endpoint_buckets[bucket] = peer;
+            peer = next;
+        }
+    }
+    free(server->buckets);
+    free(server->endpoint_buckets);
+    server->buckets = buckets;
+    server->endpoint_buckets = endpoint_buckets;
+    server->bucket_count = count;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+// peers live until exit, timer events keep pointers to them
+static peer_t *
+find_or_create_peer(server_t *server, const struct sockaddr_in *address) {
+    size_t bucket = address_hash(address, server->bucket_count);
+    for (peer_t *peer = server->buckets[bucket]; peer; peer = peer->next) {
+        if (peer->address.sin_addr.s_addr == address->sin_addr.s_addr
+                && peer->address.sin_port == address->sin_port) {
+            return peer;
+        }
+    }
+    if (server->peer_count >= server->bucket_count && !grow_buckets(server)) {
+        bucket = address_hash(address, server->bucket_count);
+    }
+    peer_t *peer = (peer_t *) calloc(1, sizeof(peer_t));
+    if (!peer) {
+        return NULL;
+    }
+    peer->address = *address;
+    peer->next = server->buckets[bucket];
+    server->buckets[bucket] = peer;
+    ++server->peer_count;
+    return peer;
+}
+
+//------------------------------------------------------------------------------
+
+static void send_next_request(server_t *server, peer_t *peer);
+
+static void
+enqueue_request(peer_t *peer, request_kind_t kind, const char *path,
+                const char *payload) {
+    if (peer->queue_count == MAX_QUEUED_REQUESTS) {
+        return;
+    }
+    peer->queue[(peer->queue_head + peer->queue_count++) % MAX_QUEUED_REQUESTS] =
+            (request_t) {
+                .kind = kind,
+                .path = path,
+                .payload = payload
+            };
+}
+
+//------------------------------------------------------------------------------
+
+static void
+transmit_inflight(server_t *server, peer_t *peer) {
+    inflight_t *inflight = &peer->inflight;
+    inflight->seq = ++server->next_seq;
+    send_coap(server, peer, inflight->data, inflight->length);
+    schedule(server, EVENT_RETRANSMIT, peer, inflight->seq, inflight->timeout_ms);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+send_next_request(server_t *server, peer_t *peer) {
+    if (peer->inflight.active || !peer->queue_count || !peer->registered) {
+        return;
+    }
+    inflight_t *inflight = &peer->inflight;
+    inflight->request = peer->queue[peer->queue_head];
+    peer->queue_head = (peer->queue_head + 1) % MAX_QUEUED_REQUESTS;
+    --peer->queue_count;
+
+    const request_t *request = &inflight->request;
+    inflight->msg_id = server->next_msg_id++;
+    inflight->token = ++server->next_token & ~OBSERVE_TOKEN_FLAG;
+    if (request->kind == REQUEST_OBSERVE) {
+        inflight->token |= OBSERVE_TOKEN_FLAG;
+    }
+    uint8_t token[4] = {
+        (uint8_t) (inflight->token >> 24), (uint8_t) (inflight->token >> 16),
+        (uint8_t) (inflight->token >> 8), (uint8_t) inflight->token
+    };
+    coap_builder_t builder;
+    coap_builder_init(&builder, inflight->data, sizeof(inflight->data), COAP_TYPE_CON,
+                      request->payload ? COAP_PUT : COAP_GET, inflight->msg_id,
+                      token, sizeof(token));
+    if (request->kind == REQUEST_OBSERVE) {
+        coap_builder_option_uint(&builder, COAP_OPTION_OBSERVE, 0);
+    }
+    coap_builder_path(&builder, COAP_OPTION_URI_PATH, request->path);
+    if (request->payload) {
+        coap_builder_option_uint(&builder, COAP_OPTION_CONTENT_FORMAT, COAP_FORMAT_TEXT);
+        coap_builder_payload(&builder, request->payload, strlen(request->payload));
+    }
+    if (builder.overflow) {
+        ++server->stats.failed[request->kind];
+        send_next_request(server, peer);
+        return;
+    }
+    inflight->length = builder.length;
+    inflight->active = true;
+    inflight->acked = false;
+    inflight->retransmits = 0;
+    inflight->timeout_ms = ACK_TIMEOUT_MS
+                           + (int) (next_random(server)
+                                    % (ACK_TIMEOUT_MS * (ACK_RANDOM_FACTOR_PCT - 100) / 100));
+    inflight->sent_ms = now_ms();
+    transmit_inflight(server, peer);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+finish_inflight(server_t *server, peer_t *peer, bool success) {
+    inflight_t *inflight = &peer->inflight;
+    if (success) {
+        ++server->stats.completed[inflight->request.kind];
+        server->stats.rtt_total_ms += now_ms() - inflight->sent_ms;
+        ++server->stats.rtt_count;
+    } else {
+        ++server->stats.failed[inflight->request.kind];
+    }
+    inflight->active = false;
+    ++inflight->seq;
+    send_next_request(server, peer);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+retransmit(server_t *server, peer_t *peer, uint32_t seq) {
+    inflight_t *inflight = &peer->inflight;
+    if (!inflight->active || inflight->seq != seq || inflight->acked) {
+        return;
+    }
+    if (inflight->retransmits == MAX_RETRANSMIT) {
+        if (server->options.verbose) {
+            printf("%s: %s of /%s timed out\n", peer->endpoint_name,
+                   REQUEST_KIND_NAMES[inflight->request.kind], inflight->request.path);
+        }
+        finish_inflight(server, peer, false);
+        return;
+    }
+    ++inflight->retransmits;
+    inflight->timeout_ms *= 2;
+    ++server->stats.retransmissions;
+    transmit_inflight(server, peer);
+}
+
+//------------------------------------------------------------------------------
+
+// requests sent to every client after it registers
+static void
+start_session(server_t *server, peer_t *peer) {
+    const options_t *options = &server->options;
+    peer->queue_head = 0;
+    peer->queue_count = 0;
+    if (peer->inflight.active) {
+        peer->inflight.active = false;
+        ++peer->inflight.seq;
+    }
+    for (size_t i = 0; i < options->observe_count; ++i) {
+        enqueue_request(peer, REQUEST_OBSERVE, options->observe[i], NULL);
+    }
+    for (size_t i = 0; i < options->write_count; ++i) {
+        enqueue_request(peer, REQUEST_WRITE, options->write[i], options->write_value[i]);
+    }
+    if (server->firmware) {
+        enqueue_request(peer, REQUEST_FIRMWARE, FIRMWARE_URI_PATH, server->firmware_uri);
+    }
+    if (options->read_count) {
+        schedule(server, EVENT_READ, peer, ++peer->read_timer_seq,
+                 options->read_interval_ms);
+    }
+    send_next_request(server, peer);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+periodic_read(server_t *server, peer_t *peer, uint32_t seq) {
+    const options_t *options = &server->options;
+    if (!peer->registered || seq != peer->read_timer_seq) {
+        return;
+    }
+    for (size_t i = 0; i < options->read_count; ++i) {
+        enqueue_request(peer, REQUEST_READ, options->read[i], NULL);
+    }
+    schedule(server, EVENT_READ, peer, ++peer->read_timer_seq, options->read_interval_ms);
+    send_next_request(server, peer);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+unregister(server_t *server, peer_t *peer) {
+    if (!peer->registered) {
+        return;
+    }
+    endpoint_unlink(server, peer);
+    peer->registered = false;
+    ++peer->read_timer_seq;
+    --server->registered_count;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+endpoint_name_of(const coap_msg_t *request, char *out, size_t size) {
+    snprintf(out, size, "?");
+    for (size_t i = 0; i < request->option_count; ++i) {
+        const coap_option_t *option = &request->options[i];
+        if (option->number == COAP_OPTION_URI_QUERY && option->length > 3
+                && !memcmp(option->value, "ep=", 3)) {
+            snprintf(out, size, "%.*s", (int) option->length - 3,
+                     (const char *) option->value + 3);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static uint8_t
+handle_register(server_t *server, peer_t *peer, const coap_msg_t *request) {
+    char name[MAX_ENDPOINT_NAME];
+    endpoint_name_of(request, name, sizeof(name));
+
+    // a client reconnecting from a new port replaces its old registration
+    size_t bucket = name_hash(name, server->bucket_count);
+    for (peer_t *other = server->endpoint_buckets[bucket]; other;
+         other = other->endpoint_next) {
+        if (!strcmp(other->endpoint_name, name)) {
+            unregister(server, other);
+            break;
+        }
+    }
+    unregister(server, peer);
+
+    snprintf(peer->endpoint_name, sizeof(peer->endpoint_name), "%s", name);
+    peer->registered = true;
+    peer->registration_id = ++server->next_registration_id;
+    bucket = name_hash(peer->endpoint_name, server->bucket_count);
+    peer->endpoint_next = server->endpoint_buckets[bucket];
+    server->endpoint_buckets[bucket] = peer;
+    ++server->registered_count;
+    ++server->stats.registrations;
+    if (server->options.verbose) {
+        printf("%s registered from %s:%u\n", peer->endpoint_name,
+               inet_ntoa(peer->address.sin_addr), (unsigned) ntohs(peer->address.sin_port));
+    }
+    return COAP_CREATED;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+serve_block(server_t *server, const coap_msg_t *request,
+            coap_builder_t *builder, uint8_t *buffer, size_t capacity) {
+    uint32_t szx = server->options.block_szx;
+    uint32_t requested_szx = szx;
+    size_t offset = 0;
+    const coap_option_t *block2 = coap_find_option(request, COAP_OPTION_BLOCK2);
+    if (block2) {
+        uint32_t value = coap_option_uint(block2);
+        requested_szx = value & 0x7;
+        // a block larger than ours is split, its offset stays the same
+        offset = (size_t) (value >> 4) << (requested_szx + 4);
+        if (requested_szx < szx) {
+            szx = requested_szx;
+        }
+    }
+    size_t block_size = (size_t) 1 << (szx + 4);
+    uint32_t num = (uint32_t) (offset >> (szx + 4));
+    if (requested_szx > COAP_BLOCK_SZX_MAX || offset > server->firmware_size
+            || (offset == server->firmware_size && offset)) {
+        coap_builder_response(builder, buffer, capacity, request, COAP_BAD_OPTION,
+                              server->next_msg_id++);
+        return;
+    }
+    size_t length = server->firmware_size - offset;
+    bool more = length > block_size;
+    if (more) {
+        length = block_size;
+    }
+    coap_builder_response(builder, buffer, capacity, request, COAP_CONTENT,
+                          server->next_msg_id++);
+    coap_builder_option_uint(builder, COAP_OPTION_CONTENT_FORMAT, COAP_FORMAT_OPAQUE);
+    coap_builder_option_uint(builder, COAP_OPTION_BLOCK2,
+                             num << 4 | (uint32_t) more << 3 | szx);
+    coap_builder_option_uint(builder, COAP_OPTION_SIZE2, (uint32_t) server->firmware_size);
+    coap_builder_payload(builder, server->firmware + offset, length);
+    ++server->stats.blocks_served;
+    server->stats.bytes_served += length;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+handle_request(server_t *server, peer_t *peer, const coap_msg_t *request) {
+    char path[MAX_PATH];
+    coap_builder_t builder;
+    coap_option_path(request, COAP_OPTION_URI_PATH, path, sizeof(path));
+
+    // blocks are idempotent and not cached, a duplicate is served again
+    if (request->code == COAP_GET && server->firmware && !strcmp(path, FIRMWARE_PATH)) {
+        uint8_t buffer[MAX_DATAGRAM];
+        serve_block(server, request, &builder, buffer, sizeof(buffer));
+        send_builder(server, peer, &builder);
+        return;
+    }
+
+    // retransmitted request whose response got lost, answer it again
+    if (request->type == COAP_TYPE_CON && peer->has_last_response
+            && request->msg_id == peer->last_request_msg_id) {
+        ++server->stats.duplicates;
+        send_coap(server, peer, peer->last_response, peer->last_response_length);
+        return;
+    }
+
+    char location[32];
+    snprintf(location, sizeof(location), "rd/%u", (unsigned) peer->registration_id);
+    uint8_t code = COAP_NOT_FOUND;
+    bool registered = false;
+    if (request->code == COAP_POST && !strcmp(path, "rd")) {
+        code = handle_register(server, peer, request);
+        snprintf(location, sizeof(location), "rd/%u", (unsigned) peer->registration_id);
+        registered = true;
+    } else if (request->code == COAP_POST && peer->registered && !strcmp(path, location)) {
+        ++server->stats.updates;
+        code = COAP_CHANGED;
+    } else if (request->code == COAP_DELETE && peer->registered
+               && !strcmp(path, location)) {
+        unregister(server, peer);
+        ++server->stats.deregistrations;
+        code = COAP_DELETED;
+    }
+    coap_builder_response(&builder, peer->last_response, sizeof(peer->last_response),
+                          request, code, server->next_msg_id++);
+    if (registered) {
+        coap_builder_path(&builder, COAP_OPTION_LOCATION_PATH, location);
+    }
+    if (builder.overflow) {
+        peer->has_last_response = false;
+        return;
+    }
+    peer->has_last_response = request->type == COAP_TYPE_CON;
+    peer->last_request_msg_id = request->msg_id;
+    peer->last_response_length = builder.length;
+    send_builder(server, peer, &builder);
+    if (registered) {
+        start_session(server, peer);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+send_empty(server_t *server, peer_t *peer, uint8_t type, uint16_t msg_id) {
+    uint8_t buffer[COAP_HEADER_SIZE];
+    coap_builder_t builder;
+    coap_builder_init(&builder, buffer, sizeof(buffer), type, COAP_EMPTY, msg_id, NULL, 0);
+    send_builder(server, peer, &builder);
+}
+
+//------------------------------------------------------------------------------
+
+static void
+handle_response(server_t *server, peer_t *peer, const coap_msg_t *msg) {
+    inflight_t *inflight = &peer->inflight;
+    bool matches = inflight->active && msg->token == inflight->token;
+    bool observation = (msg->token & OBSERVE_TOKEN_FLAG) && msg->token_length == 4;
+    if (msg->type == COAP_TYPE_CON) {
+        // unknown separate responses are rejected, which also cancels
+        // notifications of observations from a previous session
+        send_empty(server, peer, matches || observation ? COAP_TYPE_ACK : COAP_TYPE_RST,
+                   msg->msg_id);
+    }
+    if (matches) {
+        bool success = msg->code >> 5 == 2;
+        if (!success && server->options.verbose) {
+            printf("%s: %s of /%s failed with %u.%02u\n", peer->endpoint_name,
+                   REQUEST_KIND_NAMES[inflight->request.kind], inflight->request.path,
+                   (unsigned) (msg->code >> 5), (unsigned) (msg->code & 0x1F));
+        }
+        finish_inflight(server, peer, success);
+    } else if (observation) {
+        ++server->stats.notifications;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+handle_coap(server_t *server, peer_t *peer, const uint8_t *data, size_t length) {
+    coap_msg_t msg;
+    if (coap_parse(&msg, data, length)) {
+        return;
+    }
+    if (COAP_IS_REQUEST(msg.code)) {
+        handle_request(server, peer, &msg);
+    } else if (msg.code != COAP_EMPTY) {
+        handle_response(server, peer, &msg);
+    } else if (peer->inflight.active && msg.msg_id == peer->inflight.msg_id) {
+        if (msg.type == COAP_TYPE_ACK) {
+            // separate response follows, it is not retransmitted any more
+            peer->inflight.acked = true;
+        } else if (msg.type == COAP_TYPE_RST) {
+            finish_inflight(server, peer, false);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+#ifdef TOYOTA_WITH_DTLS_SERVER
+
+static void
+handle_dtls(server_t *server, peer_t *peer, const uint8_t *data, size_t length) {
+    // a client that restarted opens a new session on the same address
+    if (peer->ssl && peer->handshake_done && is_client_hello(data, length)) {
+        reset_dtls(peer);
+    }
+    if (!peer->ssl) {
+        if (!is_client_hello(data, length) || open_dtls(server, peer)) {
+            return;
+        }
+    }
+    BIO_write(peer->rbio, data, (int) length);
+
+    if (!peer->handshake_done) {
+        int result = SSL_do_handshake(peer->ssl);
+        flush_dtls(server, peer);
+        if (result == 1) {
+            peer->handshake_done = true;
+            ++peer->dtls_timer_seq;
+            ++server->stats.handshakes;
+        } else {
+            int error = SSL_get_error(peer->ssl, result);
+            if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+                ++server->stats.handshake_failures;
+                if (server->options.verbose) {
+                    char reason[256];
+                    ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+                    printf("handshake with %s:%u failed: %s\n",
+                           inet_ntoa(peer->address.sin_addr),
+                           (unsigned) ntohs(peer->address.sin_port), reason);
+                }
+                ERR_clear_error();
+                reset_dtls(peer);
+                return;
+            }
+            schedule_dtls_timer(server, peer);
+            return;
+        }
+    }
+
+    uint8_t plaintext[MAX_DATAGRAM];
+    int received;
+    while (peer->ssl && (received = SSL_read(peer->ssl, plaintext, sizeof(plaintext))) > 0) {
+        handle_coap(server, peer, plaintext, (size_t) received);
+    }
+    if (peer->ssl) {
+        if (SSL_get_shutdown(peer->ssl) & SSL_RECEIVED_SHUTDOWN) {
+            flush_dtls(server, peer);
+            reset_dtls(peer);
+        } else {
+            flush_dtls(server, peer);
+        }
+    }
+    ERR_clear_error();
+}
+
+//------------------------------------------------------------------------------
+
+static void
+dtls_timeout(server_t *server, peer_t *peer, uint32_t seq) {
+    if (!peer->ssl || peer->handshake_done || seq != peer->dtls_timer_seq) {
+        return;
+    }
+    if (DTLSv1_handle_timeout(peer->ssl) < 0) {
+        ++server->stats.handshake_failures;
+        reset_dtls(peer);
+        return;
+    }
+    flush_dtls(server, peer);
+    schedule_dtls_timer(server, peer);
+}
+
+#endif // TOYOTA_WITH_DTLS_SERVER
+
+//------------------------------------------------------------------------------
+
+static void
+socket_readable(server_t *server) {
+    uint8_t buffer[MAX_DATAGRAM];
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t from_length = sizeof(from);
+        ssize_t received = recvfrom(server->fd, buffer, sizeof(buffer), 0,
+                                    (struct sockaddr *) &from, &from_length);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        ++server->stats.datagrams_in;
+        if (random_drop(server)) {
+            ++server->stats.dropped_in;
+            continue;
+        }
+        peer_t *peer = find_or_create_peer(server, &from);
+        if (!peer) {
+            continue;
+        }
+#ifdef TOYOTA_WITH_DTLS_SERVER
+        if (!server->options.nosec) {
+            handle_dtls(server, peer, buffer, (size_t) received);
+            continue;
+        }
+#endif
+        handle_coap(server, peer, buffer, (size_t) received);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static void
+print_stats(server_t *server, bool summary) {
+    const stats_t *now = &server->stats;
+    const stats_t *before = summary ? &(stats_t) { 0 } : &server->reported;
+    int64_t now_ms_ = now_ms();
+    double seconds = (double) (now_ms_ - (summary ? server->start_ms
+                                                  : server->reported_ms)) / 1000.0;
+    if (seconds <= 0.0) {
+        seconds = 1.0;
+    }
+    printf("%s registered=%zu peers=%zu reg=%" PRIu64 " upd=%" PRIu64 " dereg=%" PRIu64
+           " observe=%" PRIu64 "/%" PRIu64 " read=%" PRIu64 "/%" PRIu64
+           " write=%" PRIu64 "/%" PRIu64 " fw=%" PRIu64 "/%" PRIu64
+           " notify=%" PRIu64 " blocks=%" PRIu64 " MB/s=%.2f rtt_ms=%.1f"
+           " retrans=%" PRIu64 " dup=%" PRIu64 " hs=%" PRIu64 "/%" PRIu64
+           " drop_in=%" PRIu64 " drop_out=%" PRIu64 "\n",
+           summary ? "total" : "stats", server->registered_count, server->peer_count,
+           now->registrations - before->registrations,
+           now->updates - before->updates,
+           now->deregistrations - before->deregistrations,
+           now->completed[REQUEST_OBSERVE] - before->completed[REQUEST_OBSERVE],
+           now->failed[REQUEST_OBSERVE] - before->failed[REQUEST_OBSERVE],
+           now->completed[REQUEST_READ] - before->completed[REQUEST_READ],
+           now->failed[REQUEST_READ] - before->failed[REQUEST_READ],
+           now->completed[REQUEST_WRITE] - before->completed[REQUEST_WRITE],
+           now->failed[REQUEST_WRITE] - before->failed[REQUEST_WRITE],
+           now->completed[REQUEST_FIRMWARE] - before->completed[REQUEST_FIRMWARE],
+           now->failed[REQUEST_FIRMWARE] - before->failed[REQUEST_FIRMWARE],
+           now->notifications - before->notifications,
+           now->blocks_served - before->blocks_served,
+           (double) (now->bytes_served - before->bytes_served) / (1024.0 * 1024.0) / seconds,
+           now->rtt_count > before->rtt_count
+                   ? (double) (now->rtt_total_ms - before->rtt_total_ms)
+                             / (double) (now->rtt_count - before->rtt_count)
+                   : 0.0,
+           now->retransmissions - before->retransmissions,
+           now->duplicates - before->duplicates,
+           now->handshakes - before->handshakes,
+           now->handshake_failures - before->handshake_failures,
+           now->dropped_in - before->dropped_in,
+           now->dropped_out - before->dropped_out);
+    fflush(stdout);
+    server->reported = server->stats;
+    server->reported_ms = now_ms_;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+run_event(server_t *server, event_t *event) {
+    switch (event->kind) {
+    case EVENT_SEND:
+        ++server->stats.datagrams_out;
+        (void) sendto(server->fd, event->data, event->length, 0,
+                      (const struct sockaddr *) &event->address, sizeof(event->address));
+        free(event->data);
+        break;
+    case EVENT_RETRANSMIT:
+        retransmit(server, event->peer, event->seq);
+        break;
+    case EVENT_DTLS:
+#ifdef TOYOTA_WITH_DTLS_SERVER
+        dtls_timeout(server, event->peer, event->seq);
+#endif
+        break;
+    case EVENT_READ:
+        periodic_read(server, event->peer, event->seq);
+        break;
+    case EVENT_STATS:
+        print_stats(server, false);
+        schedule(server, EVENT_STATS, NULL, 0, server->options.stats_interval_ms);
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+static int
+run(server_t *server) {
+    struct epoll_event event = { .events = EPOLLIN };
+    if ((server->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0
+            || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->fd, &event)) {
+        perror("epoll");
+        return -1;
+    }
+    server->start_ms = server->reported_ms = now_ms();
+    if (server->options.stats_interval_ms > 0) {
+        schedule(server, EVENT_STATS, NULL, 0, server->options.stats_interval_ms);
+    }
+
+    while (running) {
+        int wait_ms = -1;
+        if (server->event_count) {
+            int64_t wait = server->events[0].deadline_ms - now_ms();
+            wait_ms = wait > 0 ? (int) wait : 0;
+        }
+        struct epoll_event ready[MAX_EVENTS];
+        int count = epoll_wait(server->epoll_fd, ready, MAX_EVENTS, wait_ms);
+        if (count < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            return -1;
+        }
+        if (count > 0) {
+            socket_readable(server);
+        }
+        int64_t now = now_ms();
+        while (server->event_count && server->events[0].deadline_ms <= now) {
+            event_t due = event_pop(server);
+            run_event(server, &due);
+        }
+    }
+    print_stats(server, true);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+load_firmware(server_t *server) {
+    const options_t *options = &server->options;
+    FILE *file = fopen(options->firmware_file, "rb");
+    if (!file) {
+        perror(options->firmware_file);
+        return -1;
+    }
+    long size = -1;
+    if (!fseek(file, 0, SEEK_END) && (size = ftell(file)) > 0
+            && !fseek(file, 0, SEEK_SET)
+            && (server->firmware = (uint8_t *) malloc((size_t) size))
+            && fread(server->firmware, 1, (size_t) size, file) == (size_t) size) {
+        server->firmware_size = (size_t) size;
+    } else {
+        fprintf(stderr, "could not read %s\n", options->firmware_file);
+        free(server->firmware);
+        server->firmware = NULL;
+    }
+    fclose(file);
+    if (!server->firmware) {
+        return -1;
+    }
+    snprintf(server->firmware_uri, sizeof(server->firmware_uri), "%s://%s:%u/%s",
+             options->nosec ? "coap" : "coaps", options->address,
+             (unsigned) options->port, FIRMWARE_PATH);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+open_socket(server_t *server) {
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(server->options.port)
+    };
+    if (inet_pton(AF_INET, server->options.address, &address.sin_addr) != 1) {
+        fprintf(stderr, "invalid address %s\n", server->options.address);
+        return -1;
+    }
+    server->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // thousands of clients register at once, do not drop their bursts
+    int buffer_size = 8 * 1024 * 1024;
+    if (server->fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    (void) setsockopt(server->fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    (void) setsockopt(server->fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    if (bind(server->fd, (const struct sockaddr *) &address, sizeof(address))) {
+        perror("bind");
+        return -1;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+print_usage(const char *program) {
+    printf("Usage: %s [OPTIONS]\n\n"
+           "LwM2M server emulator for load and latency tests of the client. Answers\n"
+           "Register, Update and De-register of any number of clients, observes,\n"
+           "reads and writes their resources and serves a firmware image with Block2.\n\n"
+           "  -a, --address ADDR       bind address (" DEFAULT_ADDRESS ")\n"
+           "  -p, --port PORT          UDP port (%d, %d with --nosec)\n"
+           "  -N, --nosec              plain CoAP instead of DTLS-PSK\n"
+           "  -i, --psk-identity ID    accepted PSK identity (any by default)\n"
+           "  -k, --psk-key KEY        PSK key (default key of the client)\n"
+           "  -L, --loss PERCENT       drop probability of every datagram, both ways\n"
+           "  -D, --delay MS           delay of every datagram sent by the server\n"
+           "  -J, --jitter MS          random extra delay 0..MS\n"
+           "  -o, --observe PATH       observe PATH on every client, e.g. /33204/0/5500\n"
+           "  -r, --read PATH          read PATH of every client periodically\n"
+           "  -I, --interval MS        period of --read (%d)\n"
+           "  -w, --write PATH=VALUE   write text VALUE to PATH after registration\n"
+           "  -f, --firmware FILE      serve FILE at /" FIRMWARE_PATH " and write its URI to /5/0/1\n"
+           "  -b, --block-size BYTES   max Block2 size, 16..1024 (1024)\n"
+           "  -s, --stats MS           statistics interval, 0 - summary at exit only (%d)\n"
+           "  -S, --seed N             seed of loss and jitter\n"
+           "  -v, --verbose            log registrations and failed requests\n\n"
+           "--observe, --read and --write can be given up to %d times each.\n",
+           program, DEFAULT_PORT, DEFAULT_NOSEC_PORT, DEFAULT_READ_INTERVAL,
+           DEFAULT_STATS_INTERVAL, MAX_PATHS);
+}
+
+//------------------------------------------------------------------------------
+
+static int
+add_path(const char **paths, size_t *count, const char *path) {
+    if (*count == MAX_PATHS) {
+        fprintf(stderr, "at most %d paths per option\n", MAX_PATHS);
+        return -1;
+    }
+    paths[(*count)++] = path;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+block_size_to_szx(long size, unsigned *out_szx) {
+    for (unsigned szx = 0; szx <= COAP_BLOCK_SZX_MAX; ++szx) {
+        if (size == 1L << (szx + 4)) {
+            *out_szx = szx;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+static int
+parse_options(int argc, char **argv, options_t *options) {
+    static const struct option long_options[] = {
+        { "address",        required_argument, 0, 'a' },
+        { "port",           required_argument, 0, 'p' },
+        { "nosec",          no_argument,       0, 'N' },
+        { "psk-identity",   required_argument, 0, 'i' },
+        { "psk-key",        required_argument, 0, 'k' },
+        { "loss",           required_argument, 0, 'L' },
+        { "delay",          required_argument, 0, 'D' },
+        { "jitter",         required_argument, 0, 'J' },
+        { "observe",        required_argument, 0, 'o' },
+        { "read",           required_argument, 0, 'r' },
+        { "interval",       required_argument, 0, 'I' },
+        { "write",          required_argument, 0, 'w' },
+        { "firmware",       required_argument, 0, 'f' },
+        { "block-size",     required_argument, 0, 'b' },
+        { "stats",          required_argument, 0, 's' },
+        { "seed",           required_argument, 0, 'S' },
+        { "verbose",        no_argument,       0, 'v' },
+        { "help",           no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    *options = (options_t) {
+        .address = DEFAULT_ADDRESS,
+        .psk_key = DEFAULT_PSK_KEY,
+        .read_interval_ms = DEFAULT_READ_INTERVAL,
+        .block_szx = COAP_BLOCK_SZX_MAX,
+        .stats_interval_ms = DEFAULT_STATS_INTERVAL,
+        .seed = (uint64_t) time(NULL)
+    };
+    long port = -1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "a:p:Ni:k:L:D:J:o:r:I:w:f:b:s:S:vh",
+                              long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'a':
+            options->address = optarg;
+            break;
+        case 'p':
+            port = strtol(optarg, NULL, 10);
+            if (port <= 0 || port > UINT16_MAX) {
+                fprintf(stderr, "invalid port %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'N':
+            options->nosec = true;
+            break;
+        case 'i':
+            options->psk_identity = optarg;
+            break;
+        case 'k':
+            options->psk_key = optarg;
+            break;
+        case 'L':
+            options->loss = strtod(optarg, NULL) / 100.0;
+            if (options->loss < 0.0 || options->loss >= 1.0) {
+                fprintf(stderr, "loss must be 0..99 percent\n");
+                return -1;
+            }
+            break;
+        case 'D':
+            options->delay_ms = atoi(optarg);
+            break;
+        case 'J':
+            options->jitter_ms = atoi(optarg);
+            break;
+        case 'o':
+            if (add_path(options->observe, &options->observe_count, optarg)) {
+                return -1;
+            }
+            break;
+        case 'r':
+            if (add_path(options->read, &options->read_count, optarg)) {
+                return -1;
+            }
+            break;
+        case 'I':
+            options->read_interval_ms = atoi(optarg);
+            break;
+        case 'w': {
+            char *separator = strchr(optarg, '=');
+            if (!separator || options->write_count == MAX_PATHS) {
+                fprintf(stderr, "invalid write %s, PATH=VALUE expected\n", optarg);
+                return -1;
+            }
+            *separator = '\0';
+            options->write[options->write_count] = optarg;
+            options->write_value[options->write_count++] = separator + 1;
+            break;
+        }
+        case 'f':
+            options->firmware_file = optarg;
+            break;
+        case 'b':
+            if (block_size_to_szx(strtol(optarg, NULL, 10), &options->block_szx)) {
+                fprintf(stderr, "block size must be a power of 2, 16..1024\n");
+                return -1;
+            }
+            break;
+        case 's':
+            options->stats_interval_ms = atoi(optarg);
+            break;
+        case 'S':
+            options->seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'v':
+            options->verbose = true;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(0);
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (optind != argc || options->delay_ms < 0 || options->jitter_ms < 0
+            || options->read_interval_ms <= 0) {
+        print_usage(argv[0]);
+        return -1;
+    }
+#ifndef TOYOTA_WITH_DTLS_SERVER
+    if (!options->nosec) {
+        fprintf(stderr, "built without OpenSSL, only --nosec is supported\n");
+        return -1;
+    }
+#endif
+    options->port = (uint16_t) (port > 0 ? port
+                                         : options->nosec ? DEFAULT_NOSEC_PORT
+                                                          : DEFAULT_PORT);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+static void
+release_server(server_t *server) {
+    for (size_t i = 0; i < server->bucket_count; ++i) {
+        peer_t *peer = server->buckets[i];
+        while (peer) {
+            peer_t *next = peer->next;
+#ifdef TOYOTA_WITH_DTLS_SERVER
+            reset_dtls(peer);
+#endif
+            free(peer);
+            peer = next;
+        }
+    }
+    for (size_t i = 0; i < server->event_count; ++i) {
+        free(server->events[i].data);
+    }
+#ifdef TOYOTA_WITH_DTLS_SERVER
+    SSL_CTX_free(server->ssl_ctx);
+#endif
+    free(server->events);
+    free(server->buckets);
+    free(server->endpoint_buckets);
+    free(server->firmware);
+    if (server->epoll_fd > 0) {
+        close(server->epoll_fd);
+    }
+    if (server->fd > 0) {
+        close(server->fd);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+int
+main(int argc, char **argv) {
+    server_t server = {
+        .fd = -1,
+        .epoll_fd = -1,
+        .bucket_count = INITIAL_BUCKETS
+    };
+    if (parse_options(argc, argv, &server.options)) {
+        return 1;
+    }
+    server.random_state = server.options.seed ? server.options.seed : 1;
+    server.next_msg_id = (uint16_t) next_random(&server);
+    server.buckets = (peer_t **) calloc(server.bucket_count, sizeof(peer_t *));
+    server.endpoint_buckets = (peer_t **) calloc(server.bucket_count, sizeof(peer_t *));
+
+    int result = 1;
+    if (!server.buckets || !server.endpoint_buckets) {
+        fprintf(stderr, "out of memory\n");
+        goto finish;
+    }
+    if (server.options.firmware_file && load_firmware(&server)) {
+        goto finish;
+    }
+#ifdef TOYOTA_WITH_DTLS_SERVER
+    if (!server.options.nosec && create_ssl_ctx(&server)) {
+        fprintf(stderr, "could not create DTLS context\n");
+        goto finish;
+    }
+#endif
+    if (open_socket(&server)) {
+        goto finish;
+    }
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+    printf("listening on %s://%s:%u, loss %.1f%%, delay %d+%d ms\n",
+           server.options.nosec ? "coap" : "coaps", server.options.address,
+           (unsigned) server.options.port, server.options.loss * 100.0,
+           server.options.delay_ms, server.options.jitter_ms);
+    fflush(stdout);
+    result = run(&server) ? 1 : 0;
+
+finish:
+    release_server(&server);
+    return result;
+}